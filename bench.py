@@ -0,0 +1,49 @@
+import os
+import subprocess
+import sys
+import time
+
+COMPILE_CMD = ['./atlas', '--include', '.', '--run']
+STARTUP_PROGRAM = 'test/test_1_hello.atl'
+STARTUP_RUNS = 500
+
+# Runs every program in bench/ and prints what it reports.
+# Extra arguments are passed to the compiler, e.g. `python bench.py --freestanding`
+
+def run_bench(bench_name, extra_args):
+    print(' '.join(COMPILE_CMD + extra_args) + ' ' + bench_name)
+    try:
+        res = subprocess.check_output(COMPILE_CMD + extra_args + [bench_name]).decode('utf-8')
+        print(res)
+    except subprocess.CalledProcessError as e:
+        print('Error: Process exited with non-zero exit status for "' + bench_name + '"')
+
+def measure_startup():
+    # binary size and startup latency of the libc build against --freestanding
+    for (name, args) in [('libc', []), ('freestanding', ['--freestanding'])]:
+        output = 'bench_startup_' + name
+        subprocess.check_output(['./atlas', '--include', '.', '-o', output] + args + [STARTUP_PROGRAM])
+        size = os.path.getsize(output)
+        start = time.perf_counter()
+        for _ in range(STARTUP_RUNS):
+            subprocess.run(['./' + output], stdout=subprocess.DEVNULL)
+        elapsed = (time.perf_counter() - start) / STARTUP_RUNS
+        print(name + ': ' + str(size) + ' bytes, ' + '%.1f' % (elapsed * 1e6) + ' us per run')
+        os.remove(output)
+    print('')
+
+def main():
+    print('')
+    measure_startup()
+    directory = 'bench'
+    res = []
+    for (dir_path, dir_names, file_names) in os.walk(directory):
+        for file in sorted(file_names):
+            if file.split('.')[-1] == 'atl':
+                res.append(dir_path + '/' + file)
+
+    for file in res:
+        run_bench(file, sys.argv[1:])
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,33 @@
+#!/bin/bash
+# Compile-to-run latency of atlas --run: out.c through gcc, through tcc
+# when it is installed, --native, which writes the executable itself, and
+# --interpret, which runs the program without writing one.
+# Run from the repository root after building the compiler:
+#   bench/compile_latency.sh [path to atlas] [runs]
+ATLAS=${1:-./atlas}
+RUNS=${2:-20}
+PROGRAMS="test/test_3_fib.atl test/test_7_file_io.atl test/test_20_ir.atl test/euler/problem2.atl"
+
+# milliseconds for one atlas --run, on average over $RUNS of them
+latency() {
+    local start end
+    start=$(date +%s%N)
+    for ((i = 0; i < RUNS; i++)); do
+        "$ATLAS" --include . --run "$@" > /dev/null 2>&1
+    done
+    end=$(date +%s%N)
+    echo $(( (end - start) / RUNS / 1000000 ))
+}
+
+printf "%-28s %8s %8s %8s %9s\n" "program" "gcc" "tcc" "native" "interpret"
+for program in $PROGRAMS; do
+    gcc_ms=$(latency "$program")
+    tcc_ms="-"
+    if command -v tcc > /dev/null; then
+        tcc_ms=$(latency --backend tcc "$program")
+    fi
+    native_ms=$(latency --native "$program")
+    interpret_ms=$(latency --interpret "$program")
+    printf "%-28s %6s ms %6s ms %6s ms %6s ms\n" "$program" "$gcc_ms" "$tcc_ms" "$native_ms" "$interpret_ms"
+done
+rm -f out.c
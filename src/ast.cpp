@@ -1,11 +1,13 @@
 #include <vector>
 #include <string>
+#include <cstring>
 #include <iostream>
 
 #include "global.hpp"
 #include "error.hpp"
 #include "ast.hpp"
 #include "tokenize.hpp"
+#include "vector.hpp"
 
 void expect(Token* token, TokenType expected) {
     if (token->tt != expected) {
@@ -13,13 +15,13 @@ void expect(Token* token, TokenType expected) {
                           + "\"\n         Got: " + token->token
                           + " (" + std::to_string(token->line) + ", " + std::to_string(token->column) + ")";
         print_error_msg(err);
-        exit(1);
+        error_abort();
     }
 }
 
 void print_tabs(int tab_level) {
     for (int i; i < tab_level; i++) {
-        std::cout << "\t";
+        error_out() << "\t";
     }
 }
 
@@ -36,21 +38,14 @@ void print_nodes(std::vector<Node*> nodes) {
     }
 }
 
-ParamNode* ast_create_param(Token* type,
-                            Token* name,
-                            bool is_array,
-                            int ptr_level,
-                            ExpressionNode* arr_size)
-{
+ParamNode* ast_create_param(Token* name) {
     ParamNode* ret = new ParamNode;
     ret->nt = NODE_PARAM;
     ret->token = name;
     ret->identifier = name;
-    ret->type = get_var_type(type);
-    ret->type_ = type;
-    ret->is_array = is_array;
-    ret->ptr_level = ptr_level;
-    ret->arr_size = arr_size;
+    ret->type_ = NULL;
+    ret->is_array = false;
+    ret->arr_size = NULL;
     return ret;
 }
 
@@ -59,6 +54,52 @@ Token* next_token(std::vector<Token*> tokens, int* i) {
     return tokens[*i];
 }
 
+// Parses [N]T, []T, [..]T and *T into var. The index starts on the first
+// token of the type and is left on the type name
+void ast_parse_var_type(std::vector<Token*> tokens, int* i, VarNode* var) {
+    Token* current_token = tokens[*i];
+    var->is_array = false;
+    var->ptr_level = 0;
+    var->arr_size = NULL; // incase the var is an array
+    if (current_token->tt == TK_SQUARE_OPEN) {
+        current_token = next_token(tokens, i);
+        if (current_token->tt == TK_SQUARE_CLOSE) {
+            var->is_slice = true;
+        } else if (current_token->tt == TK_DOT) {
+            current_token = next_token(tokens, i);
+            expect(current_token, TK_DOT);
+            current_token = next_token(tokens, i);
+            expect(current_token, TK_SQUARE_CLOSE);
+            var->is_dynamic = true;
+        } else {
+            // array type
+            var->is_array = true;
+            var->ptr_level++;
+            var->arr_size = ast_create_expression(tokens, false, false, true, i);
+            current_token = next_token(tokens, i);
+            expect(current_token, TK_SQUARE_CLOSE);
+        }
+        current_token = next_token(tokens, i);
+    }
+    // TODO: handle deeper layers of pointers
+    while (current_token->tt == TK_STAR) {
+        var->ptr_level++;
+        current_token = next_token(tokens, i);
+    }
+    expect(current_token, TK_IDENTIFIER);
+    GenericNode* generic = ast_get_generic(current_token->token);
+    Token* lookahead = ast_get_lookahead(tokens, i);
+    if (generic != NULL && generic->is_type &&
+        lookahead != NULL && lookahead->tt == TK_SQUARE_OPEN) {
+        // Vec[i64], the type name becomes the instance's name
+        current_token = next_token(tokens, i);
+        current_token = ast_parse_instance(generic, tokens, i);
+    }
+    var->type_ = current_token;
+    var->type = get_var_type(current_token);
+    vector_note(current_token->token);
+}
+
 std::vector<ParamNode*> ast_parse_params(std::vector<Token*> tokens, int* i) {
     std::vector<ParamNode*> params;
     Token* current_token = tokens[*i];
@@ -66,32 +107,9 @@ std::vector<ParamNode*> ast_parse_params(std::vector<Token*> tokens, int* i) {
         expect(current_token, TK_IDENTIFIER);
         Token* name = current_token;
         current_token = next_token(tokens, i);
-        bool is_array = false;
-        int ptr_level = 0;
-        ExpressionNode* arr_size = NULL; // incase the var is an array
-        if (current_token->tt == TK_SQUARE_OPEN) {
-            // array type   
-            is_array = true;
-            ptr_level++;
-            current_token = next_token(tokens, i); // expr
-            arr_size = ast_create_expression(tokens, false, false, true, i);
-            current_token = tokens[*i]; // update current_token
-            expect(current_token, TK_SQUARE_CLOSE);
-            current_token = next_token(tokens, i); // expr
-        } else if (current_token->tt == TK_STAR) {
-            // TODO: handle deeper layers of pointers
-            while(current_token->tt == TK_STAR) {
-                ptr_level++;
-                current_token = next_token(tokens, i);
-            }
-        }
-        expect(current_token, TK_IDENTIFIER);
-        Token* type = current_token;
+        ParamNode* param = ast_create_param(name);
+        ast_parse_var_type(tokens, i, param);
         current_token = next_token(tokens, i);
-        //Token* name = current_token;
-        //current_token = next_token(tokens, i);
-        ParamNode* param = ast_create_param(type, name, is_array, ptr_level,
-                                            arr_size);
         params.push_back(param);
         if (current_token->tt == TK_COMMA) {
             current_token = next_token(tokens, i); // skip the comma
@@ -119,20 +137,25 @@ ExpressionNode* ast_create_binop(ExpressionNode* lhs, ExpressionNode* rhs, Token
 
 ExpressionNode* ast_create_call(Token* name, std::vector<Token*> tokens, int* i) {
     log_print("Creating CallNode\n");
+    if (vector_is_intrinsic(name->token)) {
+        vector_note(name->token.substr(0, name->token.find('_'))); // v4f32_splat
+    }
     ExpressionNode* ret = new ExpressionNode;
     CallNode* call = new CallNode;
     std::vector<ExpressionNode*> args;
     (*i)++; // the index should be at the open_paren
-    (*i)++; // the index should be at the first part of the expr
-    for (; *i < tokens.size(); (*i)++) {
-        Token* current_token = tokens[*i];
-        if (current_token->tt == TK_PAREN_CLOSE || current_token->tt == TK_NEWLINE) {
-            // if (current_token->tt == TK_PAREN_CLOSE) {
-            //     (*i)++; // get rid of bracket
-            // }
+    Token* current_token = next_token(tokens, i); // first part of the expr
+    while (current_token->tt != TK_PAREN_CLOSE) {
+        if (current_token->tt == TK_NEWLINE) {
+            // unterminated call, stop at the last argument
+            (*i)--;
             break;
         }
         args.push_back(ast_create_expression(tokens, true, false, false, i));
+        current_token = next_token(tokens, i);
+        if (current_token->tt == TK_COMMA) {
+            current_token = next_token(tokens, i); // skip the comma
+        }
     }
     call->args = args;
     ret->call_node = call;
@@ -144,16 +167,66 @@ ExpressionNode* ast_create_call(Token* name, std::vector<Token*> tokens, int* i)
 StatementNode* ast_create_return(std::vector<Token*> tokens, int* i) {
     StatementNode* ret = new StatementNode;
     ReturnNode* ret_node = new ReturnNode;
-    (*i)++;
-    ret_node->expr = ast_create_expression(tokens, false, false, false, i);
     ret->nt = NODE_RETURN;
-
     ret->return_lhs = ret_node;
+    ret_node->token = tokens[*i];
+    Token* lookahead = ast_get_lookahead(tokens, i);
+    if (lookahead == NULL || lookahead->tt == TK_NEWLINE || lookahead->tt == TK_CURLY_CLOSE) {
+        // bare return
+        ret_node->expr = NULL;
+        ret_node->nt = NODE_RETURN;
+        return ret;
+    }
+    (*i)++;
+    // -> tail f(x), tail is only a keyword in front of a name
+    if (lookahead->tt == TK_IDENTIFIER && lookahead->token == "tail" &&
+        *i + 1 < tokens.size() && tokens[*i + 1]->tt == TK_IDENTIFIER) {
+        ret_node->is_tail = true;
+        (*i)++;
+    }
+    ret_node->expr = ast_create_expression(tokens, false, false, false, i);
     ret_node->nt = ret_node->expr->nt;
+    if (ret_node->is_tail && ret_node->expr->nt != NODE_CALL) {
+        print_error_msg("-> tail needs a call (line " + std::to_string(ret_node->token->line) + ")");
+        error_abort();
+    }
+    ret_node->exprs.push_back(ret_node->expr);
+    lookahead = ast_get_lookahead(tokens, i);
+    while (lookahead != NULL && lookahead->tt == TK_COMMA) {
+        (*i) += 2; // skip the comma
+        ret_node->exprs.push_back(ast_create_expression(tokens, false, false, false, i));
+        lookahead = ast_get_lookahead(tokens, i);
+    }
 
     return ret;
 }
 
+// defer <stmt>, the statement runs when the enclosing block is left
+StatementNode* ast_create_defer(std::vector<Token*> tokens, int* i) {
+    Token* defer_token = tokens[*i];
+    (*i)++; // skip defer
+    StatementNode* deferred = ast_create_declaration(tokens, i);
+    switch (deferred->nt) {
+    case NODE_RETURN:
+    case NODE_DEFER:
+    case NODE_VAR_DECL:
+    case NODE_FUNC:
+    case NODE_TYPE:
+    case NODE_GENERIC:
+    case NODE_CINCLUDE:
+        print_error_msg("Only a statement run for its effect can be deferred, not a return, "
+                        "a declaration or another defer (line " + std::to_string(defer_token->line) + ")");
+        error_abort();
+    default:
+        break;
+    }
+    StatementNode* ret = new StatementNode;
+    ret->nt = NODE_DEFER;
+    ret->token = defer_token;
+    ret->defer_lhs = deferred;
+    return ret;
+}
+
 VarNode* ast_create_var(Token* identifier) {
     log_print("Creating VariableNode \"" + identifier->token + "\"\n");
     VarNode* ret = new VarNode;
@@ -173,6 +246,7 @@ VarDeclNode* ast_create_var_decl(VarType type, Token* type_id, Token* identifier
     _node->nt = NODE_VAR_DECL;
     _node->type = type;
     _node->identifier = identifier;
+    _node->is_array = false; // set by ast_parse_var_type, which destructured names can skip
     ret->lhs = _node;
     ret->rhs = rhs;
     return ret;
@@ -188,11 +262,83 @@ ExpressionNode* ast_create_variable_expr(VarType type, Token* identifier, int* i
     return ret;
 }
 
+// 1_000_000, 0xFF, 0b1010 and an optional type suffix such as 255u8 or
+// 1_i32. Values are kept in 64 bits and checked against the type
+void ast_parse_integer(Token* literal, ConstantNode* constant) {
+    std::string text = literal->token;
+    int base = 10;
+    int pos = 0;
+    if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+        base = 16;
+        pos = 2;
+    } else if (text.size() > 2 && text[0] == '0' && (text[1] == 'b' || text[1] == 'B')) {
+        base = 2;
+        pos = 2;
+    }
+    uint64_t value = 0;
+    bool overflow = false;
+    int digits = 0;
+    for (; pos < text.size(); pos++) {
+        char c = text[pos];
+        int digit;
+        if (c == '_') {
+            continue;
+        } else if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (base == 16 && c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (base == 16 && c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            break; // suffix
+        }
+        if (digit >= base) {
+            break;
+        }
+        if (value > (UINT64_MAX - digit) / base) {
+            overflow = true;
+        }
+        value = value * base + digit;
+        digits++;
+    }
+    std::string suffix = text.substr(pos);
+    VarType type = value > INT64_MAX ? TYPE_U64 : TYPE_I64;
+    uint64_t max = value > INT64_MAX ? UINT64_MAX : INT64_MAX;
+    if (suffix == "i8") {
+        type = TYPE_I8, max = INT8_MAX;
+    } else if (suffix == "i16") {
+        type = TYPE_I16, max = INT16_MAX;
+    } else if (suffix == "i32") {
+        type = TYPE_I32, max = INT32_MAX;
+    } else if (suffix == "i64") {
+        type = TYPE_I64, max = INT64_MAX;
+    } else if (suffix == "u8") {
+        type = TYPE_U8, max = UINT8_MAX;
+    } else if (suffix == "u16") {
+        type = TYPE_U16, max = UINT16_MAX;
+    } else if (suffix == "u32") {
+        type = TYPE_U32, max = UINT32_MAX;
+    } else if (suffix == "u64") {
+        type = TYPE_U64, max = UINT64_MAX;
+    } else if (suffix.size() != 0 || digits == 0) {
+        print_error_msg("Invalid integer literal \"" + text + "\" (" + std::to_string(literal->line)
+                        + ", " + std::to_string(literal->column) + ")");
+        error_abort();
+    }
+    if (overflow || value > max) {
+        print_error_msg("Integer literal \"" + text + "\" does not fit in its type (" + std::to_string(literal->line)
+                        + ", " + std::to_string(literal->column) + ")");
+        error_abort();
+    }
+    constant->value = value;
+    constant->type = type;
+}
+
 ExpressionNode* ast_create_constant(Token* constant_value) {
     log_print("Creating ConstantNode\n");
     ExpressionNode* ret = new ExpressionNode;
     ConstantNode* constant = new ConstantNode;
-    constant->value = stoi(constant_value->token);
+    ast_parse_integer(constant_value, constant);
     ret->nt = NODE_CONSTANT;
 
     ret->constant = constant;
@@ -214,7 +360,8 @@ ExpressionNode* ast_create_char(Token* character) {
     log_print("Creating CharacterNode\n");
     ExpressionNode* ret = new ExpressionNode;
     CharacterNode* character_node = new CharacterNode;
-    if (character->token.size() > 1) {
+    bool is_escape = character->token.size() == 2 && character->token[0] == '\\';
+    if (character->token.size() > 1 && !is_escape) {
         print_token(character);
         print_error_msg("Single quotes used for more than one character");
         //exit(1);
@@ -229,28 +376,34 @@ ExpressionNode* ast_create_char(Token* character) {
 int get_prec(TokenType tt) {
     switch(tt) {
     case TK_PAREN_OPEN:
-        return 7;
+        return 10;
     case TK_SQUARE_OPEN:
     case TK_DOT:
-        return 6;
+        return 9;
     case TK_STAR:
     case TK_SLASH:
     case TK_PERCENT:
-        return 5;
+        return 7;
     case TK_PLUS:
     case TK_DASH:
-        return 4;
+        return 6;
     case TK_GT:
     case TK_LT:
     case TK_GTE:
     case TK_LTE:
-        return 3;
+        return 5;
     case TK_EQUAL:
+    case TK_NOT_EQUAL:
+        return 4;
+    case TK_LOGICAL_AND:
+        return 3;
+    case TK_LOGICAL_OR:
         return 2;
     case TK_ASSIGN:
         return 1;
     case TK_NEWLINE:
     case TK_CURLY_OPEN:
+    case TK_CURLY_CLOSE:
     case TK_PAREN_CLOSE:
     case TK_SQUARE_CLOSE:
     case TK_COMMA:
@@ -259,10 +412,13 @@ int get_prec(TokenType tt) {
         print_error_msg("Invalid Operator");
         std::string err = "Operator: " + std::string(get_tt_str(tt)) + "\n";
         print_error_msg(err);
-        exit(1);
+        error_abort();
     }
 }
 
+// prefix operators bind tighter than any binary operator except . and []
+#define PREC_UNARY 8
+
 Token* ast_get_lookahead(std::vector<Token*> tokens, int* i) {
     if (*i + 1 < tokens.size()) {
         return tokens[*i + 1];
@@ -276,30 +432,15 @@ ExpressionNode* ast_create_array_decl(std::vector<Token*> tokens, int* i) {
     ExpressionNode* ret = new ExpressionNode;
     ArrayNode* arr = new ArrayNode;
     Token* current_token = next_token(tokens, i); // get the next token
-
-    if (current_token->tt != TK_SQUARE_CLOSE) {
-        for (; *i < tokens.size(); (*i)++) {
-            arr->elements.push_back(ast_create_expression(tokens,
-                                                          false,
-                                                          false,
-                                                          true,
-                                                          i));
-            current_token = tokens[*i];
-            Token* lookahead = ast_get_lookahead(tokens, i);
-            if (current_token->tt == TK_SQUARE_CLOSE
-                || lookahead->tt == TK_SQUARE_CLOSE)
-            {
-                break;
-            }
+    while (current_token->tt != TK_SQUARE_CLOSE) {
+        arr->elements.push_back(ast_create_expression(tokens, false, false, true, i));
+        current_token = next_token(tokens, i);
+        if (current_token->tt == TK_COMMA) {
+            current_token = next_token(tokens, i);
         }
     }
-    current_token = tokens[*i];
-    //expect(current_token, TK_SQUARE_CLOSE);
     ret->array = arr;
     ret->nt = NODE_ARRAY_EXPR;
-    Token* lookahead = ast_get_lookahead(tokens, i);
-    expect(lookahead, TK_NEWLINE);
-
     return ret;
 }
 
@@ -308,20 +449,11 @@ ExpressionNode* ast_create_subscript_node(std::vector<Token*> tokens, int* i) {
     ExpressionNode* ret = new ExpressionNode;
     SubscriptNode* subscript = new SubscriptNode;
     Token* current_token = next_token(tokens, i);
-    if (current_token->tt != TK_SQUARE_CLOSE) {
-        for (; *i < tokens.size(); (*i)++) {
-            subscript->indexes.push_back(ast_create_expression(tokens,
-                                                          false,
-                                                          false,
-                                                          true,
-                                                          i));
-            current_token = tokens[*i];
-            Token* lookahead = ast_get_lookahead(tokens, i);
-            if (current_token->tt == TK_SQUARE_CLOSE)
-                //|| lookahead->tt == TK_SQUARE_CLOSE)
-            {
-                break;
-            }
+    while (current_token->tt != TK_SQUARE_CLOSE) {
+        subscript->indexes.push_back(ast_create_expression(tokens, false, false, true, i));
+        current_token = next_token(tokens, i);
+        if (current_token->tt == TK_COMMA) {
+            current_token = next_token(tokens, i);
         }
     }
     ret->nt = NODE_SUBSCRIPT;
@@ -335,19 +467,11 @@ ExpressionNode* ast_create_type_instantiation(std::vector<Token*> tokens, int* i
     ExpressionNode* ret = new ExpressionNode;
     TypeInstNode* type_inst = new TypeInstNode;
     Token* current_token = next_token(tokens, i);
-    if (current_token->tt != TK_CURLY_CLOSE) {
-        for (; *i < tokens.size(); (*i)++) {
-            type_inst->values.push_back(ast_create_expression(tokens,
-                                                              false,
-                                                              false,
-                                                              true, // not sure if it should be true or false
-                                                            i));
-            current_token = tokens[*i];
-            Token* lookahead = ast_get_lookahead(tokens, i);
-            if (lookahead->tt == TK_CURLY_CLOSE) {
-                (*i)++;
-                break;
-            }
+    while (current_token->tt != TK_CURLY_CLOSE) {
+        type_inst->values.push_back(ast_create_expression(tokens, false, false, true, i));
+        current_token = next_token(tokens, i);
+        if (current_token->tt == TK_COMMA) {
+            current_token = next_token(tokens, i);
         }
     }
     log_print("type_instantiation end\n");
@@ -356,9 +480,11 @@ ExpressionNode* ast_create_type_instantiation(std::vector<Token*> tokens, int* i
     ret->type_inst = type_inst;
     return ret;
 }
+
 bool is_op_binary(Token* op) {
     switch(op->tt) {
     case TK_EQUAL:
+    case TK_NOT_EQUAL:
     case TK_PLUS:
     case TK_DASH:
     case TK_STAR:
@@ -371,188 +497,144 @@ bool is_op_binary(Token* op) {
     case TK_PERCENT:
     case TK_ASSIGN:
     case TK_SQUARE_OPEN:
+    case TK_LOGICAL_AND:
+    case TK_LOGICAL_OR:
         return true;
     case TK_NOT:
+    case TK_AMPERSAND:
     case TK_PTR_DEREFERENCE:
         return false;
     default:
         std::string err = "\"" + op->token + "\" is not a valid operator";
         print_error_msg(err);
-        exit(1);
+        error_abort();
     }
 }
 
-ExpressionNode* 
-ast_create_expr_prec(
-        std::vector<Token*> tokens,
-        int precedence,
-        bool is_args,
-        bool is_cond,
-        bool is_arr,
-        int* i) 
-{
-    ExpressionNode* lhs;
+ExpressionNode* ast_create_unary(Token* op, ExpressionNode* operand) {
+    log_print("Creating UnaryOpNode\n");
+    ExpressionNode* ret = new ExpressionNode;
+    UnaryOpNode* unary_op = new UnaryOpNode;
+    unary_op->nt = NODE_UNARY;
+    unary_op->operator_type = NODE_UNARY;
+    unary_op->op = op;
+    unary_op->operand = operand;
+    ret->nt = NODE_UNARY;
+    ret->unary_op = unary_op;
+    return ret;
+}
+
+// Parses a single operand, leaving the index on its last token
+ExpressionNode* ast_create_operand(std::vector<Token*> tokens, int* i) {
     Token* current_token = tokens[*i];
     Token* lookahead = ast_get_lookahead(tokens, i);
     log_print("lhs:");
     print_token(current_token);
-    if (current_token->tt == TK_IDENTIFIER && lookahead->tt == TK_PAREN_OPEN) {
-        lhs = ast_create_call(current_token, tokens, i);
+    if (current_token->tt == TK_IDENTIFIER && lookahead != NULL && lookahead->tt == TK_SQUARE_OPEN &&
+        ast_get_generic(current_token->token) != NULL) {
+        // max[i64](a, b) calls an instance, Vec[i64] names one (for sizeof)
+        GenericNode* generic = ast_get_generic(current_token->token);
+        current_token = next_token(tokens, i);
+        Token* name = ast_parse_instance(generic, tokens, i);
+        if (generic->is_type) {
+            return ast_create_variable_expr(TYPE_UNKNOWN, name, i);
+        }
+        expect(ast_get_lookahead(tokens, i), TK_PAREN_OPEN);
+        return ast_create_call(name, tokens, i);
+    } else if (current_token->tt == TK_IDENTIFIER && current_token->token == "comptime" &&
+               lookahead != NULL && (lookahead->tt == TK_IDENTIFIER || lookahead->tt == TK_PAREN_OPEN ||
+                                     lookahead->tt == TK_SQUARE_OPEN)) {
+        // comptime f(x) is evaluated by the compiler
+        Token* op = current_token;
+        current_token = next_token(tokens, i);
+        ExpressionNode* operand = ast_create_expr_prec(tokens, PREC_UNARY, false, false, false, i);
+        ExpressionNode* ret = ast_create_unary(op, operand);
+        ret->nt = NODE_COMPTIME;
+        ret->unary_op->operator_type = NODE_COMPTIME;
+        return ret;
+    } else if (current_token->tt == TK_IDENTIFIER && lookahead != NULL && lookahead->tt == TK_PAREN_OPEN) {
+        return ast_create_call(current_token, tokens, i);
     } else if (current_token->tt == TK_IDENTIFIER) {
-        lhs = ast_create_variable_expr(TYPE_UNKNOWN, tokens[*i], i);
+        return ast_create_variable_expr(TYPE_UNKNOWN, tokens[*i], i);
     } else if (current_token->tt == TK_CONSTANT) {
-        lhs = ast_create_constant(tokens[*i]);
+        return ast_create_constant(tokens[*i]);
     } else if (current_token->tt == TK_QUOTE) {
-        lhs = ast_create_quote(tokens[*i]);
+        return ast_create_quote(tokens[*i]);
     } else if (current_token->tt == TK_SQUARE_OPEN) {
-        //lhs = ast_create_array_decl(tokens, i); // only for array_decl
-        lhs = ast_create_subscript_node(tokens, i); // only for array_decl
+        return ast_create_subscript_node(tokens, i); // only for array_decl
     } else if (current_token->tt == TK_DOT_CURLY) {
-        lhs = ast_create_type_instantiation(tokens, i);
+        return ast_create_type_instantiation(tokens, i);
     } else if (current_token->tt == TK_CHAR) {
-        lhs = ast_create_char(tokens[*i]);
+        return ast_create_char(tokens[*i]);
     } else if (current_token->tt == TK_PAREN_OPEN) {
         current_token = next_token(tokens, i);
-        //lhs = ast_create_expr_prec(tokens, get_prec(TK_PAREN_OPEN),
-        //                           false, false, false, i);
-        lhs = ast_create_expression(tokens, false, false, false, i);
-        lhs->needs_paren = true;
+        ExpressionNode* expr = ast_create_expression(tokens, false, false, false, i);
+        expr->needs_paren = true;
         current_token = next_token(tokens, i);
         expect(current_token, TK_PAREN_CLOSE);
-        //current_token = next_token(tokens, i);
-    } else {
-        print_error_msg("Invalid token for lhs in ast_get_expr_prec\n");
-        print_token(current_token);
-        exit(1);
-    }
-    //operator is the lookahead
-    ExpressionNode* rhs = NULL;
-    ExpressionNode* unary_op_expr = NULL;
-
-    // Make sure it is updated
-    current_token = tokens[*i];  
-    lookahead = ast_get_lookahead(tokens, i);
-    if (is_args && current_token->tt == TK_PAREN_CLOSE) {
-        (*i)++; // Throw away closed bracket
-        return lhs;
-    } else if (is_arr && (current_token->tt == TK_SQUARE_CLOSE)) {
-        // only for var_decl
-        //TODO: remove this? -- seems like this never happens
-        print_error_msg("SUPPOSED TO BE UNREACHABLE?");
-        exit(1);
-        //return lhs;
-    } else if (is_arr && (lookahead->tt == TK_SQUARE_CLOSE)) {
-        // only for var_decl
-        (*i)++; // Throw away closed square bracket
-        return lhs;
-    } else if (is_arr && (current_token->tt == TK_COMMA)
-               || (lookahead->tt == TK_COMMA)) {
-        (*i)++; // Now token should be on ']' or ','
-        return lhs;
+        return expr;
+    } else if (current_token->tt == TK_DASH || current_token->tt == TK_NOT ||
+               current_token->tt == TK_STAR || current_token->tt == TK_AMPERSAND) {
+        // prefix operator, * dereferences and & takes the address
+        Token* op = current_token;
+        current_token = next_token(tokens, i);
+        ExpressionNode* operand = ast_create_expr_prec(tokens, PREC_UNARY, false, false, false, i);
+        return ast_create_unary(op, operand);
     }
+    print_error_msg("Invalid token for lhs in ast_get_expr_prec\n");
+    print_token(current_token);
+    error_abort();
+}
 
-    current_token = tokens[*i];  
-    lookahead = ast_get_lookahead(tokens, i);
-
-    if (current_token->tt != TK_NEWLINE && lookahead->tt != TK_CURLY_OPEN) {
-        // FIX to make the second half of OR check if lookahead operator has different associativity
-        if (lookahead->tt == TK_CURLY_CLOSE) {
-            return lhs;
+// Precedence climbing. The index starts on the first token of the
+// expression and is left on its last token, so the caller can look at
+// whatever terminated it (newline, '{', ',', ')', ']' or '}')
+ExpressionNode* 
+ast_create_expr_prec(
+        std::vector<Token*> tokens,
+        int precedence,
+        bool is_args,
+        bool is_cond,
+        bool is_arr,
+        int* i) 
+{
+    ExpressionNode* lhs = ast_create_operand(tokens, i);
+    for (;;) {
+        Token* lookahead = ast_get_lookahead(tokens, i);
+        if (lookahead == NULL) {
+            break;
+        }
+        int op_prec = get_prec(lookahead->tt);
+        if (op_prec < 0 || op_prec < precedence) {
+            break;
         }
-        while(get_prec(lookahead->tt) >= precedence || lookahead->tt == TK_ASSIGN) {
+        Token* op = next_token(tokens, i);
+        if (!is_op_binary(op)) {
+            std::string err = "\"" + op->token + "\" can not be used as a binary operator";
+            print_error_msg(err);
+            error_abort();
+        }
+        Token* current_token = next_token(tokens, i); // rhs
+        log_print("rhs:");
+        print_token(current_token);
+        ExpressionNode* rhs;
+        if (op->tt == TK_SQUARE_OPEN) {
+            // index, codegen closes the bracket
+            rhs = ast_create_expression(tokens, false, false, true, i);
             current_token = next_token(tokens, i);
-            Token* op = current_token; // operator is a lookahead
-            if (!is_op_binary(op)) {
-                exit(50);
-                UnaryOpNode* unary_op_node = new UnaryOpNode;
-                unary_op_node->nt = NODE_UNARY;
-                unary_op_node->operand = lhs;
-                lhs = new ExpressionNode;
-                lhs->nt = NODE_UNARY;
-                // unary op
-                switch(op->tt) {
-                case TK_PTR_DEREFERENCE:
-                    break;
-                case TK_NOT:
-                    // NOTE: NOT AND * ARE LEFT ASSOCIATIVE
-                    std::string err = "\"" + op->token + "\" is not implemented yet";
-                    print_error_msg(err);
-                    exit(1);
-                    //TODO: fix this switch
-                //default:
-                    //std::string err = "\"" + op->token + "\" is not a valid operator";
-                    print_error_msg(err);
-                    exit(1);
-                }
-            } else {
-                current_token = next_token(tokens, i); // rhs
-                log_print("rhs:");
-                print_token(current_token);
-                if (op->tt == TK_ASSIGN) {
-                    // right to left
-                    rhs = ast_create_expression(tokens, false, false, false, i);
-                } else {
-                    // left to right
-                    lookahead = ast_get_lookahead(tokens, i);
-                    if (current_token->tt == TK_IDENTIFIER
-                        && lookahead->tt == TK_PAREN_OPEN) {
-                        // Function Call
-                        rhs = ast_create_call(current_token, tokens, i);
-                    } else if (current_token->tt == TK_IDENTIFIER) {
-                        // Variable
-                        rhs = ast_create_variable_expr(TYPE_UNKNOWN, tokens[*i], i);
-                    } else if (current_token->tt == TK_CONSTANT) {
-                        // Constant TODO: handle quotes 
-                        rhs = ast_create_constant(tokens[*i]);
-                    } else if (current_token->tt == TK_QUOTE) {
-                        rhs = ast_create_quote(tokens[*i]);
-                    } else {
-                        return lhs;
-                    }
-                }
-                current_token = tokens[*i];
-                lookahead = ast_get_lookahead(tokens, i);
-                //if (op->tt == TK_SQUARE_OPEN) {
-                if (lookahead->tt == TK_SQUARE_CLOSE && !is_arr) {
-                    (*i)++;
-                    current_token = tokens[*i];
-                    expect(current_token, TK_SQUARE_CLOSE);
-                    lookahead = ast_get_lookahead(tokens, i);
-                    if (lookahead->tt == TK_NEWLINE) {
-                        //exit(69);
-                        lhs = ast_create_binop(lhs, rhs, op);
-                        break;
-                    }
-                } 
-                // TODO: handle left associativity
-                // TODO: MIGHT BE FAILING HERE FOR ARRAY EXPR 
-                while (get_prec(lookahead->tt) >= get_prec(op->tt)) {
-                    if (get_prec(lookahead->tt) > get_prec(op->tt))
-                        rhs = ast_create_expr_prec(tokens, get_prec(op->tt) + 1, is_args, is_cond, is_arr, i);
-                    else
-                        rhs = ast_create_expr_prec(tokens, get_prec(op->tt), is_args, is_cond, is_arr, i);
-                    lookahead = ast_get_lookahead(tokens, i);
-                    if (lookahead->tt != TK_NEWLINE)
-                        current_token = next_token(tokens, i);
-                    if (current_token->tt == TK_NEWLINE || current_token->tt == TK_COMMA) {
-                        break;
-                    }
-                }
-                lhs = ast_create_binop(lhs, rhs, op);
-                lookahead = ast_get_lookahead(tokens, i);
-                if (lookahead->tt == TK_NEWLINE) {
-                    break;
-                }
-            }
-            lookahead = ast_get_lookahead(tokens, i);
-            if (current_token->tt == TK_NEWLINE ||
-                lookahead->tt == TK_NEWLINE ||
-                current_token->tt == TK_COMMA) {
-                break;
-            }
+            expect(current_token, TK_SQUARE_CLOSE);
+        } else if (op->tt == TK_DOT) {
+            expect(current_token, TK_IDENTIFIER);
+            rhs = ast_create_variable_expr(TYPE_UNKNOWN, current_token, i);
+        } else if (op->tt == TK_ASSIGN) {
+            // right to left
+            rhs = ast_create_expr_prec(tokens, op_prec, is_args, is_cond, is_arr, i);
+        } else {
+            // left to right
+            rhs = ast_create_expr_prec(tokens, op_prec + 1, is_args, is_cond, is_arr, i);
         }
+        lhs = ast_create_binop(lhs, rhs, op);
     }
-    //print_node(lhs, 0);
     return lhs;
 }
 
@@ -605,6 +687,109 @@ int ast_create_for_determine_for(std::vector<Token*> tokens, int* i) {
     return newline_count;
 }
 
+// for x in ... or for &x in ..., starting after for
+bool ast_is_for_each(std::vector<Token*> tokens, int* i) {
+    int j = *i;
+    if (tokens[j]->tt == TK_AMPERSAND) {
+        j++;
+    }
+    return j + 1 < tokens.size() && tokens[j]->tt == TK_IDENTIFIER &&
+           tokens[j + 1]->tt == TK_IDENTIFIER && tokens[j + 1]->token == "in";
+}
+
+// Parses tokens[begin, end) on their own, for expressions that the
+// expression parser can't find the end of
+ExpressionNode* ast_create_expression_between(std::vector<Token*> tokens, int begin, int end) {
+    std::vector<Token*> expr_tokens(tokens.begin() + begin, tokens.begin() + end);
+    Token* newline = new Token(*tokens[end]);
+    newline->tt = TK_NEWLINE;
+    newline->token = "\n";
+    expr_tokens.push_back(newline);
+    int k = 0;
+    return ast_create_expression(expr_tokens, false, false, false, &k);
+}
+
+// reduce(+ sum, * product, min lo, max hi), leaves the index on the )
+void ast_parse_reduce(std::vector<Token*> tokens, int* i, ForNode* for_node) {
+    Token* current_token = next_token(tokens, i);
+    expect(current_token, TK_PAREN_OPEN);
+    while (current_token->tt != TK_PAREN_CLOSE) {
+        Token* op = next_token(tokens, i);
+        if (op->tt != TK_PLUS && op->tt != TK_STAR && op->token != "min" && op->token != "max") {
+            print_error_msg("reduce expects +, *, min or max, got \"" + op->token + "\"");
+            error_abort();
+        }
+        current_token = next_token(tokens, i);
+        expect(current_token, TK_IDENTIFIER);
+        for_node->reduce_ops.push_back(op);
+        for_node->reduce_vars.push_back(current_token);
+        current_token = next_token(tokens, i);
+        if (current_token->tt != TK_COMMA) {
+            expect(current_token, TK_PAREN_CLOSE);
+        }
+    }
+}
+
+// Leaves the index on the last token of the array or range
+void ast_create_for_each(std::vector<Token*> tokens, int* i, ForNode* for_node) {
+    Token* current_token = tokens[*i];
+    for_node->for_type = FOR_EACH;
+    for_node->init = NULL;
+    for_node->test = NULL;
+    for_node->update = NULL;
+    for_node->range_end = NULL;
+    for_node->each_by_ref = current_token->tt == TK_AMPERSAND;
+    if (for_node->each_by_ref) {
+        current_token = next_token(tokens, i);
+    }
+    for_node->each_var = current_token;
+    current_token = next_token(tokens, i); // in
+    current_token = next_token(tokens, i);
+
+    // a..b, the .. can't be left to the expression parser since . is an operator
+    int depth = 0;
+    int dots = -1;
+    int reduce = -1;
+    for (int j = *i; j + 1 < tokens.size() && tokens[j]->tt != TK_CURLY_OPEN; j++) {
+        TokenType tt = tokens[j]->tt;
+        if (tt == TK_PAREN_OPEN || tt == TK_SQUARE_OPEN) {
+            depth++;
+        } else if (tt == TK_PAREN_CLOSE || tt == TK_SQUARE_CLOSE) {
+            depth--;
+        } else if (depth == 0 && dots < 0 && tt == TK_DOT && tokens[j + 1]->tt == TK_DOT) {
+            dots = j;
+        } else if (depth == 0 && tt == TK_IDENTIFIER && tokens[j]->token == "reduce" &&
+                   tokens[j + 1]->tt == TK_PAREN_OPEN) {
+            reduce = j;
+            break;
+        }
+    }
+    if (for_node->is_parallel && dots < 0) {
+        print_error_msg("for parallel " + for_node->each_var->token + " needs a range");
+        error_abort();
+    } else if (!for_node->is_parallel && reduce >= 0) {
+        print_error_msg("reduce can only be used with for parallel");
+        error_abort();
+    }
+    if (dots < 0) {
+        for_node->iterable = ast_create_expression(tokens, false, false, false, i);
+        return;
+    }
+    if (for_node->each_by_ref) {
+        print_error_msg("for &" + for_node->each_var->token + " can't be used with a range");
+        error_abort();
+    }
+    for_node->iterable = ast_create_expression_between(tokens, *i, dots);
+    if (reduce < 0) {
+        *i = dots + 2;
+        for_node->range_end = ast_create_expression(tokens, false, false, false, i);
+        return;
+    }
+    for_node->range_end = ast_create_expression_between(tokens, dots + 2, reduce);
+    *i = reduce;
+    ast_parse_reduce(tokens, i, for_node);
+}
+
 StatementNode* ast_create_for(std::vector<Token*> tokens, int* i) {
     log_print("Creating ForNode\n");
     StatementNode* ret = new StatementNode;
@@ -613,7 +798,17 @@ StatementNode* ast_create_for(std::vector<Token*> tokens, int* i) {
     Token* current_token = next_token(tokens, i); // skip for
     print_token(current_token);
     int for_type = ast_create_for_determine_for(tokens, i);
-    if (for_type == FOR_LOOP) {
+    if (current_token->tt == TK_IDENTIFIER && current_token->token == "parallel" &&
+        !ast_is_for_each(tokens, i)) {
+        int j = *i + 1;
+        if (j < tokens.size() && ast_is_for_each(tokens, &j)) {
+            for_node->is_parallel = true;
+            current_token = next_token(tokens, i);
+        }
+    }
+    if (ast_is_for_each(tokens, i)) {
+        ast_create_for_each(tokens, i, for_node);
+    } else if (for_type == FOR_LOOP) {
         // init statement
         // for now assuming its a var_decl but need to fix this later
         StatementNode* init_statement = ast_create_declaration(tokens, i);
@@ -651,7 +846,7 @@ StatementNode* ast_create_for(std::vector<Token*> tokens, int* i) {
         for_node->for_type = FOR_WHILE;
     } else {
         print_error_msg("For Loop not recognized... Perhaps it is not supported yet");
-        exit(1);
+        error_abort();
     }
 
     // block
@@ -701,6 +896,101 @@ StatementNode* ast_create_if(std::vector<Token*> tokens, int* i) {
     return ret;
 }
 
+void ast_match_error(std::string message, Token* token) {
+    print_error_msg(message + " (line " + std::to_string(token->line) + ")");
+    error_abort();
+}
+
+// 0, 1..5, 'a'..='z' { ... }, the index starts on the first value and is
+// left on the } closing the block
+MatchArm* ast_create_match_arm(std::vector<Token*> tokens, int* i) {
+    MatchArm* arm = new MatchArm;
+    arm->token = tokens[*i];
+    std::vector<int> ends;
+    int depth = 0;
+    int j = *i;
+    for (; j < tokens.size(); j++) {
+        TokenType tt = tokens[j]->tt;
+        if (tt == TK_PAREN_OPEN || tt == TK_SQUARE_OPEN) {
+            depth++;
+        } else if (tt == TK_PAREN_CLOSE || tt == TK_SQUARE_CLOSE) {
+            depth--;
+        } else if (depth == 0 && tt == TK_COMMA) {
+            ends.push_back(j);
+        } else if (depth == 0 && (tt == TK_CURLY_OPEN || tt == TK_NEWLINE)) {
+            break;
+        }
+    }
+    if (j == tokens.size() || tokens[j]->tt != TK_CURLY_OPEN) {
+        ast_match_error("Each arm of a match needs a block", arm->token);
+    }
+    ends.push_back(j);
+    int begin = *i;
+    for (int end : ends) {
+        int dots = -1;
+        for (int k = begin; k + 1 < end && dots < 0; k++) {
+            if (tokens[k]->tt == TK_DOT && tokens[k + 1]->tt == TK_DOT) {
+                dots = k;
+            }
+        }
+        MatchCase match_case;
+        match_case.last = NULL;
+        match_case.includes_last = false;
+        int first_end = dots >= 0 ? dots : end;
+        int last_begin = dots + 2;
+        if (dots >= 0 && last_begin < end && tokens[last_begin]->tt == TK_ASSIGN) {
+            match_case.includes_last = true;
+            last_begin++;
+        }
+        if (begin == first_end || (dots >= 0 && last_begin >= end)) {
+            ast_match_error("Expected a value or a range in the arm of a match", tokens[begin]);
+        }
+        match_case.first = ast_create_expression_between(tokens, begin, first_end);
+        if (dots >= 0) {
+            match_case.last = ast_create_expression_between(tokens, last_begin, end);
+        }
+        arm->cases.push_back(match_case);
+        begin = end + 1;
+    }
+    *i = j;
+    arm->block = ast_create_block(tokens, i);
+    return arm;
+}
+
+StatementNode* ast_create_match(std::vector<Token*> tokens, int* i) {
+    log_print("Creating MatchNode\n");
+    MatchNode* match = new MatchNode;
+    match->nt = NODE_MATCH;
+    match->token = tokens[*i];
+    match->else_block = NULL;
+    (*i)++; // skip match
+    match->value = ast_create_expression(tokens, false, true, false, i);
+    Token* current_token = next_token(tokens, i);
+    expect(current_token, TK_CURLY_OPEN);
+    for (current_token = next_token(tokens, i); current_token->tt != TK_CURLY_CLOSE;
+         current_token = next_token(tokens, i)) {
+        if (current_token->tt == TK_NEWLINE) {
+            continue;
+        } else if (match->else_block != NULL) {
+            ast_match_error("The else arm has to be the last arm of a match", current_token);
+        } else if (current_token->tt == TK_ELSE) {
+            current_token = next_token(tokens, i);
+            expect(current_token, TK_CURLY_OPEN);
+            match->else_block = ast_create_block(tokens, i);
+        } else {
+            match->arms.push_back(ast_create_match_arm(tokens, i));
+        }
+    }
+    if (match->arms.size() == 0) {
+        ast_match_error("A match needs at least one arm besides else", match->token);
+    }
+    StatementNode* ret = new StatementNode;
+    ret->nt = NODE_MATCH;
+    ret->token = match->token;
+    ret->match_lhs = match;
+    return ret;
+}
+
 BlockNode* ast_create_block(std::vector<Token*> tokens, int* i) {
     log_print("Creating BlockNode\n");
     std::vector<StatementNode*> statements;
@@ -742,7 +1032,11 @@ BlockNode* ast_create_block(std::vector<Token*> tokens, int* i) {
             statement->cinclude_lhs = cinclude;
             statements.push_back(statement);
         } else {
-            statements.push_back(ast_create_declaration(tokens, i));
+            StatementNode* statement = ast_create_declaration(tokens, i);
+            if (statement->nt == NODE_DEFER) {
+                block->defers.push_back(statement->defer_lhs);
+            }
+            statements.push_back(statement);
         }
         if (tt == TK_CURLY_CLOSE) {
             break;
@@ -775,9 +1069,6 @@ TypeNode* ast_create_type_struct(std::vector<Token*> tokens, int* i) {
     for (; *i < tokens.size();) {
         current_token = next_token(tokens, i);
         print_token(current_token);
-        bool is_array = false;
-        int ptr_level = 0;
-        ExpressionNode* arr_size = NULL; // incase the var is an array
         if (current_token->tt == TK_CURLY_CLOSE) {
             current_token = next_token(tokens, i); // skip curly close
             break;
@@ -785,27 +1076,8 @@ TypeNode* ast_create_type_struct(std::vector<Token*> tokens, int* i) {
         expect(current_token, TK_IDENTIFIER); // type
         Token* name = current_token;
         current_token = next_token(tokens, i);
-        if (current_token->tt == TK_SQUARE_OPEN) {
-            // array type   
-            is_array = true;
-            ptr_level++;
-            current_token = next_token(tokens, i); // expr
-            arr_size = ast_create_expression(tokens, false, false, true, i);
-            current_token = tokens[*i]; // update current_token
-            expect(current_token, TK_SQUARE_CLOSE);
-            current_token = next_token(tokens, i); // expr
-        } else if (current_token->tt == TK_STAR) {
-            // TODO: handle deeper layers of pointers
-            while(current_token->tt == TK_STAR) {
-                ptr_level++;
-                current_token = next_token(tokens, i);
-            }
-        }
-        Token* type = current_token;
-        VarDeclNode* var = ast_create_var_decl(get_var_type(type), type, name, NULL);
-        var->lhs->ptr_level = ptr_level;
-        var->lhs->is_array = is_array;
-        var->lhs->arr_size = arr_size;
+        VarDeclNode* var = ast_create_var_decl(TYPE_UNKNOWN, NULL, name, NULL);
+        ast_parse_var_type(tokens, i, var->lhs);
         type_node->name = type_name;
         type_node->declarations.push_back(var);
         current_token = next_token(tokens, i); // newline
@@ -814,37 +1086,198 @@ TypeNode* ast_create_type_struct(std::vector<Token*> tokens, int* i) {
     return type_node;
 }
 
+std::string ast_mangle_type(VarNode* var) {
+    std::string type;
+    if (var->is_slice) {
+        type += "S";
+    } else if (var->is_dynamic) {
+        type += "V";
+    }
+    for (int i = 0; i < var->ptr_level; i++) {
+        type += "P";
+    }
+    Token* var_type = var->type_;
+    if (var_type->token == "i64") {
+        type += "x";
+    } else if (var_type->token == "u64") {
+        type += "y";
+    } else if (var_type->token == "i32") {
+        type += "i";
+    } else if (var_type->token == "u32") {
+        type += "j";
+    } else if (var_type->token == "i16") {
+        type += "s";
+    } else if (var_type->token == "u16") {
+        type += "t";
+    } else if (var_type->token == "i8") {
+        type += "Dh";
+    } else if (var_type->token == "u8") {
+        type += "h";
+    } else {
+        type += std::to_string(var_type->token.length()) + var_type->token;
+    }
+    return type;
+}
+
 void ast_name_mangler(FunctionNode* function) {
     std::string og_name = function->token->token;
 
     std::string type;
-    if (function->return_types == NULL) {
-        type = "v";
-    } else if (function->return_types->token == "i64") {
-        type = "x";
-    } else if (function->return_types->token == "u64") {
-        type = "y";
-    } else if (function->return_types->token == "i32") {
-        type = "i";
-    } else if (function->return_types->token == "u32") {
-        type = "j";
-    } else if (function->return_types->token == "i16") {
-        type = "s";
-    } else if (function->return_types->token == "u16") {
-        type = "t";
-    } else if (function->return_types->token == "i8") {
-        type = "Dh";
-    } else if (function->return_types->token == "u8") {
-        type = "h";
-    } else {
-        type = std::to_string(function->return_types->token.length())
-            + function->return_types->token;
+    if (function->type_args.size() != 0) {
+        // instances are named max[i64], the type arguments are mangled
+        // between I and E as in the Itanium ABI
+        og_name = og_name.substr(0, og_name.find('['));
+        type += "I";
+        for (VarNode* type_arg : function->type_args) {
+            type += ast_mangle_type(type_arg);
+        }
+        type += "E";
+    }
+    if (function->return_vars.size() == 0) {
+        type += "v";
+    }
+    for (VarNode* return_var : function->return_vars) {
+        type += ast_mangle_type(return_var);
     }
     
     function->mangled_name = "Z_" + std::to_string(og_name.length())
                              + og_name + type;
 }
 
+thread_local std::vector<GenericNode*> ast_generics;
+thread_local std::vector<std::string> ast_instances; // every instance made so far, across includes
+thread_local std::vector<StatementNode*> ast_pending_instances; // placed before the statement that needed them
+
+GenericNode* ast_get_generic(std::string name) {
+    for (GenericNode* generic : ast_generics) {
+        if (generic->name->token == name) {
+            return generic;
+        }
+    }
+    return NULL;
+}
+
+// Vec[T] type { ... } or max fn[T](a T, b T) -> T { ... }, starting on the name
+GenericNode* ast_create_generic(std::vector<Token*> tokens, int* i) {
+    GenericNode* generic = new GenericNode;
+    generic->nt = NODE_GENERIC;
+    Token* current_token = tokens[*i];
+    generic->name = current_token;
+    generic->tokens.push_back(current_token);
+    current_token = next_token(tokens, i);
+    generic->is_type = current_token->tt == TK_SQUARE_OPEN;
+    if (!generic->is_type) {
+        expect(current_token, TK_FN);
+        generic->tokens.push_back(current_token);
+        current_token = next_token(tokens, i);
+    }
+    expect(current_token, TK_SQUARE_OPEN);
+    current_token = next_token(tokens, i);
+    while (current_token->tt != TK_SQUARE_CLOSE) {
+        expect(current_token, TK_IDENTIFIER);
+        generic->params.push_back(current_token->token);
+        current_token = next_token(tokens, i);
+        if (current_token->tt == TK_COMMA) {
+            current_token = next_token(tokens, i);
+        }
+    }
+    // keep everything up to the closing curly of the body
+    int depth = 0;
+    for (;;) {
+        current_token = next_token(tokens, i);
+        generic->tokens.push_back(current_token);
+        if (current_token->tt == TK_CURLY_OPEN || current_token->tt == TK_DOT_CURLY) {
+            depth++;
+        } else if (current_token->tt == TK_CURLY_CLOSE && --depth == 0) {
+            break;
+        }
+    }
+    Token* newline = new Token(*current_token);
+    newline->tt = TK_NEWLINE;
+    newline->token = "\n";
+    generic->tokens.push_back(newline);
+    ast_generics.push_back(generic);
+    return generic;
+}
+
+// Parses the type arguments of generic starting on '[' and leaves the index
+// on ']'. The instance is parsed the first time it is seen and the token
+// naming it is returned: max[i64] for functions and Vec_i64 for types
+Token* ast_parse_instance(GenericNode* generic, std::vector<Token*> tokens, int* i) {
+    expect(tokens[*i], TK_SQUARE_OPEN);
+    std::vector<std::vector<Token*>> args;
+    std::vector<VarNode*> type_args;
+    Token* current_token = next_token(tokens, i);
+    while (current_token->tt != TK_SQUARE_CLOSE) {
+        int start = *i;
+        VarNode* type_arg = ast_create_var(current_token);
+        ast_parse_var_type(tokens, i, type_arg);
+        args.push_back(std::vector<Token*>(tokens.begin() + start, tokens.begin() + *i + 1));
+        type_args.push_back(type_arg);
+        current_token = next_token(tokens, i);
+        if (current_token->tt == TK_COMMA) {
+            current_token = next_token(tokens, i);
+        }
+    }
+    if (args.size() != generic->params.size()) {
+        std::string err = "\"" + generic->name->token + "\" takes "
+                        + std::to_string(generic->params.size()) + " type arguments but "
+                        + std::to_string(args.size()) + " were given";
+        print_error_msg(err);
+        error_abort();
+    }
+
+    std::string name = generic->name->token + (generic->is_type ? "_" : "[");
+    for (int j = 0; j < type_args.size(); j++) {
+        if (j != 0) {
+            name += generic->is_type ? "_" : ",";
+        }
+        // readable names for builtin types, Vec_i64 rather than Vec_x
+        VarNode* type_arg = type_args[j];
+        std::string prefix = type_arg->is_slice ? "S" : type_arg->is_dynamic ? "V" : "";
+        for (int k = 0; k < type_arg->ptr_level; k++) {
+            prefix += "P";
+        }
+        name += prefix + type_arg->type_->token;
+    }
+    name += generic->is_type ? "" : "]";
+    Token* name_token = new Token(*generic->name);
+    name_token->token = name;
+
+    for (std::string instance : ast_instances) {
+        if (instance == name) {
+            return name_token;
+        }
+    }
+    ast_instances.push_back(name); // before parsing so recursion finds it
+
+    std::vector<Token*> body;
+    body.push_back(name_token);
+    for (int j = 1; j < generic->tokens.size(); j++) {
+        Token* token = generic->tokens[j];
+        int param = -1;
+        for (int k = 0; k < generic->params.size(); k++) {
+            if (token->tt == TK_IDENTIFIER && token->token == generic->params[k]) {
+                param = k;
+            }
+        }
+        if (param < 0) {
+            body.push_back(token);
+        } else {
+            body.insert(body.end(), args[param].begin(), args[param].end());
+        }
+    }
+    int k = 0;
+    StatementNode* statement = ast_create_declaration(body, &k);
+    if (statement->nt == NODE_FUNC) {
+        ast_set_func_attributes(statement->func_lhs, generic->attributes);
+        statement->func_lhs->type_args = type_args;
+        ast_name_mangler(statement->func_lhs);
+    }
+    ast_pending_instances.push_back(statement);
+    return name_token;
+}
+
 FunctionNode* ast_create_function(std::vector<Token*> tokens, int* i) {
     FunctionNode* ret = new FunctionNode;
 
@@ -867,14 +1300,19 @@ FunctionNode* ast_create_function(std::vector<Token*> tokens, int* i) {
         expect(current_token, TK_PAREN_CLOSE);
         current_token = next_token(tokens, i);
         if (current_token->tt == TK_ARROW) {
-            // parse return types
-            // TODO: support multiple types
-            current_token = next_token(tokens, i);
-            auto return_type = current_token;
-            ret->return_types = return_type;
-            current_token = next_token(tokens, i);
+            // parse return types, -> i64, bool returns both
+            do {
+                current_token = next_token(tokens, i);
+                VarNode* return_var = ast_create_var(name);
+                ast_parse_var_type(tokens, i, return_var);
+                ret->return_vars.push_back(return_var);
+                current_token = next_token(tokens, i);
+            } while (current_token->tt == TK_COMMA);
+            ret->return_var = ret->return_vars[0];
+            ret->return_types = ret->return_var->type_;
         } else {
             ret->return_types = NULL;
+            ret->return_var = NULL;
         }
         if (current_token->tt == TK_NEWLINE) {
             ret->is_prototype = true;
@@ -914,39 +1352,35 @@ VarDeclNode* ast_handle_var_decl_lhs(std::vector<Token*> tokens, int* i) {
     current_token = next_token(tokens, i); // skip DOUBLE_C
     Token* id = current_token;
     expect(current_token, TK_IDENTIFIER);
-    bool is_array = false;
-    int ptr_level = 0;
-    ExpressionNode* arr_size = NULL; // incase the var is an array
-    current_token = next_token(tokens, i); // skip DOUBLE_C
-    if (current_token->tt == TK_SQUARE_OPEN) {
-        // array type   
-        is_array = true;
-        ptr_level++;
-        current_token = next_token(tokens, i); // expr
-        arr_size = ast_create_expression(tokens, false, false, true, i);
-        current_token = tokens[*i]; // update current_token
-        expect(current_token, TK_SQUARE_CLOSE);
-        current_token = next_token(tokens, i); // expr
-    } else if (current_token->tt == TK_STAR) {
-        // TODO: handle deeper layers of pointers
-        while(current_token->tt == TK_STAR) {
-            ptr_level++;
+    current_token = next_token(tokens, i); // type
+    VarDeclNode* lhs = ast_create_var_decl(TYPE_UNKNOWN, NULL, id, NULL);
+    if (current_token->tt != TK_COMMA) {
+        ast_parse_var_type(tokens, i, lhs->lhs);
+        lhs->type = lhs->lhs->type;
+        current_token = next_token(tokens, i);
+    }
+    if (current_token->tt == TK_COMMA) {
+        // :: q, r i64 = f() destructures a multi-value return, names
+        // without a type take it from the function
+        lhs->destructure.push_back(lhs->lhs);
+        while (current_token->tt == TK_COMMA) {
+            current_token = next_token(tokens, i);
+            expect(current_token, TK_IDENTIFIER);
+            VarNode* var = ast_create_var(current_token);
+            lhs->destructure.push_back(var);
             current_token = next_token(tokens, i);
+            if (current_token->tt != TK_COMMA && current_token->tt != TK_ASSIGN) {
+                ast_parse_var_type(tokens, i, var);
+                current_token = next_token(tokens, i);
+            }
         }
     }
-    expect(current_token, TK_IDENTIFIER);
-    Token* type = current_token;
-    current_token = next_token(tokens, i);
-    VarDeclNode* lhs = ast_create_var_decl(get_var_type(type), type, id, NULL);
-    lhs->lhs->ptr_level = ptr_level;
-    lhs->lhs->is_array = is_array;
-    lhs->lhs->arr_size = arr_size;
     return lhs;
 }
 
 VarDeclNode* ast_handle_var_decl(std::vector<Token*> tokens, int* i, bool has_atrs) {
     Token* current_token = tokens[*i]; // update token
-    bool is_static, is_const = false;
+    bool is_static = false, is_const = false;
     if(has_atrs) {
         // collect attributes first
         while(current_token->tt != TK_DOUBLE_C) {
@@ -962,7 +1396,7 @@ VarDeclNode* ast_handle_var_decl(std::vector<Token*> tokens, int* i, bool has_at
             } else {
                 std::string err = "Invalid attribute: " + current_token->token;
                 print_error_msg(err);
-                exit(1);
+                error_abort();
             }
             current_token = next_token(tokens, i);
         }
@@ -971,6 +1405,11 @@ VarDeclNode* ast_handle_var_decl(std::vector<Token*> tokens, int* i, bool has_at
     lhs->is_static = is_static;
     lhs->is_const = is_const;
     current_token = tokens[*i]; // update token
+    if ((lhs->lhs->is_dynamic || lhs->lhs->is_array) && current_token->tt == TK_NEWLINE) {
+        // dynamic arrays start out empty and fixed ones zeroed
+        (*i)--;
+        return lhs;
+    }
     expect(current_token, TK_ASSIGN);
     current_token = next_token(tokens, i);
     ExpressionNode* rhs = ast_create_expression(tokens, false, false, false, i);
@@ -981,6 +1420,165 @@ VarDeclNode* ast_handle_var_decl(std::vector<Token*> tokens, int* i, bool has_at
     return lhs;
 }
 
+// inline, hot f fn(...), attributes are identifiers separated by commas
+// before the name of a function. Some take a constant, memo(1000)
+// attr, attr(N) ... name <keyword>, keyword is fn or type
+bool ast_has_attributes(std::vector<Token*> tokens, int* i, TokenType keyword) {
+    int j = *i;
+    while (j < tokens.size() && tokens[j]->tt == TK_IDENTIFIER) {
+        int next = j + 1;
+        if (next + 2 < tokens.size() && tokens[next]->tt == TK_PAREN_OPEN &&
+            tokens[next + 1]->tt == TK_CONSTANT && tokens[next + 2]->tt == TK_PAREN_CLOSE) {
+            next += 3;
+        }
+        if (next < tokens.size() && tokens[next]->tt == TK_COMMA) {
+            j = next + 1;
+            continue;
+        }
+        return next + 1 < tokens.size() && tokens[next]->tt == TK_IDENTIFIER &&
+               tokens[next + 1]->tt == keyword;
+    }
+    return false;
+}
+
+bool ast_is_func_with_attributes(std::vector<Token*> tokens, int* i) {
+    return ast_has_attributes(tokens, i, TK_FN);
+}
+
+bool ast_is_type_with_attributes(std::vector<Token*> tokens, int* i) {
+    return ast_has_attributes(tokens, i, TK_TYPE);
+}
+
+// Leaves the index on the name before keyword. The constant of an
+// attribute follows it in the list
+std::vector<Token*> ast_parse_attributes(std::vector<Token*> tokens, int* i, TokenType keyword) {
+    std::vector<Token*> attributes;
+    Token* current_token = tokens[*i];
+    while (ast_get_lookahead(tokens, i)->tt != keyword) {
+        if (current_token->tt == TK_CONSTANT) {
+            attributes.push_back(current_token);
+        } else if (current_token->tt != TK_COMMA && current_token->tt != TK_PAREN_OPEN &&
+                   current_token->tt != TK_PAREN_CLOSE) {
+            expect(current_token, TK_IDENTIFIER);
+            attributes.push_back(current_token);
+        }
+        current_token = next_token(tokens, i);
+    }
+    return attributes;
+}
+
+std::vector<Token*> ast_parse_func_attributes(std::vector<Token*> tokens, int* i) {
+    return ast_parse_attributes(tokens, i, TK_FN);
+}
+
+void ast_set_type_attributes(TypeNode* type, std::vector<Token*> attributes) {
+    for (int j = 0; j < attributes.size(); j++) {
+        Token* attribute = attributes[j];
+        Token* argument = j + 1 < attributes.size() && attributes[j + 1]->tt == TK_CONSTANT
+                        ? attributes[j + 1] : NULL;
+        if (argument != NULL && attribute->token != "align") {
+            print_error_msg("Attribute " + attribute->token + " doesn't take a value");
+            error_abort();
+        }
+        if (attribute->token == "align") {
+            ConstantNode align;
+            align.value = 0;
+            if (argument != NULL) {
+                ast_parse_integer(argument, &align);
+                j++;
+            }
+            if (align.value == 0 || (align.value & (align.value - 1)) != 0) {
+                print_error_msg("align of \"" + type->name->token + "\" needs a power of two, align(64)");
+                error_abort();
+            }
+            type->align = align.value;
+        } else if (attribute->token == "packed") {
+            type->is_packed = true;
+        } else if (attribute->token == "ordered") {
+            type->is_ordered = true;
+        } else if (attribute->token == "soa") {
+            type->is_soa = true;
+        } else {
+            print_error_msg("Invalid type attribute: " + attribute->token);
+            error_abort();
+        }
+    }
+}
+
+void ast_set_func_attributes(FunctionNode* function, std::vector<Token*> attributes) {
+    for (int j = 0; j < attributes.size(); j++) {
+        Token* attribute = attributes[j];
+        Token* argument = j + 1 < attributes.size() && attributes[j + 1]->tt == TK_CONSTANT
+                        ? attributes[j + 1] : NULL;
+        if (argument != NULL && attribute->token != "memo") {
+            std::string err = "Attribute " + attribute->token + " doesn't take a value";
+            print_error_msg(err);
+            error_abort();
+        }
+        if (attribute->token == "memo") {
+            function->is_memo = true;
+            if (argument != NULL) {
+                ConstantNode limit;
+                ast_parse_integer(argument, &limit);
+                function->memo_limit = limit.value;
+                j++;
+            }
+        } else if (attribute->token == "comptime") {
+            function->is_comptime = true;
+        } else if (attribute->token == "inline") {
+            function->is_inline = true;
+        } else if (attribute->token == "noinline") {
+            function->is_noinline = true;
+        } else if (attribute->token == "static" || attribute->token == "internal") {
+            function->is_internal = true;
+        } else if (attribute->token == "export") {
+            function->is_export = true;
+        } else if (attribute->token == "hot") {
+            function->is_hot = true;
+        } else if (attribute->token == "cold") {
+            function->is_cold = true;
+        } else if (attribute->token == "flatten") {
+            function->is_flatten = true;
+        } else {
+            std::string err = "Invalid attribute: " + attribute->token;
+            print_error_msg(err);
+            error_abort();
+        }
+    }
+    std::string name = function->token->token;
+    std::string err;
+    if (function->is_inline && function->is_noinline) {
+        err = "\"" + name + "\" can't be both inline and noinline";
+    } else if (function->is_hot && function->is_cold) {
+        err = "\"" + name + "\" can't be both hot and cold";
+    } else if (function->is_internal && function->is_export) {
+        err = "\"" + name + "\" can't be both internal and exported";
+    } else if (function->is_inline && function->is_export) {
+        err = "\"" + name + "\" can't be both inline and exported";
+    } else if (name == "main" && (function->is_internal || function->is_inline || function->is_memo)) {
+        err = "main must have external linkage";
+    }
+    if (err.size() != 0) {
+        print_error_msg(err);
+        error_abort();
+    }
+}
+
+// Name[...] type, as opposed to indexing at the start of a statement
+bool ast_is_generic_type(std::vector<Token*> tokens, int* i) {
+    int depth = 0;
+    for (int j = *i + 1; j < tokens.size(); j++) {
+        if (tokens[j]->tt == TK_SQUARE_OPEN) {
+            depth++;
+        } else if (tokens[j]->tt == TK_SQUARE_CLOSE && --depth == 0) {
+            return j + 1 < tokens.size() && tokens[j + 1]->tt == TK_TYPE;
+        } else if (tokens[j]->tt == TK_NEWLINE) {
+            return false;
+        }
+    }
+    return false;
+}
+
 StatementNode* ast_create_declaration(std::vector<Token*> tokens, int* i) {
     StatementNode* stmt = new StatementNode;
     // assume starts at the beginning of the line
@@ -1009,7 +1607,30 @@ StatementNode* ast_create_declaration(std::vector<Token*> tokens, int* i) {
             return statement;
         } else if (current_token->tt == TK_IDENTIFIER) {
             Token* lookahead = ast_get_lookahead(tokens, i);
-            if (lookahead->tt == TK_COMMA || lookahead->tt == TK_DOUBLE_C) {
+            if (ast_is_func_with_attributes(tokens, i)) {
+                std::vector<Token*> attributes = ast_parse_func_attributes(tokens, i);
+                if (tokens[*i + 2]->tt == TK_SQUARE_OPEN) {
+                    StatementNode* stmt = new StatementNode;
+                    stmt->nt = NODE_GENERIC;
+                    stmt->generic_lhs = ast_create_generic(tokens, i);
+                    stmt->generic_lhs->attributes = attributes;
+                    return stmt;
+                }
+                FunctionNode* fn = ast_create_function(tokens, i);
+                ast_set_func_attributes(fn, attributes);
+                StatementNode* stmt = new StatementNode;
+                stmt->nt = NODE_FUNC;
+                stmt->func_lhs = fn;
+                return stmt;
+            } else if (ast_is_type_with_attributes(tokens, i)) {
+                std::vector<Token*> attributes = ast_parse_attributes(tokens, i, TK_TYPE);
+                TypeNode* type_struct = ast_create_type_struct(tokens, i);
+                ast_set_type_attributes(type_struct, attributes);
+                StatementNode* stmt = new StatementNode;
+                stmt->nt = NODE_TYPE;
+                stmt->type_lhs = type_struct;
+                return stmt;
+            } else if (lookahead->tt == TK_COMMA || lookahead->tt == TK_DOUBLE_C) {
                 // var_decl
                 VarDeclNode* var_decl = ast_handle_var_decl(tokens, i, true);
                 StatementNode* statement = new StatementNode;
@@ -1017,6 +1638,12 @@ StatementNode* ast_create_declaration(std::vector<Token*> tokens, int* i) {
                 statement->vardecl_lhs = var_decl;
                 statement->expr_rhs = var_decl->rhs;
                 return statement;
+            } else if ((lookahead->tt == TK_FN && tokens[*i + 2]->tt == TK_SQUARE_OPEN) ||
+                       (lookahead->tt == TK_SQUARE_OPEN && ast_is_generic_type(tokens, i))) {
+                StatementNode* stmt = new StatementNode;
+                stmt->nt = NODE_GENERIC;
+                stmt->generic_lhs = ast_create_generic(tokens, i);
+                return stmt;
             } else if (lookahead->tt == TK_FN) {
                 // Function
                 FunctionNode* fn = ast_create_function(tokens, i);
@@ -1058,6 +1685,10 @@ StatementNode* ast_create_declaration(std::vector<Token*> tokens, int* i) {
             StatementNode* stmt = ast_create_for(tokens, i);
             stmt->nt = NODE_FOR;
             return stmt;
+        } else if (current_token->tt == TK_DEFER) {
+            return ast_create_defer(tokens, i);
+        } else if (current_token->tt == TK_MATCH) {
+            return ast_create_match(tokens, i);
         } else {
             // Expression
             StatementNode* statement = new StatementNode;
@@ -1091,8 +1722,15 @@ std::vector<StatementNode*> ast_create(std::vector<Token*> tokens) {
             auto tokens = tokenize(src);
             auto ast = ast_create(tokens);
             ret.insert(ret.end(), ast.begin(), ast.end());
+        } else if (tt == TK_DEFER) {
+            print_error_msg("defer is only allowed in a block (line " + std::to_string(current_token->line) + ")");
+            error_abort();
         } else {
-            ret.push_back(ast_create_declaration(tokens, &i));
+            StatementNode* statement = ast_create_declaration(tokens, &i);
+            // generic instances it needed go first
+            ret.insert(ret.end(), ast_pending_instances.begin(), ast_pending_instances.end());
+            ast_pending_instances.clear();
+            ret.push_back(statement);
         }
     }
     return ret;
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <cstdint>
+
 #include "tokenize.hpp"
 
 enum ForType {
     FOR_WHILE = 0,
-    FOR_EACH = 1, // not implemented yet
+    FOR_EACH = 1, // for x in arr, for &x in arr and for i in a..b
     FOR_LOOP = 2,
 };
 
@@ -40,6 +42,8 @@ enum NodeType {
     NODE_RETURN,
     NODE_IF,
     NODE_FOR,
+    NODE_DEFER,
+    NODE_MATCH,
     NODE_TYPE,
     NODE_ARRAY_EXPR,
     NODE_CHAR,
@@ -48,6 +52,8 @@ enum NodeType {
     NODE_MEMBER_ACCESS,
     NODE_TYPE_INST,
     NODE_CINCLUDE,
+    NODE_GENERIC,
+    NODE_COMPTIME,
 };
 
 
@@ -62,6 +68,8 @@ struct VarNode : Node {
     Token* identifier;
 
     bool is_array;
+    bool is_slice = false;   // []T, ptr and len
+    bool is_dynamic = false; // [..]T, ptr, len and cap
     int ptr_level = 0;
     struct ExpressionNode* arr_size;
     // Codegen
@@ -74,11 +82,19 @@ struct VarDeclNode : Node {
     VarType type;
     VarNode* lhs;
     struct ExpressionNode* rhs;
+    std::vector<VarNode*> destructure; // every name of :: a, b = f(), lhs is the first
 };
 
 struct TypeNode : Node {
     Token* name;
-    std::vector<VarDeclNode*> declarations;
+    std::vector<VarDeclNode*> declarations; // as written, which is the order of .{...} values
+    bool is_reachable = true; // cleared by dce_start when nothing uses it
+    // attributes written before the name, e.g. packed, align(64) Header type {...}
+    bool is_packed  = false;
+    bool is_ordered = false; // keeps the declaration order, for structs shared with C
+    bool is_soa     = false; // fixed arrays of it are laid out as an array per field
+    int64_t align   = 0;     // align(N), 0 for the alignment of the fields
+    std::vector<VarDeclNode*> layout; // the fields in memory order, see layout.cpp
 };
 
 struct BinaryOpNode : Node {
@@ -110,6 +126,7 @@ struct MemberAccessNode : Node {
 struct UnaryOpNode : Node {
     //TODO: look to move certain things to here
     NodeType operator_type;
+    Token* op; // prefix operator when operator_type is NODE_UNARY or NODE_COMPTIME
     union {
         SubscriptNode* subscript;
         CallNode* call_node;
@@ -118,7 +135,8 @@ struct UnaryOpNode : Node {
 };
 
 struct ConstantNode : Node {
-    int value;
+    uint64_t value; // two's complement when the type is signed
+    VarType type;   // i64 unless suffixed (10u8) or too large for it
 };
 
 struct QuoteNode : Node {
@@ -160,6 +178,15 @@ struct ForNode : Node {
     ExpressionNode* test;
     struct StatementNode* update;
     struct BlockNode* block;
+    // FOR_EACH only
+    Token* each_var;
+    bool each_by_ref;          // for &x in arr, x points at the element
+    ExpressionNode* iterable;  // the array, or the start of a range
+    ExpressionNode* range_end; // NULL unless this is a range, which excludes it
+    // for parallel i in a..b reduce(+ sum, max best)
+    bool is_parallel = false;
+    std::vector<Token*> reduce_ops; // +, *, min or max
+    std::vector<Token*> reduce_vars;
 };
 
 struct IfNode : Node {
@@ -173,6 +200,28 @@ struct ElseNode : Node {
     struct BlockNode* block;
 };
 
+// match x { 0 { } 1, 2 { } 'a'..='z' { } else { } }, one arm per line
+struct MatchCase {
+    ExpressionNode* first;
+    ExpressionNode* last; // NULL unless this is a range
+    bool includes_last;   // a..=b, a..b excludes b like for i in a..b does
+    // the values it covers, both included, set by fold_start
+    int64_t lo = 0;
+    int64_t hi = 0;
+};
+
+struct MatchArm {
+    Token* token;
+    std::vector<MatchCase> cases;
+    struct BlockNode* block;
+};
+
+struct MatchNode : Node {
+    ExpressionNode* value;
+    std::vector<MatchArm*> arms;
+    struct BlockNode* else_block; // NULL without an else arm
+};
+
 struct AssignNode : Node {
     VarNode* lhs;
     ExpressionNode* rhs;
@@ -186,12 +235,41 @@ struct FunctionNode : Node {
     std::vector<ParamNode*> params;
     struct BlockNode* block;
     Token* return_types;
+    VarNode* return_var; // full return type, NULL when nothing is returned
+    std::vector<VarNode*> return_vars; // more than one for multi-value returns
+    std::vector<VarNode*> type_args; // set on instances of generic functions
+    bool is_comptime = false; // only ever run by the compiler, never emitted
+    // attributes written before the name, e.g. inline, cold puts fn(...)
+    bool is_inline   = false;
+    bool is_noinline = false;
+    bool is_internal = false; // static or internal, already the default for definitions
+    bool is_export   = false; // keeps external linkage
+    bool is_hot      = false;
+    bool is_cold     = false;
+    bool is_flatten  = false;
+    bool is_memo     = false; // results are cached, see memo.cpp
+    uint64_t memo_limit = 0;  // memo(N), at most N cached results, 0 for no limit
+    bool is_reachable = true; // cleared by dce_start when main can't call it
+    bool has_tail_loop = false; // set by tail_start, its self tail calls jump back to the top
     bool is_prototype;
     std::string mangled_name;
 };
 
+// Generic functions and types are kept as tokens and parsed again for
+// every instantiation with the type parameters substituted
+struct GenericNode : Node {
+    Token* name;
+    bool is_type;
+    std::vector<std::string> params;
+    std::vector<Token*> tokens; // the definition without its [params]
+    std::vector<Token*> attributes; // given to every instance of a function
+};
+
 struct ReturnNode : Node {
     ExpressionNode* expr;
+    std::vector<ExpressionNode*> exprs; // every value of a multi-value return
+    bool is_tail = false;      // -> tail f(x), see tail.cpp
+    bool is_self_tail = false; // set by tail_start, a call of the function it returns from
 };
 
 struct StatementNode : Node {
@@ -206,6 +284,9 @@ struct StatementNode : Node {
         ForNode* for_lhs;
         TypeNode* type_lhs;
         CincludeNode* cinclude_lhs;
+        GenericNode* generic_lhs;
+        struct StatementNode* defer_lhs; // the statement run when the block is left
+        MatchNode* match_lhs;
     };
     // RHS
     union {
@@ -222,22 +303,24 @@ struct Scope {
 struct BlockNode : Node {
     Scope* scope;
     std::vector<StatementNode*> statements;
+    // defer statements in the order they appear, also kept in statements
+    // where they are so only the ones reached run
+    std::vector<StatementNode*> defers;
 };
 
 void expect(Token* token, TokenType expected);
 void print_tabs(int tab_level);
 void print_node(Node* node, int tab_level);
 void print_nodes(std::vector<Node*> nodes);
-ParamNode* ast_create_param(Token* type,
-                            Token* name,
-                            bool is_array,
-                            int ptr_level,
-                            ExpressionNode* arr_size);
+ParamNode* ast_create_param(Token* name);
+void ast_parse_var_type(std::vector<Token*> tokens, int* i, VarNode* var);
 Token* next_token(std::vector<Token*> tokens, int* i);
 std::vector<ParamNode*> ast_parse_params(std::vector<Token*> tokens, int* i);
 ExpressionNode* ast_create_binop(ExpressionNode* lhs, ExpressionNode* rhs, Token* op);
 ExpressionNode* ast_create_call(Token* name, std::vector<Token*> tokens, int* i);
 StatementNode* ast_create_return(std::vector<Token*> tokens, int* i);
+StatementNode* ast_create_defer(std::vector<Token*> tokens, int* i);
+StatementNode* ast_create_match(std::vector<Token*> tokens, int* i);
 VarNode* ast_create_var(Token* identifier);
 VarDeclNode* ast_create_var_decl(VarType type, Token* type_id, Token* identifier, ExpressionNode* rhs);
 ExpressionNode* ast_create_variable_expr(VarType type, Token* identifier, int* i);
@@ -249,6 +332,17 @@ Token* ast_get_lookahead(std::vector<Token*> tokens, int* i);
 ExpressionNode* ast_create_array_decl(std::vector<Token*> tokens, int* i);
 ExpressionNode* ast_create_subscript_node(std::vector<Token*> tokens, int* i);
 ExpressionNode* ast_create_type_instantiation(std::vector<Token*> tokens, int* i);
+ExpressionNode* ast_create_unary(Token* op, ExpressionNode* operand);
+ExpressionNode* ast_create_operand(std::vector<Token*> tokens, int* i);
+GenericNode* ast_create_generic(std::vector<Token*> tokens, int* i);
+GenericNode* ast_get_generic(std::string name);
+Token* ast_parse_instance(GenericNode* generic, std::vector<Token*> tokens, int* i);
+bool ast_is_func_with_attributes(std::vector<Token*> tokens, int* i);
+std::vector<Token*> ast_parse_func_attributes(std::vector<Token*> tokens, int* i);
+bool ast_is_type_with_attributes(std::vector<Token*> tokens, int* i);
+std::vector<Token*> ast_parse_attributes(std::vector<Token*> tokens, int* i, TokenType keyword);
+void ast_set_type_attributes(TypeNode* type, std::vector<Token*> attributes);
+void ast_set_func_attributes(FunctionNode* function, std::vector<Token*> attributes);
 ExpressionNode* ast_create_expr_prec(
         std::vector<Token*> tokens,
         int precedence,
@@ -0,0 +1,68 @@
+#include <sstream>
+#include <thread>
+
+#include "atlas.hpp"
+#include "error.hpp"
+#include "tokenize.hpp"
+#include "fold.hpp"
+#include "memo.hpp"
+#include "dce.hpp"
+#include "layout.hpp"
+#include "tail.hpp"
+#include "ir.hpp"
+
+std::vector<StatementNode*> ast_create(std::vector<Token*> tokens);
+
+std::vector<StatementNode*> atlas_front(std::string src) {
+    log_print(src + "\n");
+    log_print("-----TOKENIZING START------\n");
+    auto tokens = tokenize(src);
+    print_tokens(tokens);
+    log_print("------TOKENIZING END-------\n\n");
+    log_print("--------AST START----------\n");
+    auto ast = ast_create(tokens);
+    log_print("---------AST END-----------\n\n");
+    log_print("-------FOLDING START-------\n");
+    fold_start(ast);
+    log_print("--------FOLDING END--------\n\n");
+    memo_start(ast);
+    log_print("---------DCE START---------\n");
+    dce_start(ast);
+    log_print("----------DCE END----------\n\n");
+    layout_start(ast);
+    tail_start();
+    if (global_state->use_ir) {
+        log_print("----------IR START---------\n");
+        ir_start(ast);
+        log_print("-----------IR END----------\n\n");
+    }
+    return ast;
+}
+
+// The body of the thread atlas_compile starts. Everything the passes keep
+// is thread_local, so it starts out empty here and goes with the thread
+void atlas_compile_thread(State* options, std::string* src, AtlasResult* result) {
+    std::ostringstream messages;
+    std::ostringstream c;
+    options->out = &messages;
+    global_state = options;
+    try {
+        std::vector<StatementNode*> ast = atlas_front(*src);
+        log_print("------CODEGEN START--------\n");
+        codegen_c(ast, &c);
+        log_print("-------CODEGEN END---------\n\n");
+        result->ok = true;
+        result->c = c.str();
+    } catch (AtlasError&) {
+        result->ok = false;
+    }
+    result->messages = messages.str();
+    global_state = NULL;
+}
+
+AtlasResult atlas_compile(State options, std::string src) {
+    AtlasResult result;
+    std::thread thread(atlas_compile_thread, &options, &src, &result);
+    thread.join();
+    return result;
+}
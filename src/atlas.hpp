@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "global.hpp"
+
+// libatlas, every file in src but cli.cpp. A compilation keeps all of its
+// state to itself and hands errors back instead of exiting, so a program
+// can run as many as it likes at once from different threads
+
+// What atlas_compile made of a program
+struct AtlasResult {
+    bool ok = false;      // false when it stopped at an error
+    std::string c;        // what the command line writes to out.c
+    std::string messages; // errors, and what --emit-ir, --print-layout and --debug print
+};
+
+// Compiles src as the file options.input_filename, finding its includes
+// through options.include_path or options.input_file_dir. It only goes
+// as far as the C: building it, --native, --interpret and --run are up
+// to the caller
+AtlasResult atlas_compile(State options, std::string src);
+
+// Tokenizing through the IR on the calling thread's state, what
+// atlas_compile and the command line both start with
+std::vector<StatementNode*> atlas_front(std::string src);
+
+// main.cpp
+void codegen_c(std::vector<StatementNode*> ast, std::ostream* file);
+void codegen_start(std::vector<StatementNode*> ast, std::string filename, std::string backend);
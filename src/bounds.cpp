@@ -0,0 +1,437 @@
+#include <vector>
+#include <string>
+#include <iostream>
+
+#include "global.hpp"
+#include "error.hpp"
+#include "ir.hpp"
+#include "bounds.hpp"
+
+// A check passes when index < length compared unsigned, both converted to
+// i64 first so a negative index fails it too. To tell what a check tests,
+// values are named by what they are worked out from (bounds_key):
+// constants, loads of slots nothing points at and arithmetic on those.
+// Two values with the same name are equal as long as none of the slots
+// read for them is written on the way from one to the other, which
+// bounds_clear follows through the blocks in between.
+//
+// Casts to a 64 bit integer are looked through. The bits they give are
+// the same whichever of i64 and u64 they go to, so a check and the
+// comparison guarding it agree on the value even when they convert it
+// differently
+
+const char* ir_op_name(IrOp op);
+
+thread_local BoundsStats bounds_stats;
+
+struct BoundsAt {
+    int block; // index into blocks
+    int index;
+};
+
+struct BoundsCheck {
+    BoundsAt at;
+    int index;              // the values compared
+    int length;
+    std::string index_key;
+    std::string length_key;
+    std::vector<int> slots; // read for the two keys
+    int from;               // first of those reads, -1 when one is in another block
+};
+
+// The function being looked at
+thread_local IrFunction* bounds_func = NULL;
+thread_local std::vector<IrInstr*> bounds_defs;
+thread_local std::vector<BoundsAt> bounds_def_at;
+thread_local std::vector<int> bounds_block_index; // by block id
+thread_local std::vector<std::vector<int>> bounds_preds;
+thread_local std::vector<std::vector<bool>> bounds_dom; // [b][d], whether d dominates b
+thread_local std::vector<bool> bounds_escapes;          // by slot, its address is used for more than getting at it
+thread_local std::vector<std::vector<BoundsAt>> bounds_writes; // by slot
+
+// The slot an address points into, -1 when it isn't a slot or a field of one
+int bounds_slot_of(int address, int64_t* offset) {
+    IrInstr* def = bounds_defs[address];
+    if (def->op == IR_SLOT) {
+        *offset = 0;
+        return def->imm;
+    } else if (def->op == IR_FIELD) {
+        int slot = bounds_slot_of(def->args[0], offset);
+        *offset += def->imm;
+        return slot;
+    }
+    return -1;
+}
+
+void bounds_analyze(IrFunction* func) {
+    bounds_func = func;
+    int count = func->values.size();
+    int blocks = func->blocks.size();
+    bounds_defs.assign(count, NULL);
+    bounds_def_at.assign(count, {-1, -1});
+    bounds_block_index.clear();
+    for (int b = 0; b < blocks; b++) {
+        IrBlock* block = func->blocks[b];
+        while (bounds_block_index.size() <= block->id) {
+            bounds_block_index.push_back(-1);
+        }
+        bounds_block_index[block->id] = b;
+        for (int i = 0; i < block->instrs.size(); i++) {
+            if (block->instrs[i].value >= 0) {
+                bounds_defs[block->instrs[i].value] = &block->instrs[i];
+                bounds_def_at[block->instrs[i].value] = {b, i};
+            }
+        }
+    }
+    bounds_preds.assign(blocks, {});
+    for (int b = 0; b < blocks; b++) {
+        for (int* target : ir_targets(func->blocks[b]->instrs.back())) {
+            bounds_preds[bounds_block_index[*target]].push_back(b);
+        }
+    }
+    bounds_dom.assign(blocks, std::vector<bool>(blocks, true));
+    bounds_dom[0].assign(blocks, false);
+    bounds_dom[0][0] = true;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int b = 1; b < blocks; b++) {
+            std::vector<bool> dom(blocks, true);
+            for (int pred : bounds_preds[b]) {
+                for (int d = 0; d < blocks; d++) {
+                    dom[d] = dom[d] && bounds_dom[pred][d];
+                }
+            }
+            dom[b] = true;
+            if (dom != bounds_dom[b]) {
+                bounds_dom[b] = dom;
+                changed = true;
+            }
+        }
+    }
+
+    // Reading or writing through an address keeps the slot to itself, as
+    // does passing or returning a struct by value
+    bounds_escapes.assign(func->slots.size(), false);
+    bounds_writes.assign(func->slots.size(), {});
+    for (int b = 0; b < blocks; b++) {
+        for (int i = 0; i < func->blocks[b]->instrs.size(); i++) {
+            IrInstr& instr = func->blocks[b]->instrs[i];
+            int64_t offset;
+            for (int a = 0; a < instr.args.size(); a++) {
+                int slot = bounds_slot_of(instr.args[a], &offset);
+                if (slot < 0) {
+                    continue;
+                }
+                bool is_access = (a == 0 && (instr.op == IR_LOAD || instr.op == IR_STORE || instr.op == IR_ZERO ||
+                                             instr.op == IR_FIELD)) || instr.op == IR_COPY ||
+                                 (instr.op == IR_CALL && a < instr.arg_types.size() &&
+                                  ir_is_struct(instr.arg_types[a])) ||
+                                 (instr.op == IR_RET && ir_is_struct(func->return_type));
+                bounds_escapes[slot] = bounds_escapes[slot] || !is_access;
+                if (a == 0 && (instr.op == IR_STORE || instr.op == IR_COPY || instr.op == IR_ZERO)) {
+                    bounds_writes[slot].push_back({b, i});
+                }
+            }
+            if (instr.dest >= 0 && bounds_slot_of(instr.dest, &offset) >= 0) {
+                bounds_writes[bounds_slot_of(instr.dest, &offset)].push_back({b, i});
+            }
+        }
+    }
+}
+
+bool bounds_is_64(IrType type) {
+    return type.kind == IR_INT && type.ptr_level == 0 && type.count < 0 && ir_size_of(type) == 8;
+}
+
+int bounds_strip(int value) {
+    while (bounds_defs[value]->op == IR_CAST && bounds_is_64(bounds_defs[value]->type)) {
+        value = bounds_defs[value]->args[0];
+    }
+    return value;
+}
+
+bool bounds_const(int value, int64_t* imm) {
+    IrInstr* def = bounds_defs[bounds_strip(value)];
+    *imm = def->imm;
+    return def->op == IR_CONST;
+}
+
+// reads gets the loads the name depends on
+std::string bounds_key(int value, std::vector<int>* reads) {
+    value = bounds_strip(value);
+    IrInstr* def = bounds_defs[value];
+    int64_t offset;
+    switch (def->op) {
+    case IR_CONST:
+        return "c" + std::to_string(def->imm);
+    case IR_LOAD:
+    {
+        int slot = bounds_slot_of(def->args[0], &offset);
+        if (slot < 0 || bounds_escapes[slot]) {
+            break;
+        }
+        reads->push_back(value);
+        return "s" + std::to_string(slot) + "+" + std::to_string(offset) + " " + ir_type_str(def->type);
+    }
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+        return std::string(ir_op_name(def->op)) + " " + ir_type_str(def->type) + "("
+               + bounds_key(def->args[0], reads) + ", " + bounds_key(def->args[1], reads) + ")";
+    default:
+        break;
+    }
+    return "v" + std::to_string(value);
+}
+
+// Whether value is never negative. A slot is when everything stored to
+// it is, taking that it is while finding out, which is how a counter
+// going up from 0 comes out right
+bool bounds_nonneg(int value, std::vector<int>& visiting) {
+    IrInstr* def = bounds_defs[bounds_strip(value)];
+    int64_t offset;
+    bool is_small = def->type.kind == IR_BOOL || (def->type.kind == IR_INT && ir_size_of(def->type) < 8);
+    if (def->type.ptr_level == 0 && def->type.count < 0 && is_small &&
+        (def->type.kind == IR_BOOL || ir_is_unsigned(def->type))) {
+        return true;
+    }
+    switch (def->op) {
+    case IR_CONST:
+        return def->imm >= 0;
+    case IR_ADD:
+    case IR_MUL:
+    case IR_DIV:
+        return bounds_nonneg(def->args[0], visiting) && bounds_nonneg(def->args[1], visiting);
+    case IR_LOAD:
+    {
+        int slot = bounds_slot_of(def->args[0], &offset);
+        if (slot < 0 || bounds_escapes[slot] || offset != 0 || bounds_func->slots[slot].param >= 0 ||
+            !ir_is_scalar(bounds_func->slots[slot].type)) {
+            return false;
+        }
+        for (int seen : visiting) {
+            if (seen == slot) {
+                return true;
+            }
+        }
+        visiting.push_back(slot);
+        bool is_nonneg = true;
+        for (BoundsAt at : bounds_writes[slot]) {
+            IrInstr& write = bounds_func->blocks[at.block]->instrs[at.index];
+            is_nonneg = is_nonneg && (write.op == IR_ZERO ||
+                                      (write.op == IR_STORE && bounds_nonneg(write.args[1], visiting)));
+        }
+        visiting.pop_back();
+        return is_nonneg;
+    }
+    default:
+        return false;
+    }
+}
+
+// Whether instructions from up to to of block b write to one of slots
+bool bounds_written(std::vector<int>& slots, int b, int from, int to) {
+    for (int slot : slots) {
+        for (BoundsAt at : bounds_writes[slot]) {
+            if (at.block == b && at.index >= from && at.index < to) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Whether slots are left alone on every path from instruction from of
+// block a to instruction to of block b, which a dominates. The blocks in
+// between are the ones b can be reached backwards from without going
+// through a
+bool bounds_clear(std::vector<int>& slots, int a, int from, int b, int to) {
+    std::vector<IrBlock*>& blocks = bounds_func->blocks;
+    if (a == b && from <= to) {
+        return !bounds_written(slots, a, from, to);
+    } else if (bounds_written(slots, a, from, blocks[a]->instrs.size()) || bounds_written(slots, b, 0, to)) {
+        return false;
+    }
+    std::vector<bool> seen(blocks.size(), false);
+    std::vector<int> worklist = bounds_preds[b];
+    while (worklist.size() != 0) {
+        int block = worklist.back();
+        worklist.pop_back();
+        if (block == a || seen[block]) {
+            continue;
+        }
+        seen[block] = true;
+        if (bounds_written(slots, block, 0, blocks[block]->instrs.size())) {
+            return false;
+        }
+        worklist.insert(worklist.end(), bounds_preds[block].begin(), bounds_preds[block].end());
+    }
+    return true;
+}
+
+// Whether cond being true, or false when negated, means check passes:
+// it compares a value named like the index, index < y or index <= y,
+// with a y named like the length or a constant no bigger than it. A
+// signed comparison only says so for an index that can't be negative
+bool bounds_guard(IrInstr* cond, bool negate, BoundsCheck& check, std::vector<int>* reads) {
+    IrOp op = cond->op;
+    if (op < IR_LT || op > IR_GE) {
+        return false;
+    }
+    if (negate) {
+        op = op == IR_LT ? IR_GE : op == IR_LE ? IR_GT : op == IR_GT ? IR_LE : IR_LT;
+    }
+    int lhs = cond->args[0];
+    int rhs = cond->args[1];
+    if (op == IR_GT || op == IR_GE) {
+        lhs = cond->args[1];
+        rhs = cond->args[0];
+        op = op == IR_GT ? IR_LT : IR_LE;
+    }
+    IrType type = bounds_func->values[lhs];
+    std::vector<int> visiting;
+    if (bounds_key(lhs, reads) != check.index_key ||
+        (!ir_is_unsigned(type) && !bounds_nonneg(lhs, visiting))) {
+        return false;
+    }
+    if (op == IR_LT && bounds_key(rhs, reads) == check.length_key) {
+        return true;
+    }
+    int64_t bound, length;
+    if (!bounds_const(rhs, &bound) || !bounds_const(check.length, &length)) {
+        return false;
+    }
+    if (op == IR_LE && (bound == -1 || bound == INT64_MAX)) {
+        return false;
+    }
+    return (uint64_t)bound + (op == IR_LE) <= (uint64_t)length;
+}
+
+// A branch on every path to the check, taken the side the check is on,
+// with nothing read for the comparison written since
+bool bounds_is_guarded(BoundsCheck& check) {
+    std::vector<IrBlock*>& blocks = bounds_func->blocks;
+    int b = check.at.block;
+    for (int d = 0; d < blocks.size(); d++) {
+        IrInstr& last = blocks[d]->instrs.back();
+        if (d == b || !bounds_dom[b][d] || last.op != IR_BRANCH || last.target == last.target_else ||
+            bounds_def_at[last.args[0]].block != d) {
+            continue;
+        }
+        for (int side = 0; side < 2; side++) {
+            int t = bounds_block_index[side == 0 ? last.target : last.target_else];
+            std::vector<int> reads;
+            if (bounds_preds[t].size() != 1 || !bounds_dom[b][t] ||
+                !bounds_guard(bounds_defs[last.args[0]], side == 1, check, &reads)) {
+                continue;
+            }
+            std::vector<int> slots = check.slots;
+            int from = bounds_def_at[last.args[0]].index;
+            bool is_local = true;
+            for (int read : reads) {
+                int64_t offset;
+                slots.push_back(bounds_slot_of(bounds_defs[read]->args[0], &offset));
+                is_local = is_local && bounds_def_at[read].block == d;
+                from = bounds_def_at[read].index < from ? bounds_def_at[read].index : from;
+            }
+            if (is_local && bounds_clear(slots, d, from, b, check.at.index)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void bounds_eliminate(IrFunction* func) {
+    bounds_analyze(func);
+    std::vector<BoundsCheck> checks;
+    for (int b = 0; b < func->blocks.size(); b++) {
+        for (int i = 0; i < func->blocks[b]->instrs.size(); i++) {
+            IrInstr& instr = func->blocks[b]->instrs[i];
+            if (instr.op != IR_CHECK) {
+                continue;
+            }
+            BoundsCheck check;
+            check.at = {b, i};
+            check.index = instr.args[0];
+            check.length = instr.args[1];
+            std::vector<int> reads;
+            check.index_key = bounds_key(check.index, &reads);
+            check.length_key = bounds_key(check.length, &reads);
+            check.from = i;
+            for (int read : reads) {
+                int64_t offset;
+                check.slots.push_back(bounds_slot_of(bounds_defs[read]->args[0], &offset));
+                if (bounds_def_at[read].block != b) {
+                    check.from = -1;
+                } else if (check.from >= 0 && bounds_def_at[read].index < check.from) {
+                    check.from = bounds_def_at[read].index;
+                }
+            }
+            checks.push_back(check);
+        }
+    }
+    bounds_stats.inserted += checks.size();
+
+    // A removed check still holds where it was, so it can cover others
+    std::vector<bool> removed(checks.size(), false);
+    int count = 0;
+    for (int c = 0; c < checks.size(); c++) {
+        BoundsCheck& check = checks[c];
+        int64_t index, length;
+        if (bounds_const(check.index, &index) && bounds_const(check.length, &length) &&
+            (uint64_t)index < (uint64_t)length) {
+            removed[c] = true;
+            bounds_stats.constant++;
+            continue;
+        } else if (check.from < 0) {
+            continue;
+        } else if (bounds_is_guarded(check)) {
+            removed[c] = true;
+            bounds_stats.loop++;
+            continue;
+        }
+        for (int e = 0; e < checks.size() && !removed[c]; e++) {
+            BoundsCheck& earlier = checks[e];
+            bool is_before = earlier.at.block == check.at.block ? earlier.at.index < check.at.index
+                                                                 : bounds_dom[check.at.block][earlier.at.block];
+            int64_t earlier_length;
+            bool covers = earlier.length_key == check.length_key ||
+                          (bounds_const(earlier.length, &earlier_length) && bounds_const(check.length, &length) &&
+                           (uint64_t)earlier_length <= (uint64_t)length);
+            if (!is_before || earlier.from < 0 || earlier.index_key != check.index_key || !covers) {
+                continue;
+            }
+            std::vector<int> slots = check.slots;
+            slots.insert(slots.end(), earlier.slots.begin(), earlier.slots.end());
+            if (bounds_clear(slots, earlier.at.block, earlier.from, check.at.block, check.at.index)) {
+                removed[c] = true;
+                bounds_stats.repeated++;
+            }
+        }
+    }
+
+    for (int c = checks.size() - 1; c >= 0; c--) {
+        if (removed[c]) {
+            std::vector<IrInstr>& instrs = func->blocks[checks[c].at.block]->instrs;
+            instrs.erase(instrs.begin() + checks[c].at.index);
+            count++;
+        }
+    }
+    if (count != 0) {
+        log_print("BOUNDS: " + std::to_string(count) + " of " + std::to_string(checks.size())
+                  + " checks removed from " + func->func->token->token + "\n");
+        ir_optimize(func); // the lengths only the checks used
+    }
+}
+
+void bounds_report() {
+    if (!global_state->bounds_check) {
+        return;
+    }
+    int eliminated = bounds_stats.constant + bounds_stats.loop + bounds_stats.repeated;
+    error_out() << "bounds:  " << bounds_stats.inserted << " checks, " << eliminated << " eliminated ("
+                << bounds_stats.constant << " constant, " << bounds_stats.loop << " loop, "
+                << bounds_stats.repeated << " repeated)\n";
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "ir.hpp"
+
+// Counts for --stats
+struct BoundsStats {
+    int inserted = 0; // checks written, by the IR and by the C emitter
+    int constant = 0; // removed, a constant index below a constant length
+    int loop = 0;     // removed, the index was already compared against the length
+    int repeated = 0; // removed, an earlier check of the same index and length covers it
+};
+
+extern thread_local BoundsStats bounds_stats;
+
+// --bounds-check puts an IR_CHECK in front of every index into a fixed
+// array or a string. This drops the ones that can't fail: constant
+// indexes, loop counters that never go below 0 and are only used under a
+// comparison with the length, and a check done before on every path with
+// nothing written to the index or the length since. Run by ir_start on
+// each function once it is optimized
+void bounds_eliminate(IrFunction* func);
+void bounds_report(); // the counts, for --stats
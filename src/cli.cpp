@@ -0,0 +1,204 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "atlas.hpp"
+#include "error.hpp"
+#include "tokenize.hpp"
+#include "vector.hpp"
+#include "x64.hpp"
+#include "vm.hpp"
+
+// The atlas command: reads the options and the file, then builds or runs
+// what libatlas makes of it
+
+void check_valid_backend(std::string backend) {
+    //TODO: actually check if the backend exists
+    if (backend == "gcc" || backend == "clang" || backend == "tcc") {
+        return;
+    }
+    print_error_msg("backend is not supported");
+    exit(1);
+}
+
+void print_usage() {
+    std::cout << "Usage: atlas [options] file...\n";
+    std::cout << "Options:\n";
+    std::cout << "    --include <dir>\n";
+    std::cout << "    -I <dir>          Add directory to the Path to the Include search paths\n";
+    std::cout << "    --debug           Used to show logs for Compiler development\n";
+    std::cout << "    --run\n";
+    std::cout << "    -r                Runs the program after compilation.\n";
+    std::cout << "                      NOTE: Removes output file if not specified with -o\n";
+    std::cout << "    --output\n";
+    std::cout << "    -o <filename>     Place the output file in the specified name\n";
+    std::cout << "    --freestanding    Build a static binary without libc\n";
+    std::cout << "    --stats           Print the size of out.c and the binary and the backend's time\n";
+    std::cout << "    -O0 -O1 -O2 -O3 -Os\n";
+    std::cout << "                      Optimization level for the C backend, none by default\n";
+    std::cout << "    --emit-ir         Print the IR of every function that could be lowered to it\n";
+    std::cout << "    --no-ir           Write C straight from the AST, without the IR\n";
+    std::cout << "    --print-layout    Print the size, field offsets and padding of every struct\n";
+    std::cout << "    --bounds-check    Stop with an error on an index outside a fixed array, string\n";
+    std::cout << "                      or slice. Checks that can't fail are left out\n";
+    std::cout << "    --native          Write an x86-64 executable without a C compiler, for quick\n";
+    std::cout << "                      debug builds. Falls back to C for what it can't compile\n";
+    std::cout << "    --interpret       Run the program in the compiler from a bytecode, without\n";
+    std::cout << "                      building it. Falls back to --run for what it can't run\n";
+    std::cout << "    --backend <cc>    C compiler to build out.c with: gcc (default), clang or tcc\n";
+    std::cout << "    --threads <n>     Threads for parallel loops, one per core by default.\n";
+    std::cout << "                      ATLAS_THREADS in the environment overrides it at runtime\n";
+    exit(0);
+}
+
+State* set_options(int argc, char** argv) {
+    State* state = new State;
+    bool filepath_set = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--debug") {
+            state->debug = true;
+        } else if (arg == "-o" || arg == "--output") {
+            if (i == argc) {
+                print_error_msg("No output file provided after -o flag");
+                exit(1);
+            }
+            i++;
+            state->output_file_path = std::string(argv[i]);
+        } else if (arg == "-I" || arg == "--include") {
+            if (i == argc) {
+                print_error_msg("No path provided after -I flag");
+                exit(1);
+            }
+            i++;
+            state->include_path = std::string(argv[i]);
+            if (state->include_path[state->include_path.size() - 1] != '/') {
+                state->include_path += '/';
+            }
+        } else if (arg == "-r" || arg == "--run") {
+            state->run = true;
+        } else if (arg == "-E" || arg == "--emit-c") {
+            state->emit_c = true;
+        } else if (arg == "--freestanding") {
+            state->freestanding = true;
+        } else if (arg == "--stats") {
+            state->stats = true;
+        } else if (arg == "--emit-ir") {
+            state->emit_ir = true;
+        } else if (arg == "--print-layout") {
+            state->print_layout = true;
+        } else if (arg == "--bounds-check") {
+            state->bounds_check = true;
+        } else if (arg == "--no-ir") {
+            state->use_ir = false;
+        } else if (arg == "--native") {
+            state->native = true;
+        } else if (arg == "--interpret") {
+            state->interpret = true;
+        } else if (arg == "--backend") {
+            if (i + 1 == argc) {
+                print_error_msg("No C compiler provided after --backend flag");
+                exit(1);
+            }
+            i++;
+            state->backend = std::string(argv[i]);
+            check_valid_backend(state->backend);
+        } else if (arg == "-O0" || arg == "-O1" || arg == "-O2" || arg == "-O3" || arg == "-Os") {
+            state->opt_level = arg;
+        } else if (arg == "--threads") {
+            if (i + 1 == argc) {
+                print_error_msg("No thread count provided after --threads flag");
+                exit(1);
+            }
+            i++;
+            state->threads = atoi(argv[i]);
+        } else if (arg == "--help") {
+            print_usage();
+        } else if (argv[i][0] == '-') {
+            std::string err = "Unknown option: " + arg;
+            print_error_msg(err);
+            exit(1);
+        } else {
+            state->input_filename = arg;
+            filepath_set = true;
+            char BUFF[255]; // Max number of chars for filename in Linux
+            //std::string full_path = ;
+            state->input_file_dir = getcwd(BUFF, sizeof(BUFF));
+            state->input_file_dir += "/";
+        }
+    }
+    if (!filepath_set) {
+        std::cout << "atlas: " << CL_RED << "error:" << CL_RESET <<" no input files\n";
+        exit(1);
+    }
+    return state;    
+}
+
+void run_program(std::string output_file_path) {
+    //TODO: handle case where this fails because codegen didn't succeed
+    std::string command;
+    bool is_output_specified = true;
+    if (output_file_path.size() == 0) {
+        command = "./a.out";
+        output_file_path = "a.out";
+        is_output_specified = false;
+    }
+    command = "./" + output_file_path;
+    int ret = std::system(command.c_str());
+    if (!is_output_specified) {
+        std::string remove = "rm " + output_file_path;
+        std::system(remove.c_str());
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc == 1) {
+        //TODO: print a usage
+        std::cout << "atlas: " << CL_RED << "error:" << CL_RESET <<" no input files\n";
+        return 1;
+    }
+
+    State* state = set_options(argc, argv);
+    global_state = state;
+    std::string BACKEND = state->backend;
+    if (state->debug) {
+        std::cout << "[INFO]: Debug Mode is enabled\n";
+        if (BACKEND == "gcc") {
+            BACKEND += " -fcompare-debug-second -w ";
+        }
+        //BACKEND = "g++ -fcompare-debug-second -w ";
+    }
+    //BACKEND = "clang";
+    if (state->opt_level.size() != 0) {
+        BACKEND += " " + state->opt_level + " ";
+    }
+
+    try {
+        std::string src = read_file(state->input_filename);
+        auto ast = atlas_front(src);
+        if (vector_used_types().size() != 0) {
+            // 32 and 64 byte vectors without AVX make gcc note an ABI change,
+            // which can't matter for the inline helpers they are passed to
+            BACKEND += " -Wno-psabi ";
+        }
+        if (state->interpret) {
+            int exit_code = 0;
+            if (vm_start(ast, &exit_code)) {
+                return exit_code;
+            }
+            state->run = true;
+        }
+        log_print("------CODEGEN START--------\n");
+        if (!state->native || !x64_start(ast, state->output_file_path)) {
+            codegen_start(ast, "out.c", BACKEND);
+        }
+        log_print("-------CODEGEN END---------\n\n");
+    } catch (AtlasError&) {
+        return 1; // the error is printed already
+    }
+    if (state->run) {
+        run_program(state->output_file_path);
+    }
+    return 0;
+}
@@ -0,0 +1,656 @@
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "global.hpp"
+#include "error.hpp"
+#include "fold.hpp"
+#include "comptime.hpp"
+
+// A tree walking interpreter for comptime. It runs pure Atlas code
+// (integers, fixed size arrays and types, no pointers, strings or calls
+// into C) inside the compiler, and the results are written back into the
+// AST so they end up as initialized data in out.c
+
+#define COMPTIME_FUEL      100000000 // statements run per evaluation
+#define COMPTIME_MAX_DEPTH 1000      // nested calls
+
+enum ComptimeKind {
+    COMPTIME_INT,
+    COMPTIME_ARRAY,
+    COMPTIME_STRUCT,
+};
+
+struct ComptimeValue {
+    ComptimeKind kind = COMPTIME_INT;
+    uint64_t value = 0;
+    VarType type = TYPE_I64;
+    // arrays are shared when passed around, like a decayed array in C
+    std::shared_ptr<std::vector<ComptimeValue>> elements;
+    TypeNode* layout = NULL;
+    std::vector<ComptimeValue> fields; // in declaration order
+};
+
+struct ComptimeVar {
+    std::string name;
+    ComptimeValue value;
+};
+
+// One per call, with a scope per block
+struct ComptimeFrame {
+    std::vector<std::vector<ComptimeVar>> scopes;
+};
+
+thread_local std::vector<ComptimeFrame*> comptime_frames;
+thread_local std::vector<VarDeclNode*> comptime_global_decls; // const globals
+thread_local std::vector<ComptimeVar> comptime_globals;       // the ones evaluated so far
+thread_local std::vector<TypeNode*> comptime_types;
+thread_local uint64_t comptime_fuel = 0;
+thread_local int comptime_count = 0;
+
+// set by a return statement until the call it returns from is done
+thread_local bool comptime_returning = false;
+thread_local ComptimeValue comptime_return_value;
+
+ComptimeValue comptime_expr(ExpressionNode* expr);
+ComptimeValue comptime_init(ExpressionNode* expr, VarNode* var);
+bool comptime_block(BlockNode* block);
+
+[[noreturn]] void comptime_error(std::string message) {
+    print_error_msg("comptime: " + message);
+    error_abort();
+}
+
+void comptime_add_global(VarDeclNode* var_decl) {
+    comptime_global_decls.push_back(var_decl);
+}
+
+void comptime_add_type(TypeNode* type) {
+    comptime_types.push_back(type);
+}
+
+int comptime_eval_count() {
+    return comptime_count;
+}
+
+ComptimeValue comptime_int(uint64_t value, VarType type) {
+    ComptimeValue ret;
+    ret.value = fold_cast(value, type);
+    ret.type = type;
+    return ret;
+}
+
+uint64_t comptime_as_int(ComptimeValue value) {
+    if (value.kind != COMPTIME_INT) {
+        comptime_error("expected an integer");
+    }
+    return value.value;
+}
+
+// Structs are values, so the arrays in their fields are copied too
+ComptimeValue comptime_copy(ComptimeValue value) {
+    if (value.kind == COMPTIME_STRUCT) {
+        for (int i = 0; i < value.fields.size(); i++) {
+            value.fields[i] = comptime_copy(value.fields[i]);
+        }
+    } else if (value.kind == COMPTIME_ARRAY && value.layout != NULL) {
+        // an array that lives inside a struct
+        std::vector<ComptimeValue> elements;
+        for (ComptimeValue element : *value.elements) {
+            elements.push_back(comptime_copy(element));
+        }
+        value.elements = std::make_shared<std::vector<ComptimeValue>>(elements);
+    }
+    return value;
+}
+
+TypeNode* comptime_get_type(std::string name) {
+    for (TypeNode* type : comptime_types) {
+        if (type->name->token == name) {
+            return type;
+        }
+    }
+    return NULL;
+}
+
+// The element type of an array
+VarNode* comptime_elem_var(VarNode* var) {
+    VarNode* elem = new VarNode;
+    *elem = *var;
+    elem->is_array = false;
+    elem->arr_size = NULL;
+    elem->ptr_level = var->ptr_level - 1;
+    return elem;
+}
+
+ComptimeValue comptime_zero(VarNode* var, TypeNode* owner) {
+    if (var->is_slice || var->is_dynamic || var->ptr_level - var->is_array > 0) {
+        comptime_error("pointers, slices and dynamic arrays are not supported");
+    }
+    ComptimeValue ret;
+    if (var->is_array) {
+        uint64_t size = comptime_as_int(comptime_expr(var->arr_size));
+        ComptimeValue elem = comptime_zero(comptime_elem_var(var), NULL);
+        ret.kind = COMPTIME_ARRAY;
+        ret.layout = owner;
+        ret.elements = std::make_shared<std::vector<ComptimeValue>>(size, elem);
+        for (int i = 0; i < size; i++) {
+            (*ret.elements)[i] = comptime_copy(elem);
+        }
+        return ret;
+    }
+    if (fold_is_integer(var->type)) {
+        return comptime_int(0, var->type);
+    }
+    TypeNode* type = comptime_get_type(var->type_->token);
+    if (type == NULL) {
+        comptime_error("type " + var->type_->token + " is not supported");
+    }
+    ret.kind = COMPTIME_STRUCT;
+    ret.layout = type;
+    for (VarDeclNode* field : type->declarations) {
+        ret.fields.push_back(comptime_zero(field->lhs, type));
+    }
+    return ret;
+}
+
+// Gives value the declared type of var
+ComptimeValue comptime_convert(ComptimeValue value, VarNode* var) {
+    if (var == NULL) {
+        return value;
+    }
+    if (value.kind == COMPTIME_INT && !var->is_array && fold_is_integer(var->type)) {
+        return comptime_int(value.value, var->type);
+    }
+    if (value.kind == COMPTIME_STRUCT) {
+        return comptime_copy(value);
+    }
+    return value;
+}
+
+uint64_t comptime_char(CharacterNode* character) {
+    std::string value = character->value;
+    if (value.size() == 0) {
+        return 0;
+    }
+    if (value[0] != '\\' || value.size() == 1) {
+        return (uint8_t)value[0];
+    }
+    switch (value[1]) {
+    case 'n':
+        return '\n';
+    case 't':
+        return '\t';
+    case 'r':
+        return '\r';
+    case '0':
+        return 0;
+    default:
+        return (uint8_t)value[1];
+    }
+}
+
+ComptimeVar* comptime_lookup(std::string name) {
+    if (comptime_frames.size() != 0) {
+        ComptimeFrame* frame = comptime_frames.back();
+        for (int i = frame->scopes.size() - 1; i >= 0; i--) {
+            for (ComptimeVar& var : frame->scopes[i]) {
+                if (var.name == name) {
+                    return &var;
+                }
+            }
+        }
+    }
+    for (ComptimeVar& var : comptime_globals) {
+        if (var.name == name) {
+            return &var;
+        }
+    }
+    for (VarDeclNode* var_decl : comptime_global_decls) {
+        if (var_decl->lhs->identifier->token != name || var_decl->rhs == NULL) {
+            continue;
+        }
+        // evaluated once, without the locals of whoever asked for it
+        comptime_frames.push_back(new ComptimeFrame);
+        ComptimeValue value = comptime_init(var_decl->rhs, var_decl->lhs);
+        delete comptime_frames.back();
+        comptime_frames.pop_back();
+        comptime_globals.push_back({name, value});
+        return &comptime_globals.back();
+    }
+    return NULL;
+}
+
+void comptime_declare(std::string name, ComptimeValue value) {
+    comptime_frames.back()->scopes.back().push_back({name, value});
+}
+
+// A variable, element or field. Indexes are evaluated before anything is
+// looked up, so the pointer can't be invalidated by a call
+ComptimeValue* comptime_lvalue(ExpressionNode* expr, bool is_write) {
+    if (expr->nt == NODE_VAR) {
+        std::string name = expr->var_node->identifier->token;
+        ComptimeVar* var = comptime_lookup(name);
+        if (var == NULL) {
+            comptime_error(name + " is not known at compile time");
+        }
+        for (ComptimeVar& global : comptime_globals) {
+            if (is_write && &global == var) {
+                comptime_error("can't assign to the global " + name);
+            }
+        }
+        return &var->value;
+    }
+    if (expr->nt == NODE_BINOP && expr->binop->op->tt == TK_SQUARE_OPEN) {
+        uint64_t index = comptime_as_int(comptime_expr(expr->binop->rhs));
+        ComptimeValue* array = comptime_lvalue(expr->binop->lhs, is_write);
+        if (array->kind != COMPTIME_ARRAY) {
+            comptime_error("only arrays can be indexed");
+        }
+        if (index >= array->elements->size()) {
+            comptime_error("index " + std::to_string((int64_t)index) + " is out of bounds");
+        }
+        return &(*array->elements)[index];
+    }
+    if (expr->nt == NODE_BINOP && expr->binop->op->tt == TK_DOT) {
+        ComptimeValue* value = comptime_lvalue(expr->binop->lhs, is_write);
+        std::string field = expr->binop->rhs->var_node->identifier->token;
+        if (value->kind != COMPTIME_STRUCT) {
+            comptime_error("." + field + " on something that isn't a type");
+        }
+        for (int i = 0; i < value->layout->declarations.size(); i++) {
+            if (value->layout->declarations[i]->lhs->identifier->token == field) {
+                return &value->fields[i];
+            }
+        }
+        comptime_error(value->layout->name->token + " has no field " + field);
+    }
+    comptime_error("expression can't be assigned to");
+    return NULL;
+}
+
+FunctionNode* comptime_get_function(std::string name) {
+    for (FunctionNode* func : function_table) {
+        if (func->token->token == name) {
+            return func;
+        }
+    }
+    return NULL;
+}
+
+ComptimeValue comptime_call(CallNode* call) {
+    std::string name = call->name->token;
+    if (name == "len" && call->args.size() == 1) {
+        ComptimeValue array = comptime_expr(call->args[0]);
+        if (array.kind != COMPTIME_ARRAY) {
+            comptime_error("len() of something that isn't an array");
+        }
+        return comptime_int(array.elements->size(), TYPE_U64);
+    }
+    FunctionNode* func = comptime_get_function(name);
+    if (func == NULL || func->block == NULL) {
+        comptime_error(name + "() can't be called at compile time");
+    }
+    if (func->return_vars.size() > 1) {
+        comptime_error(name + "() returns more than one value");
+    }
+    if (call->args.size() != func->params.size()) {
+        comptime_error(name + "() takes " + std::to_string(func->params.size()) + " arguments");
+    }
+    if (comptime_frames.size() >= COMPTIME_MAX_DEPTH) {
+        comptime_error("calls nested deeper than " + std::to_string(COMPTIME_MAX_DEPTH));
+    }
+    ComptimeFrame* frame = new ComptimeFrame;
+    frame->scopes.push_back({});
+    for (int i = 0; i < call->args.size(); i++) {
+        ComptimeValue arg = comptime_init(call->args[i], func->params[i]);
+        frame->scopes.back().push_back({func->params[i]->identifier->token, arg});
+    }
+    comptime_frames.push_back(frame);
+    comptime_block(func->block);
+    comptime_frames.pop_back();
+    delete frame;
+    ComptimeValue ret;
+    if (comptime_returning) {
+        ret = comptime_convert(comptime_return_value, func->return_var);
+        comptime_returning = false;
+    } else if (func->return_var != NULL) {
+        comptime_error(name + "() ended without returning a value");
+    }
+    return ret;
+}
+
+ComptimeValue comptime_binop(ExpressionNode* expr) {
+    BinaryOpNode* binop = expr->binop;
+    switch (binop->op->tt) {
+    case TK_ASSIGN:
+    {
+        ComptimeValue value = comptime_expr(binop->rhs);
+        ComptimeValue* lhs = comptime_lvalue(binop->lhs, true);
+        if (lhs->kind == COMPTIME_INT) {
+            *lhs = comptime_int(comptime_as_int(value), lhs->type);
+        } else if (lhs->kind == COMPTIME_STRUCT && value.kind == COMPTIME_STRUCT) {
+            *lhs = comptime_copy(value);
+        } else {
+            comptime_error("arrays can't be assigned to");
+        }
+        return *lhs;
+    }
+    case TK_SQUARE_OPEN:
+    case TK_DOT:
+        return *comptime_lvalue(expr, false);
+    case TK_LOGICAL_AND:
+    case TK_LOGICAL_OR:
+    {
+        // short-circuits like C
+        bool lhs = comptime_as_int(comptime_expr(binop->lhs)) != 0;
+        if (lhs == (binop->op->tt == TK_LOGICAL_OR)) {
+            return comptime_int(lhs, TYPE_I32);
+        }
+        return comptime_int(comptime_as_int(comptime_expr(binop->rhs)) != 0, TYPE_I32);
+    }
+    default:
+    {
+        ComptimeValue lhs = comptime_expr(binop->lhs);
+        ComptimeValue rhs = comptime_expr(binop->rhs);
+        ConstantNode a;
+        ConstantNode b;
+        a.value = comptime_as_int(lhs);
+        a.type = lhs.type;
+        b.value = comptime_as_int(rhs);
+        b.type = rhs.type;
+        uint64_t result;
+        VarType type;
+        if (!fold_eval_binop(binop->op->tt, &a, &b, &result, &type)) {
+            comptime_error("can't evaluate " + binop->op->token + " (division by zero?)");
+        }
+        return comptime_int(result, type);
+    }
+    }
+}
+
+ComptimeValue comptime_expr(ExpressionNode* expr) {
+    switch (expr->nt) {
+    case NODE_CONSTANT:
+        return comptime_int(expr->constant->value, fold_literal_type(expr->constant->value, expr->constant->type));
+    case NODE_CHAR:
+        return comptime_int(comptime_char(expr->character), TYPE_U8);
+    case NODE_VAR:
+    {
+        std::string name = expr->var_node->identifier->token;
+        ComptimeVar* var = comptime_lookup(name);
+        if (var == NULL) {
+            comptime_error(name + " is not known at compile time");
+        }
+        return var->value;
+    }
+    case NODE_BINOP:
+        return comptime_binop(expr);
+    case NODE_UNARY:
+    {
+        UnaryOpNode* unary_op = expr->unary_op;
+        if (unary_op->operator_type != NODE_UNARY ||
+            (unary_op->op->tt != TK_DASH && unary_op->op->tt != TK_NOT)) {
+            comptime_error("pointers are not supported");
+        }
+        ComptimeValue operand = comptime_expr(unary_op->operand);
+        if (unary_op->op->tt == TK_NOT) {
+            return comptime_int(comptime_as_int(operand) == 0, TYPE_I32);
+        }
+        return comptime_int(-comptime_as_int(operand), fold_promote(operand.type));
+    }
+    case NODE_COMPTIME:
+        return comptime_expr(expr->unary_op->operand);
+    case NODE_CALL:
+        return comptime_call(expr->call_node);
+    case NODE_SUBSCRIPT:
+    case NODE_ARRAY_EXPR:
+        return comptime_init(expr, NULL);
+    case NODE_TYPE_INST:
+        comptime_error(".{...} needs a declared type");
+    case NODE_QUOTE:
+        comptime_error("strings are not supported");
+    default:
+        comptime_error("expression can't be evaluated");
+    }
+    return ComptimeValue();
+}
+
+// Evaluates the initial value of var, which gives array and type
+// literals their types
+ComptimeValue comptime_init(ExpressionNode* expr, VarNode* var) {
+    std::vector<ExpressionNode*> elements;
+    if (expr->nt == NODE_SUBSCRIPT) {
+        elements = expr->subscript->indexes;
+    } else if (expr->nt == NODE_ARRAY_EXPR) {
+        elements = expr->array->elements;
+    } else if (expr->nt == NODE_TYPE_INST && var != NULL) {
+        elements = expr->type_inst->values;
+    } else {
+        return comptime_convert(comptime_expr(expr), var);
+    }
+    if (var == NULL) {
+        // [a, b, c] on its own
+        ComptimeValue ret;
+        ret.kind = COMPTIME_ARRAY;
+        ret.elements = std::make_shared<std::vector<ComptimeValue>>();
+        for (ExpressionNode* element : elements) {
+            ret.elements->push_back(comptime_expr(element));
+        }
+        return ret;
+    }
+    ComptimeValue ret = comptime_zero(var, NULL);
+    if (ret.kind == COMPTIME_ARRAY) {
+        if (elements.size() > ret.elements->size()) {
+            comptime_error("too many elements for " + var->identifier->token);
+        }
+        VarNode* elem = comptime_elem_var(var);
+        for (int i = 0; i < elements.size(); i++) {
+            (*ret.elements)[i] = comptime_init(elements[i], elem);
+        }
+    } else if (ret.kind == COMPTIME_STRUCT) {
+        if (elements.size() > ret.fields.size()) {
+            comptime_error("too many values for " + ret.layout->name->token);
+        }
+        for (int i = 0; i < elements.size(); i++) {
+            VarNode* field = ret.layout->declarations[i]->lhs;
+            ComptimeValue value = comptime_init(elements[i], field);
+            if (value.kind == COMPTIME_ARRAY) {
+                value.layout = ret.layout;
+            }
+            ret.fields[i] = value;
+        }
+    } else {
+        comptime_error("a literal can't initialize " + var->identifier->token);
+    }
+    return ret;
+}
+
+void comptime_use_fuel() {
+    if (comptime_fuel == 0) {
+        comptime_error("ran out of fuel after " + std::to_string(COMPTIME_FUEL) + " steps");
+    }
+    comptime_fuel--;
+}
+
+bool comptime_statements(std::vector<StatementNode*> statements);
+
+bool comptime_if(IfNode* if_node) {
+    if (comptime_as_int(comptime_expr(if_node->condition)) != 0) {
+        return comptime_block(if_node->block);
+    }
+    if (if_node->_else == NULL) {
+        return false;
+    }
+    if (if_node->_else->block != NULL) {
+        return comptime_block(if_node->_else->block);
+    }
+    return comptime_if(if_node->_else->else_if->if_lhs);
+}
+
+// Elements are copied into the loop variable, for &x would need pointers
+bool comptime_for_each(ForNode* for_node) {
+    std::string name = for_node->each_var->token;
+    if (for_node->each_by_ref) {
+        comptime_error("for &" + name + " needs pointers");
+    }
+    std::vector<ComptimeValue> values;
+    ComptimeValue start = comptime_expr(for_node->iterable);
+    if (for_node->range_end != NULL) {
+        ComptimeValue end = comptime_expr(for_node->range_end);
+        VarType type = end.type;
+        bool is_unsigned = fold_is_unsigned(type);
+        for (uint64_t i = comptime_as_int(start);
+             is_unsigned ? i < end.value : (int64_t)i < (int64_t)end.value; i++) {
+            comptime_use_fuel();
+            values.push_back(comptime_int(i, type));
+        }
+    } else if (start.kind == COMPTIME_ARRAY) {
+        values = *start.elements;
+    } else {
+        comptime_error("for " + name + " in expects an array or a range");
+    }
+    for (ComptimeValue value : values) {
+        comptime_use_fuel();
+        comptime_frames.back()->scopes.push_back({});
+        comptime_declare(name, comptime_copy(value));
+        bool returned = comptime_block(for_node->block);
+        comptime_frames.back()->scopes.pop_back();
+        if (returned) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool comptime_for(ForNode* for_node) {
+    if (for_node->for_type == FOR_EACH) {
+        return comptime_for_each(for_node);
+    }
+    comptime_frames.back()->scopes.push_back({});
+    if (for_node->for_type == FOR_LOOP) {
+        comptime_statements({for_node->init});
+    }
+    bool returned = false;
+    for (;;) {
+        comptime_use_fuel();
+        if (for_node->test != NULL && comptime_as_int(comptime_expr(for_node->test)) == 0) {
+            break;
+        }
+        if (comptime_block(for_node->block)) {
+            returned = true;
+            break;
+        }
+        if (for_node->for_type == FOR_LOOP) {
+            comptime_statements({for_node->update});
+        }
+    }
+    comptime_frames.back()->scopes.pop_back();
+    return returned;
+}
+
+// Returns true once a return statement has run
+bool comptime_statements(std::vector<StatementNode*> statements) {
+    for (StatementNode* statement : statements) {
+        comptime_use_fuel();
+        switch (statement->nt) {
+        case NODE_VAR_DECL:
+        {
+            VarDeclNode* var_decl = statement->vardecl_lhs;
+            if (var_decl->destructure.size() != 0) {
+                comptime_error("multi-value returns are not supported");
+            }
+            ComptimeValue value = var_decl->rhs == NULL ? comptime_zero(var_decl->lhs, NULL)
+                                                        : comptime_init(var_decl->rhs, var_decl->lhs);
+            comptime_declare(var_decl->lhs->identifier->token, value);
+            break;
+        }
+        case NODE_RETURN:
+        {
+            ReturnNode* return_node = statement->return_lhs;
+            if (return_node->exprs.size() > 1) {
+                comptime_error("multi-value returns are not supported");
+            }
+            comptime_return_value = return_node->exprs.size() == 0 ? ComptimeValue()
+                                                                   : comptime_expr(return_node->exprs[0]);
+            comptime_returning = true;
+            return true;
+        }
+        case NODE_IF:
+            if (comptime_if(statement->if_lhs)) {
+                return true;
+            }
+            break;
+        case NODE_FOR:
+            if (comptime_for(statement->for_lhs)) {
+                return true;
+            }
+            break;
+        case NODE_BINOP:
+        case NODE_CALL:
+        case NODE_UNARY:
+        case NODE_VAR:
+        case NODE_CONSTANT:
+        case NODE_COMPTIME:
+            comptime_expr(statement->expr_lhs);
+            break;
+        default:
+            comptime_error("statement can't be run at compile time");
+        }
+    }
+    return false;
+}
+
+bool comptime_block(BlockNode* block) {
+    comptime_frames.back()->scopes.push_back({});
+    bool returned = comptime_statements(block->statements);
+    comptime_frames.back()->scopes.pop_back();
+    return returned;
+}
+
+// Writes value into expr
+void comptime_to_expr(ComptimeValue value, ExpressionNode* expr) {
+    expr->needs_paren = false;
+    if (value.kind == COMPTIME_INT) {
+        ConstantNode* constant = new ConstantNode;
+        constant->nt = NODE_CONSTANT;
+        constant->value = value.value;
+        constant->type = value.type;
+        expr->nt = NODE_CONSTANT;
+        expr->constant = constant;
+        expr->needs_paren = !fold_is_unsigned(value.type) && (int64_t)value.value < 0;
+    } else if (value.kind == COMPTIME_ARRAY) {
+        ArrayNode* array = new ArrayNode;
+        array->nt = NODE_ARRAY_EXPR;
+        for (ComptimeValue element : *value.elements) {
+            ExpressionNode* element_expr = new ExpressionNode;
+            comptime_to_expr(element, element_expr);
+            array->elements.push_back(element_expr);
+        }
+        expr->nt = NODE_ARRAY_EXPR;
+        expr->array = array;
+    } else {
+        TypeInstNode* type_inst = new TypeInstNode;
+        type_inst->nt = NODE_TYPE_INST;
+        for (ComptimeValue field : value.fields) {
+            ExpressionNode* field_expr = new ExpressionNode;
+            comptime_to_expr(field, field_expr);
+            type_inst->values.push_back(field_expr);
+        }
+        expr->nt = NODE_TYPE_INST;
+        expr->type_inst = type_inst;
+    }
+}
+
+void comptime_eval(ExpressionNode* expr) {
+    comptime_fuel = COMPTIME_FUEL;
+    comptime_returning = false;
+    comptime_frames.push_back(new ComptimeFrame);
+    comptime_frames.back()->scopes.push_back({});
+    ExpressionNode* operand = expr->nt == NODE_COMPTIME ? expr->unary_op->operand : expr;
+    ComptimeValue value = comptime_expr(operand);
+    delete comptime_frames.back();
+    comptime_frames.pop_back();
+    comptime_to_expr(value, expr);
+    comptime_count++;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "ast.hpp"
+
+// Compile time evaluation, run by the fold pass. comptime_eval replaces
+// expr (a comptime expression or a call to a comptime function) with its
+// value: a constant, an array literal or a type instantiation
+void comptime_eval(ExpressionNode* expr);
+void comptime_add_global(VarDeclNode* var_decl);
+void comptime_add_type(TypeNode* type);
+int comptime_eval_count();
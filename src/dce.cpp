@@ -0,0 +1,324 @@
+#include <vector>
+#include <string>
+
+#include "global.hpp"
+#include "error.hpp"
+#include "dce.hpp"
+#include "memo.hpp"
+
+// Walks the call graph from main over function_table. Every name a
+// reachable function mentions (types of variables, sizeof arguments) is
+// recorded, and the types named that way are kept along with the types
+// of their fields
+
+thread_local RuntimeUse dce_runtime;
+
+thread_local std::vector<FunctionNode*> dce_worklist;
+thread_local std::vector<std::string> dce_names; // types and variables mentioned by reachable code
+// The arrays the for x in loops being walked go over. The loop keeps
+// pointers into one, so growing it in the body is rejected here
+thread_local std::vector<ExpressionNode*> dce_iterating;
+
+void dce_statements(std::vector<StatementNode*> statements);
+
+bool dce_has_name(std::string name) {
+    for (std::string used : dce_names) {
+        if (used == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void dce_add_name(std::string name) {
+    if (!dce_has_name(name)) {
+        dce_names.push_back(name);
+    }
+}
+
+// The prototype and the definition of a function share its name
+void dce_mark_function(std::string name) {
+    for (FunctionNode* func : function_table) {
+        if (func->token->token == name && !func->is_reachable) {
+            func->is_reachable = true;
+            dce_worklist.push_back(func);
+        }
+    }
+}
+
+void dce_intrinsic(std::string name) {
+    if (name == "putchar") {
+        dce_runtime.putchar = true;
+    } else if (name == "exit") {
+        dce_runtime.exit = true;
+    } else if (name == "read" || name == "write" || name == "lseek" || name == "fstat") {
+        dce_runtime.io = true;
+    } else if (name == "memcpy" || name == "memmove" || name == "memset" ||
+               name == "memcmp" || name == "memchr") {
+        dce_runtime.memory = true;
+    } else if (name == "append" || name == "reserve") {
+        dce_runtime.dynamic = true;
+    } else if (name == "time_ns") {
+        dce_runtime.time = true;
+    } else if (name.compare(0, 4, "map_") == 0) {
+        dce_runtime.map = true;
+    }
+}
+
+// Whether a and b name the same variable or field, as in x or r.items
+bool dce_same_place(ExpressionNode* a, ExpressionNode* b) {
+    if (a->nt == NODE_VAR && b->nt == NODE_VAR) {
+        return a->var_node->identifier->token == b->var_node->identifier->token;
+    } else if (a->nt == NODE_BINOP && b->nt == NODE_BINOP && a->binop->op->tt == TK_DOT &&
+               b->binop->op->tt == TK_DOT) {
+        return dce_same_place(a->binop->lhs, b->binop->lhs) && dce_same_place(a->binop->rhs, b->binop->rhs);
+    }
+    return false;
+}
+
+void dce_check_growth(CallNode* call) {
+    std::string name = call->name->token;
+    if ((name != "append" && name != "reserve") || call->args.size() == 0) {
+        return;
+    }
+    for (ExpressionNode* iterable : dce_iterating) {
+        if (dce_same_place(call->args[0], iterable)) {
+            print_error_msg(name + " can't grow an array a for loop is going over, its buffer can move (line "
+                            + std::to_string(call->name->line) + ")");
+            error_abort();
+        }
+    }
+}
+
+void dce_var(VarNode* var) {
+    if (var == NULL) {
+        return;
+    }
+    if (var->type_ != NULL) {
+        dce_add_name(var->type_->token);
+    }
+    if (var->is_dynamic) {
+        dce_runtime.dynamic = true;
+    }
+}
+
+void dce_expr(ExpressionNode* expr) {
+    if (expr == NULL) {
+        return;
+    }
+    switch (expr->nt) {
+    case NODE_VAR:
+        dce_add_name(expr->var_node->identifier->token);
+        break;
+    case NODE_QUOTE:
+        // codegen_quote builds strings with atlas_create_string
+        dce_add_name("string");
+        dce_mark_function("atlas_create_string");
+        break;
+    case NODE_BINOP:
+        dce_expr(expr->binop->lhs);
+        if (expr->binop->op->tt != TK_DOT) {
+            dce_expr(expr->binop->rhs);
+        }
+        break;
+    case NODE_UNARY:
+        dce_expr(expr->unary_op->operand);
+        break;
+    case NODE_CALL:
+        dce_check_growth(expr->call_node);
+        dce_intrinsic(expr->call_node->name->token);
+        dce_mark_function(expr->call_node->name->token);
+        for (ExpressionNode* arg : expr->call_node->args) {
+            dce_expr(arg);
+        }
+        break;
+    case NODE_ARRAY_EXPR:
+        for (ExpressionNode* element : expr->array->elements) {
+            dce_expr(element);
+        }
+        break;
+    case NODE_SUBSCRIPT:
+        for (ExpressionNode* index : expr->subscript->indexes) {
+            dce_expr(index);
+        }
+        break;
+    case NODE_TYPE_INST:
+        for (ExpressionNode* value : expr->type_inst->values) {
+            dce_expr(value);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void dce_if(IfNode* if_node) {
+    dce_expr(if_node->condition);
+    dce_statements(if_node->block->statements);
+    if (if_node->_else != NULL && if_node->_else->block != NULL) {
+        dce_statements(if_node->_else->block->statements);
+    } else if (if_node->_else != NULL && if_node->_else->else_if != NULL) {
+        dce_if(if_node->_else->else_if->if_lhs);
+    }
+}
+
+void dce_statements(std::vector<StatementNode*> statements) {
+    for (StatementNode* statement : statements) {
+        switch (statement->nt) {
+        case NODE_VAR_DECL:
+        {
+            VarDeclNode* var_decl = statement->vardecl_lhs;
+            dce_var(var_decl->lhs);
+            for (VarNode* var : var_decl->destructure) {
+                dce_var(var);
+            }
+            if (var_decl->lhs->is_array) {
+                dce_expr(var_decl->lhs->arr_size);
+            }
+            dce_expr(var_decl->rhs);
+            break;
+        }
+        case NODE_RETURN:
+            for (ExpressionNode* expr : statement->return_lhs->exprs) {
+                dce_expr(expr);
+            }
+            break;
+        case NODE_IF:
+            dce_if(statement->if_lhs);
+            break;
+        case NODE_FOR:
+        {
+            ForNode* for_node = statement->for_lhs;
+            if (for_node->for_type == FOR_LOOP) {
+                dce_statements({for_node->init});
+                dce_statements({for_node->update});
+            } else if (for_node->for_type == FOR_EACH) {
+                dce_expr(for_node->iterable);
+                dce_expr(for_node->range_end);
+                dce_runtime.parallel = dce_runtime.parallel || for_node->is_parallel;
+            }
+            dce_expr(for_node->test);
+            bool is_iterating = for_node->for_type == FOR_EACH && for_node->range_end == NULL;
+            if (is_iterating) {
+                dce_iterating.push_back(for_node->iterable);
+            }
+            dce_statements(for_node->block->statements);
+            if (is_iterating) {
+                dce_iterating.pop_back();
+            }
+            break;
+        }
+        case NODE_DEFER:
+            dce_statements({statement->defer_lhs});
+            break;
+        case NODE_MATCH:
+            dce_expr(statement->match_lhs->value);
+            for (MatchArm* arm : statement->match_lhs->arms) {
+                dce_statements(arm->block->statements);
+            }
+            if (statement->match_lhs->else_block != NULL) {
+                dce_statements(statement->match_lhs->else_block->statements);
+            }
+            break;
+        case NODE_FUNC:
+        case NODE_TYPE:
+        case NODE_GENERIC:
+        case NODE_CINCLUDE:
+            break;
+        default:
+            dce_expr(statement->expr_lhs);
+            break;
+        }
+    }
+}
+
+void dce_function(FunctionNode* func) {
+    if (func->is_memo && !memo_is_dense(func)) {
+        dce_runtime.map = true; // for its cache
+    }
+    for (VarNode* return_var : func->return_vars) {
+        dce_var(return_var);
+    }
+    for (ParamNode* param : func->params) {
+        dce_var(param);
+    }
+    if (func->block != NULL) {
+        dce_statements(func->block->statements);
+    }
+}
+
+void dce_start(std::vector<StatementNode*> ast) {
+    bool has_main = false;
+    for (FunctionNode* func : function_table) {
+        has_main = has_main || func->mangled_name == "main";
+    }
+    if (!has_main) {
+        return; // nothing to start from, keep everything
+    }
+    dce_runtime = RuntimeUse();
+    dce_runtime.putchar = false;
+    dce_runtime.exit = global_state->freestanding; // _start exits through it
+    dce_runtime.io = false;
+    dce_runtime.memory = false;
+    dce_runtime.dynamic = false;
+    dce_runtime.map = false;
+    dce_runtime.time = false;
+    dce_runtime.parallel = false;
+    for (FunctionNode* func : function_table) {
+        func->is_reachable = false;
+    }
+    for (FunctionNode* func : function_table) {
+        if ((func->mangled_name == "main" || func->is_export) && !func->is_reachable) {
+            func->is_reachable = true;
+            dce_worklist.push_back(func);
+        }
+    }
+    // globals are always emitted
+    for (StatementNode* statement : ast) {
+        if (statement->nt == NODE_VAR_DECL) {
+            dce_statements({statement});
+        }
+    }
+    while (dce_worklist.size() != 0) {
+        FunctionNode* func = dce_worklist.back();
+        dce_worklist.pop_back();
+        dce_function(func);
+    }
+
+    // types used by the fields of used types, until nothing changes
+    std::vector<TypeNode*> types;
+    for (StatementNode* statement : ast) {
+        if (statement->nt == NODE_TYPE) {
+            statement->type_lhs->is_reachable = false;
+            types.push_back(statement->type_lhs);
+        }
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (TypeNode* type : types) {
+            if (type->is_reachable || !dce_has_name(type->name->token)) {
+                continue;
+            }
+            type->is_reachable = true;
+            changed = true;
+            for (VarDeclNode* field : type->declarations) {
+                dce_var(field->lhs);
+            }
+        }
+    }
+    if (dce_has_name("Map")) {
+        dce_runtime.map = true;
+    }
+
+    int kept = 0;
+    for (FunctionNode* func : function_table) {
+        kept += func->is_reachable && func->block != NULL && !func->is_comptime;
+    }
+    int kept_types = 0;
+    for (TypeNode* type : types) {
+        kept_types += type->is_reachable;
+    }
+    log_print("Kept " + std::to_string(kept) + " functions and " + std::to_string(kept_types)
+              + " of " + std::to_string(types.size()) + " types\n");
+}
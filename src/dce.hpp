@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+
+#include "ast.hpp"
+
+// Which pieces of the runtime prelude the reachable code uses. Everything
+// is on until dce_start has run
+struct RuntimeUse {
+    bool putchar = true;
+    bool exit    = true;
+    bool io      = true;
+    bool memory  = true;
+    bool dynamic = true;
+    bool map     = true;
+    bool time    = true;
+    bool parallel = true;
+};
+
+extern thread_local RuntimeUse dce_runtime;
+
+// Whole program dead code elimination, run after folding. Marks the
+// functions reachable from main (and exported ones) and the types they
+// use, codegen skips everything else
+void dce_start(std::vector<StatementNode*> ast);
@@ -1,13 +1,24 @@
 #include "error.hpp"
 #include "global.hpp"
 
+std::ostream& error_out() {
+    if (global_state == NULL) {
+        return std::cout; // still reading the options
+    }
+    return *global_state->out;
+}
+
+void error_abort() {
+    throw AtlasError();
+}
+
 void print_error_msg(std::string error) {
-    std::cout << CL_RED << "[COMPILER ERROR]: " << CL_RESET << error << "\n";
+    error_out() << CL_RED << "[COMPILER ERROR]: " << CL_RESET << error << "\n";
 }
 
 void log_print(std::string message) {
     if(global_state->debug) {
-        std::cout << "[INFO]: " + message;
+        error_out() << "[INFO]: " + message;
     }
 }
 
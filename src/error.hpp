@@ -6,6 +6,13 @@
 void print_error_msg(std::string error);
 void log_print(std::string message);
 
+// Thrown by error_abort once an error has been printed. atlas_compile
+// catches it and hands the messages back, the command line exits with 1
+struct AtlasError {};
+
+[[noreturn]] void error_abort();
+std::ostream& error_out(); // where messages go, std::cout unless atlas_compile collects them
+
 // Colors
 //const char* CL_BLACK   = "\e[0;30m";
 //const char* CL_RED     = "\e[0;31m";
@@ -0,0 +1,947 @@
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+
+#include "global.hpp"
+#include "error.hpp"
+#include "ir.hpp"
+#include "escape.hpp"
+
+// An allocation is followed through the values computed from it and the
+// slots it is stored in. It escapes when it may be reached once the frame
+// is gone: stored anywhere but a slot, returned, cast to an integer, freed
+// through something that may be another pointer, or passed to a function
+// whose parameter escapes. Parameters get the same analysis up front so
+// calls to puts, equal and the like don't count.
+//
+// A slot is only ever one buffer, so an allocation in a loop also has to
+// be finished with before the loop comes around again: everything that
+// touches it is after it in its block, and the slots it is stored in are
+// written before they are read
+
+IrType ir_int(VarType int_type);
+IrType ir_bool();
+IrType ir_void();
+IrType ir_pointer_to(IrType type);
+IrInstr ir_instr(IrOp op, IrType type);
+const char* ir_op_name(IrOp op);
+
+const int64_t ESCAPE_FIXED_MAX = 1024; // the biggest constant size given a slot
+const int64_t ESCAPE_CAP = 256;        // the slot for sizes only known at runtime
+const int ESCAPE_INLINE_MAX = 96;      // instructions, for a function inlined to get at its alloc
+const int ESCAPE_ROUNDS = 4;           // of inlining, for what the inlined bodies call
+
+thread_local EscapeStats escape_stats;
+
+struct EscapeUse {
+    int block; // position in func->blocks
+    int index;
+    int arg;   // in args, -1 for dest
+};
+
+// A read or write of a slot the pointer is in
+struct EscapeAccess {
+    int block;
+    int index;
+    int slot;
+    int64_t offset; // -1 when it isn't known
+    int64_t size;
+    bool is_write;
+};
+
+struct EscapeFunction {
+    IrFunction* func;
+    std::vector<IrInstr*> defs;
+    std::vector<std::vector<EscapeUse>> uses;
+    std::vector<std::vector<int>> slot_values; // the IR_SLOT values of every slot
+    std::vector<bool> in_loop;                 // by block position
+};
+
+// Everything one allocation reaches
+struct EscapeReach {
+    std::vector<bool> is_derived;  // a pointer computed from it
+    std::vector<bool> is_address;  // the address of a slot holding it
+    std::vector<bool> is_holder;   // a slot holding it
+    std::vector<int> derived;      // worklists of the three
+    std::vector<int> addresses;
+    std::vector<int> holders;
+    std::vector<EscapeUse> derived_uses;
+    std::vector<EscapeAccess> accesses;
+    std::vector<int> frees;        // values passed to free
+    bool returned = false;
+    std::string reason;            // why it escapes
+};
+
+// By index into ir_functions
+thread_local std::vector<std::vector<bool>> escape_param_safe; // nothing reached from the parameter escapes
+thread_local std::vector<bool> escape_is_constructor;          // returns memory it allocated and nothing else keeps
+
+/* Facts */
+
+EscapeFunction escape_facts(IrFunction* func) {
+    EscapeFunction facts;
+    facts.func = func;
+    facts.defs.assign(func->values.size(), NULL);
+    facts.uses.assign(func->values.size(), {});
+    facts.slot_values.assign(func->slots.size(), {});
+    std::vector<int> positions;
+    for (int b = 0; b < func->blocks.size(); b++) {
+        IrBlock* block = func->blocks[b];
+        while (positions.size() <= block->id) {
+            positions.push_back(-1);
+        }
+        positions[block->id] = b;
+        for (int i = 0; i < block->instrs.size(); i++) {
+            IrInstr& instr = block->instrs[i];
+            if (instr.value >= 0) {
+                facts.defs[instr.value] = &instr;
+            }
+            if (instr.op == IR_SLOT) {
+                facts.slot_values[instr.imm].push_back(instr.value);
+            }
+            for (int a = 0; a < instr.args.size(); a++) {
+                facts.uses[instr.args[a]].push_back({b, i, a});
+            }
+            if (instr.dest >= 0) {
+                facts.uses[instr.dest].push_back({b, i, -1});
+            }
+        }
+    }
+    // in a loop when it can get back to itself
+    facts.in_loop.assign(func->blocks.size(), false);
+    for (int b = 0; b < func->blocks.size(); b++) {
+        std::vector<bool> seen(func->blocks.size(), false);
+        std::vector<int> worklist = {b};
+        while (worklist.size() != 0 && !facts.in_loop[b]) {
+            IrInstr& last = func->blocks[worklist.back()]->instrs.back();
+            worklist.pop_back();
+            for (int* target : ir_targets(last)) {
+                int next = positions[*target];
+                if (next == b) {
+                    facts.in_loop[b] = true;
+                } else if (!seen[next]) {
+                    seen[next] = true;
+                    worklist.push_back(next);
+                }
+            }
+        }
+    }
+    return facts;
+}
+
+IrInstr& escape_instr(EscapeFunction& facts, EscapeUse use) {
+    return facts.func->blocks[use.block]->instrs[use.index];
+}
+
+bool escape_constant(EscapeFunction& facts, int value, int64_t* imm) {
+    IrInstr* def = facts.defs[value];
+    if (def->op != IR_CONST && def->op != IR_SIZEOF) {
+        return false;
+    }
+    *imm = def->imm;
+    return true;
+}
+
+int escape_strip_casts(EscapeFunction& facts, int value) {
+    while (facts.defs[value]->op == IR_CAST && facts.defs[value]->type.ptr_level > 0) {
+        value = facts.defs[value]->args[0];
+    }
+    return value;
+}
+
+// The slot an address is in, and how far into it when that is constant
+int escape_slot_of(EscapeFunction& facts, int address, int64_t* offset) {
+    *offset = 0;
+    IrInstr* def = facts.defs[address];
+    while (true) {
+        int64_t index;
+        switch (def->op) {
+        case IR_SLOT:
+            return def->imm;
+        case IR_FIELD:
+            *offset = *offset >= 0 ? *offset + def->imm : -1;
+            break;
+        case IR_INDEX:
+            if (*offset >= 0 && escape_constant(facts, def->args[1], &index)) {
+                *offset += index * ir_size_of(def->mem_type);
+            } else {
+                *offset = -1;
+            }
+            break;
+        case IR_CAST:
+            if (def->type.ptr_level == 0) {
+                return -1;
+            }
+            break;
+        default:
+            return -1;
+        }
+        def = facts.defs[def->args[0]];
+    }
+}
+
+bool escape_param_is_safe(std::string callee, int param) {
+    int index = ir_find_function(callee);
+    return index >= 0 && param < escape_param_safe[index].size() && escape_param_safe[index][param];
+}
+
+/* Following a pointer */
+
+bool escape_fail(EscapeReach* reach, std::string reason) {
+    reach->reason = reason;
+    return false;
+}
+
+void escape_derive(EscapeReach* reach, int value) {
+    if (!reach->is_derived[value]) {
+        reach->is_derived[value] = true;
+        reach->derived.push_back(value);
+    }
+}
+
+void escape_hold(EscapeReach* reach, int slot) {
+    if (!reach->is_holder[slot]) {
+        reach->is_holder[slot] = true;
+        reach->holders.push_back(slot);
+    }
+}
+
+void escape_access(EscapeFunction& facts, EscapeReach* reach, EscapeUse use, int address,
+                   int64_t size, bool is_write) {
+    int64_t offset;
+    int slot = escape_slot_of(facts, address, &offset);
+    reach->accesses.push_back({use.block, use.index, slot, offset, size, is_write});
+}
+
+// A use of a pointer to the allocation or into it
+bool escape_derived_use(EscapeFunction& facts, EscapeUse use, bool allow_return, EscapeReach* reach) {
+    IrInstr& instr = escape_instr(facts, use);
+    reach->derived_uses.push_back(use);
+    int64_t offset;
+    switch (instr.op) {
+    case IR_LOAD:
+    case IR_ZERO:
+    case IR_COPY:
+    case IR_SUB:
+    case IR_EQ:
+    case IR_NE:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_BRANCH:
+        return true;
+    case IR_STORE:
+    {
+        if (use.arg == 0) {
+            return true;
+        }
+        int slot = escape_slot_of(facts, instr.args[0], &offset);
+        if (slot < 0) {
+            return escape_fail(reach, "is stored through a pointer");
+        }
+        escape_hold(reach, slot);
+        return true;
+    }
+    case IR_FIELD:
+    case IR_INDEX:
+        escape_derive(reach, instr.value);
+        return true;
+    case IR_CAST:
+        if (instr.type.ptr_level == 0) {
+            return escape_fail(reach, "is cast to an integer");
+        }
+        escape_derive(reach, instr.value);
+        return true;
+    case IR_INTRINSIC:
+        if (instr.name == "free") {
+            reach->frees.push_back(instr.args[0]);
+            return true;
+        } else if (instr.name == "memcpy" || instr.name == "memmove" || instr.name == "memset" ||
+                   instr.name == "memchr") {
+            if (use.arg == 0 && instr.value >= 0) {
+                escape_derive(reach, instr.value); // what they return points into their first argument
+            }
+            return true;
+        } else if (instr.name == "memcmp" || instr.name == "read" || instr.name == "write" ||
+                   instr.name == "open") {
+            return true;
+        }
+        return escape_fail(reach, "is passed to " + instr.name);
+    case IR_CALL:
+        if (use.arg < 0 || escape_param_is_safe(instr.name, use.arg)) {
+            return true;
+        }
+        return escape_fail(reach, "is passed to " + instr.name);
+    case IR_RET:
+        reach->returned = true;
+        return allow_return || escape_fail(reach, "is returned");
+    default:
+        return escape_fail(reach, "is used by " + std::string(ir_op_name(instr.op)));
+    }
+}
+
+// A use of the address of a slot the pointer is in
+bool escape_address_use(EscapeFunction& facts, EscapeUse use, bool allow_return, EscapeReach* reach) {
+    IrInstr& instr = escape_instr(facts, use);
+    int64_t offset;
+    switch (instr.op) {
+    case IR_LOAD:
+        escape_access(facts, reach, use, instr.args[0], ir_size_of(instr.mem_type), false);
+        if (instr.type.ptr_level > 0) {
+            escape_derive(reach, instr.value);
+        }
+        return true;
+    case IR_STORE:
+        if (use.arg != 0) {
+            return escape_fail(reach, "has the address of where it is kept stored");
+        }
+        escape_access(facts, reach, use, instr.args[0], ir_size_of(instr.mem_type), true);
+        return true;
+    case IR_ZERO:
+        escape_access(facts, reach, use, instr.args[0], ir_size_of(instr.mem_type), true);
+        return true;
+    case IR_COPY:
+    {
+        if (use.arg == 0) {
+            escape_access(facts, reach, use, instr.args[0], ir_size_of(instr.mem_type), true);
+            return true;
+        }
+        escape_access(facts, reach, use, instr.args[1], ir_size_of(instr.mem_type), false);
+        int slot = escape_slot_of(facts, instr.args[0], &offset);
+        if (slot < 0) {
+            return escape_fail(reach, "is copied through a pointer");
+        }
+        escape_hold(reach, slot);
+        return true;
+    }
+    case IR_FIELD:
+    case IR_INDEX:
+    case IR_CAST:
+        if (use.arg != 0 || instr.type.ptr_level == 0) {
+            return escape_fail(reach, "has the address of where it is kept cast to an integer");
+        }
+        if (!reach->is_address[instr.value]) {
+            reach->is_address[instr.value] = true;
+            reach->addresses.push_back(instr.value);
+        }
+        return true;
+    case IR_CALL:
+        if (use.arg < 0) {
+            IrType type = facts.func->values[instr.dest];
+            type.ptr_level--;
+            escape_access(facts, reach, use, instr.dest, ir_size_of(type), true);
+            return true;
+        } else if (ir_is_struct(instr.arg_types[use.arg]) && escape_param_is_safe(instr.name, use.arg)) {
+            escape_access(facts, reach, use, instr.args[use.arg], ir_size_of(instr.arg_types[use.arg]), false);
+            return true;
+        }
+        return escape_fail(reach, "is passed to " + instr.name);
+    case IR_RET:
+        escape_access(facts, reach, use, instr.args[0], ir_size_of(facts.func->return_type), false);
+        reach->returned = true;
+        return allow_return || escape_fail(reach, "is returned");
+    case IR_EQ:
+    case IR_NE:
+        return true;
+    default:
+        return escape_fail(reach, "has the address of where it is kept used by "
+                                  + std::string(ir_op_name(instr.op)));
+    }
+}
+
+// Freeing is only dropped along with the allocation when it certainly is
+// that allocation: root itself, or loaded from a slot nothing else is
+// ever stored in
+bool escape_frees_root(EscapeFunction& facts, int root, int freed) {
+    freed = escape_strip_casts(facts, freed);
+    if (root < 0 || freed == root) {
+        return freed == root;
+    }
+    IrInstr* def = facts.defs[freed];
+    if (def->op != IR_LOAD || facts.defs[def->args[0]]->op != IR_SLOT) {
+        return false;
+    }
+    int stores = 0;
+    for (int address : facts.slot_values[facts.defs[def->args[0]]->imm]) {
+        for (EscapeUse use : facts.uses[address]) {
+            IrInstr& instr = escape_instr(facts, use);
+            if (instr.op == IR_LOAD) {
+                continue;
+            } else if (instr.op != IR_STORE || use.arg != 0 || escape_strip_casts(facts, instr.args[1]) != root) {
+                return false;
+            }
+            stores++;
+        }
+    }
+    return stores == 1;
+}
+
+// Follows root, the pointer alloc returned, or root_slot, a slot it is
+// in, to everything it reaches. Being returned is fine with allow_return,
+// which is for finding constructors
+bool escape_walk(EscapeFunction& facts, int root, int root_slot, bool allow_return, EscapeReach* reach) {
+    reach->is_derived.assign(facts.defs.size(), false);
+    reach->is_address.assign(facts.defs.size(), false);
+    reach->is_holder.assign(facts.func->slots.size(), false);
+    if (root >= 0) {
+        escape_derive(reach, root);
+    }
+    if (root_slot >= 0) {
+        escape_hold(reach, root_slot);
+    }
+    while (true) {
+        if (reach->derived.size() != 0) {
+            int value = reach->derived.back();
+            reach->derived.pop_back();
+            for (EscapeUse use : facts.uses[value]) {
+                if (!escape_derived_use(facts, use, allow_return, reach)) {
+                    return false;
+                }
+            }
+        } else if (reach->holders.size() != 0) {
+            int slot = reach->holders.back();
+            reach->holders.pop_back();
+            for (int address : facts.slot_values[slot]) {
+                if (!reach->is_address[address]) {
+                    reach->is_address[address] = true;
+                    reach->addresses.push_back(address);
+                }
+            }
+        } else if (reach->addresses.size() != 0) {
+            int address = reach->addresses.back();
+            reach->addresses.pop_back();
+            for (EscapeUse use : facts.uses[address]) {
+                if (!escape_address_use(facts, use, allow_return, reach)) {
+                    return false;
+                }
+            }
+        } else {
+            break;
+        }
+    }
+    for (int freed : reach->frees) {
+        if (!escape_frees_root(facts, root, freed)) {
+            return escape_fail(reach, "is freed through what may be another pointer");
+        }
+    }
+    return true;
+}
+
+bool escape_is_covered(std::vector<std::pair<int64_t, int64_t>>& written, int64_t from, int64_t to) {
+    bool moved = true;
+    while (from < to && moved) {
+        moved = false;
+        for (std::pair<int64_t, int64_t> range : written) {
+            if (range.first <= from && from < range.second) {
+                from = range.second;
+                moved = true;
+            }
+        }
+    }
+    return from >= to;
+}
+
+bool escape_access_before(EscapeAccess a, EscapeAccess b) {
+    return a.index < b.index || (a.index == b.index && !a.is_write && b.is_write);
+}
+
+// For an allocation in a loop: nothing before it in its block or outside
+// it sees the pointer, and whatever holds it is written before it is read
+bool escape_is_block_local(EscapeFunction& facts, int block, int index, int root_slot, EscapeReach* reach) {
+    for (EscapeUse use : reach->derived_uses) {
+        if (use.block != block || use.index <= index) {
+            return escape_fail(reach, "is used across loop iterations");
+        }
+    }
+    std::vector<EscapeAccess> accesses = reach->accesses;
+    std::sort(accesses.begin(), accesses.end(), escape_access_before);
+    std::vector<std::vector<std::pair<int64_t, int64_t>>> written(facts.func->slots.size());
+    for (EscapeAccess access : accesses) {
+        bool is_site = access.index == index && root_slot >= 0 && access.is_write;
+        if (access.block != block || (access.index <= index && !is_site)) {
+            return escape_fail(reach, "is kept across loop iterations");
+        } else if (access.offset < 0 && !access.is_write) {
+            return escape_fail(reach, "is read from where it may be left from the last iteration");
+        } else if (access.offset < 0) {
+            continue;
+        } else if (access.is_write) {
+            written[access.slot].push_back({access.offset, access.offset + access.size});
+        } else if (!escape_is_covered(written[access.slot], access.offset, access.offset + access.size)) {
+            return escape_fail(reach, "is read from where it may be left from the last iteration");
+        }
+    }
+    return true;
+}
+
+// Whether the allocation at the instruction, an alloc or a call to a
+// constructor, never outlives the frame
+bool escape_is_local(EscapeFunction& facts, int block, int index, EscapeReach* reach) {
+    IrInstr& instr = facts.func->blocks[block]->instrs[index];
+    int root_slot = -1;
+    if (instr.dest >= 0) {
+        int64_t offset;
+        root_slot = escape_slot_of(facts, instr.dest, &offset);
+        if (root_slot < 0) {
+            return escape_fail(reach, "is returned into memory that isn't a local");
+        }
+    }
+    if (!escape_walk(facts, instr.value, root_slot, false, reach)) {
+        return false;
+    }
+    return !facts.in_loop[block] || escape_is_block_local(facts, block, index, root_slot, reach);
+}
+
+/* Summaries */
+
+bool escape_is_site(IrInstr& instr) {
+    if (instr.op == IR_INTRINSIC) {
+        return instr.name == "alloc";
+    } else if (instr.op != IR_CALL) {
+        return false;
+    }
+    int callee = ir_find_function(instr.name);
+    return callee >= 0 && escape_is_constructor[callee];
+}
+
+// Small, loop free and not recursive, and hands back at least one
+// allocation nothing else keeps
+bool escape_find_constructor(IrFunction* func) {
+    if (!ir_is_struct(func->return_type) && func->return_type.ptr_level == 0) {
+        return false;
+    }
+    EscapeFunction facts = escape_facts(func);
+    int instrs = 0;
+    for (int b = 0; b < func->blocks.size(); b++) {
+        if (facts.in_loop[b]) {
+            return false;
+        }
+        for (IrInstr& instr : func->blocks[b]->instrs) {
+            instrs++;
+            if (instr.op == IR_CALL && instr.name == func->func->mangled_name) {
+                return false;
+            }
+        }
+    }
+    if (instrs > ESCAPE_INLINE_MAX) {
+        return false;
+    }
+    for (int b = 0; b < func->blocks.size(); b++) {
+        for (IrInstr& instr : func->blocks[b]->instrs) {
+            if (!escape_is_site(instr)) {
+                continue;
+            }
+            EscapeReach reach;
+            int64_t offset;
+            int root_slot = instr.dest >= 0 ? escape_slot_of(facts, instr.dest, &offset) : -1;
+            if ((instr.dest < 0 || root_slot >= 0) &&
+                escape_walk(facts, instr.value, root_slot, true, &reach) &&
+                reach.returned && reach.frees.size() == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool escape_find_param_safe(IrFunction* func, int param) {
+    EscapeFunction facts = escape_facts(func);
+    for (int slot = 0; slot < func->slots.size(); slot++) {
+        if (func->slots[slot].param == param) {
+            EscapeReach reach;
+            return escape_walk(facts, -1, slot, false, &reach);
+        }
+    }
+    return true;
+}
+
+// Both only ever go from false to true, so a few rounds settle them.
+// Recursive functions stay pessimistic
+void escape_summarize() {
+    escape_param_safe.assign(ir_functions.size(), {});
+    escape_is_constructor.assign(ir_functions.size(), false);
+    for (int f = 0; f < ir_functions.size(); f++) {
+        escape_param_safe[f].assign(ir_functions[f]->func->params.size(), false);
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int f = 0; f < ir_functions.size(); f++) {
+            IrFunction* func = ir_functions[f];
+            for (int p = 0; p < escape_param_safe[f].size(); p++) {
+                if (!escape_param_safe[f][p] && escape_find_param_safe(func, p)) {
+                    escape_param_safe[f][p] = true;
+                    changed = true;
+                }
+            }
+            if (!escape_is_constructor[f] && escape_find_constructor(func)) {
+                escape_is_constructor[f] = true;
+                changed = true;
+            }
+        }
+    }
+}
+
+/* Rewriting */
+
+int escape_new_value(IrFunction* func, IrType type) {
+    func->values.push_back(type);
+    return func->values.size() - 1;
+}
+
+int escape_new_block_id(IrFunction* func) {
+    int id = 0;
+    for (IrBlock* block : func->blocks) {
+        id = std::max(id, block->id + 1);
+    }
+    return id;
+}
+
+int escape_add_slot(IrFunction* func, std::string name, IrType type) {
+    IrSlot slot;
+    slot.name = name;
+    slot.type = type;
+    func->slots.push_back(slot);
+    return func->slots.size() - 1;
+}
+
+// Room for size bytes, in 8 byte words so anything alloc held still lines up
+int escape_add_buffer(IrFunction* func, int64_t size) {
+    IrType type = ir_int(TYPE_U64);
+    type.count = std::max((int64_t)1, (size + 7) / 8);
+    return escape_add_slot(func, "alloc", type);
+}
+
+int escape_emit_slot(IrFunction* func, IrBlock* block, int slot) {
+    IrInstr instr = ir_instr(IR_SLOT, ir_pointer_to(func->slots[slot].type));
+    instr.mem_type = func->slots[slot].type;
+    instr.imm = slot;
+    instr.value = escape_new_value(func, instr.type);
+    block->instrs.push_back(instr);
+    return instr.value;
+}
+
+void escape_emit_jump(IrBlock* block, int target) {
+    IrInstr jump = ir_instr(IR_JUMP, ir_void());
+    jump.target = target;
+    block->instrs.push_back(jump);
+}
+
+void escape_emit_store(IrFunction* func, IrBlock* block, int slot, int value) {
+    IrInstr store = ir_instr(IR_STORE, ir_void());
+    store.mem_type = func->slots[slot].type;
+    store.args = {escape_emit_slot(func, block, slot), value};
+    block->instrs.push_back(store);
+}
+
+// A parameter that is only ever read, so the inlined body can use the
+// argument wherever it is loaded
+bool escape_is_forwarded(EscapeFunction& facts, int slot) {
+    if (facts.func->slots[slot].param < 0 || !ir_is_scalar(facts.func->slots[slot].type)) {
+        return false;
+    }
+    for (int address : facts.slot_values[slot]) {
+        for (EscapeUse use : facts.uses[address]) {
+            if (escape_instr(facts, use).op != IR_LOAD) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The body of callee in place of the call at index in the block at
+// position b, the rest of the block after it
+void escape_inline(IrFunction* func, int b, int index, IrFunction* callee) {
+    EscapeFunction facts = escape_facts(callee);
+    IrBlock* block = func->blocks[b];
+    IrInstr call = block->instrs[index];
+    int next_id = escape_new_block_id(func);
+    IrBlock* after = new IrBlock;
+    after->id = next_id++;
+    after->instrs.assign(block->instrs.begin() + index + 1, block->instrs.end());
+    block->instrs.resize(index);
+
+    std::vector<int> slots(callee->slots.size(), -1);
+    std::vector<int> forwarded(callee->slots.size(), -1);
+    for (int s = 0; s < callee->slots.size(); s++) {
+        IrSlot slot = callee->slots[s];
+        if (escape_is_forwarded(facts, s)) {
+            forwarded[s] = call.args[slot.param];
+            continue;
+        }
+        slots[s] = escape_add_slot(func, slot.name, slot.type);
+        if (slot.param >= 0 && ir_is_struct(slot.type)) {
+            IrInstr copy = ir_instr(IR_COPY, ir_void());
+            copy.mem_type = slot.type;
+            copy.args = {escape_emit_slot(func, block, slots[s]), call.args[slot.param]};
+            block->instrs.push_back(copy);
+        } else if (slot.param >= 0) {
+            escape_emit_store(func, block, slots[s], call.args[slot.param]);
+        }
+    }
+    int result = -1;
+    if (call.value >= 0) {
+        result = escape_add_slot(func, "ret", func->values[call.value]);
+    }
+
+    std::vector<int> values(callee->values.size(), -1);
+    for (IrBlock* callee_block : callee->blocks) {
+        for (IrInstr& instr : callee_block->instrs) {
+            IrInstr* address = instr.op == IR_LOAD ? facts.defs[instr.args[0]] : NULL;
+            if (address != NULL && address->op == IR_SLOT && forwarded[address->imm] >= 0) {
+                values[instr.value] = forwarded[address->imm];
+            } else if (instr.value >= 0) {
+                values[instr.value] = escape_new_value(func, callee->values[instr.value]);
+            }
+        }
+    }
+    std::vector<int> block_ids;
+    for (IrBlock* callee_block : callee->blocks) {
+        while (block_ids.size() <= callee_block->id) {
+            block_ids.push_back(-1);
+        }
+        block_ids[callee_block->id] = next_id++;
+    }
+    escape_emit_jump(block, block_ids[callee->blocks[0]->id]);
+
+    std::vector<IrBlock*> body;
+    for (IrBlock* callee_block : callee->blocks) {
+        IrBlock* copy = new IrBlock;
+        copy->id = block_ids[callee_block->id];
+        for (IrInstr instr : callee_block->instrs) {
+            IrInstr* address = instr.op == IR_LOAD ? facts.defs[instr.args[0]] : NULL;
+            if ((instr.op == IR_SLOT && forwarded[instr.imm] >= 0) ||
+                (address != NULL && address->op == IR_SLOT && forwarded[address->imm] >= 0)) {
+                continue;
+            }
+            if (instr.value >= 0) {
+                instr.value = values[instr.value];
+            }
+            for (int& arg : instr.args) {
+                arg = values[arg];
+            }
+            if (instr.dest >= 0) {
+                instr.dest = values[instr.dest];
+            }
+            if (instr.op == IR_SLOT) {
+                instr.imm = slots[instr.imm];
+            }
+            for (int* target : ir_targets(instr)) {
+                *target = block_ids[*target];
+            }
+            if (instr.op != IR_RET) {
+                copy->instrs.push_back(instr);
+                continue;
+            }
+            if (call.dest >= 0) {
+                IrInstr result_copy = ir_instr(IR_COPY, ir_void());
+                result_copy.mem_type = callee->return_type;
+                result_copy.args = {call.dest, instr.args[0]};
+                copy->instrs.push_back(result_copy);
+            } else if (result >= 0) {
+                escape_emit_store(func, copy, result, instr.args[0]);
+            }
+            escape_emit_jump(copy, after->id);
+        }
+        body.push_back(copy);
+    }
+    if (result >= 0) {
+        IrBlock* prefix = new IrBlock;
+        int address = escape_emit_slot(func, prefix, result);
+        IrInstr load = ir_instr(IR_LOAD, func->values[call.value]);
+        load.mem_type = func->values[call.value];
+        load.args = {address};
+        load.value = call.value;
+        prefix->instrs.push_back(load);
+        after->instrs.insert(after->instrs.begin(), prefix->instrs.begin(), prefix->instrs.end());
+        delete prefix;
+    }
+    body.push_back(after);
+    func->blocks.insert(func->blocks.begin() + b + 1, body.begin(), body.end());
+    escape_stats.inlined++;
+}
+
+// alloc(n) with a constant n becomes the address of a slot of n bytes
+void escape_to_slot(IrFunction* func, int b, int index, int64_t size) {
+    IrBlock* block = func->blocks[b];
+    IrInstr alloc = block->instrs[index];
+    IrBlock scratch;
+    int address = escape_emit_slot(func, &scratch, escape_add_buffer(func, size));
+    IrInstr cast = ir_instr(IR_CAST, alloc.type);
+    cast.value = alloc.value;
+    cast.args = {address};
+    block->instrs[index] = cast;
+    block->instrs.insert(block->instrs.begin() + index, scratch.instrs[0]);
+}
+
+// alloc(n) otherwise becomes a slot of ESCAPE_CAP bytes when n fits in it,
+// and stays alloc(n) when it doesn't
+void escape_to_capped_slot(IrFunction* func, int b, int index) {
+    IrBlock* block = func->blocks[b];
+    IrInstr alloc = block->instrs[index];
+    int next_id = escape_new_block_id(func);
+    IrBlock* small = new IrBlock;
+    IrBlock* big = new IrBlock;
+    IrBlock* after = new IrBlock;
+    small->id = next_id++;
+    big->id = next_id++;
+    after->id = next_id++;
+    after->instrs.assign(block->instrs.begin() + index + 1, block->instrs.end());
+    block->instrs.resize(index);
+    int buffer = escape_add_buffer(func, ESCAPE_CAP);
+    int pointer = escape_add_slot(func, "alloc_ptr", alloc.type);
+
+    IrType size_type = func->values[alloc.args[0]];
+    IrInstr cap = ir_instr(IR_CONST, size_type);
+    cap.imm = ESCAPE_CAP;
+    cap.value = escape_new_value(func, size_type);
+    block->instrs.push_back(cap);
+    IrInstr fits = ir_instr(IR_LE, ir_bool());
+    fits.args = {alloc.args[0], cap.value};
+    fits.value = escape_new_value(func, fits.type);
+    block->instrs.push_back(fits);
+    IrInstr branch = ir_instr(IR_BRANCH, ir_void());
+    branch.args = {fits.value};
+    branch.target = small->id;
+    branch.target_else = big->id;
+    block->instrs.push_back(branch);
+
+    IrInstr cast = ir_instr(IR_CAST, alloc.type);
+    cast.args = {escape_emit_slot(func, small, buffer)};
+    cast.value = escape_new_value(func, alloc.type);
+    small->instrs.push_back(cast);
+    escape_emit_store(func, small, pointer, cast.value);
+    escape_emit_jump(small, after->id);
+
+    IrInstr heap = alloc;
+    heap.value = escape_new_value(func, alloc.type);
+    big->instrs.push_back(heap);
+    escape_emit_store(func, big, pointer, heap.value);
+    escape_emit_jump(big, after->id);
+
+    IrBlock prefix;
+    IrInstr load = ir_instr(IR_LOAD, alloc.type);
+    load.mem_type = alloc.type;
+    load.args = {escape_emit_slot(func, &prefix, pointer)};
+    load.value = alloc.value;
+    prefix.instrs.push_back(load);
+    after->instrs.insert(after->instrs.begin(), prefix.instrs.begin(), prefix.instrs.end());
+    func->blocks.insert(func->blocks.begin() + b + 1, {small, big, after});
+}
+
+void escape_log(IrFunction* func, std::string what) {
+    log_print("escape: " + what + " in " + func->func->token->token + "\n");
+}
+
+// Calls to constructors whose result stays in the frame are inlined so
+// their alloc can be looked at where it is used
+bool escape_inline_calls(IrFunction* func) {
+    EscapeFunction facts = escape_facts(func);
+    std::vector<std::pair<int, int>> sites;
+    std::vector<std::string> reasons; // logged once nothing more is inlined
+    for (int b = 0; b < func->blocks.size(); b++) {
+        for (int i = 0; i < func->blocks[b]->instrs.size(); i++) {
+            IrInstr& instr = func->blocks[b]->instrs[i];
+            if (instr.op != IR_CALL || !escape_is_site(instr) || instr.name == func->func->mangled_name) {
+                continue;
+            }
+            EscapeReach reach;
+            if (escape_is_local(facts, b, i, &reach)) {
+                sites.push_back({b, i});
+            } else {
+                reasons.push_back("the result of " + instr.name + " " + reach.reason);
+            }
+        }
+    }
+    for (int r = 0; r < reasons.size() && sites.size() == 0; r++) {
+        escape_log(func, reasons[r]);
+    }
+    // last first, so the positions of the rest stay put
+    for (int s = sites.size() - 1; s >= 0; s--) {
+        IrInstr& call = func->blocks[sites[s].first]->instrs[sites[s].second];
+        escape_inline(func, sites[s].first, sites[s].second, ir_functions[ir_find_function(call.name)]);
+    }
+    if (sites.size() != 0) {
+        ir_optimize(func);
+    }
+    return sites.size() != 0;
+}
+
+struct EscapeSite {
+    int block;
+    int index;
+    int64_t size; // -1 for the capped slot
+};
+
+void escape_move_allocs(IrFunction* func) {
+    EscapeFunction facts = escape_facts(func);
+    std::vector<EscapeSite> sites;
+    std::vector<int> frees;
+    for (int b = 0; b < func->blocks.size(); b++) {
+        for (int i = 0; i < func->blocks[b]->instrs.size(); i++) {
+            IrInstr& instr = func->blocks[b]->instrs[i];
+            if (instr.op != IR_INTRINSIC || instr.name != "alloc") {
+                continue;
+            }
+            EscapeReach reach;
+            int64_t size = -1;
+            bool is_constant = escape_constant(facts, instr.args[0], &size);
+            if (!escape_is_local(facts, b, i, &reach)) {
+                escape_log(func, "alloc " + reach.reason);
+            } else if (is_constant && size > ESCAPE_FIXED_MAX) {
+                escape_log(func, "alloc is too big for the stack");
+            } else if (!is_constant && reach.frees.size() != 0) {
+                escape_log(func, "alloc is freed, and may be too big for the stack");
+            } else {
+                sites.push_back({b, i, is_constant ? size : -1});
+                frees.insert(frees.end(), reach.frees.begin(), reach.frees.end());
+                continue;
+            }
+            escape_stats.heap++;
+        }
+    }
+    for (int s = sites.size() - 1; s >= 0; s--) {
+        if (sites[s].size >= 0) {
+            escape_to_slot(func, sites[s].block, sites[s].index, sites[s].size);
+        } else {
+            escape_to_capped_slot(func, sites[s].block, sites[s].index);
+            escape_stats.capped++;
+        }
+        escape_stats.stack++;
+    }
+    for (IrBlock* block : func->blocks) {
+        std::vector<IrInstr> kept;
+        for (IrInstr& instr : block->instrs) {
+            bool is_dropped = instr.op == IR_INTRINSIC && instr.name == "free" &&
+                              std::find(frees.begin(), frees.end(), instr.args[0]) != frees.end();
+            if (!is_dropped) {
+                kept.push_back(instr);
+            }
+        }
+        block->instrs = kept;
+    }
+    if (sites.size() != 0) {
+        ir_optimize(func);
+    }
+}
+
+/* Entry */
+
+void escape_start() {
+    escape_summarize();
+    for (IrFunction* func : ir_functions) {
+        for (int round = 0; round < ESCAPE_ROUNDS && escape_inline_calls(func); round++) {
+        }
+        escape_move_allocs(func);
+    }
+    log_print("escape: " + std::to_string(escape_stats.stack) + " allocations moved to the stack, "
+              + std::to_string(escape_stats.heap) + " left on the heap\n");
+}
+
+void escape_report() {
+    error_out() << "alloc:   " << escape_stats.stack << " on the stack (" << escape_stats.capped
+                << " capped), " << escape_stats.heap << " on the heap, " << escape_stats.inlined
+                << " calls inlined\n";
+}
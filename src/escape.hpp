@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+
+#include "ast.hpp"
+
+// Counts for --stats, over the functions in the IR
+struct EscapeStats {
+    int heap = 0;    // calls to alloc left as they were
+    int stack = 0;   // allocations turned into storage in the frame
+    int capped = 0;  // of those, the ones only small enough sizes go to the frame for
+    int inlined = 0; // calls to functions returning fresh memory inlined to get at their alloc
+};
+
+extern thread_local EscapeStats escape_stats;
+
+// Escape analysis over the IR, run by ir_start once every function it can
+// take is lowered. Memory from alloc that provably never outlives the
+// frame it was allocated in is moved to a slot of that frame: a fixed one
+// for constant sizes, and one used while the size fits a cap with alloc
+// kept for bigger ones. Calls to small functions that only hand back what
+// they allocated (atlas_create_string, join) are inlined first when their
+// result doesn't escape, so string literals and temporaries get the same
+void escape_start();
+void escape_report(); // the counts, for --stats
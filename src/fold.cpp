@@ -0,0 +1,561 @@
+#include <vector>
+#include <string>
+
+#include "global.hpp"
+#include "error.hpp"
+#include "fold.hpp"
+#include "comptime.hpp"
+#include "ir.hpp"
+
+// Evaluates integer expressions whose operands are all known at compile
+// time, replaces uses of const globals with their value and removes
+// arithmetic identities (x * 1, x + 0, ...). Everything is rewritten in
+// place so the statements keep pointing at the same nodes
+
+struct FoldConst {
+    std::string name;
+    ConstantNode* value;
+};
+
+thread_local std::vector<FoldConst> fold_consts; // const globals with a known value
+thread_local std::vector<std::vector<std::string>> fold_scopes; // locals, which shadow them
+thread_local int fold_count = 0;
+thread_local bool fold_in_comptime = false; // comptime functions only run in the interpreter
+
+void fold_statements(std::vector<StatementNode*> statements, bool is_global);
+int64_t ir_int_size(VarType int_type);
+
+bool fold_is_unsigned(VarType type) {
+    return type == TYPE_U8 || type == TYPE_U16 || type == TYPE_U32 || type == TYPE_U64;
+}
+
+// Converts value to type the way a C cast would
+uint64_t fold_cast(uint64_t value, VarType type) {
+    switch (type) {
+    case TYPE_I8:
+        return (uint64_t)(int64_t)(int8_t)value;
+    case TYPE_I16:
+        return (uint64_t)(int64_t)(int16_t)value;
+    case TYPE_I32:
+        return (uint64_t)(int64_t)(int32_t)value;
+    case TYPE_U8:
+        return (uint8_t)value;
+    case TYPE_U16:
+        return (uint16_t)value;
+    case TYPE_U32:
+        return (uint32_t)value;
+    default:
+        return value;
+    }
+}
+
+bool fold_is_integer(VarType type) {
+    return type >= TYPE_I8 && type <= TYPE_U64;
+}
+
+ConstantNode* fold_lookup_const(std::string name) {
+    for (std::vector<std::string> scope : fold_scopes) {
+        for (std::string local : scope) {
+            if (local == name) {
+                return NULL;
+            }
+        }
+    }
+    for (FoldConst constant : fold_consts) {
+        if (constant.name == name) {
+            return constant.value;
+        }
+    }
+    return NULL;
+}
+
+void fold_add_local(VarNode* var) {
+    if (fold_scopes.size() != 0) {
+        fold_scopes.back().push_back(var->identifier->token);
+    }
+}
+
+void fold_to_constant(ExpressionNode* expr, uint64_t value, VarType type) {
+    ConstantNode* constant = new ConstantNode;
+    constant->nt = NODE_CONSTANT;
+    constant->value = value;
+    constant->type = type;
+    expr->nt = NODE_CONSTANT;
+    expr->constant = constant;
+    // only a negative number could still need its parentheses
+    expr->needs_paren = expr->needs_paren && !fold_is_unsigned(type) && (int64_t)value < 0;
+    fold_count++;
+}
+
+// Replaces expr with one of its operands
+void fold_to_operand(ExpressionNode* expr, ExpressionNode* operand) {
+    bool needs_paren = expr->needs_paren || operand->needs_paren;
+    *expr = *operand;
+    expr->needs_paren = needs_paren;
+    fold_count++;
+}
+
+bool fold_is_constant(ExpressionNode* expr, uint64_t value) {
+    return expr->nt == NODE_CONSTANT && expr->constant->value == value;
+}
+
+// The type C gives a constant as codegen_constant writes it: int when it
+// fits in one, unless it is a u64. Arithmetic on constants folds the way
+// out.c would compute it, so this is the type they start out with
+VarType fold_literal_type(uint64_t value, VarType type) {
+    if (type == TYPE_U64) {
+        return TYPE_U64;
+    } else if (type == TYPE_U8 || type == TYPE_U16 || type == TYPE_U32) {
+        return value > INT32_MAX ? TYPE_U32 : TYPE_I32;
+    }
+    int64_t signed_value = (int64_t)value;
+    return signed_value < INT32_MIN || signed_value > INT32_MAX ? TYPE_I64 : TYPE_I32;
+}
+
+// The integer promotions, anything smaller than an int becomes one
+VarType fold_promote(VarType type) {
+    return ir_int_size(type) < 4 ? TYPE_I32 : type;
+}
+
+// C's usual arithmetic conversions, the same as ir_common_type
+VarType fold_common_type(VarType a, VarType b) {
+    a = fold_promote(a);
+    b = fold_promote(b);
+    if (a == b) {
+        return a;
+    }
+    if (fold_is_unsigned(a) == fold_is_unsigned(b)) {
+        return ir_int_size(a) > ir_int_size(b) ? a : b;
+    }
+    VarType u = fold_is_unsigned(a) ? a : b;
+    VarType s = fold_is_unsigned(a) ? b : a;
+    return ir_int_size(u) >= ir_int_size(s) ? u : s;
+}
+
+// Evaluates op like C on values of these types: both sides are converted
+// to their common type, the result wraps around in it, and comparisons,
+// && and || give an int. Returns false for what can't be evaluated
+// (division by zero or overflowing, unknown operators)
+bool fold_eval_binop(TokenType op, ConstantNode* lhs, ConstantNode* rhs, uint64_t* result, VarType* type) {
+    VarType common = fold_common_type(lhs->type, rhs->type);
+    bool is_unsigned = fold_is_unsigned(common);
+    uint64_t a = fold_cast(lhs->value, common);
+    uint64_t b = fold_cast(rhs->value, common);
+    int64_t sa = (int64_t)a;
+    int64_t sb = (int64_t)b;
+    int64_t min = common == TYPE_I32 ? INT32_MIN : INT64_MIN;
+    *type = common;
+    switch (op) {
+    case TK_PLUS:
+        *result = a + b;
+        break;
+    case TK_DASH:
+        *result = a - b;
+        break;
+    case TK_STAR:
+        *result = a * b;
+        break;
+    case TK_SLASH:
+    case TK_PERCENT:
+        if (b == 0 || (!is_unsigned && sa == min && sb == -1)) {
+            return false;
+        }
+        if (op == TK_SLASH) {
+            *result = is_unsigned ? a / b : (uint64_t)(sa / sb);
+        } else {
+            *result = is_unsigned ? a % b : (uint64_t)(sa % sb);
+        }
+        break;
+    case TK_EQUAL:
+        *result = a == b, *type = TYPE_I32;
+        break;
+    case TK_NOT_EQUAL:
+        *result = a != b, *type = TYPE_I32;
+        break;
+    case TK_LT:
+        *result = is_unsigned ? a < b : sa < sb, *type = TYPE_I32;
+        break;
+    case TK_LTE:
+        *result = is_unsigned ? a <= b : sa <= sb, *type = TYPE_I32;
+        break;
+    case TK_GT:
+        *result = is_unsigned ? a > b : sa > sb, *type = TYPE_I32;
+        break;
+    case TK_GTE:
+        *result = is_unsigned ? a >= b : sa >= sb, *type = TYPE_I32;
+        break;
+    case TK_LOGICAL_AND:
+        *result = a != 0 && b != 0, *type = TYPE_I32;
+        break;
+    case TK_LOGICAL_OR:
+        *result = a != 0 || b != 0, *type = TYPE_I32;
+        break;
+    default:
+        return false;
+    }
+    *result = fold_cast(*result, *type);
+    return true;
+}
+
+// Both operands are constants. Division by zero is left for the C
+// compiler to complain about, and so is a result C would give a type no
+// constant is written with (an unsigned int or a long long that fits in
+// an int)
+bool fold_binop(ExpressionNode* expr) {
+    ConstantNode lhs = *expr->binop->lhs->constant;
+    ConstantNode rhs = *expr->binop->rhs->constant;
+    lhs.type = fold_literal_type(lhs.value, lhs.type);
+    rhs.type = fold_literal_type(rhs.value, rhs.type);
+    uint64_t result;
+    VarType type;
+    if (!fold_eval_binop(expr->binop->op->tt, &lhs, &rhs, &result, &type) ||
+        fold_literal_type(result, type) != type) {
+        return false;
+    }
+    fold_to_constant(expr, result, type);
+    return true;
+}
+
+// x + 0, 0 + x, x - 0, x * 1, 1 * x and x / 1 become x. x * 0 becomes 0
+// when x is a variable, since dropping it can't skip a side effect
+void fold_identity(ExpressionNode* expr) {
+    ExpressionNode* lhs = expr->binop->lhs;
+    ExpressionNode* rhs = expr->binop->rhs;
+    switch (expr->binop->op->tt) {
+    case TK_PLUS:
+        if (fold_is_constant(rhs, 0)) {
+            fold_to_operand(expr, lhs);
+        } else if (fold_is_constant(lhs, 0)) {
+            fold_to_operand(expr, rhs);
+        }
+        break;
+    case TK_DASH:
+        if (fold_is_constant(rhs, 0)) {
+            fold_to_operand(expr, lhs);
+        }
+        break;
+    case TK_STAR:
+        if (fold_is_constant(rhs, 1)) {
+            fold_to_operand(expr, lhs);
+        } else if (fold_is_constant(lhs, 1)) {
+            fold_to_operand(expr, rhs);
+        } else if (fold_is_constant(rhs, 0) && lhs->nt == NODE_VAR) {
+            fold_to_operand(expr, rhs);
+        } else if (fold_is_constant(lhs, 0) && rhs->nt == NODE_VAR) {
+            fold_to_operand(expr, lhs);
+        }
+        break;
+    case TK_SLASH:
+        if (fold_is_constant(rhs, 1)) {
+            fold_to_operand(expr, lhs);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void fold_expr(ExpressionNode* expr) {
+    if (expr == NULL) {
+        return;
+    }
+    switch (expr->nt) {
+    case NODE_VAR:
+    {
+        ConstantNode* value = fold_lookup_const(expr->var_node->identifier->token);
+        if (value != NULL) {
+            fold_to_constant(expr, value->value, value->type);
+        }
+        break;
+    }
+    case NODE_BINOP:
+    {
+        TokenType op = expr->binop->op->tt;
+        if (op == TK_DOT) {
+            fold_expr(expr->binop->lhs); // the rhs names a field
+            break;
+        }
+        if (op != TK_ASSIGN || expr->binop->lhs->nt != NODE_VAR) {
+            fold_expr(expr->binop->lhs);
+        }
+        fold_expr(expr->binop->rhs);
+        if (expr->binop->lhs->nt == NODE_CONSTANT && expr->binop->rhs->nt == NODE_CONSTANT &&
+            fold_binop(expr)) {
+            break;
+        }
+        fold_identity(expr);
+        break;
+    }
+    case NODE_UNARY:
+    {
+        UnaryOpNode* unary_op = expr->unary_op;
+        if (unary_op->operator_type != NODE_UNARY) {
+            fold_expr(unary_op->operand);
+            break;
+        }
+        if (unary_op->op->tt == TK_AMPERSAND) {
+            break; // &X needs X to stay an lvalue
+        }
+        fold_expr(unary_op->operand);
+        ExpressionNode* operand = unary_op->operand;
+        if (operand->nt != NODE_CONSTANT) {
+            break;
+        }
+        VarType type = fold_literal_type(operand->constant->value, operand->constant->type);
+        uint64_t value = fold_cast(-operand->constant->value, type);
+        if (unary_op->op->tt == TK_DASH && fold_literal_type(value, type) == type) {
+            fold_to_constant(expr, value, type);
+        } else if (unary_op->op->tt == TK_NOT) {
+            fold_to_constant(expr, operand->constant->value == 0, TYPE_I32);
+        }
+        break;
+    }
+    case NODE_CALL:
+    {
+        for (ExpressionNode* arg : expr->call_node->args) {
+            fold_expr(arg);
+        }
+        FunctionNode* callee = NULL;
+        for (FunctionNode* func : function_table) {
+            if (func->token->token == expr->call_node->name->token) {
+                callee = func;
+            }
+        }
+        if (callee != NULL && callee->is_comptime && !fold_in_comptime) {
+            comptime_eval(expr);
+        }
+        break;
+    }
+    case NODE_COMPTIME:
+        fold_expr(expr->unary_op->operand);
+        if (!fold_in_comptime) {
+            comptime_eval(expr);
+        }
+        break;
+    case NODE_ARRAY_EXPR:
+        for (ExpressionNode* element : expr->array->elements) {
+            fold_expr(element);
+        }
+        break;
+    case NODE_SUBSCRIPT:
+        for (ExpressionNode* index : expr->subscript->indexes) {
+            fold_expr(index);
+        }
+        break;
+    case NODE_TYPE_INST:
+        for (ExpressionNode* value : expr->type_inst->values) {
+            fold_expr(value);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void fold_var(VarNode* var) {
+    if (var->is_array) {
+        fold_expr(var->arr_size);
+    }
+}
+
+void fold_block(BlockNode* block) {
+    if (block == NULL) {
+        return;
+    }
+    fold_scopes.push_back({});
+    fold_statements(block->statements, false);
+    fold_scopes.pop_back();
+}
+
+void fold_if(IfNode* if_node) {
+    fold_expr(if_node->condition);
+    fold_block(if_node->block);
+    if (if_node->_else != NULL) {
+        if (if_node->_else->block != NULL) {
+            fold_block(if_node->_else->block);
+        } else if (if_node->_else->else_if != NULL) {
+            fold_if(if_node->_else->else_if->if_lhs);
+        }
+    }
+}
+
+// The value a bound of a match arm folded to, it has to be known here
+int64_t fold_match_bound(ExpressionNode* expr, Token* arm) {
+    int64_t value;
+    if (expr->nt == NODE_CONSTANT) {
+        return (int64_t)expr->constant->value;
+    } else if (expr->nt == NODE_CHAR && ir_char_value(expr->character->value, &value)) {
+        return value;
+    }
+    print_error_msg("The arms of a match need constant values (line " + std::to_string(arm->line) + ")");
+    error_abort();
+}
+
+// Works out the values every case covers. An empty range or a value more
+// than one arm covers is an error, C would only catch some of them
+void fold_match(MatchNode* match) {
+    std::vector<MatchCase*> cases;
+    for (MatchArm* arm : match->arms) {
+        for (MatchCase& match_case : arm->cases) {
+            fold_expr(match_case.first);
+            match_case.lo = fold_match_bound(match_case.first, arm->token);
+            match_case.hi = match_case.lo;
+            if (match_case.last != NULL) {
+                fold_expr(match_case.last);
+                match_case.hi = fold_match_bound(match_case.last, arm->token);
+                if (!match_case.includes_last && match_case.hi != INT64_MIN) {
+                    match_case.hi--;
+                }
+            }
+            if (match_case.hi < match_case.lo) {
+                print_error_msg("Empty range in the arm of a match (line " + std::to_string(arm->token->line) + ")");
+                error_abort();
+            }
+            for (MatchCase* other : cases) {
+                if (match_case.lo <= other->hi && other->lo <= match_case.hi) {
+                    int64_t value = match_case.lo > other->lo ? match_case.lo : other->lo;
+                    print_error_msg(std::to_string(value) + " is matched by more than one arm (line "
+                                    + std::to_string(arm->token->line) + ")");
+                    error_abort();
+                }
+            }
+            cases.push_back(&match_case);
+        }
+    }
+}
+
+void fold_match_check(MatchNode* match, VarType type) {
+    if (match->else_block != NULL) {
+        return;
+    }
+    std::string line = std::to_string(match->token->line);
+    if (!fold_is_integer(type) || type == TYPE_I64 || type == TYPE_U64) {
+        print_error_msg("match needs an else arm unless its value is an 8, 16 or 32 bit integer (line " + line + ")");
+        error_abort();
+    }
+    int64_t min = fold_is_unsigned(type) ? 0 : (int64_t)fold_cast((uint64_t)1 << (ir_int_size(type) * 8 - 1), type);
+    int64_t max = fold_is_unsigned(type) ? (int64_t)fold_cast(-1, type) : -min - 1;
+    // the smallest value no case covers, moved past each case that covers it
+    int64_t missing = min;
+    bool changed = true;
+    while (changed && missing <= max) {
+        changed = false;
+        for (MatchArm* arm : match->arms) {
+            for (MatchCase& match_case : arm->cases) {
+                if (match_case.lo <= missing && missing <= match_case.hi) {
+                    missing = match_case.hi + 1;
+                    changed = true;
+                }
+            }
+        }
+    }
+    if (missing <= max) {
+        print_error_msg("match isn't exhaustive, no arm covers " + std::to_string(missing)
+                        + ", add them or an else arm (line " + line + ")");
+        error_abort();
+    }
+}
+
+void fold_statements(std::vector<StatementNode*> statements, bool is_global) {
+    for (StatementNode* statement : statements) {
+        switch (statement->nt) {
+        case NODE_VAR_DECL:
+        {
+            VarDeclNode* var_decl = statement->vardecl_lhs;
+            fold_var(var_decl->lhs);
+            fold_expr(var_decl->rhs);
+            if (var_decl->destructure.size() != 0) {
+                for (VarNode* var : var_decl->destructure) {
+                    fold_add_local(var);
+                }
+            } else if (is_global && var_decl->is_const && var_decl->rhs != NULL &&
+                       var_decl->rhs->nt != NODE_CONSTANT) {
+                comptime_add_global(var_decl); // arrays and types for comptime code
+            } else if (is_global && var_decl->is_const && var_decl->rhs != NULL &&
+                       var_decl->rhs->nt == NODE_CONSTANT && var_decl->lhs->ptr_level == 0 &&
+                       fold_is_integer(var_decl->lhs->type)) {
+                // uses see the value with the declared type
+                ConstantNode* value = new ConstantNode;
+                value->nt = NODE_CONSTANT;
+                value->type = var_decl->lhs->type;
+                value->value = fold_cast(var_decl->rhs->constant->value, value->type);
+                fold_consts.push_back({var_decl->lhs->identifier->token, value});
+            } else {
+                fold_add_local(var_decl->lhs);
+            }
+            break;
+        }
+        case NODE_TYPE:
+            comptime_add_type(statement->type_lhs);
+            for (VarDeclNode* field : statement->type_lhs->declarations) {
+                fold_var(field->lhs);
+            }
+            break;
+        case NODE_FUNC:
+        {
+            FunctionNode* func = statement->func_lhs;
+            fold_in_comptime = func->is_comptime;
+            fold_scopes.push_back({});
+            for (ParamNode* param : func->params) {
+                fold_var(param);
+                fold_add_local(param);
+            }
+            fold_block(func->block);
+            fold_scopes.pop_back();
+            fold_in_comptime = false;
+            break;
+        }
+        case NODE_RETURN:
+            for (ExpressionNode* expr : statement->return_lhs->exprs) {
+                fold_expr(expr);
+            }
+            break;
+        case NODE_IF:
+            fold_if(statement->if_lhs);
+            break;
+        case NODE_FOR:
+        {
+            ForNode* for_node = statement->for_lhs;
+            fold_scopes.push_back({});
+            if (for_node->for_type == FOR_LOOP) {
+                fold_statements({for_node->init}, false);
+            } else if (for_node->for_type == FOR_EACH) {
+                fold_expr(for_node->iterable);
+                fold_expr(for_node->range_end);
+                fold_scopes.back().push_back(for_node->each_var->token);
+            }
+            fold_expr(for_node->test);
+            if (for_node->for_type == FOR_LOOP) {
+                fold_statements({for_node->update}, false);
+            }
+            fold_block(for_node->block);
+            fold_scopes.pop_back();
+            break;
+        }
+        case NODE_DEFER:
+            fold_statements({statement->defer_lhs}, false);
+            break;
+        case NODE_MATCH:
+            fold_expr(statement->match_lhs->value);
+            fold_match(statement->match_lhs);
+            for (MatchArm* arm : statement->match_lhs->arms) {
+                fold_block(arm->block);
+            }
+            fold_block(statement->match_lhs->else_block);
+            break;
+        case NODE_GENERIC:
+        case NODE_CINCLUDE:
+            break;
+        default:
+            // expression statements
+            fold_expr(statement->expr_lhs);
+            break;
+        }
+    }
+}
+
+void fold_start(std::vector<StatementNode*> ast) {
+    fold_statements(ast, true);
+    log_print("Folded " + std::to_string(fold_count) + " expressions\n");
+    log_print("Evaluated " + std::to_string(comptime_eval_count()) + " comptime expressions\n");
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+
+#include "ast.hpp"
+
+// Constant folding, run on the whole program between ast_create and
+// codegen_start
+void fold_start(std::vector<StatementNode*> ast);
+
+// Also used by the comptime interpreter
+bool fold_is_unsigned(VarType type);
+bool fold_is_integer(VarType type);
+uint64_t fold_cast(uint64_t value, VarType type);
+VarType fold_literal_type(uint64_t value, VarType type);
+VarType fold_promote(VarType type);
+bool fold_eval_binop(TokenType op, ConstantNode* lhs, ConstantNode* rhs, uint64_t* result, VarType* type);
+
+// A match without an else arm on a value of type must cover every value
+// it can have, codegen and the IR check once they know the type
+void fold_match_check(MatchNode* match, VarType type);
@@ -4,14 +4,28 @@
 #include "ast.hpp"
 
 struct State {
-    bool debug;
+    bool debug = false;
     bool run = false;
     bool emit_c = true;
+    bool freestanding = false;
+    bool stats = false;
+    bool emit_ir = false;
+    bool print_layout = false; // --print-layout, sizes and padding of every struct
+    bool use_ir = true;    // --no-ir writes C from the AST for every function
+    bool native = false;   // --native, machine code from the IR without a C compiler
+    bool interpret = false; // --interpret, runs the IR as bytecode in the compiler
+    bool bounds_check = false; // --bounds-check, indexes into arrays and strings are checked
+    std::string opt_level; // passed on to the backend, -O2 and such
+    std::string backend = "gcc";
+    int threads = 0;       // for parallel loops, 0 is one per core
     std::string output_file_path;
     std::string input_file_dir;
     std::string input_filename;
     std::string include_path;
+    std::ostream* out = &std::cout; // errors, logs, --stats, --emit-ir and --print-layout
 };
 
-extern State* global_state;
-extern std::vector<FunctionNode*> function_table; // "table"
+// Every compilation has its own, so each global in the compiler is
+// thread_local and atlas_compile runs a compilation on a thread of its own
+extern thread_local State* global_state;
+extern thread_local std::vector<FunctionNode*> function_table; // "table"
@@ -0,0 +1,2077 @@
+#include <vector>
+#include <string>
+#include <iostream>
+
+#include "global.hpp"
+#include "error.hpp"
+#include "fold.hpp"
+#include "vector.hpp"
+#include "ir.hpp"
+#include "escape.hpp"
+#include "layout.hpp"
+#include "tail.hpp"
+#include "bounds.hpp"
+
+// Lowers the reachable functions to the IR once the AST is folded and
+// pruned. Names are resolved against the scopes of the function and the
+// globals, every expression gets a type and the conversions between types
+// become explicit casts. A function using something the IR has no way to
+// say yet (slices, maps, floats, vectors, multi-value returns...) is left
+// to the AST emitter, ir_fail says why
+
+std::string get_nt_str(NodeType nt);
+FunctionNode* codegen_get_function(std::string name);
+bool codegen_is_intrinsic_function(std::string call_name);
+
+thread_local std::vector<IrFunction*> ir_functions;
+thread_local std::vector<std::string> ir_strings;
+thread_local std::vector<VarDeclNode*> ir_globals;
+thread_local std::vector<std::string> ir_skipped; // name: reason, for --emit-ir
+thread_local int ir_looked_at = 0;
+
+struct IrLocal {
+    std::string name;
+    int slot;
+    IrType type;
+};
+
+// A lowered expression. Structs are the address of their storage and
+// arrays the address of their first element
+struct IrValue {
+    int id;
+    IrType type;
+    bool is_zero = false; // the constant 0, which also converts to a pointer
+};
+
+thread_local IrFunction* ir_func = NULL;
+thread_local IrBlock* ir_block = NULL;
+thread_local std::vector<std::vector<IrLocal>> ir_scopes;
+thread_local std::string ir_fail; // why ir_func can't be lowered, empty while it can
+
+// A deferred statement with the names it saw where it was written, as a
+// return further in can shadow them
+struct IrDefer {
+    StatementNode* statement;
+    std::vector<std::vector<IrLocal>> scopes;
+};
+
+thread_local std::vector<std::vector<IrDefer>> ir_defers; // for each block being lowered, innermost last
+thread_local bool ir_in_defer = false;
+
+IrValue ir_expr(ExpressionNode* expr);
+IrValue ir_address(ExpressionNode* expr);
+IrValue ir_field(IrValue base, std::string name);
+void ir_statements(std::vector<StatementNode*> statements);
+void ir_cond(ExpressionNode* expr, IrBlock* on_true, IrBlock* on_false);
+
+/* Types */
+
+IrType ir_int(VarType int_type) {
+    IrType type;
+    type.kind = IR_INT;
+    type.int_type = int_type;
+    return type;
+}
+
+IrType ir_bool() {
+    IrType type;
+    type.kind = IR_BOOL;
+    return type;
+}
+
+IrType ir_void() {
+    return IrType();
+}
+
+// Arrays decay to a pointer to their first element
+IrType ir_pointer_to(IrType type) {
+    type.count = -1;
+    type.ptr_level++;
+    return type;
+}
+
+IrType ir_deref(IrType type) {
+    type.ptr_level--;
+    return type;
+}
+
+bool ir_same(IrType a, IrType b) {
+    return a.kind == b.kind && a.ptr_level == b.ptr_level && a.count == b.count &&
+           (a.kind != IR_INT || a.int_type == b.int_type) &&
+           (a.kind != IR_STRUCT || a.record == b.record);
+}
+
+bool ir_is_scalar(IrType type) {
+    return type.count < 0 && (type.ptr_level > 0 || type.kind == IR_INT || type.kind == IR_BOOL);
+}
+
+bool ir_is_pointer(IrType type) {
+    return type.count < 0 && type.ptr_level > 0;
+}
+
+// bool takes part in arithmetic as an integer, like it does in C
+bool ir_is_integer(IrType type) {
+    return type.count < 0 && type.ptr_level == 0 && (type.kind == IR_INT || type.kind == IR_BOOL);
+}
+
+bool ir_is_unsigned(IrType type) {
+    return ir_is_integer(type) && type.kind == IR_INT && fold_is_unsigned(type.int_type);
+}
+
+bool ir_is_struct(IrType type) {
+    return type.count < 0 && type.ptr_level == 0 && type.kind == IR_STRUCT;
+}
+
+std::string ir_int_name(VarType int_type) {
+    switch (int_type) {
+    case TYPE_I8:  return "i8";
+    case TYPE_I16: return "i16";
+    case TYPE_I32: return "i32";
+    case TYPE_I64: return "i64";
+    case TYPE_U8:  return "u8";
+    case TYPE_U16: return "u16";
+    case TYPE_U32: return "u32";
+    default:       return "u64";
+    }
+}
+
+// Written the way the type would be in Atlas, [4]*u8
+std::string ir_type_str(IrType type) {
+    std::string str;
+    if (type.count >= 0) {
+        str += "[" + std::to_string(type.count) + "]";
+    }
+    for (int i = 0; i < type.ptr_level; i++) {
+        str += "*";
+    }
+    switch (type.kind) {
+    case IR_VOID:
+        return str + "void";
+    case IR_BOOL:
+        return str + "bool";
+    case IR_STRUCT:
+        return str + type.record->name->token;
+    default:
+        return str + ir_int_name(type.int_type);
+    }
+}
+
+bool ir_reject(std::string reason) {
+    if (ir_fail.size() == 0) {
+        ir_fail = reason;
+    }
+    return false;
+}
+
+bool ir_type_from_name(std::string name, IrType* type) {
+    Token token;
+    token.token = name;
+    VarType int_type = get_var_type(&token);
+    if (fold_is_integer(int_type) && name != "int") {
+        *type = ir_int(int_type);
+    } else if (name == "bool") {
+        *type = ir_bool();
+    } else if (layout_find_type(name) != NULL) {
+        *type = IrType();
+        type->kind = IR_STRUCT;
+        type->record = layout_find_type(name);
+    } else {
+        return ir_reject("uses the type " + name);
+    }
+    return true;
+}
+
+bool ir_type_from_var(VarNode* var, IrType* type) {
+    if (var->type_ == NULL) {
+        return ir_reject("declares " + var->identifier->token + " without a type");
+    }
+    if (var->is_slice || var->is_dynamic) {
+        return ir_reject("uses the slice " + var->identifier->token);
+    }
+    if (!ir_type_from_name(var->type_->token, type)) {
+        return false;
+    }
+    type->ptr_level = var->ptr_level;
+    if (var->is_array) {
+        if (var->arr_size == NULL || var->arr_size->nt != NODE_CONSTANT) {
+            return ir_reject("declares " + var->identifier->token + " without a constant size");
+        }
+        type->count = var->arr_size->constant->value;
+        type->ptr_level--; // the array counts as one
+    }
+    return true;
+}
+
+/* Sizes, layout.cpp has the layout of structs */
+
+int64_t ir_int_size(VarType int_type) {
+    switch (int_type) {
+    case TYPE_I8:
+    case TYPE_U8:
+        return 1;
+    case TYPE_I16:
+    case TYPE_U16:
+        return 2;
+    case TYPE_I32:
+    case TYPE_U32:
+        return 4;
+    default:
+        return 8;
+    }
+}
+
+// -1 when it can't be known, a struct holding a map for one
+int64_t ir_size_of(IrType type) {
+    int64_t count = type.count < 0 ? 1 : type.count;
+    int64_t size, align, offset;
+    if (type.ptr_level > 0) {
+        size = 8;
+    } else if (type.kind == IR_INT) {
+        size = ir_int_size(type.int_type);
+    } else if (type.kind == IR_BOOL) {
+        size = 4;
+    } else if (type.kind != IR_STRUCT || !layout_record(type.record, "", &offset, &size, &align)) {
+        return -1;
+    }
+    return size * count;
+}
+
+int64_t ir_align_of(IrType type) {
+    int64_t size, align, offset;
+    if (type.ptr_level > 0) {
+        return 8;
+    } else if (type.kind == IR_INT) {
+        return ir_int_size(type.int_type);
+    } else if (type.kind != IR_STRUCT || !layout_record(type.record, "", &offset, &size, &align)) {
+        return 4; // bool
+    }
+    return align;
+}
+
+/* Building blocks */
+
+IrBlock* ir_new_block() {
+    IrBlock* block = new IrBlock;
+    block->id = ir_func->blocks.size();
+    ir_func->blocks.push_back(block);
+    return block;
+}
+
+bool ir_is_terminator(IrOp op) {
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_SWITCH || op == IR_RET;
+}
+
+bool ir_is_terminated(IrBlock* block) {
+    return block->instrs.size() != 0 && ir_is_terminator(block->instrs.back().op);
+}
+
+// Whatever follows a return or a jump goes in a block nothing jumps to,
+// ir_optimize drops it
+void ir_append(IrInstr instr) {
+    if (ir_is_terminated(ir_block)) {
+        ir_block = ir_new_block();
+    }
+    ir_block->instrs.push_back(instr);
+}
+
+IrInstr ir_instr(IrOp op, IrType type) {
+    IrInstr instr;
+    instr.op = op;
+    instr.type = type;
+    return instr;
+}
+
+IrValue ir_emit_value(IrInstr instr) {
+    instr.value = ir_func->values.size();
+    ir_func->values.push_back(instr.type);
+    ir_append(instr);
+    return {instr.value, instr.type};
+}
+
+IrValue ir_failed() {
+    return {-1, ir_int(TYPE_I64)};
+}
+
+IrValue ir_const(uint64_t value, IrType type) {
+    IrInstr instr = ir_instr(IR_CONST, type);
+    instr.imm = type.kind == IR_INT ? fold_cast(value, type.int_type) : value;
+    IrValue ret = ir_emit_value(instr);
+    ret.is_zero = value == 0;
+    return ret;
+}
+
+// Literals get the type C gives them in out.c: int when they fit in one,
+// see codegen_constant
+IrType ir_literal_type(uint64_t value, VarType type) {
+    return ir_int(fold_literal_type(value, type));
+}
+
+int ir_add_slot(std::string name, IrType type) {
+    IrSlot slot;
+    slot.name = name;
+    slot.type = type;
+    ir_func->slots.push_back(slot);
+    return ir_func->slots.size() - 1;
+}
+
+IrValue ir_slot_address(int slot) {
+    IrInstr instr = ir_instr(IR_SLOT, ir_pointer_to(ir_func->slots[slot].type));
+    instr.mem_type = ir_func->slots[slot].type;
+    instr.imm = slot;
+    IrValue ret = ir_emit_value(instr);
+    ret.type = instr.mem_type; // an address and what is there
+    return ret;
+}
+
+void ir_jump(IrBlock* target) {
+    IrInstr instr = ir_instr(IR_JUMP, ir_void());
+    instr.target = target->id;
+    ir_append(instr);
+}
+
+void ir_branch(IrValue cond, IrBlock* on_true, IrBlock* on_false) {
+    IrInstr instr = ir_instr(IR_BRANCH, ir_void());
+    instr.args.push_back(cond.id);
+    instr.target = on_true->id;
+    instr.target_else = on_false->id;
+    ir_append(instr);
+}
+
+void ir_push_scope() {
+    ir_scopes.push_back({});
+}
+
+void ir_pop_scope() {
+    ir_scopes.pop_back();
+}
+
+void ir_add_local(std::string name, int slot, IrType type) {
+    ir_scopes.back().push_back({name, slot, type});
+}
+
+/* Values */
+
+// The object at address, loaded when it fits in a value
+IrValue ir_load(IrValue address, IrType type) {
+    if (type.count >= 0) {
+        IrValue ret = address;
+        ret.type = ir_pointer_to(type);
+        return ret;
+    } else if (ir_is_struct(type)) {
+        IrValue ret = address;
+        ret.type = type;
+        return ret;
+    }
+    IrInstr instr = ir_instr(IR_LOAD, type);
+    instr.mem_type = type;
+    instr.args.push_back(address.id);
+    return ir_emit_value(instr);
+}
+
+// value as type, the way assigning it would convert it in C
+IrValue ir_convert(IrValue value, IrType type, std::string what) {
+    if (ir_fail.size() != 0 || ir_same(value.type, type)) {
+        return value;
+    }
+    bool is_allowed = (ir_is_integer(value.type) && ir_is_integer(type)) ||
+                      (ir_is_pointer(value.type) && ir_is_pointer(type));
+    if (ir_is_pointer(type) && ir_is_integer(value.type) && value.is_zero) {
+        return ir_const(0, type); // NULL
+    }
+    if (!is_allowed) {
+        ir_reject("converts " + ir_type_str(value.type) + " to " + ir_type_str(type) + " in " + what);
+        return ir_failed();
+    }
+    IrInstr instr = ir_instr(IR_CAST, type);
+    instr.args.push_back(value.id);
+    return ir_emit_value(instr);
+}
+
+// The integer promotions and usual arithmetic conversions of C
+IrType ir_promote(IrType type) {
+    if (type.kind == IR_BOOL || ir_int_size(type.int_type) < 4) {
+        return ir_int(TYPE_I32);
+    }
+    return type;
+}
+
+IrType ir_common_type(IrType a, IrType b) {
+    a = ir_promote(a);
+    b = ir_promote(b);
+    if (ir_same(a, b)) {
+        return a;
+    }
+    int64_t a_size = ir_int_size(a.int_type);
+    int64_t b_size = ir_int_size(b.int_type);
+    if (ir_is_unsigned(a) == ir_is_unsigned(b)) {
+        return a_size > b_size ? a : b;
+    }
+    IrType u = ir_is_unsigned(a) ? a : b;
+    IrType s = ir_is_unsigned(a) ? b : a;
+    return ir_int_size(u.int_type) >= ir_int_size(s.int_type) ? u : s;
+}
+
+IrValue ir_binary(IrOp op, IrValue lhs, IrValue rhs, IrType type) {
+    IrInstr instr = ir_instr(op, type);
+    instr.args.push_back(lhs.id);
+    instr.args.push_back(rhs.id);
+    return ir_emit_value(instr);
+}
+
+// p + n and p - n step by elements
+IrValue ir_index(IrValue pointer, IrValue index) {
+    IrValue offset = ir_convert(index, ir_int(TYPE_I64), "an index");
+    IrInstr instr = ir_instr(IR_INDEX, pointer.type);
+    instr.mem_type = ir_deref(pointer.type);
+    instr.args.push_back(pointer.id);
+    instr.args.push_back(offset.id);
+    return ir_emit_value(instr);
+}
+
+// The instruction defining value, looked for from the end as it is
+// nearly always close
+IrInstr* ir_find_def(int value) {
+    for (int b = ir_func->blocks.size() - 1; b >= 0; b--) {
+        std::vector<IrInstr>& instrs = ir_func->blocks[b]->instrs;
+        for (int i = instrs.size() - 1; i >= 0; i--) {
+            if (instrs[i].value == value) {
+                return &instrs[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+// --bounds-check, index as an i64 after a check that it is inside what
+// pointer points into. That is known for fixed arrays, which are their
+// address, and for the bytes of a string, loaded from its str field next
+// to len. Any other pointer goes unchecked
+IrValue ir_bounds(IrValue pointer, IrValue index, int line) {
+    index = ir_convert(index, ir_int(TYPE_I64), "an index");
+    IrInstr* def = ir_find_def(pointer.id);
+    if (ir_fail.size() != 0 || def == NULL) {
+        return index;
+    }
+    IrValue length;
+    bool is_array = def->op == IR_SLOT || def->op == IR_GLOBAL || def->op == IR_FIELD || def->op == IR_INDEX;
+    IrInstr* field = def->op == IR_LOAD ? ir_find_def(def->args[0]) : NULL;
+    IrType record = field != NULL && field->op == IR_FIELD ? ir_func->values[field->args[0]] : ir_void();
+    if (is_array && def->mem_type.count >= 0) {
+        length = ir_const(def->mem_type.count, ir_int(TYPE_I64));
+    } else if (record.kind == IR_STRUCT && record.ptr_level == 1 && field->name == "str" &&
+               record.record->name->token == "string") {
+        IrValue string = {field->args[0], record};
+        IrValue len = ir_field(string, "len");
+        length = ir_convert(ir_load(len, len.type), ir_int(TYPE_I64), "a length");
+    } else {
+        return index;
+    }
+    IrInstr instr = ir_instr(IR_CHECK, ir_void());
+    instr.args.push_back(index.id);
+    instr.args.push_back(length.id);
+    instr.imm = line;
+    ir_append(instr);
+    return index;
+}
+
+IrOp ir_op_for(TokenType tt) {
+    switch (tt) {
+    case TK_PLUS:      return IR_ADD;
+    case TK_DASH:      return IR_SUB;
+    case TK_STAR:      return IR_MUL;
+    case TK_SLASH:     return IR_DIV;
+    case TK_PERCENT:   return IR_MOD;
+    case TK_EQUAL:     return IR_EQ;
+    case TK_NOT_EQUAL: return IR_NE;
+    case TK_LT:        return IR_LT;
+    case TK_LTE:       return IR_LE;
+    case TK_GT:        return IR_GT;
+    default:           return IR_GE;
+    }
+}
+
+IrValue ir_arithmetic(IrOp op, IrValue lhs, IrValue rhs, std::string op_str) {
+    if (op == IR_ADD && ir_is_integer(lhs.type) && ir_is_pointer(rhs.type)) {
+        std::swap(lhs, rhs);
+    }
+    if ((op == IR_ADD || op == IR_SUB) && ir_is_pointer(lhs.type) && ir_is_integer(rhs.type)) {
+        if (lhs.type.kind == IR_VOID && lhs.type.ptr_level == 1) {
+            ir_reject("does arithmetic on a *void");
+            return ir_failed();
+        }
+        if (op == IR_SUB) {
+            IrInstr neg = ir_instr(IR_NEG, ir_int(TYPE_I64));
+            neg.args.push_back(ir_convert(rhs, ir_int(TYPE_I64), "an index").id);
+            rhs = ir_emit_value(neg);
+        }
+        return ir_index(lhs, rhs);
+    }
+    if (op == IR_SUB && ir_is_pointer(lhs.type) && ir_same(lhs.type, rhs.type)) {
+        return ir_binary(IR_SUB, lhs, rhs, ir_int(TYPE_I64)); // elements between them
+    }
+    if (!ir_is_integer(lhs.type) || !ir_is_integer(rhs.type)) {
+        ir_reject("uses " + op_str + " on " + ir_type_str(lhs.type) + " and " + ir_type_str(rhs.type));
+        return ir_failed();
+    }
+    IrType type = ir_common_type(lhs.type, rhs.type);
+    return ir_binary(op, ir_convert(lhs, type, op_str), ir_convert(rhs, type, op_str), type);
+}
+
+IrValue ir_compare(IrOp op, IrValue lhs, IrValue rhs, std::string op_str) {
+    if (ir_is_integer(lhs.type) && ir_is_integer(rhs.type)) {
+        IrType type = ir_common_type(lhs.type, rhs.type);
+        lhs = ir_convert(lhs, type, op_str);
+        rhs = ir_convert(rhs, type, op_str);
+    } else if (ir_is_pointer(lhs.type) && (ir_is_pointer(rhs.type) || rhs.is_zero)) {
+        rhs = ir_convert(rhs, lhs.type, op_str);
+    } else if (ir_is_pointer(rhs.type) && lhs.is_zero) {
+        lhs = ir_convert(lhs, rhs.type, op_str);
+    } else {
+        ir_reject("uses " + op_str + " on " + ir_type_str(lhs.type) + " and " + ir_type_str(rhs.type));
+        return ir_failed();
+    }
+    return ir_binary(op, lhs, rhs, ir_bool());
+}
+
+// The value of a condition, taken apart so && and || branch
+IrValue ir_cond_value(ExpressionNode* expr) {
+    int slot = ir_add_slot("cond", ir_bool());
+    IrBlock* on_true = ir_new_block();
+    IrBlock* on_false = ir_new_block();
+    IrBlock* end = ir_new_block();
+    ir_cond(expr, on_true, on_false);
+    IrBlock* blocks[] = {on_true, on_false};
+    for (int i = 0; i < 2; i++) {
+        ir_block = blocks[i];
+        IrInstr store = ir_instr(IR_STORE, ir_void());
+        store.mem_type = ir_bool();
+        store.args.push_back(ir_slot_address(slot).id);
+        store.args.push_back(ir_const(i == 0, ir_bool()).id);
+        ir_append(store);
+        ir_jump(end);
+    }
+    ir_block = end;
+    return ir_load(ir_slot_address(slot), ir_bool());
+}
+
+void ir_cond(ExpressionNode* expr, IrBlock* on_true, IrBlock* on_false) {
+    if (expr->nt == NODE_BINOP && (expr->binop->op->tt == TK_LOGICAL_AND ||
+                                   expr->binop->op->tt == TK_LOGICAL_OR)) {
+        IrBlock* rhs = ir_new_block();
+        if (expr->binop->op->tt == TK_LOGICAL_AND) {
+            ir_cond(expr->binop->lhs, rhs, on_false);
+        } else {
+            ir_cond(expr->binop->lhs, on_true, rhs);
+        }
+        ir_block = rhs;
+        ir_cond(expr->binop->rhs, on_true, on_false);
+        return;
+    }
+    if (expr->nt == NODE_UNARY && expr->unary_op->operator_type == NODE_UNARY &&
+        expr->unary_op->op->tt == TK_NOT) {
+        ir_cond(expr->unary_op->operand, on_false, on_true);
+        return;
+    }
+    IrValue value = ir_expr(expr);
+    if (!ir_is_scalar(value.type)) {
+        ir_reject("tests a " + ir_type_str(value.type));
+    }
+    ir_branch(value, on_true, on_false);
+}
+
+/* Stores */
+
+IrValue ir_call(CallNode* call, IrValue* dest);
+
+void ir_store(IrValue address, IrType type, IrValue value) {
+    IrInstr instr = ir_instr(ir_is_struct(type) ? IR_COPY : IR_STORE, ir_void());
+    instr.mem_type = type;
+    instr.args.push_back(address.id);
+    instr.args.push_back(value.id);
+    ir_append(instr);
+}
+
+void ir_zero(IrValue address, IrType type) {
+    IrInstr instr = ir_instr(IR_ZERO, ir_void());
+    instr.mem_type = type;
+    instr.args.push_back(address.id);
+    ir_append(instr);
+}
+
+// expr stored at address, a struct returned by a call is written there
+// directly. Gives back what was stored
+IrValue ir_store_expr(IrValue address, IrType type, ExpressionNode* expr) {
+    if (type.count >= 0) {
+        ir_reject("assigns to an array");
+        return ir_failed();
+    }
+    if (ir_is_struct(type)) {
+        IrValue value;
+        if (expr->nt == NODE_CALL) {
+            value = ir_call(expr->call_node, &address);
+            if (ir_fail.size() == 0 && !ir_same(value.type, type)) {
+                ir_reject("assigns " + ir_type_str(value.type) + " to " + ir_type_str(type));
+            }
+            return address;
+        }
+        value = ir_expr(expr);
+        if (ir_fail.size() == 0 && !ir_same(value.type, type)) {
+            ir_reject("assigns " + ir_type_str(value.type) + " to " + ir_type_str(type));
+            return ir_failed();
+        }
+        ir_store(address, type, value);
+        return address;
+    }
+    IrValue value = ir_convert(ir_expr(expr), type, "an assignment");
+    ir_store(address, type, value);
+    return value;
+}
+
+// Initial value of a declaration. Array and struct literals with fewer
+// values than elements leave the rest zeroed, as they do in C
+void ir_init(IrValue address, IrType type, ExpressionNode* rhs) {
+    if (rhs == NULL) {
+        if (type.count >= 0) {
+            ir_zero(address, type);
+        }
+        return;
+    }
+    std::vector<ExpressionNode*> values;
+    if (type.count >= 0 && rhs->nt == NODE_SUBSCRIPT) {
+        values = rhs->subscript->indexes;
+    } else if (type.count >= 0 && rhs->nt == NODE_ARRAY_EXPR) {
+        values = rhs->array->elements;
+    } else if ((type.count >= 0 || ir_is_struct(type)) && rhs->nt == NODE_TYPE_INST) {
+        values = rhs->type_inst->values;
+    } else {
+        ir_store_expr(address, type, rhs);
+        return;
+    }
+    int64_t count = type.count >= 0 ? type.count : type.record->declarations.size();
+    if (values.size() > count) {
+        ir_reject("has too many values in an initializer");
+        return;
+    }
+    if (values.size() < count) {
+        ir_zero(address, type);
+    }
+    for (int i = 0; i < values.size(); i++) {
+        if (type.count >= 0) {
+            IrType elem = type;
+            elem.count = -1;
+            IrValue base = address;
+            base.type = ir_pointer_to(type);
+            IrValue element = ir_index(base, ir_const(i, ir_int(TYPE_I64)));
+            ir_init(element, elem, values[i]);
+            continue;
+        }
+        IrType field;
+        if (!ir_type_from_var(type.record->declarations[i]->lhs, &field)) {
+            return;
+        }
+        std::string name = type.record->declarations[i]->lhs->identifier->token;
+        int64_t offset = -1, size, align;
+        layout_record(type.record, name, &offset, &size, &align);
+        IrInstr instr = ir_instr(IR_FIELD, ir_pointer_to(field));
+        instr.mem_type = field;
+        instr.name = name;
+        instr.imm = offset;
+        instr.args.push_back(address.id);
+        ir_init(ir_emit_value(instr), field, values[i]);
+    }
+}
+
+/* Expressions */
+
+// The local or global variable called name, NULL type when there is none
+bool ir_lookup(std::string name, IrValue* address) {
+    for (int i = ir_scopes.size() - 1; i >= 0; i--) {
+        for (int j = ir_scopes[i].size() - 1; j >= 0; j--) {
+            if (ir_scopes[i][j].name == name) {
+                *address = ir_slot_address(ir_scopes[i][j].slot);
+                return true;
+            }
+        }
+    }
+    for (VarDeclNode* global : ir_globals) {
+        if (global->lhs->identifier->token != name) {
+            continue;
+        }
+        IrType type;
+        if (!ir_type_from_var(global->lhs, &type)) {
+            *address = ir_failed();
+            return true;
+        }
+        IrInstr instr = ir_instr(IR_GLOBAL, ir_pointer_to(type));
+        instr.mem_type = type;
+        instr.name = name;
+        *address = ir_emit_value(instr);
+        address->type = type;
+        return true;
+    }
+    return false;
+}
+
+IrValue ir_field(IrValue base, std::string name) {
+    if (ir_is_pointer(base.type) && base.type.ptr_level == 1 && base.type.kind == IR_STRUCT) {
+        base.type = ir_deref(base.type); // r.fd on a *Reader
+    } else if (!ir_is_struct(base.type)) {
+        ir_reject("takes the field " + name + " of a " + ir_type_str(base.type));
+        return ir_failed();
+    }
+    TypeNode* record = base.type.record;
+    VarNode* field = NULL;
+    for (VarDeclNode* decl : record->declarations) {
+        if (decl->lhs->identifier->token == name) {
+            field = decl->lhs;
+        }
+    }
+    if (field == NULL) {
+        print_error_msg("\"" + record->name->token + "\" has no field called \"" + name + "\"");
+        error_abort();
+    }
+    IrType type;
+    if (!ir_type_from_var(field, &type)) {
+        return ir_failed();
+    }
+    int64_t offset = -1, size, align;
+    layout_record(record, name, &offset, &size, &align);
+    IrInstr instr = ir_instr(IR_FIELD, ir_pointer_to(type));
+    instr.mem_type = type;
+    instr.name = name;
+    instr.imm = offset;
+    instr.args.push_back(base.id);
+    IrValue ret = ir_emit_value(instr);
+    ret.type = type;
+    return ret;
+}
+
+// Where expr is kept, with the type of what is there
+IrValue ir_address(ExpressionNode* expr) {
+    switch (expr->nt) {
+    case NODE_VAR:
+    {
+        std::string name = expr->var_node->identifier->token;
+        IrValue address;
+        if (!ir_lookup(name, &address)) {
+            ir_reject("uses " + name + ", which the IR can't see");
+            return ir_failed();
+        }
+        return address;
+    }
+    case NODE_BINOP:
+        if (expr->binop->op->tt == TK_DOT) {
+            IrValue base = ir_address(expr->binop->lhs);
+            if (ir_is_pointer(base.type)) {
+                base = ir_load(base, base.type);
+            }
+            return ir_field(base, expr->binop->rhs->var_node->identifier->token);
+        } else if (expr->binop->op->tt == TK_SQUARE_OPEN) {
+            IrValue base = ir_expr(expr->binop->lhs);
+            if (!ir_is_pointer(base.type)) {
+                ir_reject("indexes a " + ir_type_str(base.type));
+                return ir_failed();
+            }
+            IrValue index = ir_expr(expr->binop->rhs);
+            if (global_state->bounds_check) {
+                index = ir_bounds(base, index, expr->binop->op->line);
+            }
+            IrValue ret = ir_index(base, index);
+            ret.type = ir_deref(base.type);
+            return ret;
+        }
+        break;
+    case NODE_UNARY:
+        if (expr->unary_op->operator_type == NODE_UNARY && expr->unary_op->op->tt == TK_STAR) {
+            IrValue pointer = ir_expr(expr->unary_op->operand);
+            if (!ir_is_pointer(pointer.type)) {
+                ir_reject("dereferences a " + ir_type_str(pointer.type));
+                return ir_failed();
+            }
+            pointer.type = ir_deref(pointer.type);
+            return pointer;
+        }
+        break;
+    case NODE_CALL:
+    case NODE_QUOTE:
+    {
+        IrValue value = ir_expr(expr);
+        if (ir_is_struct(value.type)) {
+            return value; // already in a temporary, "abc".len
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    ir_reject("takes the address of a " + std::string(get_nt_str(expr->nt)));
+    return ir_failed();
+}
+
+bool ir_char_value(std::string text, int64_t* value) {
+    if (text.size() == 1) {
+        *value = (signed char)text[0];
+        return true;
+    } else if (text.size() != 2 || text[0] != '\\') {
+        return false;
+    }
+    switch (text[1]) {
+    case 'n':  *value = '\n'; return true;
+    case 't':  *value = '\t'; return true;
+    case 'r':  *value = '\r'; return true;
+    case '0':  *value = 0;    return true;
+    case '\\': *value = '\\'; return true;
+    case '\'': *value = '\''; return true;
+    case '"':  *value = '"';  return true;
+    default:   return false;
+    }
+}
+
+// How the runtime functions are called, see codegen_get_intrinsic_name
+bool ir_intrinsic_signature(std::string name, IrType* result, std::vector<IrType>* params) {
+    IrType ptr = ir_pointer_to(ir_void());
+    IrType str = ir_pointer_to(ir_int(TYPE_U8));
+    IrType i32 = ir_int(TYPE_I32);
+    IrType i64 = ir_int(TYPE_I64);
+    IrType u64 = ir_int(TYPE_U64);
+    if (name == "putchar") {
+        *result = ir_void(), *params = {ir_int(TYPE_U8)};
+    } else if (name == "exit") {
+        *result = ir_void(), *params = {i32};
+    } else if (name == "alloc") {
+        *result = ptr, *params = {u64};
+    } else if (name == "free") {
+        *result = ir_void(), *params = {ptr};
+    } else if (name == "open") {
+        *result = i32, *params = {str, i32, i32};
+    } else if (name == "close") {
+        *result = i32, *params = {i32};
+    } else if (name == "read" || name == "write") {
+        *result = i64, *params = {i32, ptr, u64};
+    } else if (name == "lseek") {
+        *result = i64, *params = {i32, i64, i32};
+    } else if (name == "fstat") {
+        *result = i64, *params = {i32};
+    } else if (name == "memcpy" || name == "memmove") {
+        *result = ptr, *params = {ptr, ptr, u64};
+    } else if (name == "memset" || name == "memchr") {
+        *result = ptr, *params = {ptr, i32, u64};
+    } else if (name == "memcmp") {
+        *result = i32, *params = {ptr, ptr, u64};
+    } else if (name == "time_ns") {
+        *result = u64, *params = {};
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Arguments converted to the parameters. A struct goes by value, from
+// the address it is at
+IrValue ir_call_with(IrInstr instr, std::vector<IrValue> args, std::vector<IrType> params,
+                     IrValue* dest) {
+    std::string name = instr.name;
+    for (int i = 0; i < args.size(); i++) {
+        IrValue arg = args[i];
+        if (ir_is_struct(params[i]) && ir_fail.size() == 0 && !ir_same(arg.type, params[i])) {
+            ir_reject("passes " + ir_type_str(arg.type) + " to " + name);
+        } else if (!ir_is_struct(params[i])) {
+            arg = ir_convert(arg, params[i], "a call to " + name);
+        }
+        instr.args.push_back(arg.id);
+        instr.arg_types.push_back(params[i]);
+    }
+    if (ir_is_struct(instr.type)) {
+        IrValue address = dest != NULL ? *dest : ir_slot_address(ir_add_slot("ret", instr.type));
+        instr.dest = address.id;
+        IrType type = instr.type;
+        instr.type = ir_void();
+        ir_append(instr);
+        address.type = type;
+        return address;
+    } else if (instr.type.kind == IR_VOID && instr.type.ptr_level == 0) {
+        ir_append(instr);
+        return {-1, ir_void()};
+    }
+    return ir_emit_value(instr);
+}
+
+IrValue ir_call_function(FunctionNode* callee, std::vector<IrValue> args, IrValue* dest) {
+    std::string name = callee->token->token;
+    if (callee->return_vars.size() > 1) {
+        ir_reject("calls " + name + ", which returns several values");
+        return ir_failed();
+    }
+    if (args.size() != callee->params.size()) {
+        print_error_msg("\"" + name + "\" takes " + std::to_string(callee->params.size())
+                        + " arguments but " + std::to_string(args.size()) + " were given");
+        error_abort();
+    }
+    std::vector<IrType> params;
+    for (ParamNode* param : callee->params) {
+        IrType type;
+        if (!ir_type_from_var(param, &type)) {
+            return ir_failed();
+        }
+        params.push_back(type);
+    }
+    IrType result = ir_void();
+    if (callee->return_var != NULL && !ir_type_from_var(callee->return_var, &result)) {
+        return ir_failed();
+    }
+    IrInstr instr = ir_instr(IR_CALL, result);
+    instr.name = callee->mangled_name;
+    return ir_call_with(instr, args, params, dest);
+}
+
+IrValue ir_call(CallNode* call, IrValue* dest) {
+    std::string name = call->name->token;
+    FunctionNode* callee = codegen_get_function(name);
+    if (name == "sizeof" && callee == NULL && call->args.size() == 1 && call->args[0]->nt == NODE_VAR) {
+        std::string type_name = call->args[0]->var_node->identifier->token;
+        IrType type;
+        IrValue address;
+        if (layout_find_type(type_name) == NULL && ir_lookup(type_name, &address)) {
+            type = address.type; // sizeof a variable
+        } else if (!ir_type_from_name(type_name, &type)) {
+            return ir_failed();
+        }
+        IrInstr instr = ir_instr(IR_SIZEOF, ir_int(TYPE_U64));
+        instr.mem_type = type;
+        instr.imm = ir_size_of(type);
+        return ir_emit_value(instr);
+    }
+    if (name == "len" && callee == NULL && call->args.size() == 1) {
+        IrValue address = ir_address(call->args[0]);
+        if (address.type.count < 0) {
+            ir_reject("takes len of a " + ir_type_str(address.type));
+            return ir_failed();
+        }
+        return ir_const(address.type.count, ir_literal_type(address.type.count, TYPE_I64));
+    }
+    std::vector<IrValue> args;
+    for (ExpressionNode* arg : call->args) {
+        args.push_back(ir_expr(arg));
+    }
+    if (callee != NULL) {
+        return ir_call_function(callee, args, dest);
+    }
+    IrType result;
+    std::vector<IrType> params;
+    if (!codegen_is_intrinsic_function(name) || !ir_intrinsic_signature(name, &result, &params) ||
+        params.size() != args.size()) {
+        ir_reject("calls " + name);
+        return ir_failed();
+    }
+    IrInstr instr = ir_instr(IR_INTRINSIC, result);
+    instr.name = name;
+    return ir_call_with(instr, args, params, dest);
+}
+
+// "abc" is a string made by atlas_create_string, as codegen_quote does
+IrValue ir_quote(QuoteNode* quote) {
+    FunctionNode* create = codegen_get_function("atlas_create_string");
+    if (create == NULL) {
+        ir_reject("uses a string literal without atlas_create_string");
+        return ir_failed();
+    }
+    std::string text = quote->quote_token->token;
+    int index = -1;
+    for (int i = 0; i < ir_strings.size(); i++) {
+        if (ir_strings[i] == text) {
+            index = i;
+        }
+    }
+    if (index < 0) {
+        ir_strings.push_back(text);
+        index = ir_strings.size() - 1;
+    }
+    int len = 0;
+    for (int i = 0; i < text.size(); i++) {
+        i += text[i] == '\\';
+        len++;
+    }
+    IrInstr instr = ir_instr(IR_STRING, ir_pointer_to(ir_int(TYPE_U8)));
+    instr.imm = index;
+    std::vector<IrValue> args = {ir_emit_value(instr), ir_const(len, ir_int(TYPE_U64))};
+    return ir_call_function(create, args, NULL);
+}
+
+IrValue ir_unary(UnaryOpNode* unary_op) {
+    if (unary_op->operator_type != NODE_UNARY) {
+        ir_reject("has a " + std::string(get_nt_str(unary_op->operator_type)) + " expression");
+        return ir_failed();
+    }
+    switch (unary_op->op->tt) {
+    case TK_DASH:
+    {
+        IrValue operand = ir_expr(unary_op->operand);
+        if (!ir_is_integer(operand.type)) {
+            ir_reject("negates a " + ir_type_str(operand.type));
+            return ir_failed();
+        }
+        IrType type = ir_promote(operand.type);
+        IrInstr instr = ir_instr(IR_NEG, type);
+        instr.args.push_back(ir_convert(operand, type, "-").id);
+        return ir_emit_value(instr);
+    }
+    case TK_NOT:
+    {
+        IrValue operand = ir_expr(unary_op->operand);
+        if (!ir_is_scalar(operand.type)) {
+            ir_reject("uses ! on a " + ir_type_str(operand.type));
+            return ir_failed();
+        }
+        IrInstr instr = ir_instr(IR_NOT, ir_bool());
+        instr.args.push_back(operand.id);
+        return ir_emit_value(instr);
+    }
+    case TK_STAR:
+    {
+        ExpressionNode expr;
+        expr.nt = NODE_UNARY;
+        expr.unary_op = unary_op;
+        IrValue address = ir_address(&expr);
+        return ir_load(address, address.type);
+    }
+    case TK_AMPERSAND:
+    {
+        IrValue address = ir_address(unary_op->operand);
+        address.type = ir_pointer_to(address.type); // &arr points at its first element
+        return address;
+    }
+    default:
+        ir_reject("uses the operator " + unary_op->op->token);
+        return ir_failed();
+    }
+}
+
+IrValue ir_expr(ExpressionNode* expr) {
+    if (ir_fail.size() != 0) {
+        return ir_failed();
+    }
+    switch (expr->nt) {
+    case NODE_CONSTANT:
+        return ir_const(expr->constant->value,
+                        ir_literal_type(expr->constant->value, expr->constant->type));
+    case NODE_CHAR:
+    {
+        int64_t value;
+        if (!ir_char_value(expr->character->value, &value)) {
+            ir_reject("uses the character '" + expr->character->value + "'");
+            return ir_failed();
+        }
+        return ir_const(value, ir_int(TYPE_I32));
+    }
+    case NODE_QUOTE:
+        return ir_quote(expr->quote);
+    case NODE_VAR:
+    {
+        std::string name = expr->var_node->identifier->token;
+        IrValue address;
+        if ((name == "true" || name == "false") && !ir_lookup(name, &address)) {
+            return ir_const(name == "true", ir_bool());
+        }
+        address = ir_address(expr);
+        return ir_load(address, address.type);
+    }
+    case NODE_CALL:
+        return ir_call(expr->call_node, NULL);
+    case NODE_UNARY:
+        return ir_unary(expr->unary_op);
+    case NODE_BINOP:
+    {
+        TokenType tt = expr->binop->op->tt;
+        std::string op_str = expr->binop->op->token;
+        if (tt == TK_DOT || tt == TK_SQUARE_OPEN) {
+            IrValue address = ir_address(expr);
+            return ir_load(address, address.type);
+        } else if (tt == TK_ASSIGN) {
+            IrValue address = ir_address(expr->binop->lhs);
+            return ir_store_expr(address, address.type, expr->binop->rhs);
+        } else if (tt == TK_LOGICAL_AND || tt == TK_LOGICAL_OR) {
+            return ir_cond_value(expr);
+        }
+        IrValue lhs = ir_expr(expr->binop->lhs);
+        IrValue rhs = ir_expr(expr->binop->rhs);
+        if (ir_fail.size() != 0) {
+            return ir_failed();
+        }
+        IrOp op = ir_op_for(tt);
+        if (op >= IR_EQ) {
+            return ir_compare(op, lhs, rhs, op_str);
+        }
+        return ir_arithmetic(op, lhs, rhs, op_str);
+    }
+    default:
+        ir_reject("has a " + std::string(get_nt_str(expr->nt)) + " expression");
+        return ir_failed();
+    }
+}
+
+/* Statements */
+
+void ir_var_decl(VarDeclNode* var_decl) {
+    if (var_decl->is_static) {
+        ir_reject("has the static variable " + var_decl->lhs->identifier->token);
+        return;
+    } else if (var_decl->destructure.size() != 0) {
+        ir_reject("destructures a multi-value return");
+        return;
+    }
+    IrType type;
+    if (!ir_type_from_var(var_decl->lhs, &type)) {
+        return;
+    }
+    std::string name = var_decl->lhs->identifier->token;
+    int slot = ir_add_slot(name, type);
+    ir_init(ir_slot_address(slot), type, var_decl->rhs);
+    ir_add_local(name, slot, type);
+}
+
+// Lowers the defers of the blocks from level on, innermost and latest first
+void ir_run_defers(int level) {
+    bool was_in_defer = ir_in_defer;
+    std::vector<std::vector<IrLocal>> scopes = ir_scopes;
+    ir_in_defer = true;
+    for (int b = ir_defers.size() - 1; b >= level; b--) {
+        for (int d = ir_defers[b].size() - 1; d >= 0; d--) {
+            ir_scopes = ir_defers[b][d].scopes;
+            ir_statements({ir_defers[b][d].statement});
+        }
+    }
+    ir_scopes = scopes;
+    ir_in_defer = was_in_defer;
+}
+
+bool ir_has_defers() {
+    for (std::vector<IrDefer>& defers : ir_defers) {
+        if (defers.size() != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The call a -> tail return was lowered to, the last thing in the block
+void ir_mark_tail(ReturnNode* ret) {
+    if (ret->is_tail && ir_block->instrs.size() != 0 && ir_block->instrs.back().op == IR_CALL) {
+        ir_block->instrs.back().is_tail = true;
+    }
+}
+
+void ir_return(ReturnNode* ret) {
+    IrInstr instr = ir_instr(IR_RET, ir_void());
+    IrType type = ir_func->return_type;
+    if (ir_in_defer) {
+        ir_reject("returns from a deferred statement");
+        return;
+    }
+    if (ret->exprs.size() > 1) {
+        ir_reject("returns several values");
+        return;
+    }
+    bool is_tail_call = ret->expr != NULL && (ret->is_tail || ret->is_self_tail);
+    if (ret->expr != NULL && type.kind == IR_VOID && type.ptr_level == 0 && is_tail_call) {
+        // -> f(x) where f doesn't return anything either, tail_start checked it
+        ir_expr(ret->expr);
+        ir_mark_tail(ret);
+        ir_append(instr);
+        return;
+    } else if (ret->expr != NULL && type.kind == IR_VOID && type.ptr_level == 0) {
+        ir_reject("returns a value from a function without a result");
+        return;
+    } else if (ret->expr == NULL && (type.kind != IR_VOID || type.ptr_level != 0)) {
+        ir_reject("returns nothing from a function with a result");
+        return;
+    }
+    if (ret->is_tail && !ret->is_self_tail && ir_is_struct(type)) {
+        ir_reject("makes a tail call returning a struct");
+        return;
+    }
+    if (ret->expr != NULL && ir_is_struct(type)) {
+        IrValue value = ir_expr(ret->expr); // the address of a struct, copied out by the return
+        if (ir_fail.size() == 0 && !ir_same(value.type, type)) {
+            ir_reject("returns " + ir_type_str(value.type) + " as " + ir_type_str(type));
+        }
+        if (ir_has_defers()) {
+            // copied before the defers can change it
+            IrValue copy = ir_slot_address(ir_add_slot("ret", type));
+            ir_store(copy, type, value);
+            value = copy;
+        }
+        instr.args.push_back(value.id);
+    } else if (ret->expr != NULL) {
+        IrValue value = ir_expr(ret->expr);
+        ir_mark_tail(ret);
+        instr.args.push_back(ir_convert(value, type, "a return").id);
+    }
+    ir_run_defers(0);
+    ir_append(instr);
+}
+
+void ir_block_statements(BlockNode* block) {
+    ir_push_scope();
+    ir_defers.push_back({});
+    ir_statements(block->statements);
+    if (!ir_is_terminated(ir_block)) {
+        ir_run_defers(ir_defers.size() - 1);
+    }
+    ir_defers.pop_back();
+    ir_pop_scope();
+}
+
+void ir_if(IfNode* if_node) {
+    IrBlock* then = ir_new_block();
+    IrBlock* other = if_node->_else != NULL ? ir_new_block() : NULL;
+    IrBlock* end = ir_new_block();
+    ir_cond(if_node->condition, then, other != NULL ? other : end);
+    ir_block = then;
+    ir_block_statements(if_node->block);
+    ir_jump(end);
+    if (other != NULL) {
+        ir_block = other;
+        if (if_node->_else->block != NULL) {
+            ir_block_statements(if_node->_else->block);
+        } else {
+            ir_if(if_node->_else->else_if->if_lhs);
+        }
+        ir_jump(end);
+    }
+    ir_block = end;
+}
+
+// A switch to a block per arm, which ir_c writes back as a C switch. The
+// else arm, or the end when there is none, takes what no case covers
+void ir_match(MatchNode* match) {
+    IrValue value = ir_expr(match->value);
+    if (ir_fail.size() != 0) {
+        return;
+    } else if ((value.type.kind != IR_INT && value.type.kind != IR_BOOL) || value.type.ptr_level != 0) {
+        ir_reject("has a match on a " + ir_type_str(value.type));
+        return;
+    }
+    fold_match_check(match, value.type.kind == IR_INT ? value.type.int_type : TYPE_INVALID);
+    IrInstr instr = ir_instr(IR_SWITCH, ir_void());
+    instr.args.push_back(value.id);
+    std::vector<IrBlock*> arms;
+    for (MatchArm* arm : match->arms) {
+        arms.push_back(ir_new_block());
+        for (MatchCase& match_case : arm->cases) {
+            instr.cases.push_back({match_case.lo, match_case.hi, arms.back()->id});
+        }
+    }
+    IrBlock* other = match->else_block != NULL ? ir_new_block() : NULL;
+    IrBlock* end = ir_new_block();
+    instr.target_else = other != NULL ? other->id : end->id;
+    ir_append(instr);
+    for (int i = 0; i < arms.size(); i++) {
+        ir_block = arms[i];
+        ir_block_statements(match->arms[i]->block);
+        ir_jump(end);
+    }
+    if (other != NULL) {
+        ir_block = other;
+        ir_block_statements(match->else_block);
+        ir_jump(end);
+    }
+    ir_block = end;
+}
+
+// The type i takes in for i in a..b, as codegen_range_type picks it
+IrType ir_range_type(ExpressionNode* end) {
+    if (end->nt == NODE_VAR) {
+        IrValue address;
+        if (ir_lookup(end->var_node->identifier->token, &address) &&
+            address.type.kind == IR_INT && address.type.ptr_level == 0 && address.type.count < 0) {
+            return address.type;
+        }
+    } else if (end->nt == NODE_CONSTANT && end->constant->type == TYPE_U64) {
+        return ir_int(TYPE_U64);
+    }
+    return ir_int(TYPE_I64);
+}
+
+// for i in a..b counts up to an end evaluated once, for x in arr walks a
+// pointer up to one past the last element, like codegen_for_each
+void ir_for_each(ForNode* for_node) {
+    std::string name = for_node->each_var->token;
+    IrBlock* test = ir_new_block();
+    IrBlock* body = ir_new_block();
+    IrBlock* exit = ir_new_block();
+    ir_push_scope();
+    if (for_node->range_end != NULL) {
+        IrType type = ir_range_type(for_node->range_end);
+        int slot = ir_add_slot(name, type);
+        IrValue start = ir_convert(ir_expr(for_node->iterable), type, "a range");
+        ir_store(ir_slot_address(slot), type, start);
+        IrValue end = ir_convert(ir_expr(for_node->range_end), type, "a range");
+        ir_jump(test);
+        ir_block = test;
+        IrValue i = ir_load(ir_slot_address(slot), type);
+        ir_branch(ir_compare(IR_LT, i, end, "<"), body, exit);
+        ir_block = body;
+        ir_add_local(name, slot, type);
+        ir_block_statements(for_node->block);
+        IrValue next = ir_binary(IR_ADD, ir_load(ir_slot_address(slot), type), ir_const(1, type), type);
+        ir_store(ir_slot_address(slot), type, next);
+        ir_jump(test);
+        ir_block = exit;
+        ir_pop_scope();
+        return;
+    }
+    IrValue iterable = ir_address(for_node->iterable);
+    IrValue base, len;
+    if (iterable.type.count >= 0) {
+        base = ir_load(iterable, iterable.type);
+        len = ir_const(iterable.type.count, ir_int(TYPE_I64));
+    } else if (ir_is_struct(iterable.type) && iterable.type.record->name->token == "string") {
+        base = ir_load(ir_field(iterable, "str"), ir_pointer_to(ir_int(TYPE_U8)));
+        len = ir_load(ir_field(iterable, "len"), ir_int(TYPE_U64));
+    } else {
+        ir_reject("has a for each over a " + ir_type_str(iterable.type));
+        ir_pop_scope();
+        return;
+    }
+    IrType elem = ir_deref(base.type);
+    int p = ir_add_slot("each", base.type);
+    ir_store(ir_slot_address(p), base.type, base);
+    IrValue end = ir_index(base, len);
+    ir_jump(test);
+    ir_block = test;
+    ir_branch(ir_compare(IR_LT, ir_load(ir_slot_address(p), base.type), end, "<"), body, exit);
+    ir_block = body;
+    IrValue current = ir_load(ir_slot_address(p), base.type);
+    IrType each_type = for_node->each_by_ref ? base.type : elem;
+    int each = ir_add_slot(name, each_type);
+    ir_store(ir_slot_address(each), each_type, for_node->each_by_ref ? current : ir_load(current, elem));
+    ir_add_local(name, each, each_type);
+    ir_block_statements(for_node->block);
+    IrValue next = ir_index(ir_load(ir_slot_address(p), base.type), ir_const(1, ir_int(TYPE_I64)));
+    ir_store(ir_slot_address(p), base.type, next);
+    ir_jump(test);
+    ir_block = exit;
+    ir_pop_scope();
+}
+
+void ir_for(ForNode* for_node) {
+    if (for_node->for_type == FOR_EACH && for_node->is_parallel) {
+        ir_reject("has a for parallel loop");
+        return;
+    } else if (for_node->for_type == FOR_EACH) {
+        ir_for_each(for_node);
+        return;
+    }
+    ir_push_scope();
+    if (for_node->for_type == FOR_LOOP) {
+        ir_statements({for_node->init});
+    }
+    IrBlock* test = ir_new_block();
+    IrBlock* body = ir_new_block();
+    IrBlock* exit = ir_new_block();
+    ir_jump(test);
+    ir_block = test;
+    ir_cond(for_node->test, body, exit);
+    ir_block = body;
+    ir_block_statements(for_node->block);
+    if (for_node->for_type == FOR_LOOP) {
+        ir_expr(for_node->update->expr_lhs);
+    }
+    ir_jump(test);
+    ir_block = exit;
+    ir_pop_scope();
+}
+
+void ir_statements(std::vector<StatementNode*> statements) {
+    for (StatementNode* statement : statements) {
+        if (ir_fail.size() != 0) {
+            return;
+        }
+        switch (statement->nt) {
+        case NODE_VAR_DECL:
+            ir_var_decl(statement->vardecl_lhs);
+            break;
+        case NODE_RETURN:
+            ir_return(statement->return_lhs);
+            break;
+        case NODE_IF:
+            ir_if(statement->if_lhs);
+            break;
+        case NODE_FOR:
+            ir_for(statement->for_lhs);
+            break;
+        case NODE_DEFER:
+            ir_defers.back().push_back({statement->defer_lhs, ir_scopes});
+            break;
+        case NODE_MATCH:
+            ir_match(statement->match_lhs);
+            break;
+        case NODE_ASSIGN:
+        case NODE_BINOP:
+        case NODE_CALL:
+            ir_expr(statement->expr_lhs);
+            break;
+        default:
+            ir_reject("has a " + std::string(get_nt_str(statement->nt)) + " statement");
+            break;
+        }
+    }
+}
+
+// NULL when func uses something the IR can't say yet, ir_fail says what
+IrFunction* ir_lower_function(FunctionNode* func) {
+    ir_func = new IrFunction;
+    ir_func->func = func;
+    ir_fail = "";
+    if (func->return_vars.size() > 1) {
+        ir_reject("returns several values");
+        return NULL;
+    }
+    if (func->return_var != NULL && !ir_type_from_var(func->return_var, &ir_func->return_type)) {
+        return NULL;
+    }
+    ir_scopes.clear();
+    ir_defers.clear();
+    ir_in_defer = false;
+    ir_push_scope();
+    ir_block = ir_new_block();
+    for (int i = 0; i < func->params.size(); i++) {
+        IrType type;
+        if (!ir_type_from_var(func->params[i], &type)) {
+            return NULL;
+        } else if (type.count >= 0) {
+            ir_reject("takes the array " + func->params[i]->identifier->token);
+            return NULL;
+        }
+        int slot = ir_add_slot(func->params[i]->identifier->token, type);
+        ir_func->slots[slot].param = i;
+        ir_add_local(func->params[i]->identifier->token, slot, type);
+    }
+    ir_block_statements(func->block);
+    if (!ir_is_terminated(ir_block)) {
+        // falling off the end, which main does to return 0
+        IrInstr ret = ir_instr(IR_RET, ir_void());
+        IrType type = ir_func->return_type;
+        if (ir_is_struct(type)) {
+            IrValue address = ir_slot_address(ir_add_slot("ret", type));
+            ir_zero(address, type);
+            ret.args.push_back(address.id);
+        } else if (ir_is_scalar(type)) {
+            ret.args.push_back(ir_const(0, type).id);
+        }
+        ir_append(ret);
+    }
+    ir_pop_scope();
+    return ir_fail.size() == 0 ? ir_func : NULL;
+}
+
+/* Passes */
+
+IrBlock* ir_find_block(IrFunction* func, int id) {
+    for (IrBlock* block : func->blocks) {
+        if (block->id == id) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+std::vector<int*> ir_targets(IrInstr& instr) {
+    std::vector<int*> targets;
+    if (instr.target >= 0) {
+        targets.push_back(&instr.target);
+    }
+    for (IrCase& ir_case : instr.cases) {
+        targets.push_back(&ir_case.target);
+    }
+    if (instr.target_else >= 0) {
+        targets.push_back(&instr.target_else);
+    }
+    return targets;
+}
+
+bool ir_is_pure(IrOp op) {
+    return op != IR_STORE && op != IR_COPY && op != IR_ZERO && op != IR_CALL &&
+           op != IR_INTRINSIC && op != IR_CHECK && !ir_is_terminator(op);
+}
+
+// The constant an instruction with constant operands folds to, evaluated
+// at the width and signedness of its type
+bool ir_fold_instr(IrInstr& instr, std::vector<IrInstr*>& defs) {
+    std::vector<uint64_t> args;
+    for (int arg : instr.args) {
+        if (arg < 0 || defs[arg] == NULL || (defs[arg]->op != IR_CONST && defs[arg]->op != IR_SIZEOF) ||
+            defs[arg]->type.ptr_level != 0) {
+            return false;
+        }
+        args.push_back(defs[arg]->imm);
+    }
+    if (instr.op == IR_BRANCH) {
+        instr.op = IR_JUMP;
+        instr.target = args[0] != 0 ? instr.target : instr.target_else;
+        instr.args.clear();
+        return true;
+    } else if (instr.op == IR_SWITCH) {
+        instr.op = IR_JUMP;
+        instr.target = instr.target_else;
+        for (IrCase& ir_case : instr.cases) {
+            if (args[0] - ir_case.lo <= (uint64_t)(ir_case.hi - ir_case.lo)) {
+                instr.target = ir_case.target;
+            }
+        }
+        instr.target_else = -1;
+        instr.cases.clear();
+        instr.args.clear();
+        return true;
+    }
+    if (instr.op < IR_ADD || instr.op > IR_CAST || instr.type.ptr_level != 0) {
+        return false;
+    }
+    IrType operand = defs[instr.args[0]]->type;
+    bool is_unsigned = ir_is_unsigned(operand);
+    uint64_t a = args[0];
+    uint64_t b = args.size() > 1 ? args[1] : 0;
+    int64_t sa = (int64_t)a;
+    int64_t sb = (int64_t)b;
+    uint64_t result;
+    switch (instr.op) {
+    case IR_ADD: result = a + b; break;
+    case IR_SUB: result = a - b; break;
+    case IR_MUL: result = a * b; break;
+    case IR_DIV:
+    case IR_MOD:
+        if (b == 0 || (!is_unsigned && sa == INT64_MIN && sb == -1)) {
+            return false; // left for the program to trap on
+        }
+        if (instr.op == IR_DIV) {
+            result = is_unsigned ? a / b : (uint64_t)(sa / sb);
+        } else {
+            result = is_unsigned ? a % b : (uint64_t)(sa % sb);
+        }
+        break;
+    case IR_EQ: result = a == b; break;
+    case IR_NE: result = a != b; break;
+    case IR_LT: result = is_unsigned ? a < b : sa < sb; break;
+    case IR_LE: result = is_unsigned ? a <= b : sa <= sb; break;
+    case IR_GT: result = is_unsigned ? a > b : sa > sb; break;
+    case IR_GE: result = is_unsigned ? a >= b : sa >= sb; break;
+    case IR_NEG: result = -a; break;
+    case IR_NOT: result = a == 0; break;
+    default: result = a; break; // a cast, bool keeps its value like the C enum does
+    }
+    instr.op = IR_CONST;
+    instr.imm = instr.type.kind == IR_INT ? fold_cast(result, instr.type.int_type) : result;
+    instr.args.clear();
+    return true;
+}
+
+void ir_fold_constants(IrFunction* func) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        std::vector<IrInstr*> defs(func->values.size(), NULL);
+        for (IrBlock* block : func->blocks) {
+            for (IrInstr& instr : block->instrs) {
+                if (instr.value >= 0) {
+                    defs[instr.value] = &instr;
+                }
+            }
+        }
+        for (IrBlock* block : func->blocks) {
+            for (IrInstr& instr : block->instrs) {
+                if (instr.op != IR_CONST && (instr.op == IR_BRANCH || instr.op == IR_SWITCH || instr.value >= 0)) {
+                    changed = ir_fold_instr(instr, defs) || changed;
+                }
+            }
+        }
+    }
+}
+
+// Jumps to a block that only jumps on go straight to where it goes, then
+// blocks nothing jumps to are dropped
+void ir_remove_unreachable(IrFunction* func) {
+    for (IrBlock* block : func->blocks) {
+        for (IrInstr& instr : block->instrs) {
+            for (int* target : ir_targets(instr)) {
+                for (int hops = 0; *target >= 0 && hops < func->blocks.size(); hops++) {
+                    IrBlock* next = ir_find_block(func, *target);
+                    if (next == func->blocks[0] || next->instrs.size() != 1 ||
+                        next->instrs[0].op != IR_JUMP) {
+                        break;
+                    }
+                    *target = next->instrs[0].target;
+                }
+            }
+        }
+    }
+    std::vector<bool> reached(func->blocks.size(), false);
+    std::vector<IrBlock*> worklist = {func->blocks[0]};
+    while (worklist.size() != 0) {
+        IrBlock* block = worklist.back();
+        worklist.pop_back();
+        if (reached[block->id]) {
+            continue;
+        }
+        reached[block->id] = true;
+        for (int* target : ir_targets(block->instrs.back())) {
+            worklist.push_back(ir_find_block(func, *target));
+        }
+    }
+    std::vector<IrBlock*> kept;
+    for (IrBlock* block : func->blocks) {
+        if (reached[block->id]) {
+            kept.push_back(block);
+        }
+    }
+    func->blocks = kept;
+}
+
+// A block jumping to one nothing else jumps to takes its instructions
+void ir_merge_blocks(IrFunction* func) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        std::vector<int> preds;
+        for (IrBlock* block : func->blocks) {
+            for (int* target : ir_targets(block->instrs.back())) {
+                while (preds.size() <= *target) {
+                    preds.push_back(0);
+                }
+                preds[*target]++;
+            }
+        }
+        for (int i = 0; i < func->blocks.size() && !changed; i++) {
+            IrBlock* block = func->blocks[i];
+            IrInstr last = block->instrs.back();
+            if (last.op != IR_JUMP || last.target == func->blocks[0]->id || preds[last.target] != 1 ||
+                last.target == block->id) {
+                continue;
+            }
+            IrBlock* next = ir_find_block(func, last.target);
+            block->instrs.pop_back();
+            block->instrs.insert(block->instrs.end(), next->instrs.begin(), next->instrs.end());
+            for (int j = 0; j < func->blocks.size(); j++) {
+                if (func->blocks[j] == next) {
+                    func->blocks.erase(func->blocks.begin() + j);
+                    break;
+                }
+            }
+            changed = true;
+        }
+    }
+}
+
+void ir_remove_dead_values(IrFunction* func) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        std::vector<int> uses(func->values.size(), 0);
+        for (IrBlock* block : func->blocks) {
+            for (IrInstr& instr : block->instrs) {
+                for (int arg : instr.args) {
+                    uses[arg]++;
+                }
+                if (instr.dest >= 0) {
+                    uses[instr.dest]++;
+                }
+            }
+        }
+        for (IrBlock* block : func->blocks) {
+            std::vector<IrInstr> kept;
+            for (IrInstr& instr : block->instrs) {
+                if (instr.value >= 0 && uses[instr.value] == 0 && ir_is_pure(instr.op)) {
+                    changed = true;
+                    continue;
+                }
+                kept.push_back(instr);
+            }
+            block->instrs = kept;
+        }
+    }
+}
+
+// Whether an address into a slot is only ever used to get at what is in
+// it, so nothing can still point at a slot once the function is left
+bool ir_slots_stay(IrFunction* func) {
+    std::vector<bool> is_address(func->values.size(), false);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (IrBlock* block : func->blocks) {
+            for (IrInstr& instr : block->instrs) {
+                bool is_slot = instr.op == IR_SLOT ||
+                               ((instr.op == IR_FIELD || instr.op == IR_INDEX) && is_address[instr.args[0]]);
+                if (is_slot && !is_address[instr.value]) {
+                    is_address[instr.value] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+    for (IrBlock* block : func->blocks) {
+        for (IrInstr& instr : block->instrs) {
+            for (int i = 0; i < instr.args.size(); i++) {
+                if (!is_address[instr.args[i]]) {
+                    continue;
+                }
+                bool is_access = i == 0 && (instr.op == IR_LOAD || instr.op == IR_STORE || instr.op == IR_ZERO ||
+                                            instr.op == IR_FIELD || instr.op == IR_INDEX);
+                bool is_copied = instr.op == IR_COPY ||
+                                 (instr.op == IR_CALL && ir_is_struct(instr.arg_types[i])) ||
+                                 (instr.op == IR_RET && ir_is_struct(func->return_type));
+                if (!is_access && !is_copied) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// A call of the function itself whose result is returned straight away
+// becomes stores of the arguments to the parameter slots and a jump back
+// to the top, see tail.cpp. The top is a block of its own since nothing
+// jumps to the entry. Struct arguments are copied out before any
+// parameter is written, they could be one of them
+void ir_tail_loops(IrFunction* func) {
+    std::vector<IrBlock*> sites;
+    for (IrBlock* block : func->blocks) {
+        int count = block->instrs.size();
+        if (count < 2 || block->instrs[count - 1].op != IR_RET || block->instrs[count - 2].op != IR_CALL ||
+            block->instrs[count - 2].name != func->func->mangled_name) {
+            continue;
+        }
+        IrInstr& call = block->instrs[count - 2];
+        IrInstr& ret = block->instrs[count - 1];
+        int result = call.dest >= 0 ? call.dest : call.value;
+        if (ret.args.size() == 0 ? result < 0 : ret.args[0] == result) {
+            sites.push_back(block);
+        }
+    }
+    if (sites.size() == 0 || !ir_slots_stay(func)) {
+        return;
+    }
+    ir_func = func;
+    IrBlock* entry = func->blocks[0];
+    IrBlock* top = ir_new_block();
+    func->blocks.pop_back();
+    func->blocks.insert(func->blocks.begin() + 1, top);
+    top->instrs = entry->instrs;
+    entry->instrs.clear();
+    ir_block = entry;
+    ir_jump(top);
+    for (IrBlock* site : sites) {
+        IrInstr call = site == entry ? top->instrs[top->instrs.size() - 2] : site->instrs[site->instrs.size() - 2];
+        ir_block = site == entry ? top : site;
+        ir_block->instrs.pop_back();
+        ir_block->instrs.pop_back();
+        std::vector<IrValue> args;
+        for (int i = 0; i < call.args.size(); i++) {
+            IrValue arg = {call.args[i], call.arg_types[i]};
+            if (ir_is_struct(arg.type)) {
+                IrValue copy = ir_slot_address(ir_add_slot("tail", arg.type));
+                ir_store(copy, arg.type, arg);
+                arg = copy;
+            }
+            args.push_back(arg);
+        }
+        for (int slot = 0; slot < func->slots.size(); slot++) {
+            IrSlot param = func->slots[slot];
+            if (param.param >= 0) {
+                ir_store(ir_slot_address(slot), param.type, args[param.param]);
+            }
+        }
+        ir_jump(top);
+        tail_stats.loops++;
+    }
+}
+
+// Passes over a lowered function go here, before any backend sees it
+void ir_optimize(IrFunction* func) {
+    ir_fold_constants(func);
+    ir_remove_unreachable(func);
+    ir_merge_blocks(func);
+    ir_remove_dead_values(func);
+}
+
+/* Printing, for --emit-ir */
+
+const char* ir_op_name(IrOp op) {
+    static const char* names[] = {
+        "const", "slot", "global", "string", "sizeof", "field", "index", "load", "store",
+        "copy", "zero", "add", "sub", "mul", "div", "mod", "eq", "ne", "lt", "le", "gt",
+        "ge", "neg", "not", "cast", "call", "intrinsic", "check", "jump", "branch", "switch",
+        "ret",
+    };
+    return names[op];
+}
+
+void ir_print(IrFunction* func, std::ostream& out) {
+    out << "fn " << func->func->mangled_name << "(";
+    int params = 0;
+    for (int i = 0; i < func->slots.size(); i++) {
+        if (func->slots[i].param >= 0) {
+            out << (params++ == 0 ? "" : ", ") << "s" << i << " " << ir_type_str(func->slots[i].type);
+        }
+    }
+    out << ") -> " << ir_type_str(func->return_type) << "\n";
+    for (int i = 0; i < func->slots.size(); i++) {
+        out << "    s" << i << " " << func->slots[i].name << " " << ir_type_str(func->slots[i].type) << "\n";
+    }
+    for (IrBlock* block : func->blocks) {
+        out << "  b" << block->id << ":\n";
+        for (IrInstr& instr : block->instrs) {
+            out << "    ";
+            if (instr.value >= 0) {
+                out << "v" << instr.value << " " << ir_type_str(instr.type) << " = ";
+            }
+            out << ir_op_name(instr.op);
+            switch (instr.op) {
+            case IR_CONST:
+                out << " " << (ir_is_unsigned(instr.type) ? std::to_string((uint64_t)instr.imm)
+                                                          : std::to_string(instr.imm));
+                break;
+            case IR_SLOT:
+                out << " s" << instr.imm;
+                break;
+            case IR_GLOBAL:
+                out << " " << instr.name;
+                break;
+            case IR_STRING:
+                out << " \"" << ir_strings[instr.imm] << "\"";
+                break;
+            case IR_SIZEOF:
+                out << " " << ir_type_str(instr.mem_type) << " (" << instr.imm << ")";
+                break;
+            case IR_FIELD:
+                out << " v" << instr.args[0] << "." << instr.name << " (+" << instr.imm << ")";
+                break;
+            case IR_LOAD:
+            case IR_STORE:
+            case IR_COPY:
+            case IR_ZERO:
+                out << " " << ir_type_str(instr.mem_type);
+                for (int arg : instr.args) {
+                    out << (arg == instr.args[0] ? " [v" : ", v") << arg << (arg == instr.args[0] ? "]" : "");
+                }
+                break;
+            case IR_CALL:
+            case IR_INTRINSIC:
+                out << " " << instr.name << "(";
+                for (int i = 0; i < instr.args.size(); i++) {
+                    out << (i == 0 ? "v" : ", v") << instr.args[i];
+                }
+                out << ")";
+                if (instr.dest >= 0) {
+                    out << " -> [v" << instr.dest << "]";
+                }
+                if (instr.is_tail) {
+                    out << " tail";
+                }
+                break;
+            case IR_CHECK:
+                out << " v" << instr.args[0] << ", v" << instr.args[1] << " (line " << instr.imm << ")";
+                break;
+            case IR_JUMP:
+                out << " b" << instr.target;
+                break;
+            case IR_BRANCH:
+                out << " v" << instr.args[0] << ", b" << instr.target << ", b" << instr.target_else;
+                break;
+            case IR_SWITCH:
+                out << " v" << instr.args[0];
+                for (IrCase& ir_case : instr.cases) {
+                    out << ", " << ir_case.lo;
+                    if (ir_case.hi != ir_case.lo) {
+                        out << ".." << ir_case.hi;
+                    }
+                    out << " b" << ir_case.target;
+                }
+                out << ", else b" << instr.target_else;
+                break;
+            default:
+                for (int i = 0; i < instr.args.size(); i++) {
+                    out << (i == 0 ? " v" : ", v") << instr.args[i];
+                }
+                break;
+            }
+            out << "\n";
+        }
+    }
+    out << "\n";
+}
+
+/* Backends */
+
+// Whether a backend that only reads the IR can take the whole program:
+// everything reachable was lowered and nothing calls out to C
+bool ir_whole_program(std::vector<StatementNode*> ast, std::string* reason) {
+    if (!global_state->use_ir) {
+        *reason = "--no-ir is set";
+        return false;
+    }
+    for (StatementNode* statement : ast) {
+        if (statement->nt == NODE_CINCLUDE) {
+            *reason = "it includes a C header";
+            return false;
+        }
+    }
+    bool has_main = false;
+    for (FunctionNode* func : function_table) {
+        has_main = has_main || (func->mangled_name == "main" && ir_get_function(func) != NULL);
+        if (func->block != NULL && !func->is_comptime && func->is_reachable && ir_get_function(func) == NULL) {
+            *reason = func->token->token + " isn't in the IR";
+            return false;
+        }
+    }
+    if (!has_main) {
+        *reason = "there is no main";
+        return false;
+    }
+    for (IrFunction* func : ir_functions) {
+        for (IrBlock* block : func->blocks) {
+            for (IrInstr& instr : block->instrs) {
+                if (instr.op == IR_CALL && ir_find_function(instr.name) < 0) {
+                    *reason = func->func->token->token + " calls " + instr.name + ", which has no body";
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+int ir_find_function(std::string mangled_name) {
+    for (int i = 0; i < ir_functions.size(); i++) {
+        if (ir_functions[i]->func->mangled_name == mangled_name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool ir_constant_value(ExpressionNode* expr, int64_t* value) {
+    if (expr->nt == NODE_CONSTANT) {
+        *value = expr->constant->value;
+        return true;
+    } else if (expr->nt == NODE_CHAR) {
+        return ir_char_value(expr->character->value, value);
+    } else if (expr->nt == NODE_VAR && (expr->var_node->identifier->token == "true" ||
+                                        expr->var_node->identifier->token == "false")) {
+        *value = expr->var_node->identifier->token == "true";
+        return true;
+    }
+    return false;
+}
+
+// The bytes a global starts with, none when it starts zeroed. False when
+// it is set to something other than a constant or an array of them
+bool ir_global_init(std::string name, IrType type, std::vector<StatementNode*> ast,
+                    std::vector<uint8_t>* bytes) {
+    ExpressionNode* rhs = NULL;
+    for (StatementNode* statement : ast) {
+        if (statement->nt == NODE_VAR_DECL && statement->vardecl_lhs->lhs->identifier->token == name) {
+            rhs = statement->vardecl_lhs->rhs;
+        }
+    }
+    bytes->clear();
+    if (rhs == NULL) {
+        return true;
+    }
+    std::vector<ExpressionNode*> values = {rhs};
+    IrType elem = type;
+    if (type.count >= 0 && rhs->nt == NODE_ARRAY_EXPR) {
+        values = rhs->array->elements;
+        elem.count = -1;
+    } else if (type.count >= 0 && rhs->nt == NODE_SUBSCRIPT) {
+        values = rhs->subscript->indexes;
+        elem.count = -1;
+    }
+    int64_t size = ir_size_of(type);
+    int64_t elem_size = ir_size_of(elem);
+    bytes->resize(size, 0);
+    for (int i = 0; i < values.size(); i++) {
+        int64_t value;
+        if (ir_is_struct(elem) || elem.count >= 0 || (i + 1) * elem_size > size ||
+            !ir_constant_value(values[i], &value)) {
+            return false;
+        }
+        for (int j = 0; j < elem_size; j++) {
+            (*bytes)[i * elem_size + j] = value >> (j * 8);
+        }
+    }
+    return true;
+}
+
+// ir_strings[index] as the bytes it stands for, escapes decoded
+std::string ir_string_bytes(int index) {
+    std::string text = ir_strings[index];
+    std::string bytes;
+    for (int i = 0; i < text.size(); i++) {
+        int64_t value = text[i];
+        if (text[i] == '\\' && i + 1 < text.size() && ir_char_value(text.substr(i, 2), &value)) {
+            i++;
+        }
+        bytes += (char)value;
+    }
+    return bytes;
+}
+
+/* Entry */
+
+IrFunction* ir_get_function(FunctionNode* func) {
+    for (IrFunction* lowered : ir_functions) {
+        if (lowered->func == func) {
+            return lowered;
+        }
+    }
+    return NULL;
+}
+
+int ir_function_count() {
+    return ir_looked_at;
+}
+
+void ir_start(std::vector<StatementNode*> ast) {
+    for (StatementNode* statement : ast) {
+        if (statement->nt == NODE_VAR_DECL) {
+            ir_globals.push_back(statement->vardecl_lhs);
+        }
+    }
+    for (FunctionNode* func : function_table) {
+        if (func->block == NULL || func->is_comptime || !func->is_reachable) {
+            continue;
+        }
+        ir_looked_at++;
+        std::string reason;
+        IrFunction* lowered = NULL;
+        if (func->is_memo) {
+            reason = "is memo";
+        } else {
+            lowered = ir_lower_function(func);
+            reason = ir_fail;
+        }
+        if (lowered == NULL) {
+            ir_skipped.push_back(func->mangled_name + ": " + reason);
+            log_print("IR: " + func->token->token + " stays on the AST emitter, it " + reason + "\n");
+            continue;
+        }
+        ir_tail_loops(lowered);
+        ir_optimize(lowered);
+        if (global_state->bounds_check) {
+            bounds_eliminate(lowered);
+        }
+        ir_functions.push_back(lowered);
+    }
+    log_print("IR: lowered " + std::to_string(ir_functions.size()) + " of "
+              + std::to_string(ir_looked_at) + " functions\n");
+    escape_start();
+    if (global_state->emit_ir) {
+        for (IrFunction* func : ir_functions) {
+            ir_print(func, error_out());
+        }
+        for (std::string skipped : ir_skipped) {
+            error_out() << "; not lowered, " << skipped << "\n";
+        }
+    }
+}
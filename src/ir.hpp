@@ -0,0 +1,139 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+
+#include "ast.hpp"
+
+// A typed three address IR between the AST and the backends. Every local
+// lives in a stack slot that is read and written with explicit loads and
+// stores, values are numbered and assigned once, and control flow is a
+// list of basic blocks that each end in a jump, a branch, a switch or a
+// return.
+// Aggregates (structs and arrays) are never values, only addresses
+
+enum IrKind {
+    IR_VOID,   // *void pointers and calls without a result
+    IR_INT,    // int_type says which one
+    IR_BOOL,
+    IR_STRUCT, // record says which one
+};
+
+struct IrType {
+    IrKind kind = IR_VOID;
+    VarType int_type = TYPE_I64;
+    TypeNode* record = NULL;
+    int ptr_level = 0;
+    int64_t count = -1; // a fixed array of count elements, -1 otherwise
+};
+
+enum IrOp {
+    IR_CONST,   // imm
+    IR_SLOT,    // address of slot imm
+    IR_GLOBAL,  // address of the global name
+    IR_STRING,  // address of the bytes of ir_strings[imm]
+    IR_SIZEOF,  // size of mem_type, imm once laid out
+    IR_FIELD,   // args[0] + imm, the field name of the struct mem_type
+    IR_INDEX,   // args[0] + args[1] elements of mem_type
+    IR_LOAD,    // mem_type at args[0]
+    IR_STORE,   // args[1] to the mem_type at args[0]
+    IR_COPY,    // the mem_type at args[1] to args[0]
+    IR_ZERO,    // clears the mem_type at args[0]
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_MOD,
+    IR_EQ,
+    IR_NE,
+    IR_LT,
+    IR_LE,
+    IR_GT,
+    IR_GE,
+    IR_NEG,
+    IR_NOT,
+    IR_CAST,    // args[0] converted to type
+    IR_CALL,    // name(args), a struct result is stored at dest
+    IR_INTRINSIC, // a runtime function, putchar, alloc, memcpy...
+    IR_CHECK,   // stops the program unless args[0] < args[1] unsigned, imm is the line
+    IR_JUMP,    // target
+    IR_BRANCH,  // target when args[0] isn't zero, target_else otherwise
+    IR_SWITCH,  // the target of the case args[0] is in, target_else when it is in none
+    IR_RET,     // args[0] when there is one, the address of a struct result
+};
+
+// lo and hi are both included, a switch compares args[0] - lo with hi - lo
+// unsigned so it doesn't matter whether args[0] is
+struct IrCase {
+    int64_t lo;
+    int64_t hi;
+    int target;
+};
+
+struct IrInstr {
+    IrOp op;
+    int value = -1;    // what this defines, -1 when nothing is
+    IrType type;       // of the value
+    IrType mem_type;   // what is addressed, loaded, stored or copied
+    std::vector<int> args;
+    std::vector<IrType> arg_types; // calls, a struct argument is passed by value from its address
+    int dest = -1;     // calls returning a struct
+    int64_t imm = 0;
+    std::string name;  // callees, globals and fields
+    int target = -1;
+    int target_else = -1;
+    std::vector<IrCase> cases; // switches
+    bool is_tail = false;      // calls written -> tail, musttail in the C output
+};
+
+struct IrBlock {
+    int id;
+    std::vector<IrInstr> instrs;
+};
+
+struct IrSlot {
+    std::string name; // of the variable it holds
+    IrType type;
+    int param = -1;   // filled from this parameter on entry
+};
+
+struct IrFunction {
+    FunctionNode* func;
+    IrType return_type;
+    std::vector<IrSlot> slots;
+    std::vector<IrType> values; // the type of every value, by number
+    std::vector<IrBlock*> blocks; // the entry block first
+};
+
+// Every function ir_start could lower. The rest couldn't be, and codegen
+// writes them from the AST as before
+extern thread_local std::vector<IrFunction*> ir_functions;
+extern thread_local std::vector<std::string> ir_strings; // string literals as written, escapes and all
+
+void ir_start(std::vector<StatementNode*> ast);
+IrFunction* ir_get_function(FunctionNode* func);
+int ir_function_count(); // functions ir_start looked at
+
+bool ir_is_scalar(IrType type);
+bool ir_is_unsigned(IrType type);
+bool ir_is_struct(IrType type);
+int64_t ir_size_of(IrType type);
+int64_t ir_align_of(IrType type);
+bool ir_char_value(std::string text, int64_t* value); // 'a' and '\n' as written
+std::string ir_type_str(IrType type);
+void ir_print(IrFunction* func, std::ostream& out);
+IrBlock* ir_find_block(IrFunction* func, int id);
+std::vector<int*> ir_targets(IrInstr& instr); // every block instr can go to
+void ir_optimize(IrFunction* func); // folding and cleanup, again after a pass changes a function
+
+// For backends that take the whole program from the IR, --native and
+// --interpret. reason says why one can't
+bool ir_whole_program(std::vector<StatementNode*> ast, std::string* reason);
+int ir_find_function(std::string mangled_name); // index into ir_functions, -1 when it isn't there
+bool ir_global_init(std::string name, IrType type, std::vector<StatementNode*> ast,
+                    std::vector<uint8_t>* bytes);
+std::string ir_string_bytes(int index);
+
+// ir_c.cpp, the body of a function as C
+void ir_c_function(IrFunction* func, std::ostream* file);
@@ -0,0 +1,446 @@
+#include <vector>
+#include <string>
+#include <fstream>
+
+#include "global.hpp"
+#include "error.hpp"
+#include "ir.hpp"
+#include "tail.hpp"
+
+// Writes the body of a lowered function as C. Values used once in the
+// block that defines them are folded back into the expression using them,
+// as long as nothing between the two writes memory, so out.c reads about
+// like it did before and a backend at -O0 doesn't spill every temporary.
+// The rest become t<N> locals, slots become l<N>_<name> and blocks
+// labels jumped to with goto
+
+std::string codegen_get_intrinsic_name(std::string name);
+
+thread_local IrFunction* ir_c_func = NULL;
+thread_local std::vector<IrInstr*> ir_c_defs;
+thread_local std::vector<int> ir_c_uses;
+thread_local std::vector<bool> ir_c_inline;       // written where it is used instead of into t<N>
+
+std::string ir_c_value(int value);
+std::string ir_c_lvalue(int address);
+std::string ir_c_object(IrInstr* def);
+
+std::string ir_c_type(IrType type) {
+    std::string name;
+    switch (type.kind) {
+    case IR_VOID:
+        name = "void";
+        break;
+    case IR_BOOL:
+        name = "bool";
+        break;
+    case IR_STRUCT:
+        name = type.record->name->token;
+        break;
+    default:
+        switch (type.int_type) {
+        case TYPE_I8:  name = "sbyte"; break;
+        case TYPE_I16: name = "int16"; break;
+        case TYPE_I32: name = "int32"; break;
+        case TYPE_I64: name = "int64"; break;
+        case TYPE_U8:  name = "uchar"; break;
+        case TYPE_U16: name = "uint16"; break;
+        case TYPE_U32: name = "uint32"; break;
+        default:       name = "uint64"; break;
+        }
+    }
+    for (int i = 0; i < type.ptr_level; i++) {
+        name += "*";
+    }
+    return name;
+}
+
+// C type names for sizeof, int64[4] for arrays
+std::string ir_c_type_name(IrType type) {
+    if (type.count < 0) {
+        return ir_c_type(type);
+    }
+    IrType elem = type;
+    elem.count = -1;
+    return ir_c_type(elem) + "[" + std::to_string(type.count) + "]";
+}
+
+std::string ir_c_slot_name(int slot) {
+    return "l" + std::to_string(slot) + "_" + ir_c_func->slots[slot].name;
+}
+
+bool ir_c_is_trivial(IrOp op) {
+    return op == IR_CONST || op == IR_SLOT || op == IR_GLOBAL || op == IR_STRING || op == IR_SIZEOF;
+}
+
+bool ir_c_is_addressing(IrOp op) {
+    return op == IR_SLOT || op == IR_GLOBAL || op == IR_FIELD || op == IR_INDEX;
+}
+
+bool ir_c_writes_memory(IrOp op) {
+    return op == IR_STORE || op == IR_COPY || op == IR_ZERO || op == IR_CALL || op == IR_INTRINSIC;
+}
+
+// Same value wherever it is written out: a t<N> local, a constant or an
+// address computed from those
+bool ir_c_is_stable(int value) {
+    if (!ir_c_inline[value]) {
+        return true;
+    }
+    IrInstr* def = ir_c_defs[value];
+    if (ir_c_is_trivial(def->op)) {
+        return true;
+    } else if (def->op != IR_FIELD && def->op != IR_INDEX) {
+        return false;
+    }
+    for (int arg : def->args) {
+        if (!ir_c_is_stable(arg)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ir_c_analyze(IrFunction* func) {
+    int count = func->values.size();
+    ir_c_defs.assign(count, NULL);
+    ir_c_uses.assign(count, 0);
+    ir_c_inline.assign(count, false);
+    std::vector<int> user_block(count, -1);
+    std::vector<int> user_index(count, -1);
+    for (IrBlock* block : func->blocks) {
+        for (int i = 0; i < block->instrs.size(); i++) {
+            IrInstr& instr = block->instrs[i];
+            if (instr.value >= 0) {
+                ir_c_defs[instr.value] = &instr;
+            }
+            std::vector<int> used = instr.args;
+            if (instr.dest >= 0) {
+                used.push_back(instr.dest);
+            }
+            for (int value : used) {
+                ir_c_uses[value]++;
+                user_block[value] = block->id;
+                user_index[value] = i;
+            }
+        }
+    }
+    for (IrBlock* block : func->blocks) {
+        for (IrInstr& instr : block->instrs) {
+            if (instr.value >= 0 && ir_c_is_trivial(instr.op)) {
+                ir_c_inline[instr.value] = true;
+            }
+        }
+    }
+    // Backwards, so a value knows whether its user is folded further up
+    // and where the whole expression ends up being written
+    for (IrBlock* block : func->blocks) {
+        std::vector<int> root(block->instrs.size());
+        for (int i = block->instrs.size() - 1; i >= 0; i--) {
+            IrInstr& instr = block->instrs[i];
+            root[i] = i;
+            int value = instr.value;
+            if (value < 0 || ir_c_inline[value] || ir_c_uses[value] != 1 ||
+                user_block[value] != block->id || instr.op == IR_CALL || instr.op == IR_INTRINSIC) {
+                continue;
+            }
+            int user = user_index[value];
+            int at = block->instrs[user].value >= 0 && ir_c_inline[block->instrs[user].value] ? root[user] : user;
+            bool is_clobbered = false;
+            for (int j = i + 1; j < at; j++) {
+                is_clobbered = is_clobbered || ir_c_writes_memory(block->instrs[j].op);
+            }
+            if (!is_clobbered) {
+                ir_c_inline[value] = true;
+                root[i] = at;
+            }
+        }
+    }
+    // Addresses used more than once, when working them out again is free
+    for (IrBlock* block : func->blocks) {
+        for (IrInstr& instr : block->instrs) {
+            if (instr.value < 0 || ir_c_inline[instr.value] ||
+                (instr.op != IR_FIELD && instr.op != IR_INDEX)) {
+                continue;
+            }
+            bool is_stable = true;
+            for (int arg : instr.args) {
+                is_stable = is_stable && ir_c_is_stable(arg);
+            }
+            ir_c_inline[instr.value] = is_stable;
+        }
+    }
+}
+
+std::string ir_c_const(IrInstr* instr) {
+    IrType type = instr->type;
+    if (type.ptr_level > 0) {
+        return "0";
+    } else if (type.kind == IR_BOOL) {
+        return instr->imm != 0 ? "1" : "0";
+    }
+    switch (type.int_type) {
+    case TYPE_U64:
+        return std::to_string((uint64_t)instr->imm) + "ULL";
+    case TYPE_U32:
+        return std::to_string((uint64_t)instr->imm) + "U";
+    case TYPE_I64:
+        if (instr->imm == INT64_MIN) {
+            return "(-9223372036854775807LL - 1)";
+        }
+        return std::to_string(instr->imm) + "LL";
+    default:
+        return std::to_string(instr->imm);
+    }
+}
+
+const char* ir_c_operator(IrOp op) {
+    switch (op) {
+    case IR_ADD: return " + ";
+    case IR_SUB: return " - ";
+    case IR_MUL: return " * ";
+    case IR_DIV: return " / ";
+    case IR_MOD: return " % ";
+    case IR_EQ:  return " == ";
+    case IR_NE:  return " != ";
+    case IR_LT:  return " < ";
+    case IR_LE:  return " <= ";
+    case IR_GT:  return " > ";
+    default:     return " >= ";
+    }
+}
+
+// An address as a value, arrays decay like they do in C
+std::string ir_c_address_of(IrInstr* def) {
+    bool is_array = def->mem_type.count >= 0;
+    return (is_array ? "" : "&") + ir_c_object(def);
+}
+
+std::string ir_c_call(IrInstr* instr) {
+    std::string name = instr->op == IR_CALL ? instr->name : codegen_get_intrinsic_name(instr->name);
+    std::string call = name + "(";
+    for (int i = 0; i < instr->args.size(); i++) {
+        call += i == 0 ? "" : ", ";
+        if (instr->arg_types[i].kind == IR_STRUCT && instr->arg_types[i].ptr_level == 0) {
+            call += ir_c_lvalue(instr->args[i]); // by value
+        } else {
+            call += ir_c_value(instr->args[i]);
+        }
+    }
+    return call + ")";
+}
+
+std::string ir_c_expr(IrInstr* instr) {
+    switch (instr->op) {
+    case IR_CONST:
+        return ir_c_const(instr);
+    case IR_SLOT:
+    case IR_GLOBAL:
+    case IR_FIELD:
+        return ir_c_address_of(instr);
+    case IR_STRING:
+        return "\"" + ir_strings[instr->imm] + "\"";
+    case IR_SIZEOF:
+        return "sizeof(" + ir_c_type_name(instr->mem_type) + ")";
+    case IR_INDEX:
+        return "(" + ir_c_value(instr->args[0]) + " + " + ir_c_value(instr->args[1]) + ")";
+    case IR_LOAD:
+        return ir_c_lvalue(instr->args[0]);
+    case IR_NEG:
+        return "(-" + ir_c_value(instr->args[0]) + ")";
+    case IR_NOT:
+        return "(!" + ir_c_value(instr->args[0]) + ")";
+    case IR_CAST:
+        return "((" + ir_c_type(instr->type) + ")" + ir_c_value(instr->args[0]) + ")";
+    case IR_CALL:
+    case IR_INTRINSIC:
+        return ir_c_call(instr);
+    default:
+        return "(" + ir_c_value(instr->args[0]) + ir_c_operator(instr->op)
+               + ir_c_value(instr->args[1]) + ")";
+    }
+}
+
+std::string ir_c_value(int value) {
+    if (!ir_c_inline[value]) {
+        return "t" + std::to_string(value);
+    }
+    return ir_c_expr(ir_c_defs[value]);
+}
+
+// The object an address computation points at: l0_x, p->len or a[i]
+std::string ir_c_object(IrInstr* def) {
+    if (def->op == IR_SLOT) {
+        return ir_c_slot_name(def->imm);
+    } else if (def->op == IR_GLOBAL) {
+        return def->name;
+    } else if (def->op == IR_INDEX) {
+        return ir_c_value(def->args[0]) + "[" + ir_c_value(def->args[1]) + "]";
+    }
+    IrInstr* base = ir_c_defs[def->args[0]];
+    if (ir_c_inline[def->args[0]] && ir_c_is_addressing(base->op)) {
+        return ir_c_object(base) + "." + def->name;
+    }
+    return ir_c_value(def->args[0]) + "->" + def->name;
+}
+
+// The object at an address, *p when it isn't worked out in place
+std::string ir_c_lvalue(int address) {
+    IrInstr* def = ir_c_defs[address];
+    if (ir_c_inline[address] && ir_c_is_addressing(def->op)) {
+        return ir_c_object(def);
+    }
+    return "(*" + ir_c_value(address) + ")";
+}
+
+void ir_c_instr(IrInstr* instr, IrBlock* next, std::ostream* file) {
+    std::string label_next = next != NULL ? "L" + std::to_string(next->id) : "";
+    switch (instr->op) {
+    case IR_STORE:
+    case IR_COPY:
+    {
+        std::string value = instr->op == IR_COPY ? ir_c_lvalue(instr->args[1]) : ir_c_value(instr->args[1]);
+        *file << "\t" << ir_c_lvalue(instr->args[0]) << " = " << value << ";\n";
+        return;
+    }
+    case IR_ZERO:
+        *file << "\t__builtin_memset(" << ir_c_value(instr->args[0]) << ", 0, sizeof("
+              << ir_c_type_name(instr->mem_type) << "));\n";
+        return;
+    case IR_CHECK:
+        *file << "\tatlas_bounds(" << ir_c_value(instr->args[0]) << ", " << ir_c_value(instr->args[1])
+              << ", " << instr->imm << ");\n";
+        return;
+    case IR_JUMP:
+        if (next == NULL || next->id != instr->target) {
+            *file << "\tgoto L" << instr->target << ";\n";
+        }
+        return;
+    case IR_BRANCH:
+    {
+        std::string cond = ir_c_value(instr->args[0]);
+        if (next != NULL && next->id == instr->target) {
+            *file << "\tif (!" << cond << ") goto L" << instr->target_else << ";\n";
+        } else {
+            *file << "\tif (" << cond << ") goto L" << instr->target << ";\n";
+            if (next == NULL || next->id != instr->target_else) {
+                *file << "\tgoto L" << instr->target_else << ";\n";
+            }
+        }
+        return;
+    }
+    case IR_SWITCH:
+    {
+        // i64 labels, C converts them to the type of the value
+        IrInstr label;
+        label.op = IR_CONST;
+        label.type.kind = IR_INT;
+        *file << "\tswitch (" << ir_c_value(instr->args[0]) << ") {\n";
+        for (IrCase& ir_case : instr->cases) {
+            label.imm = ir_case.lo;
+            *file << "\tcase " << ir_c_const(&label);
+            if (ir_case.hi != ir_case.lo) {
+                label.imm = ir_case.hi;
+                *file << " ... " << ir_c_const(&label);
+            }
+            *file << ": goto L" << ir_case.target << ";\n";
+        }
+        *file << "\tdefault: goto L" << instr->target_else << ";\n\t}\n";
+        return;
+    }
+    case IR_RET:
+        if (instr->args.size() == 0) {
+            *file << "\treturn;\n";
+        } else if (ir_c_func->return_type.kind == IR_STRUCT && ir_c_func->return_type.ptr_level == 0) {
+            *file << "\treturn " << ir_c_lvalue(instr->args[0]) << ";\n";
+        } else {
+            *file << "\treturn " << ir_c_value(instr->args[0]) << ";\n";
+        }
+        return;
+    default:
+        break;
+    }
+    if (instr->dest >= 0) {
+        *file << "\t" << ir_c_lvalue(instr->dest) << " = " << ir_c_expr(instr) << ";\n";
+    } else if (instr->value < 0 || ir_c_uses[instr->value] == 0) {
+        *file << "\t" << ir_c_expr(instr) << ";\n";
+    } else if (!ir_c_inline[instr->value]) {
+        *file << "\tt" << instr->value << " = " << ir_c_expr(instr) << ";\n";
+    }
+}
+
+// A -> tail call followed by the return of what it gives back, written
+// as one return for musttail
+bool ir_c_is_tail_call(IrBlock* block, int index) {
+    IrInstr& call = block->instrs[index];
+    if (call.op != IR_CALL || !call.is_tail || call.dest >= 0 || index + 2 != block->instrs.size()) {
+        return false;
+    }
+    IrInstr& ret = block->instrs[index + 1];
+    return ret.op == IR_RET && (ret.args.size() == 0 ? call.value < 0 : ret.args[0] == call.value);
+}
+
+void ir_c_function(IrFunction* func, std::ostream* file) {
+    ir_c_func = func;
+    ir_c_analyze(func);
+    *file << "{\n";
+    for (int i = 0; i < func->slots.size(); i++) {
+        IrSlot& slot = func->slots[i];
+        IrType elem = slot.type;
+        elem.count = -1;
+        *file << "\t" << ir_c_type(elem) << " " << ir_c_slot_name(i);
+        if (slot.type.count >= 0) {
+            *file << "[" << slot.type.count << "]";
+        }
+        if (slot.param >= 0) {
+            *file << " = " << func->func->params[slot.param]->identifier->token;
+        }
+        *file << ";\n";
+    }
+    for (int value = 0; value < func->values.size(); value++) {
+        if (ir_c_defs[value] != NULL && !ir_c_inline[value] && ir_c_uses[value] != 0) {
+            *file << "\t" << ir_c_type(func->values[value]) << " t" << value << ";\n";
+        }
+    }
+    std::vector<int> targets;
+    for (int i = 0; i < func->blocks.size(); i++) {
+        IrBlock* next = i + 1 < func->blocks.size() ? func->blocks[i + 1] : NULL;
+        IrInstr& last = func->blocks[i]->instrs.back();
+        if (last.op == IR_JUMP && (next == NULL || last.target != next->id)) {
+            targets.push_back(last.target);
+        } else if (last.op == IR_BRANCH) {
+            bool falls_to_true = next != NULL && next->id == last.target;
+            bool falls_to_else = next != NULL && next->id == last.target_else;
+            if (!falls_to_true) {
+                targets.push_back(last.target);
+            }
+            if (falls_to_true || !falls_to_else) {
+                targets.push_back(last.target_else);
+            }
+        } else if (last.op == IR_SWITCH) {
+            for (int* target : ir_targets(last)) {
+                targets.push_back(*target);
+            }
+        }
+    }
+    for (int i = 0; i < func->blocks.size(); i++) {
+        IrBlock* block = func->blocks[i];
+        IrBlock* next = i + 1 < func->blocks.size() ? func->blocks[i + 1] : NULL;
+        bool is_jumped_to = false;
+        for (int target : targets) {
+            is_jumped_to = is_jumped_to || target == block->id;
+        }
+        if (is_jumped_to) {
+            *file << "L" << block->id << ":\n";
+        }
+        for (int j = 0; j < block->instrs.size(); j++) {
+            if (ir_c_is_tail_call(block, j)) {
+                *file << "\tATLAS_MUSTTAIL return " << ir_c_expr(&block->instrs[j]) << ";\n";
+                tail_stats.calls++;
+                break;
+            }
+            ir_c_instr(&block->instrs[j], next, file);
+        }
+    }
+    *file << "}\n";
+}
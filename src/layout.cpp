@@ -0,0 +1,580 @@
+#include <vector>
+#include <string>
+#include <iostream>
+
+#include "global.hpp"
+#include "error.hpp"
+#include "fold.hpp"
+#include "vector.hpp"
+#include "layout.hpp"
+
+// Sizes and offsets are worked out the way the C compiler lays the same
+// struct out, so the IR backends and the C output agree. Every field
+// starts at a multiple of its alignment and the size is rounded up to the
+// largest one; packed drops the alignment of the fields and align(N)
+// raises that of the struct.
+//
+// Sorting the fields by alignment, largest first, leaves no padding
+// between them. The sorted order is only taken when the struct gets
+// smaller, so structs that don't waste anything keep the order they were
+// written in. .{...} values still follow the declaration order.
+//
+// soa: a fixed array [N]T of a soa type T is declared as T_soaN instead,
+// a struct with an [N] array for each field of T, and a[i].x becomes
+// a.x[i]. Apart from that and len, such an array can't be used as a whole
+
+int64_t ir_int_size(VarType int_type);
+
+thread_local std::vector<TypeNode*> layout_types;
+
+// One [N]T of a soa type T and the struct standing in for it
+struct LayoutSoa {
+    TypeNode* element;
+    int64_t count;
+    TypeNode* type;
+};
+
+struct LayoutLocal {
+    std::string name;
+    int soa; // index into layout_soas, -1 for anything else
+};
+
+thread_local std::vector<LayoutSoa> layout_soas;
+thread_local std::vector<std::vector<LayoutLocal>> layout_scopes;
+
+TypeNode* layout_find_type(std::string name) {
+    for (TypeNode* type : layout_types) {
+        if (type->name->token == name) {
+            return type;
+        }
+    }
+    return NULL;
+}
+
+std::vector<VarDeclNode*> layout_fields(TypeNode* type) {
+    return type->layout.size() != 0 ? type->layout : type->declarations;
+}
+
+bool layout_var(VarNode* var, int64_t* size, int64_t* align) {
+    int64_t count = 1;
+    int ptr_level = var->ptr_level;
+    if (var->is_array) {
+        if (var->arr_size == NULL || var->arr_size->nt != NODE_CONSTANT) {
+            return false;
+        }
+        count = var->arr_size->constant->value;
+        ptr_level--;
+    }
+    std::string name = var->type_->token;
+    VectorType vector;
+    if (var->is_slice || var->is_dynamic) {
+        *size = var->is_slice ? 16 : 24; // ptr, len and cap
+        *align = 8;
+    } else if (ptr_level > 0) {
+        *size = *align = 8;
+    } else if (fold_is_integer(var->type) && name != "int") {
+        *size = *align = ir_int_size(var->type);
+    } else if (name == "bool" || name == "f32") {
+        *size = *align = 4; // an enum in C
+    } else if (name == "f64") {
+        *size = *align = 8;
+    } else if (vector_parse(name, &vector)) {
+        *size = *align = vector.lanes * vector.elem_size;
+    } else if (layout_find_type(name) != NULL) {
+        int64_t offset;
+        if (!layout_record(layout_find_type(name), "", &offset, size, align)) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    *size *= count;
+    return true;
+}
+
+// The layout of record if its fields were in the order given
+bool layout_fields_in(TypeNode* record, std::vector<VarDeclNode*> fields, std::string field,
+                      int64_t* offset, int64_t* size, int64_t* align) {
+    int64_t end = 0;
+    int64_t max_align = 1;
+    for (VarDeclNode* decl : fields) {
+        int64_t field_size, field_align;
+        if (!layout_var(decl->lhs, &field_size, &field_align)) {
+            return false;
+        }
+        if (record->is_packed) {
+            field_align = 1;
+        }
+        end = (end + field_align - 1) / field_align * field_align;
+        if (decl->lhs->identifier->token == field) {
+            *offset = end;
+            *size = field_size;
+            *align = field_align;
+            return true;
+        }
+        end += field_size;
+        max_align = max_align > field_align ? max_align : field_align;
+    }
+    if (record->align > max_align) {
+        max_align = record->align;
+    }
+    *offset = 0;
+    *size = (end + max_align - 1) / max_align * max_align;
+    *align = max_align;
+    return field.size() == 0;
+}
+
+bool layout_record(TypeNode* record, std::string field, int64_t* offset, int64_t* size, int64_t* align) {
+    return layout_fields_in(record, layout_fields(record), field, offset, size, align);
+}
+
+// Bytes of the struct not taken by any field
+int64_t layout_padding(TypeNode* record, std::vector<VarDeclNode*> fields) {
+    int64_t offset, size, align;
+    layout_fields_in(record, fields, "", &offset, &size, &align);
+    for (VarDeclNode* decl : fields) {
+        int64_t field_size, field_align;
+        layout_var(decl->lhs, &field_size, &field_align);
+        size -= field_size;
+    }
+    return size;
+}
+
+void layout_order(TypeNode* record) {
+    record->layout = record->declarations;
+    int64_t offset, size, align;
+    if (record->is_packed || record->is_ordered ||
+        !layout_fields_in(record, record->declarations, "", &offset, &size, &align)) {
+        return;
+    }
+    // a stable insertion sort, fields with the same alignment stay in order
+    std::vector<VarDeclNode*> sorted;
+    for (VarDeclNode* decl : record->declarations) {
+        int64_t decl_size, decl_align;
+        layout_var(decl->lhs, &decl_size, &decl_align);
+        int at = sorted.size();
+        for (int i = 0; i < sorted.size(); i++) {
+            int64_t other_size, other_align;
+            layout_var(sorted[i]->lhs, &other_size, &other_align);
+            if (decl_align > other_align) {
+                at = i;
+                break;
+            }
+        }
+        sorted.insert(sorted.begin() + at, decl);
+    }
+    int64_t sorted_size;
+    layout_fields_in(record, sorted, "", &offset, &sorted_size, &align);
+    if (sorted_size < size) {
+        log_print("layout: reordered " + record->name->token + ", " + std::to_string(size) + " to "
+                  + std::to_string(sorted_size) + " bytes\n");
+        record->layout = sorted;
+    }
+}
+
+/* soa arrays */
+
+bool layout_is_soa_array(VarNode* var) {
+    TypeNode* element = var->type_ != NULL ? layout_find_type(var->type_->token) : NULL;
+    return element != NULL && element->is_soa && var->is_array && var->ptr_level == 1;
+}
+
+// The struct of arrays for var, made the first time [N]T is seen and
+// placed after T
+int layout_soa_for(VarNode* var, std::vector<StatementNode*>& ast) {
+    TypeNode* element = layout_find_type(var->type_->token);
+    std::string name = var->identifier->token;
+    if (var->arr_size == NULL || var->arr_size->nt != NODE_CONSTANT) {
+        print_error_msg("The soa array \"" + name + "\" needs a constant size");
+        error_abort();
+    }
+    int64_t count = var->arr_size->constant->value;
+    for (int i = 0; i < layout_soas.size(); i++) {
+        if (layout_soas[i].element == element && layout_soas[i].count == count) {
+            return i;
+        }
+    }
+    TypeNode* type = new TypeNode;
+    type->nt = NODE_TYPE;
+    type->name = new Token(*element->name);
+    type->name->token = element->name->token + "_soa" + std::to_string(count);
+    type->is_ordered = true;
+    for (VarDeclNode* decl : element->declarations) {
+        VarNode* field = decl->lhs;
+        if (field->is_array || field->is_slice || field->is_dynamic) {
+            print_error_msg("soa type \"" + element->name->token + "\" can't have the array field \""
+                            + field->identifier->token + "\"");
+            error_abort();
+        }
+        VarDeclNode* column = ast_create_var_decl(field->type, field->type_, field->identifier, NULL);
+        column->lhs->is_array = true;
+        column->lhs->ptr_level = field->ptr_level + 1;
+        column->lhs->arr_size = var->arr_size;
+        type->declarations.push_back(column);
+    }
+    type->layout = type->declarations;
+    StatementNode* statement = new StatementNode;
+    statement->nt = NODE_TYPE;
+    statement->type_lhs = type;
+    for (int i = 0; i < ast.size(); i++) {
+        if (ast[i]->nt == NODE_TYPE && ast[i]->type_lhs == element) {
+            ast.insert(ast.begin() + i + 1, statement);
+            break;
+        }
+    }
+    layout_types.push_back(type);
+    layout_soas.push_back({element, count, type});
+    return layout_soas.size() - 1;
+}
+
+int layout_lookup(std::string name) {
+    for (int i = layout_scopes.size() - 1; i >= 0; i--) {
+        for (int j = layout_scopes[i].size() - 1; j >= 0; j--) {
+            if (layout_scopes[i][j].name == name) {
+                return layout_scopes[i][j].soa;
+            }
+        }
+    }
+    return -1;
+}
+
+bool layout_is_empty_init(ExpressionNode* rhs) {
+    return rhs == NULL ||
+           (rhs->nt == NODE_ARRAY_EXPR && rhs->array->elements.size() == 0) ||
+           (rhs->nt == NODE_SUBSCRIPT && rhs->subscript->indexes.size() == 0) ||
+           (rhs->nt == NODE_TYPE_INST && rhs->type_inst->values.size() == 0);
+}
+
+void layout_soa_expr(ExpressionNode* expr) {
+    if (expr == NULL) {
+        return;
+    }
+    switch (expr->nt) {
+    case NODE_VAR:
+    {
+        std::string name = expr->var_node->identifier->token;
+        if (layout_lookup(name) >= 0) {
+            print_error_msg("\"" + name + "\" is a soa array, it can only be used as " + name
+                            + "[i].field");
+            error_abort();
+        }
+        break;
+    }
+    case NODE_BINOP:
+    {
+        BinaryOpNode* binop = expr->binop;
+        ExpressionNode* base = binop->lhs;
+        if (binop->op->tt == TK_DOT && base->nt == NODE_BINOP && base->binop->op->tt == TK_SQUARE_OPEN &&
+            base->binop->lhs->nt == NODE_VAR && layout_lookup(base->binop->lhs->var_node->identifier->token) >= 0) {
+            // a[i].x becomes a.x[i]
+            LayoutSoa soa = layout_soas[layout_lookup(base->binop->lhs->var_node->identifier->token)];
+            std::string field = binop->rhs->var_node->identifier->token;
+            bool has_field = false;
+            for (VarDeclNode* decl : soa.element->declarations) {
+                has_field = has_field || decl->lhs->identifier->token == field;
+            }
+            if (!has_field) {
+                print_error_msg("\"" + soa.element->name->token + "\" has no field called \"" + field + "\"");
+                error_abort();
+            }
+            ExpressionNode* index = base->binop->rhs;
+            Token* dot = binop->op;
+            binop->op = base->binop->op;
+            base->binop->op = dot;
+            base->binop->rhs = binop->rhs;
+            binop->rhs = index;
+            layout_soa_expr(index);
+            break;
+        }
+        layout_soa_expr(binop->lhs);
+        if (binop->op->tt != TK_DOT) {
+            layout_soa_expr(binop->rhs);
+        }
+        break;
+    }
+    case NODE_UNARY:
+        layout_soa_expr(expr->unary_op->operand);
+        break;
+    case NODE_CALL:
+    {
+        CallNode* call = expr->call_node;
+        std::string name = call->name->token;
+        if ((name == "len" || name == "sizeof") && call->args.size() == 1 && call->args[0]->nt == NODE_VAR &&
+            layout_lookup(call->args[0]->var_node->identifier->token) >= 0) {
+            if (name == "len") {
+                ConstantNode* constant = new ConstantNode;
+                constant->nt = NODE_CONSTANT;
+                constant->value = layout_soas[layout_lookup(call->args[0]->var_node->identifier->token)].count;
+                constant->type = TYPE_I64;
+                expr->nt = NODE_CONSTANT;
+                expr->constant = constant;
+            }
+            break;
+        }
+        for (ExpressionNode* arg : call->args) {
+            layout_soa_expr(arg);
+        }
+        break;
+    }
+    case NODE_ARRAY_EXPR:
+        for (ExpressionNode* element : expr->array->elements) {
+            layout_soa_expr(element);
+        }
+        break;
+    case NODE_SUBSCRIPT:
+        for (ExpressionNode* index : expr->subscript->indexes) {
+            layout_soa_expr(index);
+        }
+        break;
+    case NODE_TYPE_INST:
+        for (ExpressionNode* value : expr->type_inst->values) {
+            layout_soa_expr(value);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void layout_declare(VarDeclNode* var_decl, bool is_global, std::vector<StatementNode*>& ast) {
+    VarNode* var = var_decl->lhs;
+    if (var->is_array) {
+        layout_soa_expr(var->arr_size);
+    }
+    layout_soa_expr(var_decl->rhs);
+    if (!layout_is_soa_array(var)) {
+        layout_scopes.back().push_back({var->identifier->token, -1});
+        for (VarNode* other : var_decl->destructure) {
+            layout_scopes.back().push_back({other->identifier->token, -1});
+        }
+        return;
+    }
+    if (!layout_is_empty_init(var_decl->rhs)) {
+        print_error_msg("The soa array \"" + var->identifier->token + "\" can only start out zeroed");
+        error_abort();
+    }
+    int soa = layout_soa_for(var, ast);
+    var->is_array = false;
+    var->ptr_level = 0;
+    var->arr_size = NULL;
+    var->type_ = layout_soas[soa].type->name;
+    var->type = get_var_type(var->type_);
+    var_decl->rhs = NULL;
+    if (!is_global) {
+        // zeroed like any other array, globals are already
+        ExpressionNode* zero = new ExpressionNode;
+        zero->nt = NODE_TYPE_INST;
+        zero->type_inst = new TypeInstNode;
+        zero->type_inst->nt = NODE_TYPE_INST;
+        var_decl->rhs = zero;
+    }
+    layout_scopes.back().push_back({var->identifier->token, soa});
+}
+
+void layout_soa_statements(std::vector<StatementNode*> statements, std::vector<StatementNode*>& ast);
+
+void layout_soa_block(BlockNode* block, std::vector<StatementNode*>& ast) {
+    if (block == NULL) {
+        return;
+    }
+    layout_scopes.push_back({});
+    layout_soa_statements(block->statements, ast);
+    layout_scopes.pop_back();
+}
+
+void layout_soa_if(IfNode* if_node, std::vector<StatementNode*>& ast) {
+    layout_soa_expr(if_node->condition);
+    layout_soa_block(if_node->block, ast);
+    if (if_node->_else != NULL && if_node->_else->block != NULL) {
+        layout_soa_block(if_node->_else->block, ast);
+    } else if (if_node->_else != NULL && if_node->_else->else_if != NULL) {
+        layout_soa_if(if_node->_else->else_if->if_lhs, ast);
+    }
+}
+
+void layout_soa_statements(std::vector<StatementNode*> statements, std::vector<StatementNode*>& ast) {
+    for (StatementNode* statement : statements) {
+        switch (statement->nt) {
+        case NODE_VAR_DECL:
+            layout_declare(statement->vardecl_lhs, false, ast);
+            break;
+        case NODE_RETURN:
+            for (ExpressionNode* expr : statement->return_lhs->exprs) {
+                layout_soa_expr(expr);
+            }
+            break;
+        case NODE_IF:
+            layout_soa_if(statement->if_lhs, ast);
+            break;
+        case NODE_FOR:
+        {
+            ForNode* for_node = statement->for_lhs;
+            layout_scopes.push_back({});
+            if (for_node->for_type == FOR_LOOP) {
+                layout_soa_statements({for_node->init}, ast);
+            } else if (for_node->for_type == FOR_EACH) {
+                layout_soa_expr(for_node->iterable);
+                layout_soa_expr(for_node->range_end);
+                layout_scopes.back().push_back({for_node->each_var->token, -1});
+            }
+            layout_soa_expr(for_node->test);
+            if (for_node->for_type == FOR_LOOP) {
+                layout_soa_statements({for_node->update}, ast);
+            }
+            layout_soa_block(for_node->block, ast);
+            layout_scopes.pop_back();
+            break;
+        }
+        case NODE_DEFER:
+            layout_soa_statements({statement->defer_lhs}, ast);
+            break;
+        case NODE_MATCH:
+            layout_soa_expr(statement->match_lhs->value);
+            for (MatchArm* arm : statement->match_lhs->arms) {
+                layout_soa_block(arm->block, ast);
+            }
+            layout_soa_block(statement->match_lhs->else_block, ast);
+            break;
+        case NODE_FUNC:
+        case NODE_TYPE:
+        case NODE_GENERIC:
+        case NODE_CINCLUDE:
+            break;
+        default:
+            layout_soa_expr(statement->expr_lhs);
+            break;
+        }
+    }
+}
+
+void layout_soa(std::vector<StatementNode*>& ast) {
+    bool has_soa = false;
+    for (TypeNode* type : layout_types) {
+        has_soa = has_soa || type->is_soa;
+    }
+    if (!has_soa) {
+        return;
+    }
+    layout_scopes.clear();
+    layout_scopes.push_back({});
+    std::vector<StatementNode*> globals = ast; // layout_soa_for adds to ast
+    for (StatementNode* statement : globals) {
+        if (statement->nt == NODE_VAR_DECL) {
+            layout_declare(statement->vardecl_lhs, true, ast);
+        }
+    }
+    for (FunctionNode* func : function_table) {
+        if (func->block == NULL) {
+            continue;
+        }
+        layout_scopes.push_back({});
+        for (ParamNode* param : func->params) {
+            if (layout_is_soa_array(param)) {
+                print_error_msg("The soa array \"" + param->identifier->token + "\" can't be passed to \""
+                                + func->token->token + "\"");
+                error_abort();
+            }
+            layout_scopes.back().push_back({param->identifier->token, -1});
+        }
+        layout_soa_block(func->block, ast);
+        layout_scopes.pop_back();
+    }
+}
+
+/* --print-layout */
+
+std::string layout_type_str(VarNode* var) {
+    std::string str;
+    int ptr_level = var->ptr_level;
+    if (var->is_array && var->arr_size != NULL && var->arr_size->nt == NODE_CONSTANT) {
+        str += "[" + std::to_string(var->arr_size->constant->value) + "]";
+        ptr_level--;
+    } else if (var->is_slice) {
+        str += "[]";
+    } else if (var->is_dynamic) {
+        str += "[..]";
+    }
+    for (int i = 0; i < ptr_level; i++) {
+        str += "*";
+    }
+    return str + var->type_->token;
+}
+
+std::string layout_pad(int64_t value, int width) {
+    std::string str = std::to_string(value);
+    while (str.size() < width) {
+        str = " " + str;
+    }
+    return str;
+}
+
+void layout_report(TypeNode* record) {
+    int64_t offset, size, align;
+    if (!layout_record(record, "", &offset, &size, &align)) {
+        error_out() << "type " << record->name->token << ": layout not known\n";
+        return;
+    }
+    error_out() << "type " << record->name->token << ", " << size << " bytes, align " << align << ", "
+                << layout_padding(record, layout_fields(record)) << " bytes of padding";
+    std::vector<std::string> notes;
+    if (record->is_packed) {
+        notes.push_back("packed");
+    }
+    if (record->align != 0) {
+        notes.push_back("align(" + std::to_string(record->align) + ")");
+    }
+    if (record->is_soa) {
+        notes.push_back("soa");
+    }
+    for (LayoutSoa soa : layout_soas) {
+        if (soa.type == record) {
+            notes.push_back("soa of [" + std::to_string(soa.count) + "]" + soa.element->name->token);
+        }
+    }
+    if (record->layout != record->declarations) {
+        int64_t written_size;
+        layout_fields_in(record, record->declarations, "", &offset, &written_size, &align);
+        notes.push_back("reordered, " + std::to_string(written_size) + " bytes and "
+                        + std::to_string(layout_padding(record, record->declarations))
+                        + " of padding as written");
+    }
+    for (int i = 0; i < notes.size(); i++) {
+        error_out() << (i == 0 ? " (" : ", ") << notes[i] << (i + 1 == notes.size() ? ")" : "");
+    }
+    error_out() << "\n";
+    int64_t end = 0;
+    for (VarDeclNode* decl : layout_fields(record)) {
+        int64_t field_offset, field_size, field_align;
+        layout_record(record, decl->lhs->identifier->token, &field_offset, &field_size, &field_align);
+        if (field_offset > end) {
+            error_out() << layout_pad(end, 8) << " " << layout_pad(field_offset - end, 8) << "  padding\n";
+        }
+        error_out() << layout_pad(field_offset, 8) << " " << layout_pad(field_size, 8) << "  "
+                    << decl->lhs->identifier->token << " " << layout_type_str(decl->lhs) << "\n";
+        end = field_offset + field_size;
+    }
+    if (size > end) {
+        error_out() << layout_pad(end, 8) << " " << layout_pad(size - end, 8) << "  padding\n";
+    }
+}
+
+void layout_start(std::vector<StatementNode*>& ast) {
+    layout_types.clear();
+    for (StatementNode* statement : ast) {
+        if (statement->nt == NODE_TYPE) {
+            layout_types.push_back(statement->type_lhs);
+        }
+    }
+    // in the order they are written, which has the types of fields first
+    for (TypeNode* type : layout_types) {
+        layout_order(type);
+    }
+    layout_soa(ast);
+    if (global_state->print_layout) {
+        for (StatementNode* statement : ast) {
+            if (statement->nt == NODE_TYPE && statement->type_lhs->is_reachable) {
+                layout_report(statement->type_lhs);
+            }
+        }
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "ast.hpp"
+
+// Struct layout, decided once after dce_start and used by the IR, the
+// backends and the C output alike. Fields are reordered by alignment when
+// that makes the struct smaller, unless it is packed or ordered, and
+// fixed arrays of a soa type become a struct holding an array per field
+void layout_start(std::vector<StatementNode*>& ast);
+
+TypeNode* layout_find_type(std::string name);
+std::vector<VarDeclNode*> layout_fields(TypeNode* type); // in memory order
+
+// Size and alignment of a variable or field of any type, false when it
+// isn't known (a struct holding a type from C)
+bool layout_var(VarNode* var, int64_t* size, int64_t* align);
+// With a field name, offset, size and align are those of the field
+bool layout_record(TypeNode* record, std::string field, int64_t* offset, int64_t* size, int64_t* align);
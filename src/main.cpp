@@ -1,884 +1,2511 @@
-#include <iostream>
-#include <string>
-#include <fstream>
-#include <vector>
-#include <cstring>
-#include <unistd.h>
-// debug
-#include <memory>
-
-#include "tokenize.hpp"
-#include "error.hpp"
-#include "ast.hpp"
-
-#define DEPEND_LIBC
-
-ExpressionNode* ast_create_expression(std::vector<Token*> tokens, bool is_args, bool is_cond, bool is_arr, int* i);
-ExpressionNode* ast_create_expr_prec(std::vector<Token*> tokens, int precedence, bool is_args, bool is_cond, bool is_arr, int* i);
-void codegen_block(BlockNode* block, std::ofstream* file, int tab_level);
-BlockNode* ast_create_block(std::vector<Token*> tokens, int* i);
-void codegen_tabs(std::ofstream* file, int tab_level);
-bool codegen_statement(StatementNode* statement, std::ofstream* file, int tab_level);
-void codegen_expr(ExpressionNode* expression, std::ofstream* file);
-std::string read_file (std::string filename);
-StatementNode* ast_create_declaration(std::vector<Token*> tokens, int* i);
-std::string ast_get_file_full_path(std::string filename);
-std::vector<StatementNode*> ast_create(std::vector<Token*> tokens);
-VarType get_var_type(Token* var_type);
-std::string codegen_get_c_type(Token* atlas_type);
-
-#include "global.hpp"
-State* global_state = NULL;
-
-std::vector<FunctionNode*> function_table; // "table"
-
-std::string get_nt_str(NodeType nt) {
-    switch(nt) {
-    case NODE_FUNC:
-        return "NODE_FUNC";
-    case NODE_PARAM:
-        return "NODE_PARAM";
-    case NODE_BLOCK:
-        return "NODE_BLOCK";
-    case NODE_ROOT:
-        return "NODE_ROOT";
-    case NODE_VAR_DECL:
-        return "NODE_VAR_DECL";
-    case NODE_CALL:
-        return "NODE_CALL";
-    case NODE_ASSIGN:
-        return "NODE_ASSIGN";
-    case NODE_BINOP:
-        return "NODE_BINOP";
-    case NODE_CONSTANT:
-        return "NODE_CONSTANT";
-    case NODE_VAR:
-        return "NODE_VAR";
-    case NODE_RETURN:
-        return "NODE_RETURN";
-    case NODE_IF:
-        return "NODE_IF";
-    case NODE_FOR:
-        return "NODE_FOR";
-    case NODE_TYPE:
-        return "NODE_TYPE";
-    case NODE_ARRAY_EXPR:
-        return "NODE_ARRAY_EXPR";
-    case NODE_CHAR:
-        return "NODE_CHAR";
-    case NODE_QUOTE:
-        return "NODE_QUOTE";
-    case NODE_SUBSCRIPT:
-        return "NODE_SUBSCRIPT";
-    case NODE_UNARY:
-        return "NODE_UNARY";
-    case NODE_MEMBER_ACCESS:
-        return "NODE_MEMBER_ACCESS";
-    case NODE_TYPE_INST:
-        return "NODE_TYPE_INST";
-    case NODE_CINCLUDE:
-        return "NODE_CINCLUDE";
-    default:
-        return "NODE_INVALID";
-    }
-}
-
-void atlas_lib(std::ofstream* file) {
-    *file << "extern int open(const char* filename, int flags, int mode);\n";
-    *file << "extern int close(int fileds);\n";
-    *file << "extern void* malloc(long unsigned int size);\n";
-    *file << "extern void free(void* ptr);\n";
-    
-    //TODO: might not need this part lol
-    *file << "#define SYSCALL_EXIT 60\n"
-          << "#define SYSCALL_WRITE 1\n"
-          << "typedef unsigned char uchar;\n"
-          << "typedef unsigned char byte;\n"
-          << "typedef char sbyte;\n"
-          << "typedef short int16;\n"
-          << "typedef unsigned short uint16;\n"
-          << "typedef unsigned short ushort;\n"
-          << "typedef int int32;\n"
-          << "typedef unsigned int uint32;\n"
-          << "typedef unsigned int uint;\n"
-          << "typedef long long int64;\n"
-          << "typedef unsigned long long uint64;\n"
-          << "typedef enum { false, true } bool;\n"
-          << "#define true 1\n"
-          << "#define false 0\n";
-
-    *file << "\n";
-
-    *file << "void atlas_exit(int exit_code)\n"
-          << "{\n"
-          << "\tasm volatile\n"
-          << "\t(\n"
-          << "\t\t\"syscall\"\n"
-          << "\t\t:\n" 
-          << "\t\t: \"a\"(SYSCALL_EXIT), \"D\"(exit_code)\n"
-          << "\t\t: \"rcx\", \"r11\", \"memory\"\n"
-          << "\t);\n"
-          << "}\n\n";
-
-    *file << "void atlas_putchar(char c) {\n"
-          << "\tasm volatile (\n"
-          << "\t\t\"movq $1, %%rax\\n\"\n"
-          << "\t\t\"movq $1, %%rdi\\n\"\n"
-          << "\t\t\"movq %0, %%rsi\\n\"\n"
-          << "\t\t\"movq $1, %%rdx\\n\"\n"
-          << "\t\t\"syscall\"\n"
-          << "\t\t:\n"
-          << "\t\t: \"r\"(&c)\n"
-          << "\t\t: \"%rax\", \"%rdi\", \"%rsi\", \"%rdx\"\n"
-          << "\t);\n"
-          << "}\n\n";
-}
-
-void codegen_init_c(std::vector<StatementNode*> ast, std::ofstream* file) {
-    // TODO: going to be dependent on libc for some time lol
-    #ifndef DEPEND_LIBC
-	*file << "void _start(void)\n"
-          << "{\n"
-          << "\tint ret = main();\n";
-
-    *file << "\tsys_exit(ret);\n"
-          << "}\n\n";
-    #endif
-}
-
-void codegen_end(std::ofstream* file, std::string backend) {
-    (*file).close();
-
-    std::string output_file_path;
-    if(global_state->output_file_path.size() != 0) {
-        output_file_path = global_state->output_file_path;
-    } else {
-        output_file_path = "a.out";
-    }
-    if (!global_state->emit_c) {
-        std::string remove = "rm out.c";
-        std::system(remove.c_str());
-    }
-
-    std::string command = backend + " -nostdlib out.c -o " + output_file_path;
-    log_print("Running \"" + command + "\"\n");
-    // Compile C code
-    int ret = std::system(command.c_str());
-    //TODO: not sure what scenarios this works/not works
-    if (WEXITSTATUS(ret) != 0x00) {
-        std::string err = backend + " backend Failed to compile C program";
-        print_error_msg(err.c_str());
-        std::cout << "                  Check " << backend << " error messages\n";
-        std::cout << "                  Exit Code: " << ret << "\n";
-        exit(1);
-    }
-    log_print("Generated binary \"" + output_file_path + "\"\n");
-}
-
-void codegen_end_libc(std::ofstream* file, std::string backend) {
-    (*file).close();
-
-    std::string output_file_path;
-    if(global_state->output_file_path.size() != 0) {
-        output_file_path = global_state->output_file_path;
-    } else {
-        output_file_path = "a.out";
-    }
-
-    //TODO: get rid of this mimalloc string?
-    //      for some reason it doesn't link properly on my machine
-    std::string command = backend + " out.c -o " + output_file_path;
-    log_print("Running \"" + command + "\"\n");
-    // Compile C code
-    int ret = std::system(command.c_str());
-    //TODO: not sure what scenarios this works/not works
-    if (WEXITSTATUS(ret) != 0x00) {
-        std::string err = backend + " backend Failed to compile C program";
-        print_error_msg(err.c_str());
-        std::cout << "                  Check " << backend << " error messages\n";
-        std::cout << "                  Exit Code: " << ret << "\n";
-        exit(1);
-    }
-    log_print("Generated binary \"" + output_file_path + "\"\n");
-}
-
-void codegen_array_expr(ArrayNode* array, std::ofstream* file) {
-    *file << "{";
-    for (int i = 0; i < array->elements.size(); i++) {
-        //std::cout << array->elements[i] << ": ";
-        //std::cout << get_nt_str(array->elements[i]->nt) << "\n";
-        codegen_expr(array->elements[i], file);
-        if (i != array->elements.size() - 1) {
-            *file << ", ";
-        }
-    }
-    *file << "}";
-}
-
-std::string codegen_get_intrinsic_name(std::string name) {
-    if (name == "putchar") {
-        return "atlas_putchar";
-    } else if (name == "alloc") {
-        return "malloc";
-    } else if (name == "free") {
-        return "free";
-    } else if (name == "open") {
-        return "open";
-    } else if (name == "close") {
-        return "close";
-    } else if (name == "sizeof") {
-        return "sizeof";
-    } else if (name == "exit") {
-        return "atlas_exit";
-    } else if (name == "new") {
-        return "new"; // TODO: implement
-    } else {
-        std::string err = "\"" + name + "\"" + " intrinsic has not been defined\n";
-        print_error_msg(err);
-        exit(1);
-    }
-}
-
-bool codegen_is_intrinsic_type(Token* atlas_type) {
-    if (atlas_type->token == "i64") {
-        return true;
-    } else if (atlas_type == NULL) {
-        return true;
-    } else if (atlas_type->token == "i32") {
-        return true;
-    } else if (atlas_type->token == "i16") {
-        return true;
-    } else if (atlas_type->token == "i8") {
-        return true;
-    } else if (atlas_type->token == "u64") {
-        return true;
-    } else if (atlas_type->token == "u32") {
-        return true;
-    } else if (atlas_type->token == "u16") {
-        return true;
-    } else if (atlas_type->token == "u8") {
-        //std::cout << "[ERROR]: \"u8\" IS NOT SUPPORTED\n";
-        return true;
-        //exit(1);
-    }
-    return false;
-}
-
-std::string codegen_get_c_intrinsic_type(Token* atlas_type) {
-    if (atlas_type->token == "i64") {
-        return "int64";
-    } else if (atlas_type == NULL) {
-        return "void"; //NOTE: what is this?
-    } else if (atlas_type->token == "i32") {
-        return "int32";
-    } else if (atlas_type->token == "i16") {
-        return "int16";
-    } else if (atlas_type->token == "i8") {
-        return "char";
-    } else if (atlas_type->token == "u64") {
-        return "uint64";
-    } else if (atlas_type->token == "u32") {
-        return "uint32";
-    } else if (atlas_type->token == "u16") {
-        return "uint16";
-    } else if (atlas_type->token == "u8") {
-        return "uchar";
-    }
-    print_error_msg("Something wrong has occurred in codegen_get_c_intrinsic_type");
-}
-
-bool codegen_is_intrinsic_function(std::string call_name) {
-    if (call_name == "putchar") {
-        return true;
-    } else if (call_name == "open") {
-        return true;
-    } else if (call_name == "close") {
-        return true;
-    } else if (call_name == "alloc") {
-        return true;
-    } else if (call_name == "free") {
-        return true;
-    } else if (call_name == "sizeof") {
-        return true;
-    } else if (call_name == "exit") {
-        return true;
-    } else {
-        return false;
-    }
-}
-
-void codegen_char(CharacterNode* character, std::ofstream* file) {
-    *file << "'";
-    if (character->value.size() != 0) {
-        *file << character->value;
-    }
-    *file << "'";
-}
-
-void codegen_quote(QuoteNode* quote, std::ofstream* file) {
-    //*file << "atlas_create_string("
-    *file << "Z_19atlas_create_string6string("
-          << "\"" << quote->quote_token->token << "\""
-          << ","  << quote->quote_token->token.size()
-          << ")";
-    //*file << "\"" << quote->quote_token->token << "\"";
-}
-
-void codegen_subscript(SubscriptNode* subscript, std::ofstream* file) {
-    if (subscript->is_declaration) {
-        *file << "{";
-    } else {
-        *file << "[";
-    }
-    for (int i = 0; i < subscript->indexes.size(); i++) {
-        ExpressionNode* index = subscript->indexes[i];
-        codegen_expr(index, file);
-        if (i == subscript->indexes.size() - 1) {
-            break;
-        }
-        *file << ", ";
-    }
-    if (subscript->is_declaration) {
-        *file << "}";
-    } else {
-        *file << "]";
-    }
-}
-
-void codegen_type_inst(TypeInstNode* type_inst, std::ofstream* file) {
-    *file << "{";
-    for (int i = 0; i < type_inst->values.size(); i++) {
-        ExpressionNode* value = type_inst->values[i];
-        codegen_expr(value, file);
-        if (i == type_inst->values.size() - 1) {
-            break;
-        }
-        *file << ", ";
-    }
-    *file << "}";
-}
-
-void codegen_unary_op(UnaryOpNode* unary_op, std::ofstream* file) {
-    //TODO: old code?
-    std::string str;
-    switch(unary_op->operator_type) {
-    case NODE_SUBSCRIPT:
-        codegen_expr(unary_op->operand, file);
-        codegen_subscript(unary_op->subscript, file);
-        break;
-    default:
-        print_error_msg("unary op not implemented yet\n");
-        exit(1);
-    }
-}
-
-std::string codegen_get_call_mangled(std::string name) {
-    for (FunctionNode* func : function_table) {
-        if (func->token->token == name) {
-            return func->mangled_name;
-        } else if (codegen_is_intrinsic_function(name)) {
-            return codegen_get_intrinsic_name(name);
-        }
-    }
-    // just return the original name if not found for whatever reason
-    return name;
-}
-
-void codegen_expr(ExpressionNode* expression, std::ofstream* file) {
-    file->flush();
-    if(expression->needs_paren) {
-        *file << "(";
-    }
-    switch(expression->nt) {
-    case NODE_BINOP:
-        codegen_expr(expression->binop->lhs, file);
-        if (expression->binop->op->tt == TK_DOT || expression->binop->op->tt == TK_SQUARE_OPEN) {
-            *file << expression->binop->op->token;
-        } else {
-            *file << " " << expression->binop->op->token << " ";
-        }
-        // handle rhs
-        codegen_expr(expression->binop->rhs, file);
-        if (expression->binop->op->tt == TK_SQUARE_OPEN) {
-            *file << "]";
-        }
-        break;
-    case NODE_CONSTANT:
-        *file << expression->constant->value;
-        break;
-    case NODE_CALL:
-    {
-        //std::string call_name = expression->call_node->name->token;
-        std::string call_name = codegen_get_call_mangled(expression->call_node->name->token);
-
-        *file << call_name << "("; 
-        auto args = expression->call_node->args;
-        for (int i = 0; i < args.size(); i++) {
-            codegen_expr(args[i], file);
-            if (i < args.size() - 1) {
-                *file << ", ";
-            }
-        }
-        *file << ")";
-        break;
-    }
-    case NODE_VAR:
-    {
-        //TODO: make this better lol - for reserved types 
-        if (codegen_is_intrinsic_type(expression->var_node->identifier)) {
-            *file << codegen_get_c_intrinsic_type(expression->var_node->identifier);
-        } else {
-            *file << expression->var_node->identifier->token;
-        }
-        break;
-    }
-    case NODE_ARRAY_EXPR:
-        codegen_array_expr(expression->array, file);
-        break;
-    case NODE_CHAR:
-        codegen_char(expression->character, file);
-        break;
-    case NODE_QUOTE:
-        codegen_quote(expression->quote, file);
-        break;
-    case NODE_SUBSCRIPT:
-        codegen_subscript(expression->subscript, file);
-        break;
-    case NODE_UNARY:
-        //TODO:
-        codegen_unary_op(expression->unary_op, file);
-        break;
-    case NODE_TYPE_INST:
-        codegen_type_inst(expression->type_inst, file);
-        break;
-    default:
-        std::string err = "CODEGEN EXPR " + get_nt_str(expression->nt) + "\n";
-        print_error_msg(err);
-        std::cout << expression->nt;
-        exit(1);
-    }
-    if(expression->needs_paren) {
-        *file << ")";
-    }
-}
-
-std::string codegen_get_c_type(Token* atlas_type) {
-    if (atlas_type->token == "i64") {
-        return "int64";
-    } else if (atlas_type == NULL) {
-        return "void";
-    } else if (atlas_type->token == "i32") {
-        return "int32";
-    } else if (atlas_type->token == "i16") {
-        return "int16";
-    } else if (atlas_type->token == "i8") {
-        return "int8";
-    } else if (atlas_type->token == "u64") {
-        return "uint64";
-    } else if (atlas_type->token == "u32") {
-        return "uint32";
-    } else if (atlas_type->token == "u16") {
-        return "uint16";
-    } else if (atlas_type->token == "u8") {
-        return "char";
-        //print_error_msg("\"u8\" IS NOT SUPPORTED");
-        //exit(1);
-    } else if (atlas_type->token == "string") {
-        //return "AtlasTypeString";
-        return "string";
-    } else if (atlas_type->token == "bool") {
-        return "bool";
-    }
-    std::string err = "The \"" + atlas_type->token + "\" type is not supported";
-    print_error_msg(err);
-    exit(1);
-}
-
-bool codegen_is_c_type(Token* atlas_type) {
-    if (atlas_type->token == "i64") {
-        return true;
-    } else if (atlas_type == NULL) {
-        return true;
-    } else if (atlas_type->token == "i32") {
-        return true;
-    } else if (atlas_type->token == "i16") {
-        return true;
-    } else if (atlas_type->token == "i8") {
-        return true;
-    } else if (atlas_type->token == "u64") {
-        return true;
-    } else if (atlas_type->token == "u32") {
-        return true;
-    } else if (atlas_type->token == "u16") {
-        return true;
-    } else if (atlas_type->token == "u8") {
-        //std::cout << "[ERROR]: \"u8\" IS NOT SUPPORTED\n";
-        return true;
-        //exit(1);
-    }
-    return false;
-}
-
-void codegen_var_decl(VarDeclNode* var_decl, std::ofstream* file) {
-    if (var_decl->is_static) {
-        *file << "static ";
-    }
-    if (var_decl->is_const) {
-        *file << "const ";
-    }
-    // lhs
-    if (codegen_is_c_type(var_decl->lhs->type_)) {
-        *file << codegen_get_c_type(var_decl->lhs->type_);
-    } else if (var_decl->lhs->type_->token == "string") {
-        *file << "string"; // TODO:
-    } else {
-        *file << var_decl->lhs->type_->token;
-    }
-
-    for (int i = 0; i < var_decl->lhs->ptr_level; i++) {
-        *file << "*";
-    }
-
-    *file << " " << var_decl->lhs->identifier->token;
-
-    print_token(var_decl->lhs->identifier);
-    if (var_decl->lhs->is_array == true) {
-        *file << "[";
-        codegen_expr(var_decl->lhs->arr_size, file);
-        *file << "]";
-    }
-
-    // rhs
-    if (var_decl->rhs != NULL) {
-        *file << " = ";
-        codegen_expr(var_decl->rhs, file);
-    }
-}
-
-void codegen_param(ParamNode* param, std::ofstream* file) {
-    // lhs
-    if (codegen_is_c_type(param->type_)) {
-        *file << codegen_get_c_type(param->type_);
-    } else if (param->type_->token == "string") {
-        *file << "string"; // TODO:
-    } else {
-        *file << param->type_->token;
-    }
-
-    for (int i = 0; i < param->ptr_level; i++) {
-        *file << "*";
-    }
-
-    *file << " " << param->identifier->token;
-
-    print_token(param->identifier);
-    if (param->is_array == true) {
-        *file << "[";
-        codegen_expr(param->arr_size, file);
-        *file << "]";
-    }
-}
-
-void codegen_type(TypeNode* type, std::ofstream* file) {
-    *file << "typedef struct " << type->name->token << "\n";
-    *file << "{\n";
-    for (VarDeclNode* var : type->declarations) {
-        codegen_tabs(file, 1);
-        codegen_var_decl(var, file);
-        *file << ";\n";
-    }
-    *file << "}" << type->name->token << ";\n\n";
-}
-
-void codegen_return(StatementNode* statement, std::ofstream* file) {
-    *file << "return ";
-    codegen_expr(statement->return_lhs->expr, file);
-}
-
-void codegen_if(IfNode* if_node, std::ofstream* file, int tab_level) {
-    *file << "if(";
-    codegen_expr(if_node->condition, file);
-    *file << ")\n";
-    codegen_block(if_node->block, file, tab_level + 1);
-    if (if_node->_else != NULL) {
-        if (if_node->_else->block != NULL) {
-            codegen_tabs(file, tab_level);
-            *file << "else\n";
-            codegen_block(if_node->_else->block, file, tab_level + 1);
-        } else if (if_node->_else->else_if != NULL) {
-            codegen_tabs(file, tab_level);
-            *file << " else ";
-            codegen_if(if_node->_else->else_if->if_lhs, file, tab_level);
-        }
-    }
-}
-
-void codegen_for(ForNode* for_node, std::ofstream* file, int tab_level) {
-    if (for_node->for_type == FOR_LOOP) {
-        *file << "for(";
-        codegen_statement(for_node->init, file, tab_level);
-        *file << "; ";
-        codegen_expr(for_node->test, file);
-        *file << "; ";
-        // NOTE: Can't generate statements here now
-        codegen_expr(for_node->update->expr_lhs, file);
-        *file << ")\n";
-        codegen_block(for_node->block, file, tab_level + 1);
-    } else if (for_node->for_type == FOR_WHILE) {
-        *file << "for(;";
-        codegen_expr(for_node->test, file);
-        *file << ";)\n";
-        codegen_block(for_node->block, file, tab_level + 1);
-    } else {
-        print_error_msg("Codegen for this for loop type is not implemented yet...");
-        exit(1);
-    }
-}
-
-void codegen_assign(AssignNode* assign, std::ofstream* file) {
-    // lhs
-    *file << assign->lhs->identifier->token;
-    if (assign->lhs->is_array) {
-        *file << "[";
-        codegen_expr(assign->lhs->arr_size, file);
-        *file << "]";
-    }
-    // rhs
-    *file << " = ";
-    codegen_expr(assign->rhs, file);
-}
-
-bool codegen_statement(StatementNode* statement, std::ofstream* file, int tab_level) {
-    switch(statement->nt) {
-    case NODE_VAR_DECL:
-        codegen_var_decl(statement->vardecl_lhs, file);
-        return true;
-    case NODE_ASSIGN:
-        //TODO: does this even exist anymore?
-        codegen_expr(statement->expr_lhs, file);
-        return true;
-    case NODE_BINOP:
-        codegen_expr(statement->expr_lhs, file);
-        return true;
-    case NODE_IF:
-        codegen_if(statement->if_lhs, file, tab_level);
-        return false;
-    case NODE_RETURN:
-        codegen_return(statement, file);
-        return true;
-    case NODE_FOR:
-        codegen_for(statement->for_lhs, file, tab_level);
-        return false;
-    case NODE_CALL:
-        codegen_expr(statement->expr_lhs, file);
-        return true;
-    default:
-        std::string err = "CODEGEN STATEMENT " + get_nt_str(statement->nt) + "\n";
-        print_error_msg(err);
-        exit(1);
-    }
-    return false;
-}
-
-void codegen_func(FunctionNode* func, std::ofstream* file) {
-    if (func->return_types == NULL) {
-        *file << "void ";
-    } else {
-        *file << codegen_get_c_type(func->return_types) << " ";
-    }
-    //*file << func->token->token << "(";
-    *file << func->mangled_name << "(";
-    bool add_comma = true;
-    // Args
-    for (int i = 0; i < func->params.size(); i++) {
-        codegen_param(func->params[i], file);
-        if (i + 1 != func->params.size()) {
-            *file << ", ";
-        }
-    }
-    if (func->params.size() == 0) {
-        *file << "void";
-    }
-    *file << ")\n";
-    if(func->block != NULL) {
-        codegen_block(func->block, file, 1);
-    } else {
-        *file << ";";
-    }
-    *file << "\n";
-}
-
-void codegen_tabs(std::ofstream* file, int tab_level) {
-    for (int i = 0; i < tab_level; i++) {
-        *file << "\t";
-    }
-}
-
-void codegen_block(BlockNode* block, std::ofstream* file, int tab_level) {
-    codegen_tabs(file, tab_level - 1);
-    *file << "{\n";
-    if (block != NULL) {
-        for (StatementNode* statement : block->statements) {
-            codegen_tabs(file, tab_level);
-            if(codegen_statement(statement, file, tab_level)) {
-                *file << ";\n";
-            }
-        }
-    }
-    codegen_tabs(file, tab_level - 1);
-    *file << "}\n";
-}
-
-void codegen_start(std::vector<StatementNode*> ast, std::string filename, std::string backend) {
-    std::ofstream file(filename);
-    atlas_lib(&file);
-    for (StatementNode* node : ast) {
-        log_print("Generating Node: " +  get_nt_str(node->nt) + "\n");
-        if (node->nt == NODE_FUNC) {
-            codegen_func(node->func_lhs, &file);
-        } else if (node->nt == NODE_TYPE) {
-            codegen_type(node->type_lhs, &file);
-        } else if (node->nt == NODE_CALL) {
-            codegen_expr(node->expr_lhs, &file);
-        } else if (node->nt == NODE_VAR_DECL) {
-            codegen_var_decl(node->vardecl_lhs, &file);
-            file << ";\n";
-        } else if (node->nt == NODE_CINCLUDE) {
-            file << "#include <";
-            file << node->cinclude_lhs->name->token;
-            file << ">\n";
-        }
-    }
-    codegen_init_c(ast, &file);
-    codegen_end_libc(&file, backend);
-}
-
-/* Codegen end */
-
-void check_valid_backend(std::string backend) {
-    //TODO: actually check if the backend exists
-    if (backend == "gcc" || backend == "clang" || backend == "tcc") {
-        return;
-    }
-    print_error_msg("backend is not supported");
-    exit(1);
-}
-
-void print_usage() {
-    std::cout << "Usage: atlas [options] file...\n";
-    std::cout << "Options:\n";
-    std::cout << "    --include <dir>\n";
-    std::cout << "    -I <dir>          Add directory to the Path to the Include search paths\n";
-    std::cout << "    --debug           Used to show logs for Compiler development\n";
-    std::cout << "    --run\n";
-    std::cout << "    -r                Runs the program after compilation.\n";
-    std::cout << "                      NOTE: Removes output file if not specified with -o\n";
-    std::cout << "    --output\n";
-    std::cout << "    -o <filename>     Place the output file in the specified name\n";
-    exit(0);
-}
-
-State* set_options(int argc, char** argv) {
-    State* state = new State;
-    bool filepath_set = false;
-    for (int i = 1; i < argc; i++) {
-        std::string arg = argv[i];
-        if (arg == "--debug") {
-            state->debug = true;
-        } else if (arg == "-o" || arg == "--output") {
-            if (i == argc) {
-                print_error_msg("No output file provided after -o flag");
-                exit(1);
-            }
-            i++;
-            state->output_file_path = std::string(argv[i]);
-        } else if (arg == "-I" || arg == "--include") {
-            if (i == argc) {
-                print_error_msg("No path provided after -I flag");
-                exit(1);
-            }
-            i++;
-            state->include_path = std::string(argv[i]);
-            if (state->include_path[state->include_path.size() - 1] != '/') {
-                state->include_path += '/';
-            }
-        } else if (arg == "-r" || arg == "--run") {
-            state->run = true;
-        } else if (arg == "-E" || arg == "--emit-c") {
-            state->emit_c = true;
-        } else if (arg == "--help") {
-            print_usage();
-        } else if (argv[i][0] == '-') {
-            std::string err = "Unknown option: " + arg;
-            print_error_msg(err);
-            exit(1);
-        } else {
-            state->input_filename = arg;
-            filepath_set = true;
-            char BUFF[255]; // Max number of chars for filename in Linux
-            //std::string full_path = ;
-            state->input_file_dir = getcwd(BUFF, sizeof(BUFF));
-            state->input_file_dir += "/";
-        }
-    }
-    if (!filepath_set) {
-        std::cout << "atlas: " << CL_RED << "error:" << CL_RESET <<" no input files\n";
-        exit(1);
-    }
-    return state;    
-}
-
-void run_program(std::string output_file_path) {
-    //TODO: handle case where this fails because codegen didn't succeed
-    std::string command;
-    bool is_output_specified = true;
-    if (output_file_path.size() == 0) {
-        command = "./a.out";
-        output_file_path = "a.out";
-        is_output_specified = false;
-    }
-    command = "./" + output_file_path;
-    int ret = std::system(command.c_str());
-    if (!is_output_specified) {
-        std::string remove = "rm " + output_file_path;
-        std::system(remove.c_str());
-    }
-}
-
-int main(int argc, char** argv) {
-    if (argc == 1) {
-        //TODO: print a usage
-        std::cout << "atlas: " << CL_RED << "error:" << CL_RESET <<" no input files\n";
-        return 1;
-    }
-
-    State* state = set_options(argc, argv);
-    global_state = state;
-    std::string BACKEND;
-    if (state->debug) {
-        std::cout << "[INFO]: Debug Mode is enabled\n";
-        BACKEND = "gcc -fcompare-debug-second -w ";
-        //BACKEND = "g++ -fcompare-debug-second -w ";
-    } else {
-        //BACKEND = "g++";
-        BACKEND = "gcc";
-    }
-    //BACKEND = "clang";
-
-    std::string src = read_file(state->input_filename);
-    log_print(src + "\n");
-    log_print("-----TOKENIZING START------\n");
-    auto tokens = tokenize(src);
-    print_tokens(tokens);
-    log_print("------TOKENIZING END-------\n\n");
-    log_print("--------AST START----------\n");
-    auto ast = ast_create(tokens);
-    log_print("---------AST END-----------\n\n");
-    log_print("------CODEGEN START--------\n");
-    codegen_start(ast, "out.c", BACKEND);
-    log_print("-------CODEGEN END---------\n\n");
-    if (state->run) {
-        run_program(state->output_file_path);
-    }
-    return 0;
-}
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstring>
+#include <unistd.h>
+#include <chrono>
+// debug
+#include <memory>
+
+#include "tokenize.hpp"
+#include "error.hpp"
+#include "ast.hpp"
+#include "runtime.hpp"
+#include "fold.hpp"
+#include "dce.hpp"
+#include "memo.hpp"
+#include "vector.hpp"
+#include "ir.hpp"
+#include "x64.hpp"
+#include "vm.hpp"
+#include "escape.hpp"
+#include "layout.hpp"
+#include "tail.hpp"
+#include "bounds.hpp"
+
+ExpressionNode* ast_create_expression(std::vector<Token*> tokens, bool is_args, bool is_cond, bool is_arr, int* i);
+ExpressionNode* ast_create_expr_prec(std::vector<Token*> tokens, int precedence, bool is_args, bool is_cond, bool is_arr, int* i);
+void codegen_block(BlockNode* block, std::ostream* file, int tab_level);
+BlockNode* ast_create_block(std::vector<Token*> tokens, int* i);
+void codegen_tabs(std::ostream* file, int tab_level);
+bool codegen_statement(StatementNode* statement, std::ostream* file, int tab_level);
+void codegen_expr(ExpressionNode* expression, std::ostream* file);
+std::string read_file (std::string filename);
+StatementNode* ast_create_declaration(std::vector<Token*> tokens, int* i);
+std::string ast_get_file_full_path(std::string filename);
+std::vector<StatementNode*> ast_create(std::vector<Token*> tokens);
+VarType get_var_type(Token* var_type);
+std::string codegen_get_c_type(Token* atlas_type);
+std::string codegen_get_elem_type(VarNode* var);
+std::string codegen_get_slice_name(VarNode* var);
+std::string codegen_get_slice_maker(VarNode* var);
+std::string codegen_get_var_type(VarNode* var);
+std::string codegen_get_return_type(FunctionNode* func);
+FunctionNode* codegen_get_function(std::string name);
+
+#include "global.hpp"
+thread_local State* global_state = NULL;
+
+thread_local std::vector<FunctionNode*> function_table; // "table"
+thread_local Scope* codegen_scope = NULL; // innermost scope of the code being generated
+thread_local std::vector<VarNode*> codegen_slice_types; // every distinct []T and [..]T used
+thread_local std::vector<std::string> codegen_user_types;
+thread_local std::vector<std::string> codegen_tuple_types; // structs already declared for multi-value returns
+thread_local FunctionNode* codegen_current_func = NULL;
+thread_local int codegen_tmp_count = 0; // for naming compiler made temporaries
+// A deferred statement with the scope it was written in, where its names
+// are looked up wherever it is written again
+struct CodegenDefer {
+    StatementNode* statement;
+    Scope* scope;
+};
+
+// A variable shadowed by a declaration while defers were pending. They
+// reach it through a pointer declared just before the declaration
+struct CodegenHidden {
+    VarNode* var;
+    std::string alias;
+    Scope* scope; // where the declaration was written
+};
+
+// The statements deferred so far in each block being written, innermost
+// last. They are written again wherever their block can be left
+thread_local std::vector<std::vector<CodegenDefer>> codegen_defers;
+thread_local bool codegen_in_defer = false;
+thread_local Scope* codegen_live_scope = NULL; // the scope a defer is being written into
+thread_local std::vector<CodegenHidden> codegen_hidden;
+
+std::string get_nt_str(NodeType nt) {
+    switch(nt) {
+    case NODE_FUNC:
+        return "NODE_FUNC";
+    case NODE_PARAM:
+        return "NODE_PARAM";
+    case NODE_BLOCK:
+        return "NODE_BLOCK";
+    case NODE_ROOT:
+        return "NODE_ROOT";
+    case NODE_VAR_DECL:
+        return "NODE_VAR_DECL";
+    case NODE_CALL:
+        return "NODE_CALL";
+    case NODE_ASSIGN:
+        return "NODE_ASSIGN";
+    case NODE_BINOP:
+        return "NODE_BINOP";
+    case NODE_CONSTANT:
+        return "NODE_CONSTANT";
+    case NODE_VAR:
+        return "NODE_VAR";
+    case NODE_RETURN:
+        return "NODE_RETURN";
+    case NODE_IF:
+        return "NODE_IF";
+    case NODE_FOR:
+        return "NODE_FOR";
+    case NODE_DEFER:
+        return "NODE_DEFER";
+    case NODE_MATCH:
+        return "NODE_MATCH";
+    case NODE_TYPE:
+        return "NODE_TYPE";
+    case NODE_ARRAY_EXPR:
+        return "NODE_ARRAY_EXPR";
+    case NODE_CHAR:
+        return "NODE_CHAR";
+    case NODE_QUOTE:
+        return "NODE_QUOTE";
+    case NODE_SUBSCRIPT:
+        return "NODE_SUBSCRIPT";
+    case NODE_UNARY:
+        return "NODE_UNARY";
+    case NODE_MEMBER_ACCESS:
+        return "NODE_MEMBER_ACCESS";
+    case NODE_TYPE_INST:
+        return "NODE_TYPE_INST";
+    case NODE_CINCLUDE:
+        return "NODE_CINCLUDE";
+    case NODE_COMPTIME:
+        return "NODE_COMPTIME";
+    default:
+        return "NODE_INVALID";
+    }
+}
+
+void atlas_lib(std::ostream* file) {
+    if (!global_state->freestanding) {
+        *file << "extern int open(const char* filename, int flags, int mode);\n";
+        *file << "extern int close(int fileds);\n";
+        *file << "extern void* malloc(long unsigned int size);\n";
+        *file << "extern void free(void* ptr);\n";
+        *file << "extern void* realloc(void* ptr, long unsigned int size);\n";
+        *file << "#define atlas_alloc malloc\n";
+        *file << "#define atlas_free free\n";
+        *file << "#define atlas_realloc realloc\n";
+    }
+
+    //TODO: might not need this part lol
+    *file << "#define SYSCALL_EXIT 60\n"
+          << "#define SYSCALL_WRITE 1\n"
+          << "typedef unsigned char uchar;\n"
+          << "typedef unsigned char byte;\n"
+          << "typedef char sbyte;\n"
+          << "typedef short int16;\n"
+          << "typedef unsigned short uint16;\n"
+          << "typedef unsigned short ushort;\n"
+          << "typedef int int32;\n"
+          << "typedef unsigned int uint32;\n"
+          << "typedef unsigned int uint;\n"
+          << "typedef long long int64;\n"
+          << "typedef unsigned long long uint64;\n"
+          << "typedef enum { false, true } bool;\n"
+          << "#define true 1\n"
+          << "#define false 0\n";
+    // -> tail, a real tail call where the C compiler can be told to make one
+    *file << "#if defined(__has_attribute)\n"
+          << "#if __has_attribute(musttail)\n"
+          << "#define ATLAS_MUSTTAIL __attribute__((musttail))\n"
+          << "#endif\n"
+          << "#endif\n"
+          << "#ifndef ATLAS_MUSTTAIL\n"
+          << "#define ATLAS_MUSTTAIL\n"
+          << "#endif\n";
+
+    *file << "\n";
+
+    runtime_syscalls(file);
+
+    // only what dce_start found a use for
+    if (dce_runtime.exit) {
+    *file << "void atlas_exit(int exit_code)\n"
+          << "{\n"
+          << "\tasm volatile\n"
+          << "\t(\n"
+          << "\t\t\"syscall\"\n"
+          << "\t\t:\n" 
+          << "\t\t: \"a\"(SYSCALL_EXIT), \"D\"(exit_code)\n"
+          << "\t\t: \"rcx\", \"r11\", \"memory\"\n"
+          << "\t);\n"
+          << "}\n\n";
+    }
+
+    if (dce_runtime.putchar) {
+    // write(1, &c, 1), the syscall clobbers rcx and r11 and reads c from
+    // memory, which an optimizing backend has to be told about
+    *file << "void atlas_putchar(char c) {\n"
+          << "\tatlas_syscall3(1, 1, (long)&c, 1);\n"
+          << "}\n\n";
+    }
+
+    if (global_state->freestanding) {
+        runtime_freestanding(file);
+    }
+    if (global_state->bounds_check) {
+        runtime_bounds(file);
+    }
+    if (dce_runtime.io) {
+        runtime_io(file);
+    }
+    if (dce_runtime.memory) {
+        runtime_memory(file);
+    }
+    if (dce_runtime.dynamic) {
+        runtime_dynamic(file);
+    }
+    if (dce_runtime.map) {
+        runtime_map(file);
+    }
+    if (dce_runtime.time) {
+        runtime_time(file);
+    }
+    if (dce_runtime.parallel) {
+        *file << "#define ATLAS_DEFAULT_THREADS " << global_state->threads << "\n";
+        runtime_parallel(file, global_state->freestanding);
+    }
+    for (VectorType type : vector_used_types()) {
+        runtime_vector(file, type);
+    }
+}
+
+void codegen_init_c(std::vector<StatementNode*> ast, std::ostream* file) {
+    if (global_state->freestanding) {
+        // the kernel enters with a 16 byte aligned stack and no return
+        // address, so gcc has to realign before anything uses SSE
+        *file << "__attribute__((force_align_arg_pointer, noreturn))\n"
+              << "void _start(void)\n"
+              << "{\n"
+              << "\tint ret = main();\n";
+
+        *file << "\tatlas_exit(ret);\n"
+              << "\t__builtin_unreachable();\n"
+              << "}\n\n";
+    }
+}
+
+// Sizes of out.c and the binary, and how long the backend took
+void codegen_report_stats(std::string output_file_path, long backend_ms) {
+    std::ifstream c_file("out.c", std::ios::binary | std::ios::ate);
+    std::ifstream binary(output_file_path, std::ios::binary | std::ios::ate);
+    int functions = 0;
+    for (FunctionNode* func : function_table) {
+        functions += func->is_reachable && func->block != NULL && !func->is_comptime;
+    }
+    error_out() << "out.c:   " << (long)c_file.tellg() << " bytes, "
+                << functions << " of " << function_table.size() << " functions\n";
+    if (global_state->use_ir) {
+        error_out() << "ir:      " << ir_functions.size() << " of " << ir_function_count()
+                    << " functions lowered\n";
+        escape_report();
+    }
+    tail_report();
+    bounds_report();
+    error_out() << "backend: " << backend_ms << " ms\n";
+    error_out() << "binary:  " << (long)binary.tellg() << " bytes\n";
+    error_out().flush();
+}
+
+// Runs the C compiler, timing it for --stats
+int codegen_run_backend(std::string command, std::string output_file_path) {
+    log_print("Running \"" + command + "\"\n");
+    auto start = std::chrono::steady_clock::now();
+    int ret = std::system(command.c_str());
+    auto end = std::chrono::steady_clock::now();
+    if (global_state->stats && WEXITSTATUS(ret) == 0x00) {
+        long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        codegen_report_stats(output_file_path, ms);
+    }
+    return ret;
+}
+
+void codegen_end(std::string backend) {
+    std::string output_file_path;
+    if(global_state->output_file_path.size() != 0) {
+        output_file_path = global_state->output_file_path;
+    } else {
+        output_file_path = "a.out";
+    }
+    if (!global_state->emit_c) {
+        std::string remove = "rm out.c";
+        std::system(remove.c_str());
+    }
+
+    std::string command = backend + " -static -nostdlib -fno-stack-protector -s out.c -o "
+                          + output_file_path;
+    // Compile C code
+    int ret = codegen_run_backend(command, output_file_path);
+    //TODO: not sure what scenarios this works/not works
+    if (WEXITSTATUS(ret) != 0x00) {
+        std::string err = backend + " backend Failed to compile C program";
+        print_error_msg(err.c_str());
+        error_out() << "                  Check " << backend << " error messages\n";
+        error_out() << "                  Exit Code: " << ret << "\n";
+        error_abort();
+    }
+    log_print("Generated binary \"" + output_file_path + "\"\n");
+}
+
+void codegen_end_libc(std::string backend) {
+    std::string output_file_path;
+    if(global_state->output_file_path.size() != 0) {
+        output_file_path = global_state->output_file_path;
+    } else {
+        output_file_path = "a.out";
+    }
+
+    //TODO: get rid of this mimalloc string?
+    //      for some reason it doesn't link properly on my machine
+    std::string command = backend + " out.c -o " + output_file_path;
+    // Compile C code
+    int ret = codegen_run_backend(command, output_file_path);
+    //TODO: not sure what scenarios this works/not works
+    if (WEXITSTATUS(ret) != 0x00) {
+        std::string err = backend + " backend Failed to compile C program";
+        print_error_msg(err.c_str());
+        error_out() << "                  Check " << backend << " error messages\n";
+        error_out() << "                  Exit Code: " << ret << "\n";
+        error_abort();
+    }
+    log_print("Generated binary \"" + output_file_path + "\"\n");
+}
+
+// The struct an initializer being written fills in, so .{...} can name
+// the fields as layout.cpp may have moved them. When codegen_init_is_array
+// the values are elements of an array of it
+thread_local TypeNode* codegen_init_record = NULL;
+thread_local bool codegen_init_is_array = false;
+
+TypeNode* codegen_init_type(VarNode* var) {
+    if (var->type_ == NULL || var->is_slice || var->is_dynamic || var->ptr_level != (var->is_array ? 1 : 0)) {
+        return NULL;
+    }
+    return layout_find_type(var->type_->token);
+}
+
+// Values of an array literal are the elements of codegen_init_record
+void codegen_init_elements() {
+    if (codegen_init_is_array) {
+        codegen_init_is_array = false;
+    } else {
+        codegen_init_record = NULL;
+    }
+}
+
+void codegen_array_expr(ArrayNode* array, std::ostream* file) {
+    TypeNode* record = codegen_init_record;
+    bool is_array = codegen_init_is_array;
+    codegen_init_elements();
+    *file << "{";
+    for (int i = 0; i < array->elements.size(); i++) {
+        //error_out() << array->elements[i] << ": ";
+        //error_out() << get_nt_str(array->elements[i]->nt) << "\n";
+        codegen_expr(array->elements[i], file);
+        if (i != array->elements.size() - 1) {
+            *file << ", ";
+        }
+    }
+    *file << "}";
+    codegen_init_record = record;
+    codegen_init_is_array = is_array;
+}
+
+// Hash map operations from runtime_map, all named atlas_<name> in C
+bool codegen_is_map_intrinsic(std::string name) {
+    static const char* map_intrinsics[] = {
+        "map_create", "map_create_str", "map_free", "map_len",
+        "map_insert", "map_insert_str", "map_get", "map_get_str",
+        "map_remove", "map_remove_str", "map_next", "map_key",
+        "map_key_str", "map_value",
+    };
+    for (const char* intrinsic : map_intrinsics) {
+        if (name == intrinsic) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string codegen_get_intrinsic_name(std::string name) {
+    if (name == "putchar") {
+        return "atlas_putchar";
+    } else if (name == "alloc") {
+        return global_state->freestanding ? "atlas_alloc" : "malloc";
+    } else if (name == "free") {
+        return global_state->freestanding ? "atlas_free" : "free";
+    } else if (name == "open") {
+        return global_state->freestanding ? "atlas_open" : "open";
+    } else if (name == "close") {
+        return global_state->freestanding ? "atlas_close" : "close";
+    } else if (name == "read") {
+        return "atlas_read";
+    } else if (name == "write") {
+        return "atlas_write";
+    } else if (name == "lseek") {
+        return "atlas_lseek";
+    } else if (name == "fstat") {
+        return "atlas_fstat";
+    } else if (name == "sizeof") {
+        return "sizeof";
+    } else if (name == "exit") {
+        return "atlas_exit";
+    } else if (name == "memcpy") {
+        return "atlas_memcpy";
+    } else if (name == "memmove") {
+        return "atlas_memmove";
+    } else if (name == "memset") {
+        return "atlas_memset";
+    } else if (name == "memcmp") {
+        return "atlas_memcmp";
+    } else if (name == "memchr") {
+        return "atlas_memchr";
+    } else if (name == "time_ns") {
+        return "atlas_time_ns";
+    } else if (codegen_is_map_intrinsic(name) || vector_is_intrinsic(name)) {
+        return "atlas_" + name;
+    } else if (name == "new") {
+        return "new"; // TODO: implement
+    } else {
+        std::string err = "\"" + name + "\"" + " intrinsic has not been defined\n";
+        print_error_msg(err);
+        error_abort();
+    }
+}
+
+bool codegen_is_intrinsic_type(Token* atlas_type) {
+    if (atlas_type->token == "i64") {
+        return true;
+    } else if (atlas_type == NULL) {
+        return true;
+    } else if (atlas_type->token == "i32") {
+        return true;
+    } else if (atlas_type->token == "i16") {
+        return true;
+    } else if (atlas_type->token == "i8") {
+        return true;
+    } else if (atlas_type->token == "u64") {
+        return true;
+    } else if (atlas_type->token == "u32") {
+        return true;
+    } else if (atlas_type->token == "u16") {
+        return true;
+    } else if (atlas_type->token == "u8") {
+        //error_out() << "[ERROR]: \"u8\" IS NOT SUPPORTED\n";
+        return true;
+        //exit(1);
+    } else if (atlas_type->token == "Map") {
+        return true;
+    } else if (atlas_type->token == "f32" || atlas_type->token == "f64") {
+        return true;
+    }
+    VectorType vector;
+    return vector_parse(atlas_type->token, &vector);
+}
+
+std::string codegen_get_c_intrinsic_type(Token* atlas_type) {
+    if (atlas_type->token == "i64") {
+        return "int64";
+    } else if (atlas_type == NULL) {
+        return "void"; //NOTE: what is this?
+    } else if (atlas_type->token == "i32") {
+        return "int32";
+    } else if (atlas_type->token == "i16") {
+        return "int16";
+    } else if (atlas_type->token == "i8") {
+        return "char";
+    } else if (atlas_type->token == "u64") {
+        return "uint64";
+    } else if (atlas_type->token == "u32") {
+        return "uint32";
+    } else if (atlas_type->token == "u16") {
+        return "uint16";
+    } else if (atlas_type->token == "u8") {
+        return "uchar";
+    } else if (atlas_type->token == "f32") {
+        return "float";
+    } else if (atlas_type->token == "f64") {
+        return "double";
+    }
+    VectorType vector;
+    if (vector_parse(atlas_type->token, &vector)) {
+        return "atlas_" + atlas_type->token;
+    }
+    print_error_msg("Something wrong has occurred in codegen_get_c_intrinsic_type");
+    error_abort();
+}
+
+bool codegen_is_intrinsic_function(std::string call_name) {
+    if (call_name == "putchar") {
+        return true;
+    } else if (call_name == "open") {
+        return true;
+    } else if (call_name == "close") {
+        return true;
+    } else if (call_name == "read" || call_name == "write" ||
+               call_name == "lseek" || call_name == "fstat") {
+        return true;
+    } else if (call_name == "alloc") {
+        return true;
+    } else if (call_name == "free") {
+        return true;
+    } else if (call_name == "sizeof") {
+        return true;
+    } else if (call_name == "exit") {
+        return true;
+    } else if (call_name == "memcpy" || call_name == "memmove" ||
+               call_name == "memset" || call_name == "memcmp" ||
+               call_name == "memchr") {
+        return true;
+    } else if (call_name == "time_ns") {
+        return true;
+    } else if (codegen_is_map_intrinsic(call_name) || vector_is_intrinsic(call_name)) {
+        return true;
+    } else {
+        return false;
+    }
+}
+
+// Small signed values are written as plain C ints, wider ones get an LL
+// suffix and u64 values ULL so the C compiler sees the same type
+void codegen_constant(ConstantNode* constant, std::ostream* file) {
+    if (constant->type == TYPE_U64) {
+        *file << constant->value << "ULL";
+        return;
+    } else if (constant->type == TYPE_U8 || constant->type == TYPE_U16 || constant->type == TYPE_U32) {
+        *file << constant->value << (constant->value > INT32_MAX ? "U" : "");
+        return;
+    }
+    int64_t value = (int64_t)constant->value;
+    if (value == INT64_MIN) {
+        *file << "(-9223372036854775807LL - 1)";
+    } else if (value < INT32_MIN || value > INT32_MAX) {
+        *file << value << "LL";
+    } else {
+        *file << value;
+    }
+}
+
+void codegen_char(CharacterNode* character, std::ostream* file) {
+    *file << "'";
+    if (character->value.size() != 0) {
+        *file << character->value;
+    }
+    *file << "'";
+}
+
+// Length of a string literal once the C compiler has handled its escapes
+int codegen_quote_length(std::string quote) {
+    int len = 0;
+    for (int i = 0; i < quote.size(); i++) {
+        if (quote[i] == '\\') {
+            i++;
+        }
+        len++;
+    }
+    return len;
+}
+
+void codegen_quote(QuoteNode* quote, std::ostream* file) {
+    //*file << "atlas_create_string("
+    *file << "Z_19atlas_create_string6string("
+          << "\"" << quote->quote_token->token << "\""
+          << ","  << codegen_quote_length(quote->quote_token->token)
+          << ")";
+    //*file << "\"" << quote->quote_token->token << "\"";
+}
+
+void codegen_subscript(SubscriptNode* subscript, std::ostream* file) {
+    TypeNode* record = codegen_init_record;
+    bool is_array = codegen_init_is_array;
+    if (subscript->is_declaration) {
+        codegen_init_elements();
+        *file << "{";
+    } else {
+        *file << "[";
+    }
+    for (int i = 0; i < subscript->indexes.size(); i++) {
+        ExpressionNode* index = subscript->indexes[i];
+        codegen_expr(index, file);
+        if (i == subscript->indexes.size() - 1) {
+            break;
+        }
+        *file << ", ";
+    }
+    if (subscript->is_declaration) {
+        *file << "}";
+    } else {
+        *file << "]";
+    }
+    codegen_init_record = record;
+    codegen_init_is_array = is_array;
+}
+
+// .{...} gives the fields in the order they were declared, by name when
+// the struct is known
+void codegen_type_inst(TypeInstNode* type_inst, std::ostream* file) {
+    TypeNode* record = codegen_init_record;
+    bool is_array = codegen_init_is_array;
+    *file << "{";
+    for (int i = 0; i < type_inst->values.size(); i++) {
+        ExpressionNode* value = type_inst->values[i];
+        if (record != NULL && !is_array && i < record->declarations.size()) {
+            VarNode* field = record->declarations[i]->lhs;
+            *file << "." << field->identifier->token << " = ";
+            codegen_init_record = codegen_init_type(field);
+            codegen_init_is_array = field->is_array;
+        } else {
+            codegen_init_record = record;
+            codegen_init_elements();
+        }
+        codegen_expr(value, file);
+        codegen_init_record = record;
+        codegen_init_is_array = is_array;
+        if (i == type_inst->values.size() - 1) {
+            break;
+        }
+        *file << ", ";
+    }
+    *file << "}";
+}
+
+void codegen_unary_op(UnaryOpNode* unary_op, std::ostream* file) {
+    //TODO: old code?
+    std::string str;
+    switch(unary_op->operator_type) {
+    case NODE_SUBSCRIPT:
+        codegen_expr(unary_op->operand, file);
+        codegen_subscript(unary_op->subscript, file);
+        break;
+    case NODE_UNARY:
+        *file << unary_op->op->token;
+        codegen_expr(unary_op->operand, file);
+        break;
+    default:
+        print_error_msg("unary op not implemented yet\n");
+        error_abort();
+    }
+}
+
+void codegen_push_scope() {
+    Scope* scope = new Scope;
+    scope->prev = codegen_scope;
+    codegen_scope = scope;
+}
+
+void codegen_pop_scope() {
+    codegen_scope = codegen_scope->prev;
+}
+
+void codegen_add_var(VarNode* var) {
+    if (codegen_scope != NULL) {
+        codegen_scope->names.push_back(var);
+    }
+}
+
+VarNode* codegen_lookup_var(std::string name) {
+    for (Scope* scope = codegen_scope; scope != NULL; scope = scope->prev) {
+        for (int i = scope->names.size() - 1; i >= 0; i--) {
+            if (scope->names[i]->identifier->token == name) {
+                return scope->names[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+// Whether scope is from or one around it
+bool codegen_is_open(Scope* from, Scope* scope) {
+    for (Scope* open = from; open != NULL; open = open->prev) {
+        if (open == scope) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool codegen_has_defers() {
+    for (std::vector<CodegenDefer>& defers : codegen_defers) {
+        if (defers.size() != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Called before a local named name is declared. When that shadows a
+// variable while defers are pending, they may still use the variable,
+// so a pointer to it is declared first
+void codegen_hide(std::string name, std::ostream* file) {
+    VarNode* var = codegen_lookup_var(name);
+    if (var == NULL || !codegen_has_defers()) {
+        return;
+    }
+    for (CodegenHidden& hidden : codegen_hidden) {
+        if (hidden.var == var && codegen_is_open(codegen_scope, hidden.scope)) {
+            return;
+        }
+    }
+    CodegenHidden hidden;
+    hidden.var = var;
+    hidden.alias = "atlas_hidden_" + std::to_string(codegen_tmp_count++);
+    hidden.scope = codegen_scope;
+    codegen_hidden.push_back(hidden);
+    *file << codegen_get_var_type(var) << "* " << hidden.alias << " = " << (var->is_array ? "" : "&")
+          << name << "; ";
+}
+
+// The C for the variable named name, which is the name unless a defer is
+// being written past a declaration that shadows it
+std::string codegen_var_name(std::string name) {
+    if (!codegen_in_defer) {
+        return name;
+    }
+    VarNode* var = codegen_lookup_var(name);
+    for (CodegenHidden& hidden : codegen_hidden) {
+        if (hidden.var == var && codegen_is_open(codegen_live_scope, hidden.scope)) {
+            return var->is_array ? hidden.alias : "(*" + hidden.alias + ")";
+        }
+    }
+    return name;
+}
+
+bool codegen_is_pointer(ExpressionNode* expression) {
+    if (expression->nt != NODE_VAR) {
+        return false;
+    }
+    VarNode* var = codegen_lookup_var(expression->var_node->identifier->token);
+    return var != NULL && var->ptr_level > 0 && !var->is_array
+           && !var->is_slice && !var->is_dynamic;
+}
+
+bool codegen_is_slice(ExpressionNode* expression) {
+    if (expression->nt != NODE_VAR) {
+        return false;
+    }
+    VarNode* var = codegen_lookup_var(expression->var_node->identifier->token);
+    return var != NULL && (var->is_slice || var->is_dynamic);
+}
+
+std::string codegen_get_call_mangled(std::string name) {
+    for (FunctionNode* func : function_table) {
+        if (func->token->token == name) {
+            return func->mangled_name;
+        } else if (codegen_is_intrinsic_function(name)) {
+            return codegen_get_intrinsic_name(name);
+        }
+    }
+    // just return the original name if not found for whatever reason
+    return name;
+}
+
+FunctionNode* codegen_get_function(std::string name) {
+    for (FunctionNode* func : function_table) {
+        if (func->token->token == name) {
+            return func;
+        }
+    }
+    return NULL;
+}
+
+// Passes a dynamic or fixed size array where a slice is expected
+void codegen_slice_arg(ExpressionNode* arg, std::ostream* file) {
+    VarNode* var = NULL;
+    if (arg->nt == NODE_VAR) {
+        var = codegen_lookup_var(arg->var_node->identifier->token);
+    }
+    if (var == NULL || var->is_slice) {
+        codegen_expr(arg, file);
+    } else if (var->is_dynamic) {
+        VarNode slice = *var;
+        slice.is_dynamic = false;
+        slice.is_slice = true;
+        *file << "(" << codegen_get_slice_name(&slice) << "){";
+        codegen_expr(arg, file);
+        *file << ".ptr, ";
+        codegen_expr(arg, file);
+        *file << ".len}";
+    } else if (var->is_array) {
+        VarNode slice = *var;
+        slice.is_array = false;
+        slice.is_slice = true;
+        slice.ptr_level--;
+        *file << "(" << codegen_get_slice_name(&slice) << "){";
+        codegen_expr(arg, file);
+        *file << ", ";
+        codegen_expr(var->arr_size, file);
+        *file << "}";
+    } else {
+        codegen_expr(arg, file);
+    }
+}
+
+// The number of elements in the fixed array var, which target names
+void codegen_array_len(VarNode* var, ExpressionNode* target, std::ostream* file) {
+    if (var->arr_size != NULL) {
+        codegen_expr(var->arr_size, file);
+        return;
+    }
+    *file << "sizeof(";
+    codegen_expr(target, file);
+    *file << ") / sizeof(*";
+    codegen_expr(target, file);
+    *file << ")";
+}
+
+// len, append, reserve and slice need to know the type of their first
+// argument, returns false for every other call
+bool codegen_slice_call(CallNode* call, std::ostream* file) {
+    std::string name = call->name->token;
+    if (name != "len" && name != "append" && name != "reserve" && name != "slice") {
+        return false;
+    }
+    if (codegen_get_function(name) != NULL) {
+        return false; // shadowed by a user function
+    }
+    if (call->args.size() == 0) {
+        std::string err = "\"" + name + "\" expects an array as its first argument";
+        print_error_msg(err);
+        error_abort();
+    }
+    ExpressionNode* target = call->args[0];
+    VarNode* var = NULL;
+    if (target->nt == NODE_VAR) {
+        var = codegen_lookup_var(target->var_node->identifier->token);
+    }
+    if (name == "len") {
+        bool is_string = var != NULL && var->type_ != NULL && var->type_->token == "string" &&
+                         var->ptr_level == 0;
+        if (var != NULL && var->is_array) {
+            codegen_array_len(var, target, file);
+        } else if (var != NULL && !var->is_slice && !var->is_dynamic && !is_string) {
+            std::string err = "\"len\" expects an array, a slice, a dynamic array or a string, \"" +
+                              var->identifier->token + "\" isn't one";
+            print_error_msg(err);
+            error_abort();
+        } else {
+            *file << "(";
+            codegen_expr(target, file);
+            *file << ").len";
+        }
+        return true;
+    }
+    if (var == NULL || (name != "slice" && !var->is_dynamic)) {
+        std::string err = "\"" + name + "\" expects a dynamic array variable";
+        print_error_msg(err);
+        error_abort();
+    }
+    if (name == "append" || name == "reserve") {
+        *file << "atlas_" << name << "(";
+        codegen_expr(target, file);
+        *file << ", ";
+        codegen_expr(call->args[1], file);
+        *file << ")";
+        return true;
+    }
+    // slice(arr, lo, hi)
+    VarNode slice = *var;
+    slice.is_dynamic = false;
+    slice.is_slice = true;
+    if (var->is_array) {
+        slice.is_array = false;
+        slice.ptr_level--;
+    }
+    *file << codegen_get_slice_maker(&slice) << "(";
+    codegen_expr(target, file);
+    if (var->is_array) {
+        *file << ", ";
+        codegen_array_len(var, target, file);
+    } else {
+        *file << ".ptr, ";
+        codegen_expr(target, file);
+        *file << ".len";
+    }
+    *file << ", ";
+    codegen_expr(call->args[1], file);
+    *file << ", ";
+    codegen_expr(call->args[2], file);
+    *file << ", " << call->name->line << ")";
+    return true;
+}
+
+// The variable whose length bounds lhs[i] for --bounds-check: a fixed
+// array, a slice or dynamic array, or a string indexed through .str. NULL
+// when there is none, and outside functions where globals are set up
+VarNode* codegen_bounds_var(ExpressionNode* lhs, bool* is_string) {
+    if (!global_state->bounds_check || codegen_scope == NULL || codegen_scope->prev == NULL) {
+        return NULL;
+    }
+    *is_string = lhs->nt == NODE_BINOP && lhs->binop->op->tt == TK_DOT && lhs->binop->lhs->nt == NODE_VAR &&
+                 lhs->binop->rhs->nt == NODE_VAR && lhs->binop->rhs->var_node->identifier->token == "str";
+    if (*is_string) {
+        lhs = lhs->binop->lhs;
+    } else if (lhs->nt != NODE_VAR) {
+        return NULL;
+    }
+    VarNode* var = codegen_lookup_var(lhs->var_node->identifier->token);
+    if (var == NULL) {
+        return NULL;
+    } else if (*is_string) {
+        bool is_string_var = var->type_ != NULL && var->type_->token == "string" && !var->is_array &&
+                             !var->is_slice && !var->is_dynamic && var->ptr_level <= 1;
+        return is_string_var ? var : NULL;
+    }
+    return var->is_slice || var->is_dynamic || (var->is_array && var->arr_size != NULL) ? var : NULL;
+}
+
+// The i of a[i], through atlas_bounds when there is a length to check it
+// against
+void codegen_index(ExpressionNode* expression, std::ostream* file) {
+    bool is_string = false;
+    VarNode* var = codegen_bounds_var(expression->binop->lhs, &is_string);
+    if (var == NULL) {
+        codegen_expr(expression->binop->rhs, file);
+        return;
+    }
+    bounds_stats.inserted++;
+    std::string name = var->identifier->token;
+    *file << "atlas_bounds(";
+    codegen_expr(expression->binop->rhs, file);
+    *file << ", ";
+    if (is_string) {
+        *file << name << (var->ptr_level == 1 ? "->len" : ".len");
+    } else if (var->is_slice || var->is_dynamic) {
+        *file << name << ".len";
+    } else {
+        codegen_expr(var->arr_size, file);
+    }
+    *file << ", " << expression->binop->op->line << ")";
+}
+
+void codegen_expr(ExpressionNode* expression, std::ostream* file) {
+    file->flush();
+    if(expression->needs_paren) {
+        *file << "(";
+    }
+    switch(expression->nt) {
+    case NODE_BINOP:
+        codegen_expr(expression->binop->lhs, file);
+        if (expression->binop->op->tt == TK_DOT && codegen_is_pointer(expression->binop->lhs)) {
+            *file << "->";
+        } else if (expression->binop->op->tt == TK_SQUARE_OPEN && codegen_is_slice(expression->binop->lhs)) {
+            *file << ".ptr[";
+        } else if (expression->binop->op->tt == TK_DOT || expression->binop->op->tt == TK_SQUARE_OPEN) {
+            *file << expression->binop->op->token;
+        } else {
+            *file << " " << expression->binop->op->token << " ";
+        }
+        // handle rhs
+        if (expression->binop->op->tt == TK_SQUARE_OPEN) {
+            codegen_index(expression, file);
+            *file << "]";
+        } else {
+            codegen_expr(expression->binop->rhs, file);
+        }
+        break;
+    case NODE_CONSTANT:
+        codegen_constant(expression->constant, file);
+        break;
+    case NODE_CALL:
+    {
+        //std::string call_name = expression->call_node->name->token;
+        std::string call_name = codegen_get_call_mangled(expression->call_node->name->token);
+
+        if (codegen_slice_call(expression->call_node, file)) {
+            break;
+        }
+        FunctionNode* callee = codegen_get_function(expression->call_node->name->token);
+        *file << call_name << "("; 
+        auto args = expression->call_node->args;
+        for (int i = 0; i < args.size(); i++) {
+            if (callee != NULL && i < callee->params.size() && callee->params[i]->is_slice) {
+                codegen_slice_arg(args[i], file);
+            } else {
+                codegen_expr(args[i], file);
+            }
+            if (i < args.size() - 1) {
+                *file << ", ";
+            }
+        }
+        *file << ")";
+        break;
+    }
+    case NODE_VAR:
+    {
+        //TODO: make this better lol - for reserved types 
+        if (codegen_is_intrinsic_type(expression->var_node->identifier)) {
+            *file << codegen_get_c_intrinsic_type(expression->var_node->identifier);
+        } else {
+            *file << codegen_var_name(expression->var_node->identifier->token);
+        }
+        break;
+    }
+    case NODE_ARRAY_EXPR:
+        codegen_array_expr(expression->array, file);
+        break;
+    case NODE_CHAR:
+        codegen_char(expression->character, file);
+        break;
+    case NODE_QUOTE:
+        codegen_quote(expression->quote, file);
+        break;
+    case NODE_SUBSCRIPT:
+        codegen_subscript(expression->subscript, file);
+        break;
+    case NODE_UNARY:
+        //TODO:
+        codegen_unary_op(expression->unary_op, file);
+        break;
+    case NODE_TYPE_INST:
+        codegen_type_inst(expression->type_inst, file);
+        break;
+    default:
+        std::string err = "CODEGEN EXPR " + get_nt_str(expression->nt) + "\n";
+        print_error_msg(err);
+        error_out() << expression->nt;
+        error_abort();
+    }
+    if(expression->needs_paren) {
+        *file << ")";
+    }
+}
+
+std::string codegen_get_c_type(Token* atlas_type) {
+    VectorType vector;
+    if (atlas_type->token == "i64") {
+        return "int64";
+    } else if (atlas_type == NULL) {
+        return "void";
+    } else if (atlas_type->token == "i32") {
+        return "int32";
+    } else if (atlas_type->token == "i16") {
+        return "int16";
+    } else if (atlas_type->token == "i8") {
+        return "int8";
+    } else if (atlas_type->token == "u64") {
+        return "uint64";
+    } else if (atlas_type->token == "u32") {
+        return "uint32";
+    } else if (atlas_type->token == "u16") {
+        return "uint16";
+    } else if (atlas_type->token == "u8") {
+        return "uchar";
+    } else if (atlas_type->token == "string") {
+        //return "AtlasTypeString";
+        return "string";
+    } else if (atlas_type->token == "Map") {
+        return "AtlasMap";
+    } else if (atlas_type->token == "bool") {
+        return "bool";
+    } else if (atlas_type->token == "f32") {
+        return "float";
+    } else if (atlas_type->token == "f64") {
+        return "double";
+    } else if (vector_parse(atlas_type->token, &vector)) {
+        return "atlas_" + atlas_type->token;
+    }
+    std::string err = "The \"" + atlas_type->token + "\" type is not supported";
+    print_error_msg(err);
+    error_abort();
+}
+
+bool codegen_is_c_type(Token* atlas_type) {
+    if (atlas_type->token == "i64") {
+        return true;
+    } else if (atlas_type == NULL) {
+        return true;
+    } else if (atlas_type->token == "i32") {
+        return true;
+    } else if (atlas_type->token == "i16") {
+        return true;
+    } else if (atlas_type->token == "i8") {
+        return true;
+    } else if (atlas_type->token == "u64") {
+        return true;
+    } else if (atlas_type->token == "u32") {
+        return true;
+    } else if (atlas_type->token == "u16") {
+        return true;
+    } else if (atlas_type->token == "u8") {
+        //error_out() << "[ERROR]: \"u8\" IS NOT SUPPORTED\n";
+        return true;
+        //exit(1);
+    } else if (atlas_type->token == "Map") {
+        return true;
+    } else if (atlas_type->token == "f32" || atlas_type->token == "f64") {
+        return true;
+    }
+    VectorType vector;
+    return vector_parse(atlas_type->token, &vector);
+}
+
+std::string codegen_get_elem_type(VarNode* var) {
+    if (codegen_is_c_type(var->type_)) {
+        return codegen_get_c_type(var->type_);
+    }
+    return var->type_->token; // string, bool and user types
+}
+
+// Name of the struct a slice or dynamic array of this element type lowers to
+std::string codegen_get_slice_name(VarNode* var) {
+    std::string name = var->is_dynamic ? "AtlasDynamic_" : "AtlasSlice_";
+    name += codegen_get_elem_type(var);
+    for (int i = 0; i < var->ptr_level; i++) {
+        name += "P";
+    }
+    return name;
+}
+
+// The function slice(arr, lo, hi) calls to make a slice of this type
+std::string codegen_get_slice_maker(VarNode* var) {
+    return "atlas_slice_" + codegen_get_slice_name(var).substr(std::string("AtlasSlice_").size());
+}
+
+// C spelling of a variable's type, not including array brackets
+std::string codegen_get_var_type(VarNode* var) {
+    if (var->is_slice || var->is_dynamic) {
+        return codegen_get_slice_name(var);
+    }
+    std::string type = codegen_get_elem_type(var);
+    // the array itself accounts for one level of indirection
+    int ptr_level = var->ptr_level - (var->is_array ? 1 : 0);
+    for (int i = 0; i < ptr_level; i++) {
+        type += "*";
+    }
+    return type;
+}
+
+// Multi-value returns come back as a small struct, which the SysV ABI
+// returns in rax:rdx (or xmm0:xmm1) when it is 16 bytes or less
+std::string codegen_get_tuple_name(FunctionNode* func) {
+    std::string name = "AtlasTuple";
+    for (VarNode* return_var : func->return_vars) {
+        name += "_";
+        for (char c : codegen_get_var_type(return_var)) {
+            name += c == '*' ? 'P' : c;
+        }
+    }
+    return name;
+}
+
+std::string codegen_get_return_type(FunctionNode* func) {
+    if (func->return_vars.size() == 0) {
+        return "void";
+    } else if (func->return_vars.size() == 1) {
+        return codegen_get_var_type(func->return_var);
+    }
+    return codegen_get_tuple_name(func);
+}
+
+void codegen_tuple_typedef(FunctionNode* func, std::ostream* file) {
+    if (func->return_vars.size() < 2) {
+        return;
+    }
+    std::string name = codegen_get_tuple_name(func);
+    for (std::string tuple : codegen_tuple_types) {
+        if (tuple == name) {
+            return;
+        }
+    }
+    codegen_tuple_types.push_back(name);
+    *file << "typedef struct " << name << "\n"
+          << "{\n";
+    for (int i = 0; i < func->return_vars.size(); i++) {
+        *file << "\t" << codegen_get_var_type(func->return_vars[i]) << " _" << i << ";\n";
+    }
+    *file << "}" << name << ";\n\n";
+}
+
+// :: q, r = f() stores the returned struct in a temporary and declares
+// every name from its fields
+void codegen_destructure(VarDeclNode* var_decl, std::ostream* file) {
+    ExpressionNode* rhs = var_decl->rhs;
+    FunctionNode* func = NULL;
+    if (rhs != NULL && rhs->nt == NODE_CALL) {
+        func = codegen_get_function(rhs->call_node->name->token);
+    }
+    if (func == NULL || func->return_vars.size() != var_decl->destructure.size()) {
+        print_error_msg("Expected a call to a function returning "
+                        + std::to_string(var_decl->destructure.size()) + " values");
+        error_abort();
+    }
+    std::string tmp = "atlas_tmp_" + std::to_string(codegen_tmp_count++);
+    *file << codegen_get_tuple_name(func) << " " << tmp << " = ";
+    codegen_expr(rhs, file);
+    for (int i = 0; i < var_decl->destructure.size(); i++) {
+        VarNode* var = var_decl->destructure[i];
+        if (var->type_ == NULL) {
+            VarNode* return_var = func->return_vars[i];
+            var->type_ = return_var->type_;
+            var->ptr_level = return_var->ptr_level;
+            var->is_slice = return_var->is_slice;
+            var->is_dynamic = return_var->is_dynamic;
+        }
+        var->is_array = false;
+        if (var->identifier->token == "_") {
+            continue; // discarded
+        }
+        *file << "; ";
+        codegen_hide(var->identifier->token, file);
+        *file << codegen_get_var_type(var) << " " << var->identifier->token << " = " << tmp << "._" << i;
+        codegen_add_var(var);
+    }
+}
+
+void codegen_var_decl(VarDeclNode* var_decl, std::ostream* file) {
+    if (var_decl->destructure.size() != 0) {
+        codegen_destructure(var_decl, file);
+        return;
+    }
+    codegen_hide(var_decl->lhs->identifier->token, file);
+    if (var_decl->is_static) {
+        *file << "static ";
+    }
+    if (var_decl->is_const) {
+        *file << "const ";
+    }
+    // lhs
+    *file << codegen_get_var_type(var_decl->lhs);
+
+    *file << " " << var_decl->lhs->identifier->token;
+    codegen_add_var(var_decl->lhs);
+
+    print_token(var_decl->lhs->identifier);
+    if (var_decl->lhs->is_array == true) {
+        *file << "[";
+        codegen_expr(var_decl->lhs->arr_size, file);
+        *file << "]";
+    }
+
+    // rhs
+    if (var_decl->rhs != NULL) {
+        *file << " = ";
+        codegen_init_record = codegen_init_type(var_decl->lhs);
+        codegen_init_is_array = var_decl->lhs->is_array;
+        codegen_expr(var_decl->rhs, file);
+        codegen_init_record = NULL;
+        codegen_init_is_array = false;
+    } else if (var_decl->lhs->is_dynamic || var_decl->lhs->is_array) {
+        *file << " = {0}";
+    }
+}
+
+void codegen_param(ParamNode* param, std::ostream* file) {
+    // lhs
+    *file << codegen_get_var_type(param);
+
+    *file << " " << param->identifier->token;
+    codegen_add_var(param);
+
+    print_token(param->identifier);
+    if (param->is_array == true) {
+        *file << "[";
+        codegen_expr(param->arr_size, file);
+        *file << "]";
+    }
+}
+
+void codegen_collect_slice(VarNode* var) {
+    if (var == NULL || !(var->is_slice || var->is_dynamic)) {
+        return;
+    }
+    std::string name = codegen_get_slice_name(var);
+    for (VarNode* seen : codegen_slice_types) {
+        if (codegen_get_slice_name(seen) == name) {
+            return;
+        }
+    }
+    codegen_slice_types.push_back(var);
+    if (var->is_dynamic) {
+        // dynamic arrays can always be passed on as a slice
+        VarNode* slice = new VarNode(*var);
+        slice->is_dynamic = false;
+        slice->is_slice = true;
+        codegen_collect_slice(slice);
+    }
+}
+
+// Finds every slice and dynamic array type so their structs can be declared
+// before anything uses them
+void codegen_collect_slices(std::vector<StatementNode*> statements) {
+    for (StatementNode* statement : statements) {
+        switch (statement->nt) {
+        case NODE_VAR_DECL:
+            codegen_collect_slice(statement->vardecl_lhs->lhs);
+            for (VarNode* var : statement->vardecl_lhs->destructure) {
+                codegen_collect_slice(var);
+            }
+            break;
+        case NODE_TYPE:
+            codegen_user_types.push_back(statement->type_lhs->name->token);
+            if (!statement->type_lhs->is_reachable) {
+                break;
+            }
+            for (VarDeclNode* var : statement->type_lhs->declarations) {
+                codegen_collect_slice(var->lhs);
+            }
+            break;
+        case NODE_FUNC:
+            if (!statement->func_lhs->is_reachable) {
+                break;
+            }
+            for (VarNode* return_var : statement->func_lhs->return_vars) {
+                codegen_collect_slice(return_var);
+            }
+            for (ParamNode* param : statement->func_lhs->params) {
+                codegen_collect_slice(param);
+            }
+            if (statement->func_lhs->block != NULL) {
+                codegen_collect_slices(statement->func_lhs->block->statements);
+            }
+            break;
+        case NODE_IF:
+        {
+            IfNode* if_node = statement->if_lhs;
+            codegen_collect_slices(if_node->block->statements);
+            if (if_node->_else != NULL && if_node->_else->block != NULL) {
+                codegen_collect_slices(if_node->_else->block->statements);
+            } else if (if_node->_else != NULL && if_node->_else->else_if != NULL) {
+                codegen_collect_slices({if_node->_else->else_if});
+            }
+            break;
+        }
+        case NODE_FOR:
+            if (statement->for_lhs->init != NULL && statement->for_lhs->for_type == FOR_LOOP) {
+                codegen_collect_slices({statement->for_lhs->init});
+            }
+            codegen_collect_slices(statement->for_lhs->block->statements);
+            break;
+        case NODE_DEFER:
+            codegen_collect_slices({statement->defer_lhs});
+            break;
+        case NODE_MATCH:
+            for (MatchArm* arm : statement->match_lhs->arms) {
+                codegen_collect_slices(arm->block->statements);
+            }
+            if (statement->match_lhs->else_block != NULL) {
+                codegen_collect_slices(statement->match_lhs->else_block->statements);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Declares the slice structs whose element type is elem_type, or every
+// slice of a builtin type when elem_type is empty
+void codegen_slice_typedefs(std::string elem_type, std::ostream* file) {
+    for (VarNode* var : codegen_slice_types) {
+        std::string elem = codegen_get_elem_type(var);
+        bool is_user_type = false;
+        for (std::string user_type : codegen_user_types) {
+            if (user_type == elem) {
+                is_user_type = true;
+            }
+        }
+        if (elem_type.size() == 0 ? is_user_type : elem != elem_type) {
+            continue;
+        }
+        for (int i = 0; i < var->ptr_level; i++) {
+            elem += "*";
+        }
+        std::string name = codegen_get_slice_name(var);
+        *file << "typedef struct " << name << "\n"
+              << "{\n"
+              << "\t" << elem << "* ptr;\n"
+              << "\tuint64 len;\n";
+        if (var->is_dynamic) {
+            *file << "\tuint64 cap;\n";
+        }
+        *file << "}" << name << ";\n\n";
+        if (var->is_dynamic) {
+            continue;
+        }
+        // what slice(arr, lo, hi) calls, so lo and hi are evaluated once.
+        // --bounds-check makes sure the slice is inside arr
+        *file << "static inline " << name << " " << codegen_get_slice_maker(var)
+              << "(" << elem << "* ptr, uint64 len, int64 lo, int64 hi, int32 line)\n"
+              << "{\n";
+        if (global_state->bounds_check) {
+            *file << "\tif (__builtin_expect(lo < 0 || lo > hi || (uint64)hi > len, 0)) {\n"
+                  << "\t\tatlas_slice_fail(lo, hi, len, line);\n"
+                  << "\t}\n";
+        }
+        *file << "\treturn (" << name << "){ptr + lo, hi - lo};\n"
+              << "}\n\n";
+    }
+}
+
+// Fields in the order layout.cpp put them, which is what the IR backends
+// assume as well
+void codegen_type(TypeNode* type, std::ostream* file) {
+    *file << "typedef struct ";
+    if (type->is_packed && type->align != 0) {
+        *file << "__attribute__((packed, aligned(" << type->align << "))) ";
+    } else if (type->is_packed) {
+        *file << "__attribute__((packed)) ";
+    } else if (type->align != 0) {
+        *file << "__attribute__((aligned(" << type->align << "))) ";
+    }
+    *file << type->name->token << "\n";
+    *file << "{\n";
+    codegen_push_scope();
+    for (VarDeclNode* var : layout_fields(type)) {
+        // without the = {0} codegen_var_decl gives arrays, fields can't have one
+        codegen_tabs(file, 1);
+        *file << codegen_get_var_type(var->lhs) << " " << var->lhs->identifier->token;
+        if (var->lhs->is_array) {
+            *file << "[";
+            codegen_expr(var->lhs->arr_size, file);
+            *file << "]";
+        }
+        *file << ";\n";
+    }
+    codegen_pop_scope();
+    *file << "}" << type->name->token << ";\n\n";
+    codegen_slice_typedefs(type->name->token, file);
+}
+
+// What a return gives back, without the return
+void codegen_return_value(StatementNode* statement, std::ostream* file) {
+    std::vector<ExpressionNode*> exprs = statement->return_lhs->exprs;
+    if (exprs.size() > 1) {
+        if (exprs.size() != codegen_current_func->return_vars.size()) {
+            print_error_msg("\"" + codegen_current_func->token->token + "\" returns "
+                            + std::to_string(codegen_current_func->return_vars.size())
+                            + " values but " + std::to_string(exprs.size()) + " were given");
+            error_abort();
+        }
+        *file << "(" << codegen_get_return_type(codegen_current_func) << "){";
+        for (int i = 0; i < exprs.size(); i++) {
+            if (i != 0) {
+                *file << ", ";
+            }
+            codegen_expr(exprs[i], file);
+        }
+        *file << "}";
+    } else {
+        codegen_expr(statement->return_lhs->expr, file);
+    }
+}
+
+void codegen_return(StatementNode* statement, std::ostream* file) {
+    *file << "return";
+    if (statement->return_lhs->expr != NULL) {
+        *file << " ";
+        codegen_return_value(statement, file);
+    }
+}
+
+// Writes the defers of the blocks from level on, innermost and latest first
+void codegen_write_defers(int level, std::ostream* file, int tab_level) {
+    bool was_in_defer = codegen_in_defer;
+    Scope* scope = codegen_scope;
+    codegen_in_defer = true;
+    codegen_live_scope = scope;
+    for (int b = codegen_defers.size() - 1; b >= level; b--) {
+        for (int d = codegen_defers[b].size() - 1; d >= 0; d--) {
+            codegen_scope = codegen_defers[b][d].scope;
+            codegen_tabs(file, tab_level);
+            if (codegen_statement(codegen_defers[b][d].statement, file, tab_level)) {
+                *file << ";\n";
+            }
+        }
+    }
+    codegen_scope = scope;
+    codegen_in_defer = was_in_defer;
+}
+
+// A return with defers to run keeps its value in a temporary first, so
+// the defers can't change what is returned
+void codegen_deferred_return(StatementNode* statement, std::ostream* file, int tab_level) {
+    std::string result = "atlas_ret_" + std::to_string(codegen_tmp_count++);
+    bool has_value = statement->return_lhs->expr != NULL;
+    *file << "{\n";
+    if (has_value) {
+        codegen_tabs(file, tab_level + 1);
+        *file << codegen_get_return_type(codegen_current_func) << " " << result << " = ";
+        codegen_return_value(statement, file);
+        *file << ";\n";
+    }
+    codegen_write_defers(0, file, tab_level + 1);
+    codegen_tabs(file, tab_level + 1);
+    *file << "return" << (has_value ? " " + result : "") << ";\n";
+    codegen_tabs(file, tab_level);
+    *file << "}\n";
+}
+
+// A call of the function being returned from assigns the arguments to
+// the parameters and goes back to atlas_tail at the top, see tail.cpp.
+// Every argument is worked out before a parameter changes
+void codegen_tail_loop(StatementNode* statement, std::ostream* file, int tab_level) {
+    std::vector<ParamNode*> params = codegen_current_func->params;
+    std::vector<ExpressionNode*> args = statement->return_lhs->expr->call_node->args;
+    std::vector<std::string> temps;
+    *file << "{\n";
+    for (int i = 0; i < args.size(); i++) {
+        temps.push_back("atlas_tail_" + std::to_string(codegen_tmp_count++));
+        codegen_tabs(file, tab_level + 1);
+        *file << codegen_get_var_type(params[i]) << " " << temps[i] << " = ";
+        if (params[i]->is_slice) {
+            codegen_slice_arg(args[i], file);
+        } else {
+            codegen_expr(args[i], file);
+        }
+        *file << ";\n";
+    }
+    for (int i = 0; i < args.size(); i++) {
+        codegen_tabs(file, tab_level + 1);
+        *file << params[i]->identifier->token << " = " << temps[i] << ";\n";
+    }
+    codegen_tabs(file, tab_level + 1);
+    *file << "goto atlas_tail;\n";
+    codegen_tabs(file, tab_level);
+    *file << "}\n";
+    tail_stats.loops++;
+}
+
+void codegen_if(IfNode* if_node, std::ostream* file, int tab_level) {
+    *file << "if(";
+    codegen_expr(if_node->condition, file);
+    *file << ")\n";
+    codegen_block(if_node->block, file, tab_level + 1);
+    if (if_node->_else != NULL) {
+        if (if_node->_else->block != NULL) {
+            codegen_tabs(file, tab_level);
+            *file << "else\n";
+            codegen_block(if_node->_else->block, file, tab_level + 1);
+        } else if (if_node->_else->else_if != NULL) {
+            codegen_tabs(file, tab_level);
+            *file << " else ";
+            codegen_if(if_node->_else->else_if->if_lhs, file, tab_level);
+        }
+    }
+}
+
+// The type of the value a match is on, as far as the C output can tell: a
+// variable or an element of an array or pointer. Anything else is an i64
+VarType codegen_match_type(ExpressionNode* value) {
+    VarNode* var = NULL;
+    int ptr_level = 0;
+    if (value->nt == NODE_VAR) {
+        var = codegen_lookup_var(value->var_node->identifier->token);
+    } else if (value->nt == NODE_BINOP && value->binop->op->tt == TK_SQUARE_OPEN &&
+               value->binop->lhs->nt == NODE_VAR) {
+        var = codegen_lookup_var(value->binop->lhs->var_node->identifier->token);
+        ptr_level = 1;
+    }
+    if (var == NULL || var->is_slice || var->is_dynamic || var->ptr_level != ptr_level) {
+        return TYPE_I64;
+    }
+    return var->type;
+}
+
+void codegen_case_value(int64_t value, std::ostream* file) {
+    ConstantNode constant;
+    constant.value = value;
+    constant.type = TYPE_I64;
+    codegen_constant(&constant, file);
+}
+
+// A match is a switch, which gcc turns into a jump table or a lookup table
+// when the cases are dense enough. Ranges use the GNU case lo ... hi
+void codegen_match(MatchNode* match, std::ostream* file, int tab_level) {
+    VarType type = codegen_match_type(match->value);
+    fold_match_check(match, type);
+    // u8 is a plain char here, the arms see it from 0 to 255
+    *file << (type == TYPE_U8 ? "switch((uchar)(" : "switch(");
+    codegen_expr(match->value, file);
+    *file << (type == TYPE_U8 ? "))\n" : ")\n");
+    codegen_tabs(file, tab_level);
+    *file << "{\n";
+    for (MatchArm* arm : match->arms) {
+        for (MatchCase& match_case : arm->cases) {
+            codegen_tabs(file, tab_level);
+            *file << "case ";
+            codegen_case_value(match_case.lo, file);
+            if (match_case.hi != match_case.lo) {
+                *file << " ... ";
+                codegen_case_value(match_case.hi, file);
+            }
+            *file << ":\n";
+        }
+        codegen_block(arm->block, file, tab_level + 1);
+        codegen_tabs(file, tab_level + 1);
+        *file << "break;\n";
+    }
+    if (match->else_block != NULL) {
+        codegen_tabs(file, tab_level);
+        *file << "default:\n";
+        codegen_block(match->else_block, file, tab_level + 1);
+        codegen_tabs(file, tab_level + 1);
+        *file << "break;\n";
+    }
+    codegen_tabs(file, tab_level);
+    *file << "}\n";
+}
+
+// The body of a for parallel loop becomes a function of its own, called by
+// atlas_parallel_for with a part of the range. It can't be nested in the C
+// function being written, so it is written out after it
+struct CodegenParallel {
+    ForNode* for_node;
+    std::string name;
+    VarNode* counter;
+    std::vector<VarNode*> captures; // the locals it uses, atlas_ctx[i] points at captures[i]
+    // and after them at the values its min and max reductions start from
+};
+
+thread_local std::vector<CodegenParallel> codegen_parallel_bodies;
+
+// Like codegen_lookup_var but without the globals, which the body can use directly
+VarNode* codegen_lookup_local(std::string name) {
+    for (Scope* scope = codegen_scope; scope != NULL && scope->prev != NULL; scope = scope->prev) {
+        for (int i = scope->names.size() - 1; i >= 0; i--) {
+            if (scope->names[i]->identifier->token == name) {
+                return scope->names[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+void codegen_parallel_names(std::vector<StatementNode*> statements, std::vector<std::string>& names,
+                            std::vector<std::string>& assigned, std::vector<std::string>& declared,
+                            std::vector<std::string>& calls);
+bool codegen_parallel_varies(ExpressionNode* expr);
+
+// The counter of the for parallel loop being checked and the locals of its
+// body computed from it. An element written at an index that uses none of
+// them is the same element in every thread
+thread_local std::vector<std::string> codegen_parallel_varying;
+// The locals of the body that hold their own memory, unlike a pointer or a
+// slice that can point at the memory of the caller
+thread_local std::vector<std::string> codegen_parallel_owned;
+
+// An assignment through a subscript or a pointer has to write a place of
+// its own in every iteration, unless it is into a local of the loop
+void codegen_parallel_write(ExpressionNode* target) {
+    bool varies = false;
+    bool is_deref = false;
+    while (true) {
+        if (target->nt == NODE_BINOP && target->binop->op->tt == TK_DOT) {
+            target = target->binop->lhs;
+        } else if (target->nt == NODE_BINOP && target->binop->op->tt == TK_SQUARE_OPEN) {
+            varies = varies || codegen_parallel_varies(target->binop->rhs);
+            target = target->binop->lhs;
+        } else if (target->nt == NODE_UNARY && target->unary_op->operator_type == NODE_UNARY &&
+                   target->unary_op->op->token == "*") {
+            is_deref = true;
+            target = target->unary_op->operand;
+        } else {
+            break;
+        }
+    }
+    if (target->nt != NODE_VAR || varies) {
+        return;
+    }
+    std::string name = target->var_node->identifier->token;
+    for (std::string local : codegen_parallel_owned) {
+        if (local == name) {
+            return;
+        }
+    }
+    if (is_deref) {
+        print_error_msg("for parallel can't write through \"" + name + "\", every thread would "
+                        "write the same place");
+        error_abort();
+    }
+    print_error_msg("for parallel can't write to \"" + name + "\" at an index that doesn't use \"" +
+                    codegen_parallel_varying[0] + "\", every thread would write the same element");
+    error_abort();
+}
+
+// Every variable an expression mentions, the ones it assigns, the ones it
+// declares and the functions it calls. Assigning a field assigns the
+// variable it is in
+void codegen_parallel_expr_names(ExpressionNode* expr, std::vector<std::string>& names,
+                                 std::vector<std::string>& assigned, std::vector<std::string>& declared,
+                                 std::vector<std::string>& calls) {
+    if (expr == NULL) {
+        return;
+    }
+    switch (expr->nt) {
+    case NODE_VAR:
+        names.push_back(expr->var_node->identifier->token);
+        break;
+    case NODE_BINOP:
+        if (expr->binop->op->tt == TK_ASSIGN) {
+            ExpressionNode* target = expr->binop->lhs;
+            while (target->nt == NODE_BINOP && target->binop->op->tt == TK_DOT) {
+                target = target->binop->lhs;
+            }
+            if (target->nt == NODE_VAR) {
+                assigned.push_back(target->var_node->identifier->token);
+                if (codegen_parallel_varies(expr->binop->rhs)) {
+                    codegen_parallel_varying.push_back(target->var_node->identifier->token);
+                }
+            } else {
+                codegen_parallel_write(target);
+            }
+        }
+        codegen_parallel_expr_names(expr->binop->lhs, names, assigned, declared, calls);
+        if (expr->binop->op->tt != TK_DOT) {
+            codegen_parallel_expr_names(expr->binop->rhs, names, assigned, declared, calls);
+        }
+        break;
+    case NODE_UNARY:
+        codegen_parallel_expr_names(expr->unary_op->operand, names, assigned, declared, calls);
+        break;
+    case NODE_CALL:
+        calls.push_back(expr->call_node->name->token);
+        for (ExpressionNode* arg : expr->call_node->args) {
+            codegen_parallel_expr_names(arg, names, assigned, declared, calls);
+        }
+        break;
+    case NODE_ARRAY_EXPR:
+        for (ExpressionNode* element : expr->array->elements) {
+            codegen_parallel_expr_names(element, names, assigned, declared, calls);
+        }
+        break;
+    case NODE_SUBSCRIPT:
+        for (ExpressionNode* index : expr->subscript->indexes) {
+            codegen_parallel_expr_names(index, names, assigned, declared, calls);
+        }
+        break;
+    case NODE_TYPE_INST:
+        for (ExpressionNode* value : expr->type_inst->values) {
+            codegen_parallel_expr_names(value, names, assigned, declared, calls);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void codegen_parallel_names(std::vector<StatementNode*> statements, std::vector<std::string>& names,
+                            std::vector<std::string>& assigned, std::vector<std::string>& declared,
+                            std::vector<std::string>& calls) {
+    for (StatementNode* statement : statements) {
+        switch (statement->nt) {
+        case NODE_VAR_DECL:
+        {
+            VarNode* var = statement->vardecl_lhs->lhs;
+            if (var->is_array) {
+                codegen_parallel_expr_names(var->arr_size, names, assigned, declared, calls);
+            }
+            codegen_parallel_expr_names(statement->vardecl_lhs->rhs, names, assigned, declared, calls);
+            declared.push_back(var->identifier->token);
+            if (var->ptr_level == (var->is_array ? 1 : 0) && !var->is_slice) {
+                codegen_parallel_owned.push_back(var->identifier->token);
+            }
+            if (codegen_parallel_varies(statement->vardecl_lhs->rhs)) {
+                codegen_parallel_varying.push_back(var->identifier->token);
+            }
+            break;
+        }
+        case NODE_RETURN:
+            print_error_msg("Can't return from inside a for parallel loop");
+            error_abort();
+        case NODE_IF:
+        {
+            IfNode* if_node = statement->if_lhs;
+            codegen_parallel_expr_names(if_node->condition, names, assigned, declared, calls);
+            codegen_parallel_names(if_node->block->statements, names, assigned, declared, calls);
+            if (if_node->_else != NULL && if_node->_else->block != NULL) {
+                codegen_parallel_names(if_node->_else->block->statements, names, assigned, declared, calls);
+            } else if (if_node->_else != NULL && if_node->_else->else_if != NULL) {
+                codegen_parallel_names({if_node->_else->else_if}, names, assigned, declared, calls);
+            }
+            break;
+        }
+        case NODE_FOR:
+        {
+            ForNode* for_node = statement->for_lhs;
+            if (for_node->for_type == FOR_LOOP) {
+                codegen_parallel_names({for_node->init, for_node->update}, names, assigned, declared, calls);
+            } else if (for_node->for_type == FOR_EACH) {
+                codegen_parallel_expr_names(for_node->iterable, names, assigned, declared, calls);
+                codegen_parallel_expr_names(for_node->range_end, names, assigned, declared, calls);
+                declared.push_back(for_node->each_var->token);
+                if (codegen_parallel_varies(for_node->iterable) || codegen_parallel_varies(for_node->range_end)) {
+                    codegen_parallel_varying.push_back(for_node->each_var->token);
+                }
+                for (Token* reduce_var : for_node->reduce_vars) {
+                    names.push_back(reduce_var->token);
+                    assigned.push_back(reduce_var->token);
+                }
+            }
+            codegen_parallel_expr_names(for_node->test, names, assigned, declared, calls);
+            codegen_parallel_names(for_node->block->statements, names, assigned, declared, calls);
+            break;
+        }
+        case NODE_DEFER:
+            codegen_parallel_names({statement->defer_lhs}, names, assigned, declared, calls);
+            break;
+        case NODE_MATCH:
+            codegen_parallel_expr_names(statement->match_lhs->value, names, assigned, declared, calls);
+            for (MatchArm* arm : statement->match_lhs->arms) {
+                codegen_parallel_names(arm->block->statements, names, assigned, declared, calls);
+            }
+            if (statement->match_lhs->else_block != NULL) {
+                codegen_parallel_names(statement->match_lhs->else_block->statements, names, assigned, declared, calls);
+            }
+            break;
+        default:
+            codegen_parallel_expr_names(statement->expr_lhs, names, assigned, declared, calls);
+            break;
+        }
+    }
+}
+
+// Whether the value of an expression can be different in every iteration
+bool codegen_parallel_varies(ExpressionNode* expr) {
+    std::vector<std::string> names;
+    std::vector<std::string> assigned;
+    std::vector<std::string> declared;
+    std::vector<std::string> calls;
+    codegen_parallel_expr_names(expr, names, assigned, declared, calls);
+    for (std::string name : names) {
+        for (std::string varying : codegen_parallel_varying) {
+            if (name == varying) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// The operator name is reduced with, empty when it isn't
+std::string codegen_reduce_op(ForNode* for_node, std::string name) {
+    for (int r = 0; r < for_node->reduce_vars.size(); r++) {
+        if (for_node->reduce_vars[r]->token == name) {
+            return for_node->reduce_ops[r]->token;
+        }
+    }
+    return "";
+}
+
+bool codegen_has_capture(std::vector<VarNode*>& captures, VarNode* var) {
+    for (VarNode* capture : captures) {
+        if (capture == var) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Locals are handed to the body through an array of pointers. Everything
+// but the reduction variables is read only, each thread reduces into its
+// own copy and adds that to the real one when its part of the range is done.
+// Globals can't be assigned, and only functions memo_is_pure passes can be
+// called
+void codegen_parallel_for(ForNode* for_node, VarNode* counter, std::ostream* file, int tab_level) {
+    CodegenParallel body;
+    body.for_node = for_node;
+    body.name = "atlas_parallel_" + std::to_string(codegen_tmp_count++);
+    body.counter = counter;
+    std::vector<std::string> names;
+    std::vector<std::string> assigned;
+    std::vector<std::string> declared;
+    std::vector<std::string> calls;
+    codegen_parallel_varying = {counter->identifier->token};
+    codegen_parallel_owned.clear();
+    codegen_parallel_names(for_node->block->statements, names, assigned, declared, calls);
+    for (Token* reduce_var : for_node->reduce_vars) {
+        VarNode* var = codegen_lookup_local(reduce_var->token);
+        if (var == NULL || var->ptr_level != 0 || var->is_array || var->is_slice || var->is_dynamic ||
+            get_var_type(var->type_) == TYPE_INVALID) {
+            print_error_msg("reduce needs a local number, \"" + reduce_var->token + "\" isn't one");
+            error_abort();
+        }
+        if (!codegen_has_capture(body.captures, var)) {
+            body.captures.push_back(var);
+        }
+    }
+    for (std::string name : names) {
+        VarNode* var = codegen_lookup_local(name);
+        if (var != NULL && !codegen_has_capture(body.captures, var)) {
+            body.captures.push_back(var);
+        }
+    }
+    for (std::string name : assigned) {
+        // reduced, or a local of the loop shadowing one outside
+        bool is_owned = false;
+        for (Token* reduce_var : for_node->reduce_vars) {
+            is_owned = is_owned || reduce_var->token == name;
+        }
+        for (std::string local : declared) {
+            is_owned = is_owned || local == name;
+        }
+        if (!is_owned && codegen_lookup_local(name) != NULL &&
+            codegen_has_capture(body.captures, codegen_lookup_local(name))) {
+            print_error_msg("for parallel can't assign to \"" + name + "\" from outside the loop, "
+                            "reduce it or declare it in the loop");
+            error_abort();
+        } else if (!is_owned && codegen_lookup_local(name) == NULL && codegen_lookup_var(name) != NULL) {
+            print_error_msg("for parallel can't assign to the global \"" + name + "\", "
+                            "every thread would write it");
+            error_abort();
+        }
+    }
+    for (std::string name : calls) {
+        if (name == "len" || name == "sizeof" || name == "slice") {
+            continue;
+        }
+        FunctionNode* func = NULL;
+        for (FunctionNode* candidate : function_table) {
+            if (candidate->token->token == name && candidate->block != NULL) {
+                func = candidate;
+            }
+        }
+        std::string reason;
+        if (func == NULL) {
+            print_error_msg("for parallel can't call \"" + name + "\", only Atlas functions that are pure");
+            error_abort();
+        } else if (!memo_is_pure(func, &reason)) {
+            print_error_msg("for parallel can't call \"" + name + "\", it isn't pure: " + reason);
+            error_abort();
+        }
+    }
+    std::string ctx = "atlas_ctx_" + std::to_string(codegen_tmp_count++);
+    *file << "{\n";
+    codegen_tabs(file, tab_level + 1);
+    *file << "void " << body.name << "(void** atlas_ctx, int64 atlas_begin, int64 atlas_end);\n";
+    // read here once, the threads can't read it while others merge into it
+    std::vector<std::string> seeds;
+    for (VarNode* var : body.captures) {
+        std::string op = codegen_reduce_op(for_node, var->identifier->token);
+        if (op == "min" || op == "max") {
+            std::string seed = "atlas_seed_" + std::to_string(codegen_tmp_count++);
+            codegen_tabs(file, tab_level + 1);
+            *file << codegen_get_var_type(var) << " " << seed << " = " << var->identifier->token << ";\n";
+            seeds.push_back(seed);
+        }
+    }
+    codegen_tabs(file, tab_level + 1);
+    *file << "void* " << ctx << "[] = {";
+    for (VarNode* var : body.captures) {
+        *file << (var->is_array ? "" : "&") << var->identifier->token << ", ";
+    }
+    for (std::string seed : seeds) {
+        *file << "&" << seed << ", ";
+    }
+    *file << "0};\n";
+    codegen_tabs(file, tab_level + 1);
+    *file << "atlas_parallel_for(";
+    codegen_expr(for_node->iterable, file);
+    *file << ", ";
+    codegen_expr(for_node->range_end, file);
+    *file << ", " << body.name << ", " << ctx << ");\n";
+    codegen_tabs(file, tab_level);
+    *file << "}\n";
+    codegen_parallel_bodies.push_back(body);
+}
+
+// Writes the loop bodies collected while writing the last function,
+// including ones from parallel loops nested in them
+void codegen_parallel_flush(std::ostream* file) {
+    for (int b = 0; b < codegen_parallel_bodies.size(); b++) {
+        CodegenParallel body = codegen_parallel_bodies[b];
+        ForNode* for_node = body.for_node;
+        *file << "void " << body.name << "(void** atlas_ctx, int64 atlas_begin, int64 atlas_end)\n"
+              << "{\n";
+        codegen_push_scope();
+        std::vector<std::string> merges;
+        int seed = body.captures.size();
+        for (int i = 0; i < body.captures.size(); i++) {
+            VarNode* var = body.captures[i];
+            std::string type = codegen_get_var_type(var);
+            std::string name = var->identifier->token;
+            std::string shared = "*(" + type + "*)atlas_ctx[" + std::to_string(i) + "]";
+            std::string op = codegen_reduce_op(for_node, name);
+            *file << "\t";
+            if (var->is_array) {
+                *file << type << "* " << name << " = (" << type << "*)atlas_ctx[" << i << "];\n";
+            } else if (op == "+" || op == "*") {
+                *file << type << " " << name << " = " << (op == "+" ? "0" : "1") << ";\n";
+                merges.push_back(shared + " " + op + "= " + name);
+            } else if (op == "min" || op == "max") {
+                // from the value before the loop, which the caller read
+                *file << type << " " << name << " = *(" << type << "*)atlas_ctx[" << seed++ << "];\n";
+                merges.push_back("if (" + name + (op == "min" ? " < " : " > ") + shared + ") "
+                                 + shared + " = " + name);
+            } else {
+                *file << type << " " << name << " = " << shared << ";\n";
+            }
+            codegen_add_var(var);
+        }
+        std::string counter = body.counter->identifier->token;
+        *file << "\tfor(" << codegen_get_var_type(body.counter) << " " << counter << " = atlas_begin; "
+              << counter << " < atlas_end; " << counter << "++)\n";
+        codegen_add_var(body.counter);
+        codegen_block(for_node->block, file, 2);
+        codegen_pop_scope();
+        if (merges.size() != 0) {
+            *file << "\tatlas_reduce_lock();\n";
+            for (std::string merge : merges) {
+                *file << "\t" << merge << ";\n";
+            }
+            *file << "\tatlas_reduce_unlock();\n";
+        }
+        *file << "}\n\n";
+    }
+    codegen_parallel_bodies.clear();
+}
+
+// The counter of a range takes the type of its end when that is known
+Token* codegen_range_type(ExpressionNode* end, Token* each_var) {
+    Token* type = new Token(*each_var);
+    type->tt = TK_IDENTIFIER;
+    type->token = "i64";
+    VarNode* var = end->nt == NODE_VAR ? codegen_lookup_var(end->var_node->identifier->token) : NULL;
+    if (var != NULL && var->ptr_level == 0 && !var->is_slice && !var->is_dynamic &&
+        get_var_type(var->type_) != TYPE_INVALID) {
+        type->token = var->type_->token;
+    } else if (end->nt == NODE_CONSTANT && end->constant->type == TYPE_U64) {
+        type->token = "u64";
+    }
+    return type;
+}
+
+// The variable the value of expr is typed like: a variable, a field of a
+// struct reached through one, a call to slice or to a function with one
+// result. NULL for anything else
+VarNode* codegen_expr_var(ExpressionNode* expr) {
+    if (expr->nt == NODE_VAR) {
+        return codegen_lookup_var(expr->var_node->identifier->token);
+    } else if (expr->nt == NODE_BINOP && expr->binop->op->tt == TK_DOT && expr->binop->rhs->nt == NODE_VAR) {
+        VarNode* base = codegen_expr_var(expr->binop->lhs);
+        if (base == NULL || base->type_ == NULL || base->is_array || base->is_slice || base->is_dynamic ||
+            base->ptr_level > 1) {
+            return NULL;
+        }
+        TypeNode* record = layout_find_type(base->type_->token);
+        std::string field = expr->binop->rhs->var_node->identifier->token;
+        for (int i = 0; record != NULL && i < record->declarations.size(); i++) {
+            if (record->declarations[i]->lhs->identifier->token == field) {
+                return record->declarations[i]->lhs;
+            }
+        }
+        return NULL;
+    } else if (expr->nt != NODE_CALL) {
+        return NULL;
+    }
+    CallNode* call = expr->call_node;
+    FunctionNode* func = codegen_get_function(call->name->token);
+    if (func != NULL) {
+        return func->return_vars.size() == 1 ? func->return_vars[0] : NULL;
+    } else if (call->name->token != "slice" || call->args.size() != 3) {
+        return NULL;
+    }
+    VarNode* var = codegen_expr_var(call->args[0]);
+    if (var == NULL || (!var->is_array && !var->is_slice && !var->is_dynamic)) {
+        return NULL;
+    }
+    VarNode* slice = new VarNode(*var); // as codegen_slice_call makes it
+    slice->is_dynamic = false;
+    slice->is_slice = true;
+    if (var->is_array) {
+        slice->is_array = false;
+        slice->ptr_level--;
+    }
+    return slice;
+}
+
+// for i in a..b counts with the end evaluated once. for x in arr walks a
+// pointer from the first element to one past the last, so the bound is
+// hoisted and nothing in the body can make the compiler reload it. The
+// pointer isn't restrict, the body may still write the array by name
+void codegen_for_each(ForNode* for_node, std::ostream* file, int tab_level) {
+    std::string n = std::to_string(codegen_tmp_count++);
+    VarNode* each = ast_create_var(for_node->each_var);
+    if (for_node->range_end != NULL) {
+        each->type_ = codegen_range_type(for_node->range_end, for_node->each_var);
+        each->type = get_var_type(each->type_);
+        if (for_node->is_parallel) {
+            codegen_parallel_for(for_node, each, file, tab_level);
+            return;
+        }
+        std::string type = codegen_get_var_type(each);
+        std::string i = each->identifier->token;
+        codegen_hide(i, file);
+        *file << "for(" << type << " " << i << " = ";
+        codegen_expr(for_node->iterable, file);
+        *file << ", atlas_each_end_" << n << " = ";
+        codegen_expr(for_node->range_end, file);
+        *file << "; " << i << " < atlas_each_end_" << n << "; " << i << "++)\n";
+        codegen_add_var(each);
+        codegen_block(for_node->block, file, tab_level + 1);
+        return;
+    }
+
+    ExpressionNode* iterable = for_node->iterable;
+    VarNode* var = codegen_expr_var(iterable);
+    bool is_string = var != NULL && var->ptr_level == 0 && var->type_ != NULL && var->type_->token == "string";
+    if (var == NULL || (!var->is_array && !var->is_slice && !var->is_dynamic && !is_string)) {
+        print_error_msg("for " + for_node->each_var->token
+                        + " in expects an array, a slice, a dynamic array or a string (line "
+                        + std::to_string(for_node->each_var->line) + ")");
+        error_abort();
+    }
+    // Anything but a variable is evaluated once, into a temporary unless
+    // it is an array, which is a field reached through variables
+    std::ostringstream expr;
+    codegen_expr(iterable, &expr);
+    std::string name = expr.str();
+    bool is_temp = iterable->nt != NODE_VAR && !var->is_array;
+    if (is_temp) {
+        name = "atlas_each_v_" + n;
+        *file << "{\n";
+        codegen_tabs(file, tab_level + 1);
+        *file << codegen_get_var_type(var) << " " << name << " = " << expr.str() << ";\n";
+        tab_level++;
+        codegen_tabs(file, tab_level);
+    }
+    std::string base = var->is_array ? name : is_string ? name + ".str" : name + ".ptr";
+    each->type_ = var->type_;
+    each->type = var->type;
+    each->ptr_level = var->ptr_level - (var->is_array ? 1 : 0);
+    if (is_string) {
+        each->type_ = new Token(*var->type_);
+        each->type_->token = "u8";
+        each->type = TYPE_U8;
+    }
+    std::string elem = codegen_get_var_type(each);
+    std::string p = "atlas_each_p_" + n;
+    std::string end = "atlas_each_end_" + n;
+    *file << "for(" << elem << "* " << p << " = " << base << ", *" << end << " = "
+          << base << " + ";
+    if (var->is_array) {
+        codegen_expr(var->arr_size, file);
+    } else {
+        *file << name << ".len";
+    }
+    *file << "; " << p << " < " << end << "; " << p << "++)\n";
+    codegen_tabs(file, tab_level);
+    *file << "{\n";
+    codegen_push_scope();
+    codegen_tabs(file, tab_level + 1);
+    codegen_hide(each->identifier->token, file);
+    if (for_node->each_by_ref) {
+        each->ptr_level++;
+        *file << codegen_get_var_type(each) << " " << each->identifier->token << " = " << p << ";\n";
+    } else {
+        *file << elem << " " << each->identifier->token << " = *" << p << ";\n";
+    }
+    codegen_add_var(each);
+    codegen_block(for_node->block, file, tab_level + 2);
+    codegen_pop_scope();
+    codegen_tabs(file, tab_level);
+    *file << "}\n";
+    if (is_temp) {
+        codegen_tabs(file, tab_level - 1);
+        *file << "}\n";
+    }
+}
+
+void codegen_for(ForNode* for_node, std::ostream* file, int tab_level) {
+    codegen_push_scope();
+    if (for_node->for_type == FOR_LOOP) {
+        if (for_node->init->nt == NODE_VAR_DECL) {
+            codegen_hide(for_node->init->vardecl_lhs->lhs->identifier->token, file);
+        }
+        *file << "for(";
+        codegen_statement(for_node->init, file, tab_level);
+        *file << "; ";
+        codegen_expr(for_node->test, file);
+        *file << "; ";
+        // NOTE: Can't generate statements here now
+        codegen_expr(for_node->update->expr_lhs, file);
+        *file << ")\n";
+        codegen_block(for_node->block, file, tab_level + 1);
+    } else if (for_node->for_type == FOR_WHILE) {
+        *file << "for(;";
+        codegen_expr(for_node->test, file);
+        *file << ";)\n";
+        codegen_block(for_node->block, file, tab_level + 1);
+    } else if (for_node->for_type == FOR_EACH) {
+        codegen_for_each(for_node, file, tab_level);
+    } else {
+        print_error_msg("Codegen for this for loop type is not implemented yet...");
+        error_abort();
+    }
+    codegen_pop_scope();
+}
+
+void codegen_assign(AssignNode* assign, std::ostream* file) {
+    // lhs
+    *file << codegen_var_name(assign->lhs->identifier->token);
+    if (assign->lhs->is_array) {
+        *file << "[";
+        codegen_expr(assign->lhs->arr_size, file);
+        *file << "]";
+    }
+    // rhs
+    *file << " = ";
+    codegen_expr(assign->rhs, file);
+}
+
+bool codegen_statement(StatementNode* statement, std::ostream* file, int tab_level) {
+    switch(statement->nt) {
+    case NODE_VAR_DECL:
+        codegen_var_decl(statement->vardecl_lhs, file);
+        return true;
+    case NODE_ASSIGN:
+        //TODO: does this even exist anymore?
+        codegen_expr(statement->expr_lhs, file);
+        return true;
+    case NODE_BINOP:
+        codegen_expr(statement->expr_lhs, file);
+        return true;
+    case NODE_IF:
+        codegen_if(statement->if_lhs, file, tab_level);
+        return false;
+    case NODE_RETURN:
+        if (codegen_in_defer) {
+            print_error_msg("Can't return from a deferred statement");
+            error_abort();
+        }
+        if (codegen_has_defers()) {
+            codegen_deferred_return(statement, file, tab_level);
+            return false;
+        }
+        if (statement->return_lhs->is_self_tail && codegen_current_func->has_tail_loop) {
+            codegen_tail_loop(statement, file, tab_level);
+            return false;
+        }
+        if (statement->return_lhs->is_tail) {
+            *file << "ATLAS_MUSTTAIL ";
+            tail_stats.calls++;
+        }
+        codegen_return(statement, file);
+        return true;
+    case NODE_FOR:
+        codegen_for(statement->for_lhs, file, tab_level);
+        return false;
+    case NODE_DEFER:
+        codegen_defers.back().push_back({statement->defer_lhs, codegen_scope});
+        return false;
+    case NODE_MATCH:
+        codegen_match(statement->match_lhs, file, tab_level);
+        return false;
+    case NODE_CALL:
+        codegen_expr(statement->expr_lhs, file);
+        return true;
+    default:
+        std::string err = "CODEGEN STATEMENT " + get_nt_str(statement->nt) + "\n";
+        print_error_msg(err);
+        error_abort();
+    }
+    return false;
+}
+
+// Everything with a body in this program is static unless it's main or
+// exported, so gcc sees the whole program and can inline or drop it.
+// Prototypes follow their definition, or stay extern for C functions
+void codegen_func_attributes(FunctionNode* func, std::ostream* file) {
+    FunctionNode* definition = NULL;
+    for (FunctionNode* other : function_table) {
+        if (other->mangled_name == func->mangled_name && other->block != NULL) {
+            definition = other;
+        }
+    }
+    if (definition == NULL) {
+        return;
+    }
+    std::vector<std::string> attributes;
+    if (definition->is_noinline) {
+        attributes.push_back("noinline");
+    }
+    if (definition->is_hot) {
+        attributes.push_back("hot");
+    }
+    if (definition->is_cold) {
+        attributes.push_back("cold");
+    }
+    if (definition->is_flatten) {
+        attributes.push_back("flatten");
+    }
+    if (attributes.size() != 0) {
+        *file << "__attribute__((";
+        for (int i = 0; i < attributes.size(); i++) {
+            *file << (i == 0 ? "" : ", ") << attributes[i];
+        }
+        *file << "))\n";
+    }
+    if (definition->mangled_name != "main" && !definition->is_export) {
+        *file << "static ";
+    }
+    if (definition->is_inline) {
+        *file << "inline ";
+    }
+}
+
+// name(params), the params are added to the current scope
+void codegen_params(FunctionNode* func, std::string name, std::ostream* file) {
+    *file << name << "(";
+    for (int i = 0; i < func->params.size(); i++) {
+        codegen_param(func->params[i], file);
+        if (i + 1 != func->params.size()) {
+            *file << ", ";
+        }
+    }
+    if (func->params.size() == 0) {
+        *file << "void";
+    }
+    *file << ")";
+}
+
+// The body of a memo function becomes <name>_memo_body and <name> looks
+// the arguments up in a cache before calling it. Recursive calls in the
+// body go through the cache as well
+void codegen_memo_func(FunctionNode* func, std::ostream* file) {
+    std::string name = func->mangled_name;
+    std::string body = name + "_memo_body";
+    std::string ret_type = codegen_get_return_type(func);
+    std::string args;
+    for (int i = 0; i < func->params.size(); i++) {
+        args += (i == 0 ? "" : ", ") + func->params[i]->identifier->token;
+    }
+    std::string call = body + "(" + args + ")";
+    codegen_current_func = func;
+
+    codegen_func_attributes(func, file);
+    *file << ret_type << " ";
+    codegen_push_scope();
+    codegen_params(func, name, file);
+    codegen_pop_scope();
+    *file << ";\n";
+    bool is_dense = memo_is_dense(func);
+    uint64_t size = is_dense ? memo_dense_size(func) : 0;
+    if (is_dense) {
+        *file << "static " << ret_type << " " << name << "_memo_value[" << size << "];\n";
+        *file << "static uchar " << name << "_memo_known[" << size << "];\n";
+    } else {
+        *file << "static AtlasMap* " << name << "_memo_cache;\n";
+    }
+    *file << "static " << ret_type << " ";
+    codegen_push_scope();
+    codegen_params(func, body, file);
+    *file << "\n";
+    codegen_block(func->block, file, 1);
+    codegen_pop_scope();
+    *file << "\n";
+
+    codegen_func_attributes(func, file);
+    *file << ret_type << " ";
+    codegen_push_scope();
+    codegen_params(func, name, file);
+    codegen_pop_scope();
+    *file << "\n{\n";
+    if (is_dense) {
+        std::string value = name + "_memo_value[atlas_memo_index]";
+        std::string known = name + "_memo_known[atlas_memo_index]";
+        // u8 is a plain char in C, so it goes through uchar first
+        VarType type = func->params[0]->type;
+        std::string cast = type == TYPE_U8 ? "(uchar)" : type == TYPE_U16 ? "(uint16)" : "";
+        *file << "\tuint64 atlas_memo_index = (uint64)((int64)" << cast << args << " + "
+              << memo_dense_offset(func) << ");\n"
+              << "\tif (atlas_memo_index >= " << size << "ULL)\n\t{\n"
+              << "\t\treturn " << call << ";\n\t}\n"
+              << "\tif (!" << known << ")\n\t{\n"
+              << "\t\t" << value << " = " << call << ";\n"
+              << "\t\t" << known << " = 1;\n\t}\n"
+              << "\treturn " << value << ";\n";
+    } else {
+        // several arguments are packed into a byte key
+        std::string cache = name + "_memo_cache";
+        bool is_single = func->params.size() == 1;
+        std::string key = is_single ? "(uint64)" + args
+                                    : "(const uchar*)atlas_memo_key, sizeof(atlas_memo_key)";
+        std::string suffix = is_single ? "" : "_bytes";
+        *file << "\tif (" << cache << " == 0)\n\t{\n"
+              << "\t\t" << cache << " = atlas_map_new(" << (is_single ? "false" : "true") << ");\n\t}\n";
+        if (!is_single) {
+            *file << "\tuint64 atlas_memo_key[" << func->params.size() << "] = {";
+            for (int i = 0; i < func->params.size(); i++) {
+                *file << (i == 0 ? "" : ", ") << "(uint64)" << func->params[i]->identifier->token;
+            }
+            *file << "};\n";
+        }
+        *file << "\tuint64* atlas_memo_hit = atlas_map_get" << suffix << "(" << cache << ", " << key << ");\n"
+              << "\tif (atlas_memo_hit != 0)\n\t{\n"
+              << "\t\treturn (" << ret_type << ")*atlas_memo_hit;\n\t}\n"
+              << "\t" << ret_type << " atlas_memo_result = " << call << ";\n";
+        if (func->memo_limit != 0) {
+            *file << "\tif (atlas_map_len(" << cache << ") < " << func->memo_limit << "ULL)\n";
+        }
+        *file << "\tatlas_map_insert" << suffix << "(" << cache << ", " << key
+              << ", (uint64)atlas_memo_result);\n"
+              << "\treturn atlas_memo_result;\n";
+    }
+    *file << "}\n\n";
+}
+
+void codegen_func(FunctionNode* func, std::ostream* file) {
+    codegen_tuple_typedef(func, file);
+    if (func->is_memo && func->block != NULL) {
+        codegen_memo_func(func, file);
+        return;
+    }
+    codegen_func_attributes(func, file);
+    *file << codegen_get_return_type(func);
+    *file << " ";
+    codegen_current_func = func;
+    codegen_hidden.clear();
+    codegen_push_scope();
+    codegen_params(func, func->mangled_name, file);
+    *file << "\n";
+    IrFunction* lowered = ir_get_function(func);
+    if (lowered != NULL) {
+        ir_c_function(lowered, file);
+    } else if (func->block != NULL && func->has_tail_loop) {
+        *file << "{\natlas_tail: ;\n";
+        codegen_block(func->block, file, 2);
+        *file << "}\n";
+    } else if(func->block != NULL) {
+        codegen_block(func->block, file, 1);
+    } else {
+        *file << ";";
+    }
+    codegen_pop_scope();
+    *file << "\n";
+}
+
+void codegen_tabs(std::ostream* file, int tab_level) {
+    for (int i = 0; i < tab_level; i++) {
+        *file << "\t";
+    }
+}
+
+void codegen_block(BlockNode* block, std::ostream* file, int tab_level) {
+    codegen_tabs(file, tab_level - 1);
+    *file << "{\n";
+    codegen_push_scope();
+    codegen_defers.push_back({});
+    if (block != NULL) {
+        for (StatementNode* statement : block->statements) {
+            if (statement->nt == NODE_DEFER) {
+                codegen_statement(statement, file, tab_level);
+                continue;
+            }
+            codegen_tabs(file, tab_level);
+            if(codegen_statement(statement, file, tab_level)) {
+                *file << ";\n";
+            }
+        }
+        // falling off the end, a return at the end already ran them
+        if (block->statements.size() != 0 && block->statements.back()->nt != NODE_RETURN) {
+            codegen_write_defers(codegen_defers.size() - 1, file, tab_level);
+        }
+    }
+    codegen_defers.pop_back();
+    codegen_pop_scope();
+    codegen_tabs(file, tab_level - 1);
+    *file << "}\n";
+}
+
+// Writes the whole program as C
+void codegen_c(std::vector<StatementNode*> ast, std::ostream* file) {
+    atlas_lib(file);
+    codegen_collect_slices(ast);
+    codegen_slice_typedefs("", file);
+    codegen_push_scope(); // globals
+    for (StatementNode* node : ast) {
+        log_print("Generating Node: " +  get_nt_str(node->nt) + "\n");
+        if (node->nt == NODE_FUNC && (node->func_lhs->is_comptime || !node->func_lhs->is_reachable)) {
+            continue; // already run by the compiler, or never called
+        } else if (node->nt == NODE_FUNC) {
+            codegen_func(node->func_lhs, file);
+            codegen_parallel_flush(file);
+        } else if (node->nt == NODE_TYPE && !node->type_lhs->is_reachable) {
+            continue;
+        } else if (node->nt == NODE_TYPE) {
+            codegen_type(node->type_lhs, file);
+        } else if (node->nt == NODE_CALL) {
+            codegen_expr(node->expr_lhs, file);
+        } else if (node->nt == NODE_VAR_DECL) {
+            codegen_var_decl(node->vardecl_lhs, file);
+            *file << ";\n";
+        } else if (node->nt == NODE_CINCLUDE) {
+            *file << "#include <";
+            *file << node->cinclude_lhs->name->token;
+            *file << ">\n";
+        }
+    }
+    codegen_init_c(ast, file);
+}
+
+void codegen_start(std::vector<StatementNode*> ast, std::string filename, std::string backend) {
+    std::ofstream file(filename);
+    codegen_c(ast, &file);
+    file.close();
+    if (global_state->freestanding) {
+        codegen_end(backend);
+    } else {
+        codegen_end_libc(backend);
+    }
+}
+
+/* Codegen end */
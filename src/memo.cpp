@@ -0,0 +1,318 @@
+#include <vector>
+#include <string>
+
+#include "global.hpp"
+#include "error.hpp"
+#include "fold.hpp"
+#include "memo.hpp"
+
+// A memo function gets its results cached by codegen_memo_func, which is
+// only correct when calling it twice with the same arguments can't do
+// anything different. Every function it calls is held to the same rules
+
+thread_local std::vector<std::string> memo_const_globals;
+thread_local std::vector<FunctionNode*> memo_pure; // checked, or being checked further up
+thread_local FunctionNode* memo_culprit = NULL;    // where the first impurity was found
+thread_local bool memo_any_scalar = false;         // memo_is_pure takes floats and bools as well
+
+bool memo_statements(std::vector<StatementNode*> statements, std::vector<std::string>& locals,
+                     std::string* reason);
+bool memo_function(FunctionNode* func, std::string* reason);
+
+// An integer, or any number or bool for memo_is_pure
+bool memo_is_number(VarNode* var) {
+    if (fold_is_integer(var->type)) {
+        return true;
+    }
+    return memo_any_scalar && (var->type == TYPE_F32 || var->type == TYPE_F64 ||
+                               (var->type_ != NULL && var->type_->token == "bool"));
+}
+
+bool memo_is_integer(VarNode* var) {
+    return var->ptr_level == 0 && !var->is_array && !var->is_slice && !var->is_dynamic && memo_is_number(var);
+}
+
+std::string memo_kind() {
+    return memo_any_scalar ? "a number" : "an integer";
+}
+
+bool memo_is_dense(FunctionNode* func) {
+    if (func->params.size() != 1) {
+        return false;
+    }
+    VarType type = func->params[0]->type;
+    return func->memo_limit != 0 || type == TYPE_I8 || type == TYPE_U8 ||
+           type == TYPE_I16 || type == TYPE_U16;
+}
+
+uint64_t memo_dense_size(FunctionNode* func) {
+    if (func->memo_limit != 0) {
+        return func->memo_limit;
+    }
+    VarType type = func->params[0]->type;
+    return type == TYPE_I8 || type == TYPE_U8 ? 256 : 65536;
+}
+
+// Added to the argument to get its index in the array
+int64_t memo_dense_offset(FunctionNode* func) {
+    if (func->memo_limit != 0) {
+        return 0;
+    }
+    VarType type = func->params[0]->type;
+    return type == TYPE_I8 ? 128 : type == TYPE_I16 ? 32768 : 0;
+}
+
+bool memo_has(std::vector<std::string>& names, std::string name) {
+    for (std::string other : names) {
+        if (other == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool memo_expr(ExpressionNode* expr, std::vector<std::string>& locals, std::string* reason) {
+    if (expr == NULL) {
+        return true;
+    }
+    switch (expr->nt) {
+    case NODE_VAR:
+    {
+        std::string name = expr->var_node->identifier->token;
+        if (!memo_has(locals, name) && !memo_has(memo_const_globals, name) && name != "true" && name != "false") {
+            *reason = "uses the global " + name;
+            return false;
+        }
+        return true;
+    }
+    case NODE_QUOTE:
+        *reason = "allocates strings";
+        return false;
+    case NODE_BINOP:
+        if (expr->binop->op->tt == TK_DOT) {
+            return memo_expr(expr->binop->lhs, locals, reason);
+        }
+        return memo_expr(expr->binop->lhs, locals, reason) && memo_expr(expr->binop->rhs, locals, reason);
+    case NODE_UNARY:
+    {
+        UnaryOpNode* unary_op = expr->unary_op;
+        if (unary_op->operator_type == NODE_UNARY &&
+            (unary_op->op->tt == TK_STAR || unary_op->op->tt == TK_AMPERSAND)) {
+            *reason = "uses pointers";
+            return false;
+        }
+        return memo_expr(unary_op->operand, locals, reason);
+    }
+    case NODE_CALL:
+    {
+        std::string name = expr->call_node->name->token;
+        for (ExpressionNode* arg : expr->call_node->args) {
+            if (!memo_expr(arg, locals, reason)) {
+                return false;
+            }
+        }
+        if (name == "len" || name == "sizeof") {
+            return true;
+        }
+        FunctionNode* callee = NULL;
+        for (FunctionNode* func : function_table) {
+            if (func->token->token == name && func->block != NULL) {
+                callee = func;
+            }
+        }
+        if (callee == NULL) {
+            *reason = "calls " + name;
+            return false;
+        }
+        return memo_function(callee, reason);
+    }
+    case NODE_ARRAY_EXPR:
+        for (ExpressionNode* element : expr->array->elements) {
+            if (!memo_expr(element, locals, reason)) {
+                return false;
+            }
+        }
+        return true;
+    case NODE_SUBSCRIPT:
+        for (ExpressionNode* index : expr->subscript->indexes) {
+            if (!memo_expr(index, locals, reason)) {
+                return false;
+            }
+        }
+        return true;
+    default:
+        return true;
+    }
+}
+
+bool memo_if(IfNode* if_node, std::vector<std::string>& locals, std::string* reason) {
+    if (!memo_expr(if_node->condition, locals, reason) ||
+        !memo_statements(if_node->block->statements, locals, reason)) {
+        return false;
+    }
+    if (if_node->_else == NULL) {
+        return true;
+    } else if (if_node->_else->block != NULL) {
+        return memo_statements(if_node->_else->block->statements, locals, reason);
+    }
+    return memo_if(if_node->_else->else_if->if_lhs, locals, reason);
+}
+
+// Locals aren't scoped, a name declared anywhere in the function counts
+bool memo_statements(std::vector<StatementNode*> statements, std::vector<std::string>& locals,
+                     std::string* reason) {
+    for (StatementNode* statement : statements) {
+        switch (statement->nt) {
+        case NODE_VAR_DECL:
+        {
+            VarDeclNode* var_decl = statement->vardecl_lhs;
+            VarNode* var = var_decl->lhs;
+            if (var_decl->is_static) {
+                *reason = "has the static variable " + var->identifier->token;
+                return false;
+            }
+            if (var_decl->destructure.size() != 0 || var->is_slice || var->is_dynamic ||
+                var->ptr_level - var->is_array > 0 || !memo_is_number(var)) {
+                *reason = "declares " + var->identifier->token + ", which isn't " + memo_kind();
+                return false;
+            }
+            if ((var->is_array && !memo_expr(var->arr_size, locals, reason)) ||
+                !memo_expr(var_decl->rhs, locals, reason)) {
+                return false;
+            }
+            locals.push_back(var->identifier->token);
+            break;
+        }
+        case NODE_RETURN:
+            for (ExpressionNode* expr : statement->return_lhs->exprs) {
+                if (!memo_expr(expr, locals, reason)) {
+                    return false;
+                }
+            }
+            break;
+        case NODE_IF:
+            if (!memo_if(statement->if_lhs, locals, reason)) {
+                return false;
+            }
+            break;
+        case NODE_FOR:
+        {
+            ForNode* for_node = statement->for_lhs;
+            if (for_node->for_type == FOR_LOOP &&
+                (!memo_statements({for_node->init}, locals, reason) ||
+                 !memo_statements({for_node->update}, locals, reason))) {
+                return false;
+            }
+            if (for_node->for_type == FOR_EACH) {
+                if (!memo_expr(for_node->iterable, locals, reason) ||
+                    !memo_expr(for_node->range_end, locals, reason)) {
+                    return false;
+                }
+                locals.push_back(for_node->each_var->token);
+            }
+            if (!memo_expr(for_node->test, locals, reason) ||
+                !memo_statements(for_node->block->statements, locals, reason)) {
+                return false;
+            }
+            break;
+        }
+        case NODE_DEFER:
+            if (!memo_statements({statement->defer_lhs}, locals, reason)) {
+                return false;
+            }
+            break;
+        case NODE_MATCH:
+        {
+            MatchNode* match = statement->match_lhs;
+            if (!memo_expr(match->value, locals, reason)) {
+                return false;
+            }
+            for (MatchArm* arm : match->arms) {
+                if (!memo_statements(arm->block->statements, locals, reason)) {
+                    return false;
+                }
+            }
+            if (match->else_block != NULL && !memo_statements(match->else_block->statements, locals, reason)) {
+                return false;
+            }
+            break;
+        }
+        default:
+            if (!memo_expr(statement->expr_lhs, locals, reason)) {
+                return false;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+bool memo_function(FunctionNode* func, std::string* reason) {
+    for (FunctionNode* pure : memo_pure) {
+        if (pure == func) {
+            return true;
+        }
+    }
+    memo_pure.push_back(func); // recursion is fine
+    std::vector<std::string> locals;
+    bool is_pure = true;
+    if (memo_any_scalar && func->is_memo) {
+        *reason = "is memo, and threads can't share its cache";
+        is_pure = false;
+    }
+    for (ParamNode* param : func->params) {
+        if (is_pure && !memo_is_integer(param)) {
+            *reason = "takes " + param->identifier->token + ", which isn't " + memo_kind();
+            is_pure = false;
+        }
+        locals.push_back(param->identifier->token);
+    }
+    for (VarNode* return_var : func->return_vars) {
+        if (is_pure && !memo_is_integer(return_var)) {
+            *reason = "returns something that isn't " + memo_kind();
+            is_pure = false;
+        }
+    }
+    is_pure = is_pure && memo_statements(func->block->statements, locals, reason);
+    if (!is_pure && memo_culprit == NULL) {
+        memo_culprit = func;
+    }
+    return is_pure;
+}
+
+void memo_start(std::vector<StatementNode*> ast) {
+    for (StatementNode* statement : ast) {
+        if (statement->nt == NODE_VAR_DECL && statement->vardecl_lhs->is_const) {
+            memo_const_globals.push_back(statement->vardecl_lhs->lhs->identifier->token);
+        }
+    }
+    for (FunctionNode* func : function_table) {
+        if (!func->is_memo || func->block == NULL) {
+            continue;
+        }
+        std::string name = func->token->token;
+        if (func->params.size() == 0 || func->return_vars.size() != 1) {
+            print_error_msg("memo function \"" + name + "\" needs parameters and a single result");
+            error_abort();
+        }
+        std::string reason;
+        if (!memo_function(func, &reason)) {
+            print_error_msg("memo function \"" + name + "\" is not pure: "
+                            + memo_culprit->token->token + " " + reason);
+            error_abort();
+        }
+    }
+}
+
+bool memo_is_pure(FunctionNode* func, std::string* reason) {
+    memo_pure.clear();
+    memo_culprit = NULL;
+    memo_any_scalar = true;
+    bool is_pure = memo_function(func, reason);
+    memo_any_scalar = false;
+    memo_pure.clear();
+    if (!is_pure) {
+        *reason = memo_culprit->token->token + " " + *reason;
+    }
+    return is_pure;
+}
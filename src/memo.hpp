@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+
+#include "ast.hpp"
+
+// Checks that every memo function is pure: integer parameters and result,
+// and nothing read or written but its own locals, const globals and other
+// pure functions
+void memo_start(std::vector<StatementNode*> ast);
+
+// Whether func is pure by the same rules, but taking and returning any
+// number or bool, for the calls in a for parallel body. A memo function
+// isn't, as its cache isn't locked. reason names the function at fault
+bool memo_is_pure(FunctionNode* func, std::string* reason);
+
+// A single parameter with a small domain (8 or 16 bits, or memo(N)) is
+// cached in a flat array, anything else in an AtlasMap
+bool memo_is_dense(FunctionNode* func);
+uint64_t memo_dense_size(FunctionNode* func);
+int64_t memo_dense_offset(FunctionNode* func);
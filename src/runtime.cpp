@@ -0,0 +1,1106 @@
+#include <fstream>
+
+#include "runtime.hpp"
+
+void runtime_syscalls(std::ostream* file) {
+    *file << R"(#define SYSCALL_READ 0
+#define SYSCALL_OPEN 2
+#define SYSCALL_CLOSE 3
+#define SYSCALL_FSTAT 5
+#define SYSCALL_LSEEK 8
+#define SYSCALL_MMAP 9
+#define SYSCALL_MUNMAP 11
+#define SYSCALL_MREMAP 25
+
+static inline long atlas_syscall3(long n, long a, long b, long c)
+{
+	long ret;
+	asm volatile
+	(
+		"syscall"
+		: "=a"(ret)
+		: "a"(n), "D"(a), "S"(b), "d"(c)
+		: "rcx", "r11", "memory"
+	);
+	return ret;
+}
+
+static inline long atlas_syscall6(long n, long a, long b, long c, long d, long e, long f)
+{
+	long ret;
+	register long r10 asm("r10") = d;
+	register long r8 asm("r8") = e;
+	register long r9 asm("r9") = f;
+	asm volatile
+	(
+		"syscall"
+		: "=a"(ret)
+		: "a"(n), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9)
+		: "rcx", "r11", "memory"
+	);
+	return ret;
+}
+
+)";
+}
+
+void runtime_freestanding(std::ostream* file) {
+    // Everything libc would otherwise provide: the file syscalls, an mmap
+    // backed allocator and the mem* and strlen symbols gcc is allowed to call on
+    // its own
+    *file << R"(int32 atlas_open(const char* filename, int32 flags, int32 mode)
+{
+	return atlas_syscall3(SYSCALL_OPEN, (long)filename, flags, mode);
+}
+
+int32 atlas_close(int32 fd)
+{
+	return atlas_syscall3(SYSCALL_CLOSE, fd, 0, 0);
+}
+
+)";
+
+    // Size classes are powers of two from 32 B up to 256 KB, carved out of
+    // 1 MB arenas and recycled through per class free lists. Anything bigger
+    // gets its own mapping. Every block starts with a 16 byte header so the
+    // returned pointer stays 16 byte aligned.
+    *file << R"(#define ATLAS_HEAP_CLASSES 14
+#define ATLAS_HEAP_MIN 32
+#define ATLAS_HEAP_LARGE (ATLAS_HEAP_MIN << (ATLAS_HEAP_CLASSES - 1))
+#define ATLAS_HEAP_ARENA (1 << 20)
+
+typedef struct AtlasBlock { struct AtlasBlock* next; } AtlasBlock;
+static AtlasBlock* atlas_free_lists[ATLAS_HEAP_CLASSES];
+static char* atlas_heap_cur;
+static char* atlas_heap_end;
+
+static void* atlas_mmap(uint64 size)
+{
+	long ret = atlas_syscall6(SYSCALL_MMAP, 0, size, 3 /* PROT_READ | PROT_WRITE */,
+	                          0x22 /* MAP_PRIVATE | MAP_ANONYMOUS */, -1, 0);
+	if (ret < 0 && ret > -4096) {
+		return 0;
+	}
+	return (void*)ret;
+}
+
+void* atlas_alloc(uint64 size)
+{
+	uint64 total = size + 16;
+	uint64* block;
+	if (total > ATLAS_HEAP_LARGE) {
+		block = atlas_mmap(total);
+		if (block == 0) {
+			return 0;
+		}
+		block[0] = total;
+		block[1] = ATLAS_HEAP_CLASSES;
+		return block + 2;
+	}
+	uint64 cls = 0;
+	uint64 cls_size = ATLAS_HEAP_MIN;
+	while (cls_size < total) {
+		cls_size <<= 1;
+		cls++;
+	}
+	if (atlas_free_lists[cls] != 0) {
+		block = (uint64*)atlas_free_lists[cls];
+		atlas_free_lists[cls] = atlas_free_lists[cls]->next;
+	} else {
+		if (atlas_heap_cur + cls_size > atlas_heap_end) {
+			atlas_heap_cur = atlas_mmap(ATLAS_HEAP_ARENA);
+			if (atlas_heap_cur == 0) {
+				return 0;
+			}
+			atlas_heap_end = atlas_heap_cur + ATLAS_HEAP_ARENA;
+		}
+		block = (uint64*)atlas_heap_cur;
+		atlas_heap_cur += cls_size;
+	}
+	block[0] = cls_size;
+	block[1] = cls;
+	return block + 2;
+}
+
+void atlas_free(void* ptr)
+{
+	if (ptr == 0) {
+		return;
+	}
+	uint64* block = (uint64*)ptr - 2;
+	if (block[1] == ATLAS_HEAP_CLASSES) {
+		atlas_syscall3(SYSCALL_MUNMAP, (long)block, block[0], 0);
+		return;
+	}
+	AtlasBlock* free_block = (AtlasBlock*)block;
+	free_block->next = atlas_free_lists[block[1]];
+	atlas_free_lists[block[1]] = free_block;
+}
+
+)";
+
+    // Large blocks are remapped so growing a big dynamic array never copies
+    *file << R"(void* memcpy(void* dst, const void* src, uint64 n);
+
+void* atlas_realloc(void* ptr, uint64 size)
+{
+	if (ptr == 0) {
+		return atlas_alloc(size);
+	}
+	uint64* block = (uint64*)ptr - 2;
+	uint64 old_size = block[0] - 16;
+	if (size <= old_size) {
+		return ptr;
+	}
+	if (block[1] == ATLAS_HEAP_CLASSES) {
+		long ret = atlas_syscall6(SYSCALL_MREMAP, (long)block, block[0], size + 16,
+		                          1 /* MREMAP_MAYMOVE */, 0, 0);
+		if (ret < 0 && ret > -4096) {
+			return 0;
+		}
+		block = (uint64*)ret;
+		block[0] = size + 16;
+		return block + 2;
+	}
+	void* new_ptr = atlas_alloc(size);
+	if (new_ptr != 0) {
+		memcpy(new_ptr, ptr, old_size);
+		atlas_free(ptr);
+	}
+	return new_ptr;
+}
+
+)";
+
+    // 16 byte vector kernels, gcc and clang lower these to SSE2 on x86-64
+    *file << R"(typedef uchar AtlasV16 __attribute__((vector_size(16), aligned(1), may_alias));
+
+void* memcpy(void* dst, const void* src, uint64 n)
+{
+	uchar* d = dst;
+	const uchar* s = src;
+	for (; n >= 16; n -= 16, d += 16, s += 16) {
+		*(AtlasV16*)d = *(const AtlasV16*)s;
+	}
+	for (; n != 0; n--) {
+		*d++ = *s++;
+	}
+	return dst;
+}
+
+void* memmove(void* dst, const void* src, uint64 n)
+{
+	uchar* d = dst;
+	const uchar* s = src;
+	if (d <= s || d >= s + n) {
+		return memcpy(dst, src, n);
+	}
+	d += n;
+	s += n;
+	for (; n >= 16; n -= 16) {
+		d -= 16;
+		s -= 16;
+		*(AtlasV16*)d = *(const AtlasV16*)s;
+	}
+	for (; n != 0; n--) {
+		*--d = *--s;
+	}
+	return dst;
+}
+
+void* memset(void* dst, int c, uint64 n)
+{
+	uchar* d = dst;
+	AtlasV16 v = (AtlasV16){0} + (uchar)c;
+	for (; n >= 16; n -= 16, d += 16) {
+		*(AtlasV16*)d = v;
+	}
+	for (; n != 0; n--) {
+		*d++ = (uchar)c;
+	}
+	return dst;
+}
+
+int memcmp(const void* a, const void* b, uint64 n)
+{
+	const uchar* x = a;
+	const uchar* y = b;
+#if defined(__SSE2__)
+	for (; n >= 16; n -= 16, x += 16, y += 16) {
+		AtlasV16 eq = (AtlasV16)(*(const AtlasV16*)x == *(const AtlasV16*)y);
+		if (__builtin_ia32_pmovmskb128((char __attribute__((vector_size(16))))eq) != 0xffff) {
+			break;
+		}
+	}
+#endif
+	for (; n != 0; n--, x++, y++) {
+		if (*x != *y) {
+			return *x - *y;
+		}
+	}
+	return 0;
+}
+
+void* memchr(const void* p, int c, uint64 n)
+{
+	const uchar* s = p;
+#if defined(__SSE2__)
+	AtlasV16 needle = (AtlasV16){0} + (uchar)c;
+	for (; n >= 16; n -= 16, s += 16) {
+		AtlasV16 eq = (AtlasV16)(*(const AtlasV16*)s == needle);
+		int mask = __builtin_ia32_pmovmskb128((char __attribute__((vector_size(16))))eq);
+		if (mask != 0) {
+			return (void*)(s + __builtin_ctz(mask));
+		}
+	}
+#endif
+	for (; n != 0; n--, s++) {
+		if (*s == (uchar)c) {
+			return (void*)s;
+		}
+	}
+	return 0;
+}
+
+// gcc turns counting loops over string literals into calls to this
+uint64 strlen(const char* s)
+{
+	const char* end = s;
+	while (*end != 0) {
+		end++;
+	}
+	return end - s;
+}
+
+)";
+}
+
+void runtime_io(std::ostream* file) {
+    // Bulk file I/O goes straight to the kernel in both modes, the buffering
+    // lives in std.atl's Reader and Writer
+    *file << R"(int64 atlas_read(int32 fd, void* buf, uint64 n)
+{
+	return atlas_syscall3(SYSCALL_READ, fd, (long)buf, n);
+}
+
+int64 atlas_write(int32 fd, const void* buf, uint64 n)
+{
+	return atlas_syscall3(SYSCALL_WRITE, fd, (long)buf, n);
+}
+
+int64 atlas_lseek(int32 fd, int64 offset, int32 whence)
+{
+	return atlas_syscall3(SYSCALL_LSEEK, fd, offset, whence);
+}
+
+// Returns the size of the file behind fd, or -errno
+int64 atlas_fstat(int32 fd)
+{
+	long st[18]; // struct stat on x86-64, st_size is the 7th word
+	long ret = atlas_syscall3(SYSCALL_FSTAT, fd, (long)st, 0);
+	if (ret < 0) {
+		return ret;
+	}
+	return st[6];
+}
+
+)";
+}
+
+void runtime_memory(std::ostream* file) {
+    // NOTE: the __builtin_* versions get inlined by the backend for small
+    //       constant sizes and otherwise call into libc, which already picks
+    //       an SSE2/AVX2 implementation for the running cpu. In freestanding
+    //       builds they call the kernels from runtime_freestanding instead
+    *file << R"(static inline void* atlas_memcpy(void* dst, const void* src, uint64 n)
+{
+	return __builtin_memcpy(dst, src, n);
+}
+
+static inline void* atlas_memmove(void* dst, const void* src, uint64 n)
+{
+	return __builtin_memmove(dst, src, n);
+}
+
+static inline void* atlas_memset(void* dst, int c, uint64 n)
+{
+	return __builtin_memset(dst, c, n);
+}
+
+static inline int32 atlas_memcmp(const void* a, const void* b, uint64 n)
+{
+	return __builtin_memcmp(a, b, n);
+}
+
+static inline void* atlas_memchr(const void* p, int c, uint64 n)
+{
+	return __builtin_memchr(p, c, n);
+}
+
+)";
+}
+
+void runtime_dynamic(std::ostream* file) {
+    // Slices are {ptr, len} and dynamic arrays {ptr, len, cap}, the structs
+    // themselves are declared per element type by codegen. Appending grows
+    // the capacity geometrically so it is amortized O(1). A size that
+    // doesn't fit in 64 bits or memory that can't be had stops the program,
+    // the array is left as it was
+    *file << R"(__attribute__((noreturn, noinline, cold))
+static void atlas_dynamic_fail(void)
+{
+	static const char message[] = "out of memory growing a dynamic array\n";
+	atlas_syscall3(SYSCALL_WRITE, 2, (long)message, sizeof(message) - 1);
+	atlas_syscall3(231 /* exit_group */, 1, 0, 0);
+	__builtin_unreachable();
+}
+
+void* atlas_dynamic_reserve(void* ptr, uint64* cap, uint64 elem_size, uint64 needed)
+{
+	if (needed <= *cap) {
+		return ptr;
+	}
+	if (needed > (uint64)-1 / elem_size) {
+		atlas_dynamic_fail();
+	}
+	void* grown = atlas_realloc(ptr, needed * elem_size);
+	if (grown == 0) {
+		atlas_dynamic_fail();
+	}
+	*cap = needed;
+	return grown;
+}
+
+void* atlas_dynamic_grow(void* ptr, uint64* cap, uint64 elem_size, uint64 needed)
+{
+	uint64 new_cap = *cap * 2;
+	if (new_cap < needed) {
+		new_cap = needed;
+	}
+	if (new_cap < 8) {
+		new_cap = 8;
+	}
+	return atlas_dynamic_reserve(ptr, cap, elem_size, new_cap);
+}
+
+#define atlas_reserve(d, n) \
+	((d).ptr = atlas_dynamic_reserve((d).ptr, &(d).cap, sizeof(*(d).ptr), (n)))
+#define atlas_append(d, v) \
+	((d).len == (d).cap \
+		? (void)((d).ptr = atlas_dynamic_grow((d).ptr, &(d).cap, sizeof(*(d).ptr), (d).len + 1)) \
+		: (void)0, \
+	 (d).ptr[(d).len++] = (v))
+
+)";
+}
+
+void runtime_map(std::ostream* file) {
+    // Open addressing in the style of SwissTable: every slot has a control
+    // byte holding 7 bits of the key's hash (or EMPTY/DELETED), and lookups
+    // compare a whole 16 slot group of control bytes at once before touching
+    // any keys. Groups are probed triangularly so every group gets visited
+    *file << R"(#define ATLAS_MAP_EMPTY ((uchar)0x80)
+#define ATLAS_MAP_DELETED ((uchar)0xFE)
+#define ATLAS_MAP_GROUP 16
+
+typedef uchar AtlasMapGroup __attribute__((vector_size(16), aligned(1), may_alias));
+
+typedef struct AtlasMapSlot
+{
+	uint64 key; // the key itself, or a [len, bytes] block for string keys
+	uint64 value;
+} AtlasMapSlot;
+
+typedef struct AtlasMap
+{
+	uchar* ctrl;
+	AtlasMapSlot* slots;
+	uint64 cap;
+	uint64 len;
+	uint64 growth_left;
+	bool string_keys;
+} AtlasMap;
+
+static inline uint64 atlas_hash_mix(uint64 a, uint64 b)
+{
+	__uint128_t r = (__uint128_t)a * b;
+	return (uint64)r ^ (uint64)(r >> 64);
+}
+
+static inline uint64 atlas_hash_u64(uint64 key)
+{
+	return atlas_hash_mix(key ^ 0x9E3779B97F4A7C15ull, 0xD6E8FEB86659FD93ull);
+}
+
+uint64 atlas_hash_bytes(const uchar* p, uint64 len)
+{
+	uint64 h = 0x9E3779B97F4A7C15ull ^ len;
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64 word;
+		__builtin_memcpy(&word, p, 8);
+		h = atlas_hash_mix(h ^ word, 0xD6E8FEB86659FD93ull);
+	}
+	uint64 tail = 0;
+	for (uint64 i = 0; i < len; i++) {
+		tail |= (uint64)p[i] << (i * 8);
+	}
+	return atlas_hash_mix(h ^ tail, 0xD6E8FEB86659FD93ull);
+}
+
+// One bit per slot in the group whose control byte equals c
+static inline uint32 atlas_map_match(const uchar* group, uchar c)
+{
+#if defined(__SSE2__)
+	AtlasMapGroup eq = (AtlasMapGroup)(*(const AtlasMapGroup*)group == ((AtlasMapGroup){0} + c));
+	return __builtin_ia32_pmovmskb128((char __attribute__((vector_size(16))))eq);
+#else
+	uint32 mask = 0;
+	for (int i = 0; i < ATLAS_MAP_GROUP; i++) {
+		mask |= (uint32)(group[i] == c) << i;
+	}
+	return mask;
+#endif
+}
+
+// One bit per slot in the group that is EMPTY or DELETED
+static inline uint32 atlas_map_match_free(const uchar* group)
+{
+#if defined(__SSE2__)
+	return __builtin_ia32_pmovmskb128((char __attribute__((vector_size(16))))*(const AtlasMapGroup*)group);
+#else
+	uint32 mask = 0;
+	for (int i = 0; i < ATLAS_MAP_GROUP; i++) {
+		mask |= (uint32)(group[i] >> 7) << i;
+	}
+	return mask;
+#endif
+}
+
+static void atlas_map_alloc_table(AtlasMap* m, uint64 cap)
+{
+	uchar* table = atlas_alloc(cap + cap * sizeof(AtlasMapSlot));
+	__builtin_memset(table, ATLAS_MAP_EMPTY, cap);
+	m->ctrl = table;
+	m->slots = (AtlasMapSlot*)(table + cap);
+	m->cap = cap;
+	m->growth_left = cap - cap / 8;
+}
+
+AtlasMap* atlas_map_new(bool string_keys)
+{
+	AtlasMap* m = atlas_alloc(sizeof(AtlasMap));
+	m->len = 0;
+	m->string_keys = string_keys;
+	atlas_map_alloc_table(m, ATLAS_MAP_GROUP);
+	return m;
+}
+
+#define atlas_map_create() atlas_map_new(false)
+#define atlas_map_create_str() atlas_map_new(true)
+#define atlas_map_len(m) ((m)->len)
+
+void atlas_map_free(AtlasMap* m)
+{
+	if (m->string_keys) {
+		for (uint64 slot = 0; slot < m->cap; slot++) {
+			if (m->ctrl[slot] < ATLAS_MAP_EMPTY) {
+				atlas_free((void*)m->slots[slot].key);
+			}
+		}
+	}
+	atlas_free(m->ctrl);
+	atlas_free(m);
+}
+
+// First free slot on the probe sequence of hash
+static uint64 atlas_map_free_slot(AtlasMap* m, uint64 hash)
+{
+	uint64 mask = m->cap - 1;
+	uint64 pos = hash & mask & ~(uint64)(ATLAS_MAP_GROUP - 1);
+	for (uint64 stride = ATLAS_MAP_GROUP;; stride += ATLAS_MAP_GROUP) {
+		uint32 match = atlas_map_match_free(m->ctrl + pos);
+		if (match != 0) {
+			return pos + __builtin_ctz(match);
+		}
+		pos = (pos + stride) & mask;
+	}
+}
+
+static void atlas_map_rehash(AtlasMap* m, uint64 cap)
+{
+	AtlasMap old = *m;
+	atlas_map_alloc_table(m, cap);
+	for (uint64 slot = 0; slot < old.cap; slot++) {
+		if (old.ctrl[slot] >= ATLAS_MAP_EMPTY) {
+			continue;
+		}
+		uint64 key = old.slots[slot].key;
+		uint64 hash = m->string_keys
+			? atlas_hash_bytes((uchar*)key + 8, *(uint64*)key)
+			: atlas_hash_u64(key);
+		uint64 new_slot = atlas_map_free_slot(m, hash);
+		m->ctrl[new_slot] = hash >> 57;
+		m->slots[new_slot] = old.slots[slot];
+	}
+	m->growth_left -= m->len;
+	atlas_free(old.ctrl);
+}
+
+static inline bool atlas_map_key_equal(AtlasMap* m, uint64 stored, uint64 key, uint64 len)
+{
+	if (!m->string_keys) {
+		return stored == key;
+	}
+	return *(uint64*)stored == len && __builtin_memcmp((uchar*)stored + 8, (uchar*)key, len) == 0;
+}
+
+// Slot holding key, or m->cap if it is not in the map. String keys are
+// passed as a pointer in key and their length in len
+static uint64 atlas_map_find_slot(AtlasMap* m, uint64 hash, uint64 key, uint64 len)
+{
+	uint64 mask = m->cap - 1;
+	uint64 pos = hash & mask & ~(uint64)(ATLAS_MAP_GROUP - 1);
+	uchar tag = hash >> 57;
+	for (uint64 stride = ATLAS_MAP_GROUP;; stride += ATLAS_MAP_GROUP) {
+		const uchar* group = m->ctrl + pos;
+		for (uint32 match = atlas_map_match(group, tag); match != 0; match &= match - 1) {
+			uint64 slot = pos + __builtin_ctz(match);
+			if (atlas_map_key_equal(m, m->slots[slot].key, key, len)) {
+				return slot;
+			}
+		}
+		if (atlas_map_match(group, ATLAS_MAP_EMPTY) != 0) {
+			return m->cap;
+		}
+		pos = (pos + stride) & mask;
+	}
+}
+
+static void atlas_map_put(AtlasMap* m, uint64 hash, uint64 key, uint64 len, uint64 value)
+{
+	uint64 slot = atlas_map_find_slot(m, hash, key, len);
+	if (slot != m->cap) {
+		m->slots[slot].value = value;
+		return;
+	}
+	if (m->growth_left == 0) {
+		// only grow when live keys fill the table, otherwise the rehash
+		// just clears out DELETED slots
+		atlas_map_rehash(m, m->len * 2 >= m->cap - m->cap / 8 ? m->cap * 2 : m->cap);
+	}
+	slot = atlas_map_free_slot(m, hash);
+	if (m->ctrl[slot] == ATLAS_MAP_EMPTY) {
+		m->growth_left--;
+	}
+	if (m->string_keys) {
+		uint64* block = atlas_alloc(8 + len + 1);
+		block[0] = len;
+		__builtin_memcpy(block + 1, (uchar*)key, len);
+		((uchar*)(block + 1))[len] = '\0';
+		key = (uint64)block;
+	}
+	m->ctrl[slot] = hash >> 57;
+	m->slots[slot].key = key;
+	m->slots[slot].value = value;
+	m->len++;
+}
+
+static bool atlas_map_delete(AtlasMap* m, uint64 slot)
+{
+	if (slot == m->cap) {
+		return false;
+	}
+	if (m->string_keys) {
+		atlas_free((void*)m->slots[slot].key);
+	}
+	// a group that still has an EMPTY slot never let a probe continue past
+	// it, so the slot can go back to EMPTY instead of leaving a tombstone
+	uint64 group = slot & ~(uint64)(ATLAS_MAP_GROUP - 1);
+	if (atlas_map_match(m->ctrl + group, ATLAS_MAP_EMPTY) != 0) {
+		m->ctrl[slot] = ATLAS_MAP_EMPTY;
+		m->growth_left++;
+	} else {
+		m->ctrl[slot] = ATLAS_MAP_DELETED;
+	}
+	m->len--;
+	return true;
+}
+
+void atlas_map_insert(AtlasMap* m, uint64 key, uint64 value)
+{
+	atlas_map_put(m, atlas_hash_u64(key), key, 0, value);
+}
+
+void atlas_map_insert_bytes(AtlasMap* m, const uchar* key, uint64 len, uint64 value)
+{
+	atlas_map_put(m, atlas_hash_bytes(key, len), (uint64)key, len, value);
+}
+
+// Pointer to the value stored under key, or 0 if there is none
+uint64* atlas_map_get(AtlasMap* m, uint64 key)
+{
+	uint64 slot = atlas_map_find_slot(m, atlas_hash_u64(key), key, 0);
+	return slot == m->cap ? 0 : &m->slots[slot].value;
+}
+
+uint64* atlas_map_get_bytes(AtlasMap* m, const uchar* key, uint64 len)
+{
+	uint64 slot = atlas_map_find_slot(m, atlas_hash_bytes(key, len), (uint64)key, len);
+	return slot == m->cap ? 0 : &m->slots[slot].value;
+}
+
+bool atlas_map_remove(AtlasMap* m, uint64 key)
+{
+	return atlas_map_delete(m, atlas_map_find_slot(m, atlas_hash_u64(key), key, 0));
+}
+
+bool atlas_map_remove_bytes(AtlasMap* m, const uchar* key, uint64 len)
+{
+	return atlas_map_delete(m, atlas_map_find_slot(m, atlas_hash_bytes(key, len), (uint64)key, len));
+}
+
+// Iteration uses a cursor of slot + 1 so that 0 can both start and end it
+uint64 atlas_map_next(AtlasMap* m, uint64 cursor)
+{
+	for (uint64 slot = cursor; slot < m->cap; slot++) {
+		if (m->ctrl[slot] < ATLAS_MAP_EMPTY) {
+			return slot + 1;
+		}
+	}
+	return 0;
+}
+
+#define atlas_map_key(m, cursor) ((m)->slots[(cursor) - 1].key)
+#define atlas_map_value(m, cursor) ((m)->slots[(cursor) - 1].value)
+
+// string is declared by std.atl after the runtime, so its wrappers are macros
+#define atlas_map_insert_str(m, k, v) atlas_map_insert_bytes(m, (const uchar*)(k).str, (k).len, v)
+#define atlas_map_get_str(m, k) atlas_map_get_bytes(m, (const uchar*)(k).str, (k).len)
+#define atlas_map_remove_str(m, k) atlas_map_remove_bytes(m, (const uchar*)(k).str, (k).len)
+#define atlas_map_key_str(m, cursor) \
+	((string){(char*)((uint64*)atlas_map_key(m, cursor) + 1), *(uint64*)atlas_map_key(m, cursor)})
+
+)";
+}
+
+void runtime_time(std::ostream* file) {
+    // clock_gettime(CLOCK_MONOTONIC) straight through the syscall so it also
+    // works without libc
+    *file << R"(#define SYSCALL_CLOCK_GETTIME 228
+uint64 atlas_time_ns(void)
+{
+	long long ts[2];
+	atlas_syscall3(SYSCALL_CLOCK_GETTIME, 1, (long)ts, 0);
+	return (uint64)ts[0] * 1000000000ull + (uint64)ts[1];
+}
+
+)";
+}
+
+void runtime_bounds(std::ostream* file) {
+    // --bounds-check. The message is put together backwards from the end
+    // of a buffer so nothing from libc is needed, and the failing path is
+    // kept out of line so the check itself is a compare and a branch
+    *file << R"(static char* atlas_bounds_text(char* p, const char* text)
+{
+	int n = 0;
+	while (text[n] != 0) {
+		n++;
+	}
+	while (n != 0) {
+		*--p = text[--n];
+	}
+	return p;
+}
+
+static char* atlas_bounds_number(char* p, int64 value)
+{
+	uint64 n = value < 0 ? -(uint64)value : (uint64)value;
+	do {
+		*--p = '0' + n % 10;
+		n /= 10;
+	} while (n != 0);
+	if (value < 0) {
+		*--p = '-';
+	}
+	return p;
+}
+
+__attribute__((noreturn, noinline, cold))
+void atlas_bounds_fail(int64 index, int64 len, int32 line)
+{
+	char buf[128];
+	char* end = buf + sizeof(buf);
+	char* p = atlas_bounds_text(end, ")\n");
+	p = atlas_bounds_number(p, line);
+	p = atlas_bounds_text(p, " (line ");
+	p = atlas_bounds_number(p, len);
+	p = atlas_bounds_text(p, " out of bounds for length ");
+	p = atlas_bounds_number(p, index);
+	p = atlas_bounds_text(p, "index ");
+	atlas_syscall3(SYSCALL_WRITE, 2, (long)p, end - p);
+	atlas_syscall3(231 /* exit_group */, 1, 0, 0);
+	__builtin_unreachable();
+}
+
+static inline int64 atlas_bounds(int64 index, int64 len, int32 line)
+{
+	if (__builtin_expect((uint64)index >= (uint64)len, 0)) {
+		atlas_bounds_fail(index, len, line);
+	}
+	return index;
+}
+
+__attribute__((noreturn, noinline, cold))
+void atlas_slice_fail(int64 lo, int64 hi, int64 len, int32 line)
+{
+	char buf[128];
+	char* end = buf + sizeof(buf);
+	char* p = atlas_bounds_text(end, ")\n");
+	p = atlas_bounds_number(p, line);
+	p = atlas_bounds_text(p, " (line ");
+	p = atlas_bounds_number(p, len);
+	p = atlas_bounds_text(p, " out of bounds for length ");
+	p = atlas_bounds_number(p, hi);
+	p = atlas_bounds_text(p, "..");
+	p = atlas_bounds_number(p, lo);
+	p = atlas_bounds_text(p, "slice ");
+	atlas_syscall3(SYSCALL_WRITE, 2, (long)p, end - p);
+	atlas_syscall3(231 /* exit_group */, 1, 0, 0);
+	__builtin_unreachable();
+}
+
+)";
+}
+
+void runtime_parallel(std::ostream* file, bool freestanding) {
+    *file << R"(typedef void (*AtlasParallelBody)(void** ctx, int64 begin, int64 end);
+
+)";
+    if (freestanding) {
+        // no threads without libc, the loop runs on the calling thread
+        *file << R"(#define atlas_reduce_lock()
+#define atlas_reduce_unlock()
+
+void atlas_parallel_for(int64 begin, int64 end, AtlasParallelBody body, void** ctx)
+{
+	if (begin < end) {
+		body(ctx, begin, end);
+	}
+}
+
+)";
+        return;
+    }
+
+    // Threads are started by the first parallel loop and then sleep on a
+    // futex between loops. Every thread owns a contiguous part of the range
+    // and takes chunks off its front, a thread that runs out steals the
+    // back half of someone else's part. The calling thread works too
+    *file << R"(extern int pthread_create(unsigned long* thread, const void* attr, void* (*start)(void*), void* arg);
+extern char* getenv(const char* name);
+
+#define SYSCALL_FUTEX 202
+#define SYSCALL_SCHED_GETAFFINITY 204
+#define ATLAS_POOL_MAX 64
+#define ATLAS_POOL_CHUNKS 16 // per thread, the rest is left for stealing
+
+typedef struct AtlasPoolRange {
+	int32 lock;
+	int64 next;
+	int64 end;
+	char pad[40]; // one cache line each
+} AtlasPoolRange;
+
+static struct {
+	int32 threads; // 0 until the first loop
+	int32 active;  // a loop is running, nested ones run serially
+	uint32 generation;
+	int32 busy;    // workers that haven't finished the current loop
+	int32 reduce_lock;
+	int64 chunk;
+	AtlasParallelBody body;
+	void** ctx;
+	AtlasPoolRange ranges[ATLAS_POOL_MAX];
+} atlas_pool;
+
+static void atlas_futex_wait(void* addr, uint32 value)
+{
+	atlas_syscall6(SYSCALL_FUTEX, (long)addr, 128 /* FUTEX_WAIT_PRIVATE */, value, 0, 0, 0);
+}
+
+static void atlas_futex_wake(void* addr)
+{
+	atlas_syscall3(SYSCALL_FUTEX, (long)addr, 129 /* FUTEX_WAKE_PRIVATE */, 0x7fffffff);
+}
+
+static inline void atlas_spin_lock(int32* lock)
+{
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+			__builtin_ia32_pause();
+		}
+	}
+}
+
+static inline void atlas_spin_unlock(int32* lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+#define atlas_reduce_lock() atlas_spin_lock(&atlas_pool.reduce_lock)
+#define atlas_reduce_unlock() atlas_spin_unlock(&atlas_pool.reduce_lock)
+
+static bool atlas_pool_take(int32 self, int64* begin, int64* end)
+{
+	AtlasPoolRange* own = &atlas_pool.ranges[self];
+	for (;;) {
+		atlas_spin_lock(&own->lock);
+		if (own->next < own->end) {
+			*begin = own->next;
+			*end = own->end - own->next > atlas_pool.chunk ? own->next + atlas_pool.chunk : own->end;
+			own->next = *end;
+			atlas_spin_unlock(&own->lock);
+			return true;
+		}
+		atlas_spin_unlock(&own->lock);
+
+		bool stolen = false;
+		for (int32 i = 1; i < atlas_pool.threads && !stolen; i++) {
+			AtlasPoolRange* victim = &atlas_pool.ranges[(self + i) % atlas_pool.threads];
+			atlas_spin_lock(&victim->lock);
+			int64 left = victim->end - victim->next;
+			if (left > 0) {
+				int64 steal = left - left / 2;
+				victim->end -= steal;
+				int64 from = victim->end; // another thief can move it once it's unlocked
+				atlas_spin_unlock(&victim->lock);
+				atlas_spin_lock(&own->lock);
+				own->next = from;
+				own->end = from + steal;
+				atlas_spin_unlock(&own->lock);
+				stolen = true;
+			} else {
+				atlas_spin_unlock(&victim->lock);
+			}
+		}
+		if (!stolen) {
+			return false;
+		}
+	}
+}
+
+static void atlas_pool_run(int32 self)
+{
+	int64 begin, end;
+	while (atlas_pool_take(self, &begin, &end)) {
+		atlas_pool.body(atlas_pool.ctx, begin, end);
+	}
+}
+
+static void* atlas_pool_worker(void* arg)
+{
+	int32 self = (int32)(long)arg;
+	uint32 seen = 0;
+	for (;;) {
+		uint32 generation;
+		while ((generation = __atomic_load_n(&atlas_pool.generation, __ATOMIC_ACQUIRE)) == seen) {
+			atlas_futex_wait(&atlas_pool.generation, seen);
+		}
+		seen = generation;
+		atlas_pool_run(self);
+		if (__atomic_sub_fetch(&atlas_pool.busy, 1, __ATOMIC_ACQ_REL) == 0) {
+			atlas_futex_wake(&atlas_pool.busy);
+		}
+	}
+	return 0;
+}
+
+// ATLAS_THREADS from the environment wins over --threads, and without
+// either there is one thread per core this process may run on
+static void atlas_pool_start(void)
+{
+	int64 threads = ATLAS_DEFAULT_THREADS;
+	char* env = getenv("ATLAS_THREADS");
+	if (env != 0 && *env != '\0') {
+		threads = 0;
+		for (; *env >= '0' && *env <= '9'; env++) {
+			threads = threads * 10 + (*env - '0');
+		}
+	}
+	if (threads <= 0) {
+		uint64 mask[16] = {0};
+		long size = atlas_syscall3(SYSCALL_SCHED_GETAFFINITY, 0, sizeof(mask), (long)mask);
+		threads = 0;
+		for (long i = 0; i < size / 8; i++) {
+			threads += __builtin_popcountll(mask[i]);
+		}
+	}
+	threads = threads < 1 ? 1 : threads > ATLAS_POOL_MAX ? ATLAS_POOL_MAX : threads;
+	for (int32 i = 1; i < threads; i++) {
+		unsigned long thread;
+		if (pthread_create(&thread, 0, atlas_pool_worker, (void*)(long)i) != 0) {
+			threads = i;
+			break;
+		}
+	}
+	atlas_pool.threads = threads;
+}
+
+void atlas_parallel_for(int64 begin, int64 end, AtlasParallelBody body, void** ctx)
+{
+	if (begin >= end) {
+		return;
+	}
+	if (atlas_pool.threads == 0) {
+		atlas_pool_start();
+	}
+	if (atlas_pool.threads == 1 || __atomic_exchange_n(&atlas_pool.active, 1, __ATOMIC_ACQUIRE)) {
+		body(ctx, begin, end);
+		return;
+	}
+	int64 n = end - begin;
+	int64 threads = atlas_pool.threads;
+	atlas_pool.body = body;
+	atlas_pool.ctx = ctx;
+	atlas_pool.chunk = n / (threads * ATLAS_POOL_CHUNKS);
+	atlas_pool.chunk = atlas_pool.chunk < 1 ? 1 : atlas_pool.chunk;
+	int64 from = begin;
+	for (int64 i = 0; i < threads; i++) {
+		int64 size = n / threads + (i < n % threads);
+		atlas_pool.ranges[i].next = from;
+		atlas_pool.ranges[i].end = from + size;
+		from += size;
+	}
+	__atomic_store_n(&atlas_pool.busy, threads - 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&atlas_pool.generation, 1, __ATOMIC_RELEASE);
+	atlas_futex_wake(&atlas_pool.generation);
+	atlas_pool_run(0);
+	int32 busy;
+	while ((busy = __atomic_load_n(&atlas_pool.busy, __ATOMIC_ACQUIRE)) != 0) {
+		atlas_futex_wait(&atlas_pool.busy, busy);
+	}
+	__atomic_store_n(&atlas_pool.active, 0, __ATOMIC_RELEASE);
+}
+
+)";
+}
+
+void runtime_vector(std::ostream* file, VectorType type) {
+    // $V is the C type, $E a lane, $N the lane count, $B the size in bytes
+    // and $M the mask type. Loads and stores go through memcpy so they can
+    // be unaligned, the lane loops are left to the backend to vectorize
+    std::string helpers = R"(typedef $E $V __attribute__((vector_size($B)));
+static inline $V $V_load(const void* p)
+{
+	$V v;
+	__builtin_memcpy(&v, p, $B);
+	return v;
+}
+
+static inline void $V_store(void* p, $V v)
+{
+	__builtin_memcpy(p, &v, $B);
+}
+
+// Bit i is set when lane i of the mask is
+static inline uint64 $V_mask($M m)
+{
+#if defined(__SSE2__) && $B == 16 && $N == 16
+	return (uint16)__builtin_ia32_pmovmskb128((char __attribute__((vector_size(16))))m);
+#elif defined(__AVX2__) && $B == 32 && $N == 32
+	return (uint32)__builtin_ia32_pmovmskb256((char __attribute__((vector_size(32))))m);
+#else
+	uint64 bits = 0;
+	for (int i = 0; i < $N; i++) {
+		bits |= (uint64)(m[i] != 0) << i;
+	}
+	return bits;
+#endif
+}
+
+)";
+    helpers += R"(static inline $V $V_splat($E x)
+{
+	$V v = {0};
+	return v + x;
+}
+
+static inline $E $V_sum($V v)
+{
+	$E sum = 0;
+	for (int i = 0; i < $N; i++) {
+		sum += v[i];
+	}
+	return sum;
+}
+
+static inline $E $V_hmin($V v)
+{
+	$E min = v[0];
+	for (int i = 1; i < $N; i++) {
+		min = v[i] < min ? v[i] : min;
+	}
+	return min;
+}
+
+static inline $E $V_hmax($V v)
+{
+	$E max = v[0];
+	for (int i = 1; i < $N; i++) {
+		max = v[i] > max ? v[i] : max;
+	}
+	return max;
+}
+
+// Lanes of a where m is set, of b elsewhere
+static inline $V $V_select($M m, $V a, $V b)
+{
+	return ($V)((($M)a & m) | (($M)b & ~m));
+}
+
+static inline $V $V_min($V a, $V b)
+{
+	return $V_select(a < b, a, b);
+}
+
+static inline $V $V_max($V a, $V b)
+{
+	return $V_select(a > b, a, b);
+}
+
+// Lane i of the result is lane m[i] of v
+static inline $V $V_shuffle($V v, $M m)
+{
+#if defined(__clang__)
+	$V r;
+	for (int i = 0; i < $N; i++) {
+		r[i] = v[m[i] & ($N - 1)];
+	}
+	return r;
+#else
+	return __builtin_shuffle(v, m);
+#endif
+}
+
+// Converts every lane of a vector with as many lanes
+#define $V_convert(v) __builtin_convertvector(v, $V)
+
+)";
+    std::string c_name = "atlas_" + type.name;
+    std::string replacements[][2] = {
+        {"$V", c_name},
+        {"$E", type.elem},
+        {"$N", std::to_string(type.lanes)},
+        {"$B", std::to_string(type.lanes * type.elem_size)},
+        {"$M", "atlas_" + type.mask},
+    };
+    for (auto& replacement : replacements) {
+        size_t at = 0;
+        while ((at = helpers.find(replacement[0], at)) != std::string::npos) {
+            helpers.replace(at, replacement[0].size(), replacement[1]);
+            at += replacement[1].size();
+        }
+    }
+    *file << helpers;
+}
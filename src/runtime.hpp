@@ -0,0 +1,17 @@
+#pragma once
+
+#include <fstream>
+
+#include "vector.hpp"
+
+// Pieces of the C runtime that get written into out.c by atlas_lib
+void runtime_syscalls(std::ostream* file);
+void runtime_freestanding(std::ostream* file);
+void runtime_io(std::ostream* file);
+void runtime_memory(std::ostream* file);
+void runtime_dynamic(std::ostream* file);
+void runtime_map(std::ostream* file);
+void runtime_time(std::ostream* file);
+void runtime_bounds(std::ostream* file);
+void runtime_parallel(std::ostream* file, bool freestanding);
+void runtime_vector(std::ostream* file, VectorType type);
@@ -0,0 +1,231 @@
+#include <vector>
+#include <string>
+#include <iostream>
+
+#include "global.hpp"
+#include "error.hpp"
+#include "layout.hpp"
+#include "tail.hpp"
+
+// A call whose result is returned as it is needs nothing from the frame
+// making it. When the callee is the function itself its arguments can be
+// assigned to the parameters and the body started over, so recursion of
+// any depth runs in one frame at -O0 as well as -O2.
+//
+// The C output does that with a label at the top of the function. A local
+// whose address can be taken (anything through &, and fixed arrays or
+// structs holding one, which decay to a pointer) could still be pointed
+// at by the arguments while the next time round reuses it, so functions
+// with one are left recursive there. The IR follows its slot addresses
+// instead and only gives up on the ones that really get out
+
+std::string codegen_get_var_type(VarNode* var);
+std::string codegen_get_return_type(FunctionNode* func);
+FunctionNode* codegen_get_function(std::string name);
+
+thread_local TailStats tail_stats;
+
+thread_local FunctionNode* tail_func = NULL; // the function being looked at
+thread_local bool tail_has_self = false;     // it has a self tail call
+thread_local bool tail_has_address = false;  // and a local that might be pointed at
+
+std::string tail_line(ReturnNode* ret) {
+    return " (line " + std::to_string(ret->token->line) + ")";
+}
+
+// The same C types in the same order, what clang's musttail asks for
+bool tail_same_signature(FunctionNode* func, FunctionNode* callee) {
+    if (codegen_get_return_type(func) != codegen_get_return_type(callee) ||
+        func->params.size() != callee->params.size()) {
+        return false;
+    }
+    for (int i = 0; i < func->params.size(); i++) {
+        if (codegen_get_var_type(func->params[i]) != codegen_get_var_type(callee->params[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void tail_return(ReturnNode* ret, int defers) {
+    bool is_call = ret->expr != NULL && ret->exprs.size() == 1 && ret->expr->nt == NODE_CALL;
+    if (!is_call) {
+        return;
+    }
+    CallNode* call = ret->expr->call_node;
+    FunctionNode* callee = codegen_get_function(call->name->token);
+    if (ret->is_tail) {
+        if (callee == NULL) {
+            print_error_msg("-> tail needs a function written in Atlas, " + call->name->token
+                            + " isn't one" + tail_line(ret));
+            error_abort();
+        } else if (defers != 0) {
+            print_error_msg("-> tail can't be used while there are defers to run, they would run "
+                            "after the call" + tail_line(ret));
+            error_abort();
+        } else if (!tail_same_signature(tail_func, callee)) {
+            print_error_msg("-> tail needs " + call->name->token + " to take and return the same types as "
+                            + tail_func->token->token + tail_line(ret));
+            error_abort();
+        }
+    }
+    if (callee != NULL && call->name->token == tail_func->token->token && defers == 0 &&
+        call->args.size() == tail_func->params.size() && !tail_func->is_memo) {
+        ret->is_self_tail = true;
+        tail_has_self = true;
+    }
+}
+
+void tail_expr(ExpressionNode* expr) {
+    if (expr == NULL) {
+        return;
+    }
+    switch (expr->nt) {
+    case NODE_BINOP:
+        tail_expr(expr->binop->lhs);
+        if (expr->binop->op->tt != TK_DOT) {
+            tail_expr(expr->binop->rhs);
+        }
+        break;
+    case NODE_UNARY:
+        tail_has_address = tail_has_address || expr->unary_op->op->tt == TK_AMPERSAND;
+        tail_expr(expr->unary_op->operand);
+        break;
+    case NODE_CALL:
+        for (ExpressionNode* arg : expr->call_node->args) {
+            tail_expr(arg);
+        }
+        break;
+    case NODE_ARRAY_EXPR:
+        for (ExpressionNode* element : expr->array->elements) {
+            tail_expr(element);
+        }
+        break;
+    case NODE_SUBSCRIPT:
+        for (ExpressionNode* index : expr->subscript->indexes) {
+            tail_expr(index);
+        }
+        break;
+    case NODE_TYPE_INST:
+        for (ExpressionNode* value : expr->type_inst->values) {
+            tail_expr(value);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// A fixed array, or a struct with one in it, gives out its address by
+// being used
+bool tail_holds_array(VarNode* var, int depth) {
+    if (var == NULL || var->is_array) {
+        return var != NULL;
+    }
+    TypeNode* type = var->type_ != NULL && var->ptr_level == 0 ? layout_find_type(var->type_->token) : NULL;
+    if (type == NULL || depth > 16) {
+        return false;
+    }
+    for (VarDeclNode* field : layout_fields(type)) {
+        if (tail_holds_array(field->lhs, depth + 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void tail_var(VarNode* var) {
+    tail_has_address = tail_has_address || tail_holds_array(var, 0);
+}
+
+// defers is how many are in force in the enclosing blocks
+void tail_statements(std::vector<StatementNode*> statements, int defers) {
+    for (StatementNode* statement : statements) {
+        switch (statement->nt) {
+        case NODE_VAR_DECL:
+            tail_var(statement->vardecl_lhs->lhs);
+            for (VarNode* var : statement->vardecl_lhs->destructure) {
+                tail_var(var);
+            }
+            tail_expr(statement->vardecl_lhs->rhs);
+            break;
+        case NODE_RETURN:
+            for (ExpressionNode* expr : statement->return_lhs->exprs) {
+                tail_expr(expr);
+            }
+            tail_return(statement->return_lhs, defers);
+            break;
+        case NODE_IF:
+        {
+            IfNode* if_node = statement->if_lhs;
+            tail_expr(if_node->condition);
+            tail_statements(if_node->block->statements, defers);
+            if (if_node->_else != NULL && if_node->_else->block != NULL) {
+                tail_statements(if_node->_else->block->statements, defers);
+            } else if (if_node->_else != NULL && if_node->_else->else_if != NULL) {
+                tail_statements({if_node->_else->else_if}, defers);
+            }
+            break;
+        }
+        case NODE_FOR:
+        {
+            ForNode* for_node = statement->for_lhs;
+            if (for_node->for_type == FOR_LOOP) {
+                tail_statements({for_node->init, for_node->update}, defers);
+            } else if (for_node->for_type == FOR_EACH) {
+                tail_expr(for_node->iterable);
+                tail_expr(for_node->range_end);
+            }
+            tail_expr(for_node->test);
+            tail_statements(for_node->block->statements, defers);
+            break;
+        }
+        case NODE_DEFER:
+            tail_statements({statement->defer_lhs}, defers);
+            defers++;
+            break;
+        case NODE_MATCH:
+            tail_expr(statement->match_lhs->value);
+            for (MatchArm* arm : statement->match_lhs->arms) {
+                tail_statements(arm->block->statements, defers);
+            }
+            if (statement->match_lhs->else_block != NULL) {
+                tail_statements(statement->match_lhs->else_block->statements, defers);
+            }
+            break;
+        case NODE_FUNC:
+        case NODE_TYPE:
+        case NODE_GENERIC:
+        case NODE_CINCLUDE:
+            break;
+        default:
+            tail_expr(statement->expr_lhs);
+            break;
+        }
+    }
+}
+
+void tail_start() {
+    for (FunctionNode* func : function_table) {
+        if (func->block == NULL || func->is_comptime || !func->is_reachable) {
+            continue;
+        }
+        tail_func = func;
+        tail_has_self = false;
+        tail_has_address = false;
+        for (ParamNode* param : func->params) {
+            tail_var(param);
+        }
+        tail_statements(func->block->statements, 0);
+        func->has_tail_loop = tail_has_self && !tail_has_address;
+        if (tail_has_self) {
+            log_print("TAIL: " + func->token->token + (func->has_tail_loop ? " loops" : " stays recursive in C")
+                      + " on its self tail calls\n");
+        }
+    }
+}
+
+void tail_report() {
+    error_out() << "tail:    " << tail_stats.loops << " self tail calls made loops, "
+                << tail_stats.calls << " tail calls\n";
+}
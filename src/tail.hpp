@@ -0,0 +1,21 @@
+#pragma once
+
+#include "ast.hpp"
+
+// Counts for --stats
+struct TailStats {
+    int loops = 0; // self tail calls that became a jump back to the top
+    int calls = 0; // -> tail calls left as calls, musttail in the C output
+};
+
+extern thread_local TailStats tail_stats;
+
+// Finds the returns of a call to the function they are in, which the IR
+// (ir_tail_loops) and the C output both turn into a loop, and checks the
+// ones written -> tail f(x). Those have to be a real tail call even when
+// f is another function: nothing can be left to run after the call, and
+// the callee takes and returns the same types so the C compiler can reuse
+// the frame. Walks the reachable functions in function_table, so run
+// after dce_start
+void tail_start();
+void tail_report(); // the counts, for --stats
@@ -13,7 +13,7 @@ std::string read_file (std::string filename) {
     if(file.fail()) {
         std::string err = "File \"" + std::string(filename) + "\" could not be opened";
         print_error_msg(err);
-        exit(1);
+        error_abort();
     }
     std::string ret;
     while(file.good()) {
@@ -49,13 +49,10 @@ Token* save_token(int line,
     return new Token{line, column, tt, token_string};
 }
 
+// Integer literals start with a digit, ast_create_constant checks the rest
+// (0x and 0b prefixes, _ separators and type suffixes)
 int is_number(std::string str) {
-    for (char c : str) {
-        if (!isdigit(c)) {
-            return false;
-        }
-    }
-    return true;
+    return str.size() != 0 && isdigit(str[0]);
 }
 
 TokenType tokenize_get_reserved_word(std::string word) {
@@ -66,6 +63,10 @@ TokenType tokenize_get_reserved_word(std::string word) {
         return TK_ELSE;  
     } else if (word == "for") {
         return TK_FOR;
+    } else if (word == "defer") {
+        return TK_DEFER;
+    } else if (word == "match") {
+        return TK_MATCH;
     } else if (word == "type") {
         return TK_TYPE;    
     } else if (word == "include") {
@@ -91,7 +92,8 @@ bool is_delim(char c) {
         c == '"' || c == '\'' ||
         c == ':' || c == '\n' || 
         c == ';' || c == ',' ||
-        c == '.')  
+        c == '.' || c == '!' ||
+        c == '&' || c == '|')  
     {
         return true;
     }
@@ -204,12 +206,19 @@ std::vector<Token*> tokenize (std::string src) {
                 } else {
                     ret.push_back(save_token(line, column, TK_DASH, std::string(1,c)));
                 }
+            } else if (c == '!') {
+                if (lookahead == '=') {
+                    i += 1;
+                    ret.push_back(save_token(line, column, TK_NOT_EQUAL, "!="));
+                } else {
+                    ret.push_back(save_token(line, column, TK_NOT, "!"));
+                }
             } else if (c == '&') {
                 if (lookahead == '&') {
                     i += 1;
                     ret.push_back(save_token(line, column, TK_LOGICAL_AND, "&&"));
                 } else {
-                    ret.push_back(save_token(line, column, TK_INVALID, "&"));
+                    ret.push_back(save_token(line, column, TK_AMPERSAND, "&"));
                 }
             } else if (c == '|') {
                 if (lookahead == '|') {
@@ -230,7 +239,7 @@ std::vector<Token*> tokenize (std::string src) {
                     i += 1;
                     ret.push_back(save_token(line, column, TK_GTE, ">="));
                 } else {
-                    ret.push_back(save_token(line, column, TK_LT, ">"));
+                    ret.push_back(save_token(line, column, TK_GT, ">"));
                 }
             } else if (c == '.') {
                 if (lookahead == '{') {
@@ -363,6 +372,10 @@ const char* get_tt_str(TokenType tt) {
         return "TK_EQUAL";
     } else if (tt == TK_FOR) {
         return "TK_FOR";
+    } else if (tt == TK_DEFER) {
+        return "TK_DEFER";
+    } else if (tt == TK_MATCH) {
+        return "TK_MATCH";
     } else if (tt == TK_TYPE) {
         return "TK_TYPE";
     } else if (tt == TK_FN) {
@@ -377,6 +390,8 @@ const char* get_tt_str(TokenType tt) {
         return "TK_CINCLUDE";
     } else if (tt == TK_DOT_CURLY) {
         return "TK_DOT_CURLY";
+    } else if (tt == TK_AMPERSAND) {
+        return "TK_AMPERSAND";
     } else {
         return "TK_INVALID";
     }
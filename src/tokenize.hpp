@@ -38,6 +38,8 @@ enum TokenType {
   TK_IF,
   TK_ELSE,
   TK_FOR,
+  TK_DEFER,
+  TK_MATCH,
   TK_TYPE,
   TK_FN,
   TK_PERCENT,
@@ -46,6 +48,7 @@ enum TokenType {
   TK_CINCLUDE,
   TK_PTR_DEREFERENCE,
   TK_DOT_CURLY,
+  TK_AMPERSAND,
 };
 
 struct Token {
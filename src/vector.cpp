@@ -0,0 +1,92 @@
+#include <vector>
+#include <string>
+#include <cctype>
+
+#include "vector.hpp"
+
+thread_local std::vector<std::string> vector_types; // names seen so far, masks included
+
+static const char* vector_ops[] = {
+    "load", "store", "splat", "sum", "hmin", "hmax", "min", "max",
+    "shuffle", "select", "mask", "convert",
+};
+
+bool vector_parse(std::string name, VectorType* type) {
+    if (name.size() < 4 || name[0] != 'v' || !isdigit(name[1])) {
+        return false;
+    }
+    int i = 1;
+    int lanes = 0;
+    while (i < name.size() && isdigit(name[i])) {
+        lanes = lanes * 10 + (name[i] - '0');
+        i++;
+        if (lanes > 64) {
+            return false;
+        }
+    }
+    std::string elem = name.substr(i);
+    static const struct { const char* atlas; const char* c; int size; } elems[] = {
+        {"i8", "signed char", 1},  {"u8", "unsigned char", 1},
+        {"i16", "short", 2},       {"u16", "unsigned short", 2},
+        {"i32", "int", 4},         {"u32", "unsigned int", 4},
+        {"i64", "long long", 8},   {"u64", "unsigned long long", 8},
+        {"f32", "float", 4},       {"f64", "double", 8},
+    };
+    for (auto e : elems) {
+        int bytes = lanes * e.size;
+        if (elem != e.atlas || (lanes & (lanes - 1)) != 0 ||
+            (bytes != 8 && bytes != 16 && bytes != 32 && bytes != 64)) {
+            continue;
+        }
+        type->name = name;
+        type->elem = e.c;
+        type->lanes = lanes;
+        type->elem_size = e.size;
+        type->is_float = elem[0] == 'f';
+        type->mask = "v" + std::to_string(lanes) + "i" + std::to_string(e.size * 8);
+        return true;
+    }
+    return false;
+}
+
+void vector_note(std::string name) {
+    VectorType type;
+    if (!vector_parse(name, &type)) {
+        return;
+    }
+    // the mask type goes first, the helpers of name use it
+    if (type.mask != name) {
+        vector_note(type.mask);
+    }
+    for (std::string used : vector_types) {
+        if (used == name) {
+            return;
+        }
+    }
+    vector_types.push_back(name);
+}
+
+std::vector<VectorType> vector_used_types() {
+    std::vector<VectorType> types;
+    for (std::string name : vector_types) {
+        VectorType type;
+        vector_parse(name, &type);
+        types.push_back(type);
+    }
+    return types;
+}
+
+bool vector_is_intrinsic(std::string name) {
+    size_t underscore = name.find('_');
+    VectorType type;
+    if (underscore == std::string::npos || !vector_parse(name.substr(0, underscore), &type)) {
+        return false;
+    }
+    std::string op = name.substr(underscore + 1);
+    for (const char* vector_op : vector_ops) {
+        if (op == vector_op) {
+            return true;
+        }
+    }
+    return false;
+}
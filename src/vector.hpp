@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Built in SIMD types, v<lanes><elem> like v4f32 or v16u8, 8 to 64 bytes
+// wide. They lower to GCC/Clang vector extension types named atlas_v4f32
+// and so on, so +, -, *, /, comparisons and v[i] work lane by lane in C.
+// Everything else goes through the v4f32_load style intrinsics from
+// runtime_vector
+struct VectorType {
+    std::string name;   // v4f32
+    std::string elem;   // C type of one lane
+    int lanes;
+    int elem_size;      // bytes
+    bool is_float;
+    std::string mask;   // the signed integer vector comparisons give, v4i32
+};
+
+bool vector_parse(std::string name, VectorType* type);
+// Every vector type the program names, filled in by the parser
+void vector_note(std::string name);
+std::vector<VectorType> vector_used_types();
+// v4f32_load and friends
+bool vector_is_intrinsic(std::string name);
@@ -0,0 +1,914 @@
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "global.hpp"
+#include "error.hpp"
+#include "ir.hpp"
+#include "vm.hpp"
+#include "escape.hpp"
+#include "bounds.hpp"
+
+// A register bytecode made from the IR and run in this process, for
+// --interpret. Every IR value gets its own register in the frame of the
+// function that makes it, so translating is one pass with no allocation.
+// Memory is the host's own: slots live on a stack the VM owns, alloc is
+// malloc, and pointers are real addresses, which lets loads and stores be
+// single host instructions. Handlers are dispatched with computed goto
+
+enum VmOp {
+    VM_CONST,   // a = imm
+    VM_ADD,     // a = b + c
+    VM_ADDI,    // a = b + imm, also every address that is a base plus an offset
+    VM_SUB,
+    VM_MUL,
+    VM_MULI,
+    VM_SDIV,
+    VM_UDIV,
+    VM_SMOD,
+    VM_UMOD,
+    VM_NEG,     // a = -b
+    VM_NOT,     // a = b == 0
+    VM_BOOL,    // a = b != 0
+    VM_SEXT8,   // a = b cut to 8 bits and sign extended back
+    VM_SEXT16,
+    VM_SEXT32,
+    VM_ZEXT8,
+    VM_ZEXT16,
+    VM_ZEXT32,
+    VM_INDEX,   // a = b + c * imm
+    VM_PDIFF,   // a = (b - c) / imm
+    // a = b op c, greater than is less than with b and c swapped
+    VM_EQ, VM_NE, VM_SLT, VM_SLE, VM_ULT, VM_ULE,
+    // a = b op imm
+    VM_EQI, VM_NEI, VM_SLTI, VM_SLEI, VM_SGTI, VM_SGEI, VM_ULTI, VM_ULEI, VM_UGTI, VM_UGEI,
+    // jump to a when b op c, and when b op imm
+    VM_JEQ, VM_JNE, VM_JSLT, VM_JSLE, VM_JULT, VM_JULE,
+    VM_JEQI, VM_JNEI, VM_JSLTI, VM_JSLEI, VM_JSGTI, VM_JSGEI, VM_JULTI, VM_JULEI, VM_JUGTI, VM_JUGEI,
+    // a = [b + imm]
+    VM_LOAD_I8, VM_LOAD_U8, VM_LOAD_I16, VM_LOAD_U16, VM_LOAD_I32, VM_LOAD_U32, VM_LOAD_64,
+    // [b + imm] = c
+    VM_STORE_8, VM_STORE_16, VM_STORE_32, VM_STORE_64,
+    VM_COPY,    // imm bytes from b to a
+    VM_ZERO,    // imm bytes at a
+    VM_CALL,    // a = vm_functions[imm](c arguments from vm_call_args[b]), -1 for no a
+    VM_INTRINSIC, // a = the runtime function imm, arguments as VM_CALL
+    VM_JMP,     // to a
+    VM_JNZ,     // to a when b isn't 0
+    VM_JZ,      // to a when b is 0
+    VM_RET,     // b, -1 for nothing
+    VM_CHECK,   // stops unless b < c unsigned, imm is the line, see --bounds-check
+};
+
+// Registers every frame starts with, IR value v is in register v + 2
+const int VM_FP = 0;   // where the slots are
+const int VM_NULL = 1; // always 0, the base of absolute addresses
+
+struct VmInstr {
+    const void* handler; // set by vm_run from op
+    VmOp op;
+    int32_t a = 0;
+    int32_t b = 0;
+    int32_t c = 0;
+    int64_t imm = 0;
+};
+
+struct VmParam {
+    int64_t offset; // of its slot
+    int64_t size;
+    bool is_struct; // passed as the address of the caller's copy
+};
+
+struct VmFunction {
+    IrFunction* ir;
+    int entry;
+    int num_regs;
+    int64_t frame_size;
+    std::vector<VmParam> params;
+    int64_t ret_size = -1; // of a struct result, which is copied to where the caller wants it
+};
+
+struct VmFrame {
+    VmInstr* ret_pc;
+    int64_t* regs;
+    uint8_t* fp;
+    int ret_reg;
+    VmFunction* func;
+    uint8_t* ret_dest;
+};
+
+enum VmIntrinsic {
+    VM_PUTCHAR, VM_EXIT, VM_ALLOC, VM_FREE, VM_OPEN, VM_CLOSE, VM_READ, VM_WRITE, VM_LSEEK,
+    VM_FSTAT, VM_MEMCPY, VM_MEMMOVE, VM_MEMSET, VM_MEMCMP, VM_MEMCHR, VM_TIME_NS,
+};
+
+const char* vm_intrinsic_names[] = {
+    "putchar", "exit", "alloc", "free", "open", "close", "read", "write", "lseek",
+    "fstat", "memcpy", "memmove", "memset", "memcmp", "memchr", "time_ns",
+};
+
+const int64_t VM_STACK_BYTES = 256 << 20;
+const int64_t VM_REGISTERS = 16 << 20;
+
+thread_local std::vector<VmInstr> vm_code;
+thread_local std::vector<int32_t> vm_call_args;
+thread_local std::vector<VmFunction> vm_functions;
+thread_local std::vector<std::string> vm_strings; // ir_strings decoded, kept alive while the program runs
+thread_local std::vector<std::string> vm_global_names;
+thread_local std::vector<uint8_t*> vm_global_addresses;
+thread_local std::string vm_fail;
+
+// The function being translated
+thread_local IrFunction* vm_func = NULL;
+thread_local std::vector<IrInstr*> vm_defs;
+thread_local std::vector<int> vm_needed; // uses of a value that need it in its register
+thread_local std::vector<int64_t> vm_slot_offsets;
+thread_local std::vector<int> vm_block_pcs;
+thread_local std::vector<int> vm_jumps; // instructions whose a is still a block id
+
+/* Translation */
+
+void vm_emit(VmOp op, int a, int b, int c, int64_t imm) {
+    VmInstr instr;
+    instr.handler = NULL;
+    instr.op = op;
+    instr.a = a;
+    instr.b = b;
+    instr.c = c;
+    instr.imm = imm;
+    vm_code.push_back(instr);
+}
+
+void vm_emit_jump(VmOp op, int block, int b, int c, int64_t imm) {
+    vm_jumps.push_back(vm_code.size());
+    vm_emit(op, block, b, c, imm);
+}
+
+bool vm_constant(int value, int64_t* imm) {
+    IrInstr* def = vm_defs[value];
+    if (def->op != IR_CONST && def->op != IR_SIZEOF) {
+        return false;
+    }
+    *imm = def->imm;
+    return true;
+}
+
+uint8_t* vm_global(std::string name) {
+    for (int i = 0; i < vm_global_names.size(); i++) {
+        if (vm_global_names[i] == name) {
+            return vm_global_addresses[i];
+        }
+    }
+    return NULL;
+}
+
+// A cast that leaves the 64 bit value as it is: to a pointer or a 64 bit
+// integer, from a bool, or widening without a change of sign that matters
+bool vm_is_noop_cast(IrInstr* def) {
+    IrType from = vm_func->values[def->args[0]];
+    IrType to = def->type;
+    if (to.ptr_level > 0 || (to.kind == IR_INT && ir_size_of(to) == 8)) {
+        return true;
+    } else if (to.kind != IR_INT || from.ptr_level > 0) {
+        return false;
+    } else if (from.kind == IR_BOOL) {
+        return true;
+    }
+    bool same_sign = ir_is_unsigned(from) == ir_is_unsigned(to);
+    return (ir_size_of(from) == ir_size_of(to) && same_sign) ||
+           (ir_size_of(from) < ir_size_of(to) && (same_sign || ir_is_unsigned(from)));
+}
+
+int vm_reg(int value) {
+    IrInstr* def = vm_defs[value];
+    if (def->op == IR_CAST && vm_is_noop_cast(def)) {
+        return vm_reg(def->args[0]);
+    }
+    return value + 2;
+}
+
+// Addresses that are a register plus a constant. Loads, stores and
+// fields read them as that pair so they never have to be computed
+bool vm_form(int value, int* base, int64_t* offset) {
+    IrInstr* def = vm_defs[value];
+    int64_t index;
+    switch (def->op) {
+    case IR_SLOT:
+        *base = VM_FP;
+        *offset = vm_slot_offsets[def->imm];
+        return true;
+    case IR_GLOBAL:
+        *base = VM_NULL;
+        *offset = (int64_t)vm_global(def->name);
+        return true;
+    case IR_STRING:
+        *base = VM_NULL;
+        *offset = (int64_t)vm_strings[def->imm].data();
+        return true;
+    case IR_FIELD:
+        if (!vm_form(def->args[0], base, offset)) {
+            *base = vm_reg(def->args[0]);
+            *offset = 0;
+        }
+        *offset += def->imm;
+        return true;
+    case IR_INDEX:
+        if (!vm_constant(def->args[1], &index)) {
+            return false;
+        }
+        if (!vm_form(def->args[0], base, offset)) {
+            *base = vm_reg(def->args[0]);
+            *offset = 0;
+        }
+        *offset += index * ir_size_of(def->mem_type);
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool vm_has_form(int value) {
+    int base;
+    int64_t offset;
+    return vm_form(value, &base, &offset);
+}
+
+bool vm_is_compare(IrOp op) {
+    return op >= IR_EQ && op <= IR_GE;
+}
+
+// Whether instr reads args[i] as an immediate or through vm_form rather
+// than from its register
+bool vm_folds(IrInstr& instr, int i) {
+    int64_t imm;
+    int arg = instr.args[i];
+    switch (instr.op) {
+    case IR_LOAD:
+    case IR_STORE:
+    case IR_FIELD:
+        return i == 0 && vm_has_form(arg);
+    case IR_INDEX:
+        return vm_constant(instr.args[1], &imm) && (i == 1 || vm_has_form(arg));
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+        return i == 1 && vm_constant(arg, &imm) && vm_func->values[instr.args[0]].ptr_level == 0;
+    case IR_EQ:
+    case IR_NE:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+        return i == 1 && vm_constant(arg, &imm);
+    default:
+        return false;
+    }
+}
+
+// A comparison only the branch right after it reads becomes part of the jump
+bool vm_is_fused(std::vector<IrInstr>& instrs, int i) {
+    return vm_is_compare(instrs[i].op) && i + 2 == instrs.size() && vm_needed[instrs[i].value] == 1 &&
+           instrs[i + 1].op == IR_BRANCH && instrs[i + 1].args[0] == instrs[i].value;
+}
+
+void vm_extend(int reg, IrType type) {
+    if (type.ptr_level > 0 || type.kind != IR_INT || ir_size_of(type) == 8) {
+        return;
+    }
+    bool is_signed = !ir_is_unsigned(type);
+    switch (ir_size_of(type)) {
+    case 1:  vm_emit(is_signed ? VM_SEXT8 : VM_ZEXT8, reg, reg, 0, 0); break;
+    case 2:  vm_emit(is_signed ? VM_SEXT16 : VM_ZEXT16, reg, reg, 0, 0); break;
+    default: vm_emit(is_signed ? VM_SEXT32 : VM_ZEXT32, reg, reg, 0, 0); break;
+    }
+}
+
+IrOp vm_invert(IrOp op) {
+    switch (op) {
+    case IR_EQ: return IR_NE;
+    case IR_NE: return IR_EQ;
+    case IR_LT: return IR_GE;
+    case IR_LE: return IR_GT;
+    case IR_GT: return IR_LE;
+    default:    return IR_LT;
+    }
+}
+
+// The result of a comparison in a, or a jump to the block a when it holds
+void vm_compare(IrOp op, int lhs, int rhs, int a, bool is_jump) {
+    IrType type = vm_func->values[lhs];
+    bool is_unsigned = type.ptr_level > 0 || ir_is_unsigned(type);
+    int64_t imm;
+    VmOp vm_op;
+    if (vm_constant(rhs, &imm)) {
+        int index = op == IR_EQ ? 0 : op == IR_NE ? 1 : 2 + (op - IR_LT) + (is_unsigned ? 4 : 0);
+        vm_op = (VmOp)((is_jump ? VM_JEQI : VM_EQI) + index);
+        rhs = 0;
+    } else {
+        if (op == IR_GT || op == IR_GE) {
+            std::swap(lhs, rhs);
+            op = op == IR_GT ? IR_LT : IR_LE;
+        }
+        int index = op == IR_EQ ? 0 : op == IR_NE ? 1 : 2 + (op - IR_LT) + (is_unsigned ? 2 : 0);
+        vm_op = (VmOp)((is_jump ? VM_JEQ : VM_EQ) + index);
+        rhs = vm_reg(rhs);
+        imm = 0;
+    }
+    if (is_jump) {
+        vm_emit_jump(vm_op, a, vm_reg(lhs), rhs, imm);
+    } else {
+        vm_emit(vm_op, a, vm_reg(lhs), rhs, imm);
+    }
+}
+
+VmOp vm_load_op(IrType type) {
+    bool is_signed = type.ptr_level == 0 && type.kind == IR_INT && !ir_is_unsigned(type);
+    switch (ir_size_of(type)) {
+    case 1:  return is_signed ? VM_LOAD_I8 : VM_LOAD_U8;
+    case 2:  return is_signed ? VM_LOAD_I16 : VM_LOAD_U16;
+    case 4:  return is_signed ? VM_LOAD_I32 : VM_LOAD_U32;
+    default: return VM_LOAD_64;
+    }
+}
+
+VmOp vm_store_op(IrType type) {
+    switch (ir_size_of(type)) {
+    case 1:  return VM_STORE_8;
+    case 2:  return VM_STORE_16;
+    case 4:  return VM_STORE_32;
+    default: return VM_STORE_64;
+    }
+}
+
+void vm_address(int value, int* base, int64_t* offset) {
+    if (!vm_form(value, base, offset)) {
+        *base = vm_reg(value);
+        *offset = 0;
+    }
+}
+
+void vm_instr(std::vector<IrInstr>& instrs, int i, int next_block) {
+    IrInstr& instr = instrs[i];
+    int value = instr.value;
+    int a = value >= 0 ? vm_reg(value) : -1;
+    int base;
+    int64_t offset, imm;
+    switch (instr.op) {
+    case IR_CONST:
+    case IR_SIZEOF:
+        if (vm_needed[value] != 0) {
+            vm_emit(VM_CONST, a, 0, 0, instr.imm);
+        }
+        break;
+    case IR_SLOT:
+    case IR_GLOBAL:
+    case IR_STRING:
+    case IR_FIELD:
+    case IR_INDEX:
+        if (vm_form(value, &base, &offset)) {
+            if (vm_needed[value] != 0) {
+                vm_emit(VM_ADDI, a, base, 0, offset);
+            }
+        } else {
+            vm_emit(VM_INDEX, a, vm_reg(instr.args[0]), vm_reg(instr.args[1]), ir_size_of(instr.mem_type));
+        }
+        break;
+    case IR_LOAD:
+        vm_address(instr.args[0], &base, &offset);
+        vm_emit(vm_load_op(instr.mem_type), a, base, 0, offset);
+        break;
+    case IR_STORE:
+        vm_address(instr.args[0], &base, &offset);
+        vm_emit(vm_store_op(instr.mem_type), 0, base, vm_reg(instr.args[1]), offset);
+        break;
+    case IR_COPY:
+        vm_emit(VM_COPY, vm_reg(instr.args[0]), vm_reg(instr.args[1]), 0, ir_size_of(instr.mem_type));
+        break;
+    case IR_ZERO:
+        vm_emit(VM_ZERO, vm_reg(instr.args[0]), 0, 0, ir_size_of(instr.mem_type));
+        break;
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    {
+        IrType lhs_type = vm_func->values[instr.args[0]];
+        if (lhs_type.ptr_level > 0) {
+            IrType elem = lhs_type;
+            elem.ptr_level--;
+            vm_emit(VM_PDIFF, a, vm_reg(instr.args[0]), vm_reg(instr.args[1]), ir_size_of(elem));
+            break;
+        }
+        if (vm_constant(instr.args[1], &imm)) {
+            VmOp op = instr.op == IR_MUL ? VM_MULI : VM_ADDI;
+            vm_emit(op, a, vm_reg(instr.args[0]), 0, instr.op == IR_SUB ? -imm : imm);
+        } else {
+            VmOp op = instr.op == IR_ADD ? VM_ADD : instr.op == IR_SUB ? VM_SUB : VM_MUL;
+            vm_emit(op, a, vm_reg(instr.args[0]), vm_reg(instr.args[1]), 0);
+        }
+        vm_extend(a, instr.type);
+        break;
+    }
+    case IR_DIV:
+    case IR_MOD:
+    {
+        bool is_unsigned = ir_is_unsigned(instr.type);
+        VmOp op = instr.op == IR_DIV ? (is_unsigned ? VM_UDIV : VM_SDIV) : (is_unsigned ? VM_UMOD : VM_SMOD);
+        vm_emit(op, a, vm_reg(instr.args[0]), vm_reg(instr.args[1]), 0);
+        vm_extend(a, instr.type);
+        break;
+    }
+    case IR_EQ:
+    case IR_NE:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+        if (!vm_is_fused(instrs, i)) {
+            vm_compare(instr.op, instr.args[0], instr.args[1], a, false);
+        }
+        break;
+    case IR_NEG:
+        vm_emit(VM_NEG, a, vm_reg(instr.args[0]), 0, 0);
+        vm_extend(a, instr.type);
+        break;
+    case IR_NOT:
+        vm_emit(VM_NOT, a, vm_reg(instr.args[0]), 0, 0);
+        break;
+    case IR_CAST:
+        if (vm_is_noop_cast(&instr)) {
+            break; // a is the register of args[0]
+        } else if (instr.type.kind == IR_BOOL && instr.type.ptr_level == 0) {
+            vm_emit(VM_BOOL, a, vm_reg(instr.args[0]), 0, 0);
+        } else {
+            vm_emit(VM_ADDI, a, vm_reg(instr.args[0]), 0, 0);
+            vm_extend(a, instr.type);
+        }
+        break;
+    case IR_CALL:
+    case IR_INTRINSIC:
+    {
+        int args = vm_call_args.size();
+        if (instr.dest >= 0) {
+            vm_call_args.push_back(vm_reg(instr.dest));
+        }
+        for (int arg : instr.args) {
+            vm_call_args.push_back(vm_reg(arg));
+        }
+        int callee = -1;
+        if (instr.op == IR_CALL) {
+            callee = ir_find_function(instr.name);
+        } else {
+            for (int j = 0; j < sizeof(vm_intrinsic_names) / sizeof(vm_intrinsic_names[0]); j++) {
+                callee = instr.name == vm_intrinsic_names[j] ? j : callee;
+            }
+        }
+        VmOp op = instr.op == IR_CALL ? VM_CALL : VM_INTRINSIC;
+        vm_emit(op, a, args, vm_call_args.size() - args, callee);
+        break;
+    }
+    case IR_JUMP:
+        if (instr.target != next_block) {
+            vm_emit_jump(VM_JMP, instr.target, 0, 0, 0);
+        }
+        break;
+    case IR_BRANCH:
+    {
+        int target = instr.target;
+        int other = instr.target_else;
+        IrInstr* cond = vm_defs[instr.args[0]];
+        bool is_fused = i > 0 && vm_is_fused(instrs, i - 1);
+        if (target == next_block) {
+            std::swap(target, other);
+        }
+        bool is_inverted = target != instr.target;
+        if (is_fused) {
+            IrOp op = is_inverted ? vm_invert(cond->op) : cond->op;
+            vm_compare(op, cond->args[0], cond->args[1], target, true);
+        } else {
+            vm_emit_jump(is_inverted ? VM_JZ : VM_JNZ, target, vm_reg(instr.args[0]), 0, 0);
+        }
+        if (other != next_block) {
+            vm_emit_jump(VM_JMP, other, 0, 0, 0);
+        }
+        break;
+    }
+    case IR_SWITCH:
+    {
+        // a compare per case, a range skips over its second one when the
+        // value is below it
+        int value = vm_reg(instr.args[0]);
+        bool is_unsigned = ir_is_unsigned(vm_func->values[instr.args[0]]);
+        for (IrCase& ir_case : instr.cases) {
+            if (ir_case.lo == ir_case.hi) {
+                vm_emit_jump(VM_JEQI, ir_case.target, value, 0, ir_case.lo);
+                continue;
+            }
+            vm_emit(is_unsigned ? VM_JULTI : VM_JSLTI, vm_code.size() + 2, value, 0, ir_case.lo);
+            vm_emit_jump(is_unsigned ? VM_JULEI : VM_JSLEI, ir_case.target, value, 0, ir_case.hi);
+        }
+        if (instr.target_else != next_block) {
+            vm_emit_jump(VM_JMP, instr.target_else, 0, 0, 0);
+        }
+        break;
+    }
+    case IR_RET:
+        vm_emit(VM_RET, 0, instr.args.size() != 0 ? vm_reg(instr.args[0]) : -1, 0, 0);
+        break;
+    case IR_CHECK:
+        vm_emit(VM_CHECK, 0, vm_reg(instr.args[0]), vm_reg(instr.args[1]), instr.imm);
+        break;
+    }
+}
+
+void vm_function(IrFunction* func, VmFunction* out) {
+    vm_func = func;
+    out->ir = func;
+    out->entry = vm_code.size();
+    out->num_regs = func->values.size() + 2;
+    out->ret_size = ir_is_struct(func->return_type) ? ir_size_of(func->return_type) : -1;
+
+    int64_t frame_size = 0;
+    vm_slot_offsets.clear();
+    out->params.resize(func->func->params.size());
+    for (IrSlot slot : func->slots) {
+        int64_t align = ir_align_of(slot.type);
+        frame_size = (frame_size + align - 1) / align * align;
+        vm_slot_offsets.push_back(frame_size);
+        if (slot.param >= 0) {
+            out->params[slot.param] = {frame_size, ir_size_of(slot.type), ir_is_struct(slot.type)};
+        }
+        frame_size += ir_size_of(slot.type);
+    }
+    out->frame_size = (frame_size + 15) / 16 * 16;
+
+    vm_defs.assign(func->values.size(), NULL);
+    for (IrBlock* block : func->blocks) {
+        for (IrInstr& instr : block->instrs) {
+            if (instr.value >= 0) {
+                vm_defs[instr.value] = &instr;
+            }
+        }
+    }
+    vm_needed.assign(func->values.size(), 0);
+    for (IrBlock* block : func->blocks) {
+        for (IrInstr& instr : block->instrs) {
+            for (int i = 0; i < instr.args.size(); i++) {
+                vm_needed[instr.args[i]] += !vm_folds(instr, i);
+            }
+            if (instr.dest >= 0) {
+                vm_needed[instr.dest]++;
+            }
+        }
+    }
+
+    vm_jumps.clear();
+    vm_block_pcs.clear();
+    for (int b = 0; b < func->blocks.size(); b++) {
+        IrBlock* block = func->blocks[b];
+        while (vm_block_pcs.size() <= block->id) {
+            vm_block_pcs.push_back(-1);
+        }
+        vm_block_pcs[block->id] = vm_code.size();
+        int next_block = b + 1 < func->blocks.size() ? func->blocks[b + 1]->id : -1;
+        for (int i = 0; i < block->instrs.size(); i++) {
+            vm_instr(block->instrs, i, next_block);
+        }
+    }
+    for (int jump : vm_jumps) {
+        vm_code[jump].a = vm_block_pcs[vm_code[jump].a];
+    }
+}
+
+/* Runtime */
+
+thread_local char vm_out[4096]; // putchar is buffered, anything else that does I/O flushes it first
+thread_local int vm_out_len = 0;
+
+void vm_flush() {
+    int written = 0;
+    while (written < vm_out_len) {
+        int ret = write(1, vm_out + written, vm_out_len - written);
+        if (ret <= 0) {
+            break;
+        }
+        written += ret;
+    }
+    vm_out_len = 0;
+}
+
+int64_t vm_errno(int64_t ret) {
+    return ret < 0 ? -errno : ret;
+}
+
+int64_t vm_intrinsic(int id, int64_t* args) {
+    switch (id) {
+    case VM_PUTCHAR:
+        if (vm_out_len == sizeof(vm_out)) {
+            vm_flush();
+        }
+        vm_out[vm_out_len++] = args[0];
+        return 0;
+    case VM_EXIT:
+        vm_flush();
+        exit((int)args[0]);
+    case VM_ALLOC:
+        return (int64_t)malloc(args[0]);
+    case VM_FREE:
+        free((void*)args[0]);
+        return 0;
+    case VM_OPEN:
+        return vm_errno(open((const char*)args[0], (int)args[1], (int)args[2]));
+    case VM_CLOSE:
+        return vm_errno(close((int)args[0]));
+    case VM_READ:
+        vm_flush();
+        return vm_errno(read((int)args[0], (void*)args[1], args[2]));
+    case VM_WRITE:
+        vm_flush();
+        return vm_errno(write((int)args[0], (void*)args[1], args[2]));
+    case VM_LSEEK:
+        return vm_errno(lseek((int)args[0], args[1], (int)args[2]));
+    case VM_FSTAT:
+    {
+        struct stat st;
+        if (fstat((int)args[0], &st) < 0) {
+            return -errno;
+        }
+        return st.st_size;
+    }
+    case VM_MEMCPY:
+        return (int64_t)memcpy((void*)args[0], (void*)args[1], args[2]);
+    case VM_MEMMOVE:
+        return (int64_t)memmove((void*)args[0], (void*)args[1], args[2]);
+    case VM_MEMSET:
+        return (int64_t)memset((void*)args[0], (int)args[1], args[2]);
+    case VM_MEMCMP:
+        return memcmp((void*)args[0], (void*)args[1], args[2]);
+    case VM_MEMCHR:
+        return (int64_t)memchr((void*)args[0], (int)args[1], args[2]);
+    case VM_TIME_NS:
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+    default:
+        return 0;
+    }
+}
+
+// The same message the compiled program writes
+void vm_bounds_fail(int64_t index, int64_t len, int64_t line) {
+    vm_flush();
+    std::cerr << "index " << index << " out of bounds for length " << len << " (line " << line << ")\n";
+    exit(1);
+}
+
+void vm_stack_overflow() {
+    vm_flush();
+    print_error_msg("stack overflow in the interpreter");
+    exit(1);
+}
+
+#define VM_NEXT goto *(++pc)->handler
+#define VM_GOTO(target) pc = &vm_code[target]; goto *pc->handler
+#define R(x) regs[pc->x]
+#define U(x) ((uint64_t)regs[pc->x])
+#define VM_LOAD(type) { type v; memcpy(&v, (void*)(regs[pc->b] + pc->imm), sizeof(v)); regs[pc->a] = v; VM_NEXT; }
+#define VM_STORE(type) { type v = regs[pc->c]; memcpy((void*)(regs[pc->b] + pc->imm), &v, sizeof(v)); VM_NEXT; }
+
+int64_t vm_run(int main_index) {
+    // in the order of VmOp
+    static const void* handlers[] = {
+        &&op_const, &&op_add, &&op_addi, &&op_sub, &&op_mul, &&op_muli,
+        &&op_sdiv, &&op_udiv, &&op_smod, &&op_umod, &&op_neg, &&op_not, &&op_bool,
+        &&op_sext8, &&op_sext16, &&op_sext32, &&op_zext8, &&op_zext16, &&op_zext32,
+        &&op_index, &&op_pdiff,
+        &&op_eq, &&op_ne, &&op_slt, &&op_sle, &&op_ult, &&op_ule,
+        &&op_eqi, &&op_nei, &&op_slti, &&op_slei, &&op_sgti, &&op_sgei,
+        &&op_ulti, &&op_ulei, &&op_ugti, &&op_ugei,
+        &&op_jeq, &&op_jne, &&op_jslt, &&op_jsle, &&op_jult, &&op_jule,
+        &&op_jeqi, &&op_jnei, &&op_jslti, &&op_jslei, &&op_jsgti, &&op_jsgei,
+        &&op_julti, &&op_julei, &&op_jugti, &&op_jugei,
+        &&op_load_i8, &&op_load_u8, &&op_load_i16, &&op_load_u16, &&op_load_i32, &&op_load_u32, &&op_load_64,
+        &&op_store_8, &&op_store_16, &&op_store_32, &&op_store_64,
+        &&op_copy, &&op_zero, &&op_call, &&op_intrinsic, &&op_jmp, &&op_jnz, &&op_jz, &&op_ret,
+        &&op_check,
+    };
+    for (VmInstr& instr : vm_code) {
+        instr.handler = handlers[instr.op];
+    }
+    uint8_t* stack = (uint8_t*)malloc(VM_STACK_BYTES);
+    int64_t* registers = (int64_t*)malloc(VM_REGISTERS * sizeof(int64_t));
+    uint8_t* stack_end = stack + VM_STACK_BYTES;
+    int64_t* registers_end = registers + VM_REGISTERS;
+    std::vector<VmFrame> frames;
+
+    VmFunction* func = &vm_functions[main_index];
+    int64_t* regs = registers;
+    uint8_t* fp = stack;
+    uint8_t* ret_dest = NULL;
+    regs[VM_FP] = (int64_t)fp;
+    regs[VM_NULL] = 0;
+    VmInstr* pc = &vm_code[func->entry];
+    int64_t args[8];
+    goto *pc->handler;
+
+op_const:   R(a) = pc->imm; VM_NEXT;
+op_add:     R(a) = U(b) + U(c); VM_NEXT;
+op_addi:    R(a) = U(b) + (uint64_t)pc->imm; VM_NEXT;
+op_sub:     R(a) = U(b) - U(c); VM_NEXT;
+op_mul:     R(a) = U(b) * U(c); VM_NEXT;
+op_muli:    R(a) = U(b) * (uint64_t)pc->imm; VM_NEXT;
+op_sdiv:    R(a) = R(b) / R(c); VM_NEXT;
+op_udiv:    R(a) = U(b) / U(c); VM_NEXT;
+op_smod:    R(a) = R(b) % R(c); VM_NEXT;
+op_umod:    R(a) = U(b) % U(c); VM_NEXT;
+op_neg:     R(a) = -U(b); VM_NEXT;
+op_not:     R(a) = R(b) == 0; VM_NEXT;
+op_bool:    R(a) = R(b) != 0; VM_NEXT;
+op_sext8:   R(a) = (int8_t)R(b); VM_NEXT;
+op_sext16:  R(a) = (int16_t)R(b); VM_NEXT;
+op_sext32:  R(a) = (int32_t)R(b); VM_NEXT;
+op_zext8:   R(a) = (uint8_t)R(b); VM_NEXT;
+op_zext16:  R(a) = (uint16_t)R(b); VM_NEXT;
+op_zext32:  R(a) = (uint32_t)R(b); VM_NEXT;
+op_index:   R(a) = U(b) + U(c) * (uint64_t)pc->imm; VM_NEXT;
+op_pdiff:   R(a) = (R(b) - R(c)) / pc->imm; VM_NEXT;
+op_eq:      R(a) = R(b) == R(c); VM_NEXT;
+op_ne:      R(a) = R(b) != R(c); VM_NEXT;
+op_slt:     R(a) = R(b) < R(c); VM_NEXT;
+op_sle:     R(a) = R(b) <= R(c); VM_NEXT;
+op_ult:     R(a) = U(b) < U(c); VM_NEXT;
+op_ule:     R(a) = U(b) <= U(c); VM_NEXT;
+op_eqi:     R(a) = R(b) == pc->imm; VM_NEXT;
+op_nei:     R(a) = R(b) != pc->imm; VM_NEXT;
+op_slti:    R(a) = R(b) < pc->imm; VM_NEXT;
+op_slei:    R(a) = R(b) <= pc->imm; VM_NEXT;
+op_sgti:    R(a) = R(b) > pc->imm; VM_NEXT;
+op_sgei:    R(a) = R(b) >= pc->imm; VM_NEXT;
+op_ulti:    R(a) = U(b) < (uint64_t)pc->imm; VM_NEXT;
+op_ulei:    R(a) = U(b) <= (uint64_t)pc->imm; VM_NEXT;
+op_ugti:    R(a) = U(b) > (uint64_t)pc->imm; VM_NEXT;
+op_ugei:    R(a) = U(b) >= (uint64_t)pc->imm; VM_NEXT;
+op_jeq:     if (R(b) == R(c)) { VM_GOTO(pc->a); } VM_NEXT;
+op_jne:     if (R(b) != R(c)) { VM_GOTO(pc->a); } VM_NEXT;
+op_jslt:    if (R(b) < R(c)) { VM_GOTO(pc->a); } VM_NEXT;
+op_jsle:    if (R(b) <= R(c)) { VM_GOTO(pc->a); } VM_NEXT;
+op_jult:    if (U(b) < U(c)) { VM_GOTO(pc->a); } VM_NEXT;
+op_jule:    if (U(b) <= U(c)) { VM_GOTO(pc->a); } VM_NEXT;
+op_jeqi:    if (R(b) == pc->imm) { VM_GOTO(pc->a); } VM_NEXT;
+op_jnei:    if (R(b) != pc->imm) { VM_GOTO(pc->a); } VM_NEXT;
+op_jslti:   if (R(b) < pc->imm) { VM_GOTO(pc->a); } VM_NEXT;
+op_jslei:   if (R(b) <= pc->imm) { VM_GOTO(pc->a); } VM_NEXT;
+op_jsgti:   if (R(b) > pc->imm) { VM_GOTO(pc->a); } VM_NEXT;
+op_jsgei:   if (R(b) >= pc->imm) { VM_GOTO(pc->a); } VM_NEXT;
+op_julti:   if (U(b) < (uint64_t)pc->imm) { VM_GOTO(pc->a); } VM_NEXT;
+op_julei:   if (U(b) <= (uint64_t)pc->imm) { VM_GOTO(pc->a); } VM_NEXT;
+op_jugti:   if (U(b) > (uint64_t)pc->imm) { VM_GOTO(pc->a); } VM_NEXT;
+op_jugei:   if (U(b) >= (uint64_t)pc->imm) { VM_GOTO(pc->a); } VM_NEXT;
+op_load_i8:  VM_LOAD(int8_t)
+op_load_u8:  VM_LOAD(uint8_t)
+op_load_i16: VM_LOAD(int16_t)
+op_load_u16: VM_LOAD(uint16_t)
+op_load_i32: VM_LOAD(int32_t)
+op_load_u32: VM_LOAD(uint32_t)
+op_load_64:  VM_LOAD(int64_t)
+op_store_8:  VM_STORE(uint8_t)
+op_store_16: VM_STORE(uint16_t)
+op_store_32: VM_STORE(uint32_t)
+op_store_64: VM_STORE(int64_t)
+op_copy:    memcpy((void*)R(a), (void*)R(b), pc->imm); VM_NEXT;
+op_zero:    memset((void*)R(a), 0, pc->imm); VM_NEXT;
+op_jmp:     VM_GOTO(pc->a);
+op_jnz:     if (R(b) != 0) { VM_GOTO(pc->a); } VM_NEXT;
+op_jz:      if (R(b) == 0) { VM_GOTO(pc->a); } VM_NEXT;
+op_check:   if (U(b) < U(c)) { VM_NEXT; } vm_bounds_fail(R(b), R(c), pc->imm);
+op_intrinsic:
+    {
+        int32_t* arg_regs = &vm_call_args[pc->b];
+        for (int i = 0; i < pc->c; i++) {
+            args[i] = regs[arg_regs[i]];
+        }
+        int64_t ret = vm_intrinsic(pc->imm, args);
+        if (pc->a >= 0) {
+            R(a) = ret;
+        }
+        VM_NEXT;
+    }
+op_call:
+    {
+        // the arguments go straight into the slots of the callee's parameters
+        VmFunction* callee = &vm_functions[pc->imm];
+        int64_t* new_regs = regs + func->num_regs;
+        uint8_t* new_fp = fp + func->frame_size;
+        if (new_fp + callee->frame_size > stack_end || new_regs + callee->num_regs > registers_end) {
+            vm_stack_overflow();
+        }
+        int32_t* arg_regs = &vm_call_args[pc->b];
+        uint8_t* dest = NULL;
+        if (callee->ret_size >= 0) {
+            dest = (uint8_t*)regs[*arg_regs++];
+        }
+        for (VmParam& param : callee->params) {
+            int64_t value = regs[*arg_regs++];
+            if (param.is_struct) {
+                memcpy(new_fp + param.offset, (void*)value, param.size);
+            } else {
+                memcpy(new_fp + param.offset, &value, param.size);
+            }
+        }
+        frames.push_back({pc + 1, regs, fp, pc->a, func, ret_dest});
+        regs = new_regs;
+        fp = new_fp;
+        func = callee;
+        ret_dest = dest;
+        regs[VM_FP] = (int64_t)fp;
+        regs[VM_NULL] = 0;
+        VM_GOTO(callee->entry);
+    }
+op_ret:
+    {
+        int64_t ret = pc->b >= 0 ? R(b) : 0;
+        if (func->ret_size >= 0) {
+            memcpy(ret_dest, (void*)ret, func->ret_size);
+        }
+        if (frames.size() == 0) {
+            free(stack);
+            free(registers);
+            return ret;
+        }
+        VmFrame frame = frames.back();
+        frames.pop_back();
+        regs = frame.regs;
+        fp = frame.fp;
+        func = frame.func;
+        ret_dest = frame.ret_dest;
+        pc = frame.ret_pc;
+        if (frame.ret_reg >= 0) {
+            regs[frame.ret_reg] = ret;
+        }
+        goto *pc->handler;
+    }
+}
+
+/* Entry */
+
+bool vm_start(std::vector<StatementNode*> ast, int* exit_code) {
+    auto start = std::chrono::steady_clock::now();
+    if (!ir_whole_program(ast, &vm_fail)) {
+        log_print("VM: compiling instead, " + vm_fail + "\n");
+        return false;
+    }
+    for (int i = 0; i < ir_strings.size(); i++) {
+        vm_strings.push_back(ir_string_bytes(i));
+    }
+    for (IrFunction* func : ir_functions) {
+        for (IrBlock* block : func->blocks) {
+            for (IrInstr& instr : block->instrs) {
+                if (instr.op != IR_GLOBAL || vm_global(instr.name) != NULL) {
+                    continue;
+                }
+                std::vector<uint8_t> bytes;
+                if (!ir_global_init(instr.name, instr.mem_type, ast, &bytes)) {
+                    log_print("VM: compiling instead, the global " + instr.name + " isn't set to a constant\n");
+                    return false;
+                }
+                uint8_t* address = (uint8_t*)calloc(1, ir_size_of(instr.mem_type) + 16);
+                memcpy(address, bytes.data(), bytes.size());
+                vm_global_names.push_back(instr.name);
+                vm_global_addresses.push_back(address);
+            }
+        }
+    }
+    vm_functions.resize(ir_functions.size());
+    for (int i = 0; i < ir_functions.size(); i++) {
+        vm_function(ir_functions[i], &vm_functions[i]);
+    }
+    auto translated = std::chrono::steady_clock::now();
+    log_print("VM: " + std::to_string(vm_code.size()) + " instructions for "
+              + std::to_string(vm_functions.size()) + " functions\n");
+
+    int64_t ret = vm_run(ir_find_function("main"));
+    vm_flush();
+    *exit_code = (int)ret;
+    if (global_state->stats) {
+        auto end = std::chrono::steady_clock::now();
+        long translate_us = std::chrono::duration_cast<std::chrono::microseconds>(translated - start).count();
+        long run_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - translated).count();
+        error_out() << "vm:      " << vm_code.size() << " instructions for " << vm_functions.size()
+                    << " functions in " << translate_us << " us\n";
+        escape_report();
+        bounds_report();
+        error_out() << "run:     " << run_ms << " ms\n";
+        error_out().flush();
+    }
+    return true;
+}
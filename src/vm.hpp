@@ -0,0 +1,11 @@
+#pragma once
+
+#include <vector>
+
+#include "ast.hpp"
+
+// --interpret, the program run inside the compiler from a register
+// bytecode made out of the IR. Returns false, with the reason logged, when
+// the program needs something only the C backend has, and it is built and
+// run as with --run instead. *exit_code is what main returned
+bool vm_start(std::vector<StatementNode*> ast, int* exit_code);
@@ -0,0 +1,1427 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <sys/stat.h>
+
+#include "global.hpp"
+#include "error.hpp"
+#include "ir.hpp"
+#include "x64.hpp"
+#include "escape.hpp"
+#include "bounds.hpp"
+
+// Machine code for x86-64 Linux straight from the IR, for debug builds
+// where waiting on gcc is most of the time --run takes. It is built for
+// compile speed: one pass over each function, a register allocator that
+// only looks inside a basic block, and a static ELF with no sections. The
+// runtime is a handful of routines around raw syscalls, like
+// --freestanding but written as machine code
+
+enum X64Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// Condition codes, the low nibble of jcc and setcc. cc ^ 1 is the opposite
+enum X64Cond {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+    CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF,
+};
+
+// The second byte of add, or, and, sub, xor and cmp r/m64, r64. Shifted
+// right by 3 it is the /digit of the immediate forms
+enum X64Alu {
+    ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29, ALU_XOR = 0x31, ALU_CMP = 0x39,
+};
+
+enum X64FixupKind {
+    FIX_LABEL, // rel32 to a label in the code
+    FIX_STRING, // rip relative into the string literals
+    FIX_DATA,  // into the initialized globals
+    FIX_BSS,   // into the zeroed globals and the heap
+};
+
+struct X64Fixup {
+    int at; // of the 32 bit field, which ends the instruction
+    X64FixupKind kind;
+    int64_t index; // label number or byte offset
+};
+
+// [base + disp], or [rip + ...] into the strings or the globals
+struct X64Mem {
+    X64Reg base = RBP;
+    int32_t disp = 0;
+    bool is_rip = false;
+    X64FixupKind kind = FIX_DATA;
+};
+
+enum X64HomeKind {
+    HOME_NONE,  // never used
+    HOME_REMAT, // constants and addresses, recomputed where they are used
+    HOME_REG,   // a callee saved register for its whole life
+    HOME_STACK, // a frame slot, for values used past their block
+    HOME_FLAGS, // a comparison the branch after it reads from the flags
+};
+
+struct X64Home {
+    X64HomeKind kind = HOME_NONE;
+    X64Reg reg = RAX;
+    int32_t offset = 0;
+};
+
+const uint64_t X64_BASE = 0x400000;
+const X64Reg x64_arg_regs[] = {RDI, RSI, RDX, RCX, R8, R9};
+// callee saved, so a value kept in one lives through calls and syscalls
+const X64Reg x64_pool[] = {RBX, R12, R13, R14, R15};
+
+thread_local std::vector<uint8_t> x64_code;
+thread_local std::vector<X64Fixup> x64_fixups;
+thread_local std::vector<int> x64_labels; // code offset of every label, -1 until bound
+thread_local std::vector<uint8_t> x64_strings; // string literals, NUL terminated
+thread_local std::vector<int> x64_string_offsets; // of ir_strings[i]
+thread_local std::vector<uint8_t> x64_data;
+thread_local int64_t x64_bss_size = 0;
+struct X64Global {
+    std::string name;
+    X64FixupKind kind;
+    int64_t offset;
+};
+thread_local std::vector<X64Global> x64_globals;
+thread_local std::vector<std::string> x64_function_names; // mangled, with x64_function_labels
+thread_local std::vector<int> x64_function_labels;
+thread_local std::vector<std::string> x64_routine_names; // runtime routines called so far
+thread_local std::vector<int> x64_routine_labels;
+thread_local std::string x64_fail; // why the program needs the C backend
+
+// The function being written
+thread_local IrFunction* x64_func = NULL;
+thread_local std::vector<X64Home> x64_homes;
+thread_local std::vector<IrInstr*> x64_defs;
+thread_local std::vector<int32_t> x64_slot_offsets;
+thread_local std::vector<int> x64_block_labels;
+thread_local std::vector<X64Reg> x64_saved; // pool registers it uses
+thread_local std::vector<int32_t> x64_saved_offsets;
+thread_local int32_t x64_frame_size = 0;
+thread_local int32_t x64_args_offset = 0; // where the register arguments are kept
+thread_local int x64_hidden = 0; // 1 when the first argument is where a struct result goes
+thread_local X64Cond x64_flags_cc = CC_NE;
+
+/* Encoding */
+
+void x64_byte(int byte) {
+    x64_code.push_back(byte & 0xff);
+}
+
+void x64_u32(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        x64_byte(value >> (i * 8));
+    }
+}
+
+void x64_u64(uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        x64_byte(value >> (i * 8));
+    }
+}
+
+bool x64_fits_i32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+bool x64_fits_i8(int64_t value) {
+    return value >= -128 && value <= 127;
+}
+
+// byte_regs asks for a REX even when nothing else does, so registers 4 to
+// 7 are spl, bpl, sil and dil rather than ah, ch, dh and bh
+void x64_rex(bool w, int reg, int base, bool byte_regs) {
+    int rex = 0x40 | (w << 3) | (((reg >> 3) & 1) << 2) | ((base >> 3) & 1);
+    if (rex != 0x40 || (byte_regs && (reg >= 4 || base >= 4))) {
+        x64_byte(rex);
+    }
+}
+
+void x64_opcode(std::vector<int> opcode) {
+    for (int byte : opcode) {
+        x64_byte(byte);
+    }
+}
+
+// opcode reg, rm with both registers
+void x64_rr(bool w, std::vector<int> opcode, int reg, int rm, bool byte_regs = false) {
+    x64_rex(w, reg, rm, byte_regs);
+    x64_opcode(opcode);
+    x64_byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// opcode reg, [mem]. Without an index the only special case is rsp and
+// r12 needing a SIB byte, rbp and r13 always get a displacement
+void x64_rm(int prefix, bool w, std::vector<int> opcode, int reg, X64Mem mem, bool byte_regs = false) {
+    if (prefix != 0) {
+        x64_byte(prefix);
+    }
+    x64_rex(w, reg, mem.is_rip ? 0 : mem.base, byte_regs);
+    x64_opcode(opcode);
+    if (mem.is_rip) {
+        x64_byte(0x05 | ((reg & 7) << 3));
+        x64_fixups.push_back({(int)x64_code.size(), mem.kind, mem.disp});
+        x64_u32(0);
+        return;
+    }
+    bool is_short = x64_fits_i8(mem.disp);
+    x64_byte((is_short ? 0x40 : 0x80) | ((reg & 7) << 3) | (mem.base & 7));
+    if ((mem.base & 7) == RSP) {
+        x64_byte(0x24);
+    }
+    if (is_short) {
+        x64_byte(mem.disp);
+    } else {
+        x64_u32(mem.disp);
+    }
+}
+
+X64Mem x64_at(X64Reg base, int32_t disp) {
+    X64Mem mem;
+    mem.base = base;
+    mem.disp = disp;
+    return mem;
+}
+
+X64Mem x64_rip(X64FixupKind kind, int64_t offset) {
+    X64Mem mem;
+    mem.is_rip = true;
+    mem.kind = kind;
+    mem.disp = offset;
+    return mem;
+}
+
+void x64_mov(X64Reg dst, X64Reg src) {
+    if (dst != src) {
+        x64_rr(true, {0x89}, src, dst);
+    }
+}
+
+// Clobbers the flags when value is 0
+void x64_mov_imm(X64Reg dst, int64_t value) {
+    if (value == 0) {
+        x64_rr(false, {0x31}, dst, dst); // xor r32, r32
+    } else if (value > 0 && value <= UINT32_MAX) {
+        x64_rex(false, 0, dst, false);
+        x64_byte(0xB8 + (dst & 7));
+        x64_u32(value);
+    } else if (x64_fits_i32(value)) {
+        x64_rr(true, {0xC7}, 0, dst);
+        x64_u32(value);
+    } else {
+        x64_rex(true, 0, dst, false);
+        x64_byte(0xB8 + (dst & 7));
+        x64_u64(value);
+    }
+}
+
+// Zero or sign extended to 64 bits
+void x64_load(X64Reg dst, X64Mem mem, int64_t size, bool is_signed) {
+    switch (size) {
+    case 1:  x64_rm(0, true, {0x0F, is_signed ? 0xBE : 0xB6}, dst, mem); break;
+    case 2:  x64_rm(0, true, {0x0F, is_signed ? 0xBF : 0xB7}, dst, mem); break;
+    case 4:  x64_rm(0, is_signed, {is_signed ? 0x63 : 0x8B}, dst, mem); break;
+    default: x64_rm(0, true, {0x8B}, dst, mem); break;
+    }
+}
+
+void x64_store(X64Mem mem, X64Reg src, int64_t size) {
+    switch (size) {
+    case 1:  x64_rm(0, false, {0x88}, src, mem, true); break;
+    case 2:  x64_rm(0x66, false, {0x89}, src, mem); break;
+    case 4:  x64_rm(0, false, {0x89}, src, mem); break;
+    default: x64_rm(0, true, {0x89}, src, mem); break;
+    }
+}
+
+void x64_lea(X64Reg dst, X64Mem mem) {
+    x64_rm(0, true, {0x8D}, dst, mem);
+}
+
+void x64_alu(X64Alu op, X64Reg dst, X64Reg src) {
+    x64_rr(true, {op}, src, dst);
+}
+
+void x64_alu_imm(X64Alu op, X64Reg dst, int32_t value) {
+    if (x64_fits_i8(value)) {
+        x64_rr(true, {0x83}, op >> 3, dst);
+        x64_byte(value);
+    } else {
+        x64_rr(true, {0x81}, op >> 3, dst);
+        x64_u32(value);
+    }
+}
+
+void x64_imul(X64Reg dst, X64Reg src) {
+    x64_rr(true, {0x0F, 0xAF}, dst, src);
+}
+
+void x64_imul_imm(X64Reg dst, X64Reg src, int32_t value) {
+    x64_rr(true, {0x69}, dst, src);
+    x64_u32(value);
+}
+
+// neg is /3, div /6 and idiv /7
+void x64_group3(int digit, X64Reg reg) {
+    x64_rr(true, {0xF7}, digit, reg);
+}
+
+// shl is /4, shr /5 and sar /7
+void x64_shift(int digit, X64Reg reg, int count) {
+    x64_rr(true, {0xC1}, digit, reg);
+    x64_byte(count);
+}
+
+void x64_test(X64Reg a, X64Reg b) {
+    x64_rr(true, {0x85}, b, a);
+}
+
+// reg = cc ? 1 : 0
+void x64_setcc(X64Cond cc, X64Reg reg) {
+    x64_rr(false, {0x0F, 0x90 + cc}, 0, reg, true);
+    x64_rr(false, {0x0F, 0xB6}, reg, reg, true);
+}
+
+void x64_push(X64Reg reg) {
+    x64_rex(false, 0, reg, false);
+    x64_byte(0x50 + (reg & 7));
+}
+
+void x64_pop(X64Reg reg) {
+    x64_rex(false, 0, reg, false);
+    x64_byte(0x58 + (reg & 7));
+}
+
+void x64_syscall(int number) {
+    x64_mov_imm(RAX, number);
+    x64_opcode({0x0F, 0x05});
+}
+
+int x64_new_label() {
+    x64_labels.push_back(-1);
+    return x64_labels.size() - 1;
+}
+
+void x64_bind(int label) {
+    x64_labels[label] = x64_code.size();
+}
+
+void x64_rel32(int label) {
+    x64_fixups.push_back({(int)x64_code.size(), FIX_LABEL, label});
+    x64_u32(0);
+}
+
+void x64_jmp(int label) {
+    x64_byte(0xE9);
+    x64_rel32(label);
+}
+
+void x64_jcc(X64Cond cc, int label) {
+    x64_opcode({0x0F, 0x80 + cc});
+    x64_rel32(label);
+}
+
+void x64_call(int label) {
+    x64_byte(0xE8);
+    x64_rel32(label);
+}
+
+// The value in reg, which holds type's bits and anything above them, as
+// all 64 bits. Every value is kept that way so 64 bit instructions give
+// the same answers the narrow ones would
+void x64_extend(X64Reg reg, IrType type) {
+    if (type.ptr_level > 0 || type.kind != IR_INT) {
+        return;
+    }
+    bool is_signed = !ir_is_unsigned(type);
+    switch (ir_size_of(type)) {
+    case 1:
+        x64_rr(is_signed, {0x0F, is_signed ? 0xBE : 0xB6}, reg, reg, true);
+        break;
+    case 2:
+        x64_rr(is_signed, {0x0F, is_signed ? 0xBF : 0xB7}, reg, reg);
+        break;
+    case 4:
+        if (is_signed) {
+            x64_rr(true, {0x63}, reg, reg); // movsxd
+        } else {
+            x64_rr(false, {0x89}, reg, reg); // mov r32, r32 clears the top
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Runtime */
+
+int x64_routine(std::string name) {
+    for (int i = 0; i < x64_routine_names.size(); i++) {
+        if (x64_routine_names[i] == name) {
+            return x64_routine_labels[i];
+        }
+    }
+    x64_routine_names.push_back(name);
+    x64_routine_labels.push_back(x64_new_label());
+    return x64_routine_labels.back();
+}
+
+// The heap state, free lists for the 14 size classes then the current
+// arena, see runtime_freestanding for the allocator this mirrors
+const int X64_HEAP_CLASSES = 14;
+const int64_t X64_HEAP_LARGE = 32 << (X64_HEAP_CLASSES - 1);
+const int64_t X64_HEAP_ARENA = 1 << 20;
+thread_local int64_t x64_heap_offset = -1;
+
+int64_t x64_heap() {
+    if (x64_heap_offset < 0) {
+        x64_heap_offset = (x64_bss_size + 7) / 8 * 8;
+        x64_bss_size = x64_heap_offset + (X64_HEAP_CLASSES + 2) * 8;
+    }
+    return x64_heap_offset;
+}
+
+// Copies text in front of r8, which moves back to its start
+void x64_text_before_r8(std::string text) {
+    int64_t offset = x64_strings.size();
+    x64_strings.insert(x64_strings.end(), text.begin(), text.end());
+    x64_alu_imm(ALU_SUB, R8, text.size());
+    x64_mov(RDI, R8);
+    x64_lea(RSI, x64_rip(FIX_STRING, offset));
+    x64_mov_imm(RCX, text.size());
+    x64_opcode({0xF3, 0xA4}); // rep movsb
+}
+
+// The digits of rax in front of r8, with a - when is_signed and it is negative
+void x64_number_before_r8(bool is_signed) {
+    int loop = x64_new_label();
+    int positive = x64_new_label();
+    x64_mov(R9, RAX);
+    if (is_signed) {
+        x64_test(RAX, RAX);
+        x64_jcc(CC_GE, positive);
+        x64_group3(3, RAX); // neg
+    }
+    x64_bind(positive);
+    x64_mov_imm(RCX, 10);
+    x64_bind(loop);
+    x64_mov_imm(RDX, 0);
+    x64_group3(6, RCX); // div, rax is the quotient and rdx the digit
+    x64_alu_imm(ALU_ADD, RDX, '0');
+    x64_alu_imm(ALU_SUB, R8, 1);
+    x64_store(x64_at(R8, 0), RDX, 1);
+    x64_test(RAX, RAX);
+    x64_jcc(CC_NE, loop);
+    if (is_signed) {
+        int done = x64_new_label();
+        x64_test(R9, R9);
+        x64_jcc(CC_GE, done);
+        x64_mov_imm(RDX, '-');
+        x64_alu_imm(ALU_SUB, R8, 1);
+        x64_store(x64_at(R8, 0), RDX, 1);
+        x64_bind(done);
+    }
+}
+
+// Arguments come in rdi, rsi, rdx, rcx, r8 and r9 as in the SysV ABI and
+// the result goes out in rax. A routine may clobber anything but the
+// registers in x64_pool, rbp and rsp. The first three arguments already
+// sit where the syscall wants them
+void x64_routine_body(std::string name) {
+    if (name == "putchar") {
+        x64_push(RDI); // write(1, &c, 1)
+        x64_mov(RSI, RSP);
+        x64_mov_imm(RDI, 1);
+        x64_mov_imm(RDX, 1);
+        x64_syscall(1);
+        x64_pop(RDI);
+        x64_byte(0xC3);
+    } else if (name == "exit") {
+        x64_syscall(60);
+    } else if (name == "bounds_fail") {
+        // index in rdi, the length in rsi and the line in rdx, the message
+        // runtime_bounds writes is put together backwards on the stack
+        x64_mov(R10, RDI);
+        x64_mov(R11, RSI);
+        x64_mov(RAX, RDX);
+        x64_alu_imm(ALU_SUB, RSP, 128);
+        x64_lea(R8, x64_at(RSP, 128));
+        x64_text_before_r8(")\n");
+        x64_number_before_r8(false);
+        x64_text_before_r8(" (line ");
+        x64_mov(RAX, R11);
+        x64_number_before_r8(true);
+        x64_text_before_r8(" out of bounds for length ");
+        x64_mov(RAX, R10);
+        x64_number_before_r8(true);
+        x64_text_before_r8("index ");
+        x64_mov(RSI, R8); // write(2, r8, rsp + 128 - r8)
+        x64_lea(RDX, x64_at(RSP, 128));
+        x64_alu(ALU_SUB, RDX, R8);
+        x64_mov_imm(RDI, 2);
+        x64_syscall(1);
+        x64_mov_imm(RDI, 1);
+        x64_syscall(231); // exit_group
+    } else if (name == "read" || name == "write" || name == "open" || name == "close" ||
+               name == "lseek") {
+        int number = name == "read" ? 0 : name == "write" ? 1 : name == "open" ? 2 :
+                     name == "close" ? 3 : 8;
+        x64_syscall(number);
+        if (name == "open" || name == "close") {
+            x64_rr(true, {0x63}, RAX, RAX); // an i32 result
+        }
+        x64_byte(0xC3);
+    } else if (name == "fstat") {
+        // struct stat is 144 bytes, st_size is at 48
+        int done = x64_new_label();
+        x64_alu_imm(ALU_SUB, RSP, 144);
+        x64_mov(RSI, RSP);
+        x64_syscall(5);
+        x64_test(RAX, RAX);
+        x64_jcc(CC_L, done);
+        x64_load(RAX, x64_at(RSP, 48), 8, false);
+        x64_bind(done);
+        x64_alu_imm(ALU_ADD, RSP, 144);
+        x64_byte(0xC3);
+    } else if (name == "time_ns") {
+        x64_alu_imm(ALU_SUB, RSP, 16); // clock_gettime(CLOCK_MONOTONIC, &ts)
+        x64_mov_imm(RDI, 1);
+        x64_mov(RSI, RSP);
+        x64_syscall(228);
+        x64_load(RAX, x64_at(RSP, 0), 8, false);
+        x64_imul_imm(RAX, RAX, 1000000000);
+        x64_load(RCX, x64_at(RSP, 8), 8, false);
+        x64_alu(ALU_ADD, RAX, RCX);
+        x64_alu_imm(ALU_ADD, RSP, 16);
+        x64_byte(0xC3);
+    } else if (name == "memcpy") {
+        x64_mov(RAX, RDI);
+        x64_mov(RCX, RDX);
+        x64_opcode({0xF3, 0xA4}); // rep movsb
+        x64_byte(0xC3);
+    } else if (name == "memmove") {
+        // forwards unless dst starts inside src, then backwards with df set
+        int forwards = x64_new_label();
+        x64_mov(RAX, RDI);
+        x64_mov(RCX, RDX);
+        x64_alu(ALU_CMP, RDI, RSI);
+        x64_jcc(CC_BE, forwards);
+        x64_lea(R8, x64_at(RSI, 0));
+        x64_alu(ALU_ADD, R8, RDX);
+        x64_alu(ALU_CMP, RDI, R8);
+        x64_jcc(CC_AE, forwards);
+        x64_alu_imm(ALU_ADD, RDI, -1);
+        x64_alu(ALU_ADD, RDI, RDX);
+        x64_alu_imm(ALU_ADD, RSI, -1);
+        x64_alu(ALU_ADD, RSI, RDX);
+        x64_byte(0xFD); // std
+        x64_opcode({0xF3, 0xA4});
+        x64_byte(0xFC); // cld
+        x64_byte(0xC3);
+        x64_bind(forwards);
+        x64_opcode({0xF3, 0xA4});
+        x64_byte(0xC3);
+    } else if (name == "memset") {
+        x64_mov(R8, RDI);
+        x64_mov(RAX, RSI);
+        x64_mov(RCX, RDX);
+        x64_opcode({0xF3, 0xAA}); // rep stosb
+        x64_mov(RAX, R8);
+        x64_byte(0xC3);
+    } else if (name == "memcmp") {
+        int loop = x64_new_label();
+        int done = x64_new_label();
+        x64_bind(loop);
+        x64_mov_imm(RAX, 0);
+        x64_test(RDX, RDX);
+        x64_jcc(CC_E, done);
+        x64_load(RAX, x64_at(RDI, 0), 1, false);
+        x64_load(RCX, x64_at(RSI, 0), 1, false);
+        x64_alu(ALU_SUB, RAX, RCX);
+        x64_jcc(CC_NE, done);
+        x64_alu_imm(ALU_ADD, RDI, 1);
+        x64_alu_imm(ALU_ADD, RSI, 1);
+        x64_alu_imm(ALU_SUB, RDX, 1);
+        x64_jmp(loop);
+        x64_bind(done);
+        x64_byte(0xC3);
+    } else if (name == "memchr") {
+        int loop = x64_new_label();
+        int found = x64_new_label();
+        int missing = x64_new_label();
+        x64_bind(loop);
+        x64_test(RDX, RDX);
+        x64_jcc(CC_E, missing);
+        x64_load(RAX, x64_at(RDI, 0), 1, false);
+        x64_rr(false, {0x38}, RSI, RAX, true); // cmp al, sil
+        x64_jcc(CC_E, found);
+        x64_alu_imm(ALU_ADD, RDI, 1);
+        x64_alu_imm(ALU_SUB, RDX, 1);
+        x64_jmp(loop);
+        x64_bind(found);
+        x64_mov(RAX, RDI);
+        x64_byte(0xC3);
+        x64_bind(missing);
+        x64_mov_imm(RAX, 0);
+        x64_byte(0xC3);
+    } else if (name == "mmap") {
+        // mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0),
+        // 0 rather than -errno when it fails
+        int done = x64_new_label();
+        x64_mov(RSI, RDI);
+        x64_mov_imm(RDI, 0);
+        x64_mov_imm(RDX, 3);
+        x64_mov_imm(R10, 0x22);
+        x64_mov_imm(R8, -1);
+        x64_mov_imm(R9, 0);
+        x64_syscall(9);
+        x64_alu_imm(ALU_CMP, RAX, -4096);
+        x64_jcc(CC_BE, done);
+        x64_mov_imm(RAX, 0);
+        x64_bind(done);
+        x64_byte(0xC3);
+    } else if (name == "alloc") {
+        // rax is the block size with its 16 byte header, rcx the size of
+        // its class and rdx the class
+        int64_t heap = x64_heap();
+        int large = x64_new_label();
+        int find_class = x64_new_label();
+        int have_class = x64_new_label();
+        int bump = x64_new_label();
+        int take = x64_new_label();
+        int header = x64_new_label();
+        int fail = x64_new_label();
+        x64_lea(RAX, x64_at(RDI, 16));
+        x64_alu_imm(ALU_CMP, RAX, X64_HEAP_LARGE);
+        x64_jcc(CC_A, large);
+        x64_mov_imm(RCX, 32);
+        x64_mov_imm(RDX, 0);
+        x64_bind(find_class);
+        x64_alu(ALU_CMP, RCX, RAX);
+        x64_jcc(CC_AE, have_class);
+        x64_alu(ALU_ADD, RCX, RCX);
+        x64_alu_imm(ALU_ADD, RDX, 1);
+        x64_jmp(find_class);
+        x64_bind(have_class);
+        x64_lea(R8, x64_rip(FIX_BSS, heap));
+        x64_mov(R9, RDX);
+        x64_shift(4, R9, 3);
+        x64_alu(ALU_ADD, R8, R9); // &free_lists[class]
+        x64_load(RAX, x64_at(R8, 0), 8, false);
+        x64_test(RAX, RAX);
+        x64_jcc(CC_E, bump);
+        x64_load(R9, x64_at(RAX, 0), 8, false);
+        x64_store(x64_at(R8, 0), R9, 8);
+        x64_jmp(header);
+        x64_bind(bump);
+        x64_load(RAX, x64_rip(FIX_BSS, heap + X64_HEAP_CLASSES * 8), 8, false);
+        x64_lea(R9, x64_at(RAX, 0));
+        x64_alu(ALU_ADD, R9, RCX);
+        x64_rm(0, true, {0x3B}, R9, x64_rip(FIX_BSS, heap + (X64_HEAP_CLASSES + 1) * 8)); // cmp
+        x64_jcc(CC_BE, take);
+        x64_push(RCX);
+        x64_push(RDX);
+        x64_mov_imm(RDI, X64_HEAP_ARENA);
+        x64_call(x64_routine("mmap"));
+        x64_pop(RDX);
+        x64_pop(RCX);
+        x64_test(RAX, RAX);
+        x64_jcc(CC_E, fail);
+        x64_lea(R9, x64_at(RAX, 0));
+        x64_alu_imm(ALU_ADD, R9, X64_HEAP_ARENA);
+        x64_store(x64_rip(FIX_BSS, heap + (X64_HEAP_CLASSES + 1) * 8), R9, 8);
+        x64_lea(R9, x64_at(RAX, 0));
+        x64_alu(ALU_ADD, R9, RCX);
+        x64_bind(take);
+        x64_store(x64_rip(FIX_BSS, heap + X64_HEAP_CLASSES * 8), R9, 8);
+        x64_bind(header);
+        x64_store(x64_at(RAX, 0), RCX, 8);
+        x64_store(x64_at(RAX, 8), RDX, 8);
+        x64_alu_imm(ALU_ADD, RAX, 16);
+        x64_byte(0xC3);
+        x64_bind(large); // a mapping of its own
+        x64_push(RAX);
+        x64_push(RAX);
+        x64_mov(RDI, RAX);
+        x64_call(x64_routine("mmap"));
+        x64_pop(RCX);
+        x64_pop(RCX);
+        x64_test(RAX, RAX);
+        x64_jcc(CC_E, fail);
+        x64_mov_imm(RDX, X64_HEAP_CLASSES);
+        x64_jmp(header);
+        x64_bind(fail);
+        x64_mov_imm(RAX, 0);
+        x64_byte(0xC3);
+    } else if (name == "free") {
+        int64_t heap = x64_heap();
+        int done = x64_new_label();
+        int unmap = x64_new_label();
+        x64_test(RDI, RDI);
+        x64_jcc(CC_E, done);
+        x64_alu_imm(ALU_SUB, RDI, 16);
+        x64_load(RAX, x64_at(RDI, 8), 8, false);
+        x64_alu_imm(ALU_CMP, RAX, X64_HEAP_CLASSES);
+        x64_jcc(CC_E, unmap);
+        x64_lea(R8, x64_rip(FIX_BSS, heap));
+        x64_shift(4, RAX, 3);
+        x64_alu(ALU_ADD, R8, RAX);
+        x64_load(RCX, x64_at(R8, 0), 8, false);
+        x64_store(x64_at(RDI, 0), RCX, 8);
+        x64_store(x64_at(R8, 0), RDI, 8);
+        x64_bind(done);
+        x64_byte(0xC3);
+        x64_bind(unmap);
+        x64_load(RSI, x64_at(RDI, 0), 8, false);
+        x64_syscall(11);
+        x64_byte(0xC3);
+    }
+}
+
+/* Register allocation */
+
+bool x64_is_remat(IrOp op) {
+    return op == IR_CONST || op == IR_SLOT || op == IR_GLOBAL || op == IR_STRING || op == IR_SIZEOF;
+}
+
+bool x64_is_compare(IrOp op) {
+    return op >= IR_EQ && op <= IR_GE;
+}
+
+int32_t x64_reserve(int64_t size, int64_t align) {
+    x64_frame_size += size;
+    x64_frame_size = (x64_frame_size + align - 1) / align * align;
+    return -x64_frame_size;
+}
+
+// Constants and addresses are recomputed at every use, and a comparison
+// only a branch reads stays in the flags. The rest are values used in
+// the block they are made in, which get a register from x64_pool in a
+// linear scan over the block while one is free, and values used past it,
+// which get a frame slot
+void x64_allocate(IrFunction* func) {
+    int count = func->values.size();
+    x64_homes.assign(count, X64Home());
+    x64_defs.assign(count, NULL);
+    std::vector<int> uses(count, 0);
+    std::vector<int> def_block(count, -1);
+    std::vector<int> last_use(count, -1);
+    std::vector<bool> escapes(count, false);
+    for (int b = 0; b < func->blocks.size(); b++) {
+        for (IrInstr& instr : func->blocks[b]->instrs) {
+            if (instr.value >= 0) {
+                x64_defs[instr.value] = &instr;
+                def_block[instr.value] = b;
+            }
+        }
+    }
+    for (int b = 0; b < func->blocks.size(); b++) {
+        std::vector<IrInstr>& instrs = func->blocks[b]->instrs;
+        for (int i = 0; i < instrs.size(); i++) {
+            std::vector<int> args = instrs[i].args;
+            if (instrs[i].dest >= 0) {
+                args.push_back(instrs[i].dest);
+            }
+            for (int arg : args) {
+                uses[arg]++;
+                last_use[arg] = i;
+                escapes[arg] = escapes[arg] || def_block[arg] != b;
+            }
+        }
+    }
+
+    x64_frame_size = 0;
+    x64_slot_offsets.clear();
+    for (IrSlot slot : func->slots) {
+        x64_slot_offsets.push_back(x64_reserve(ir_size_of(slot.type), ir_align_of(slot.type)));
+    }
+    x64_saved.clear();
+    x64_saved_offsets.clear();
+    for (int b = 0; b < func->blocks.size(); b++) {
+        std::vector<IrInstr>& instrs = func->blocks[b]->instrs;
+        int owners[16];
+        for (int r = 0; r < 16; r++) {
+            owners[r] = -1;
+        }
+        for (int i = 0; i < instrs.size(); i++) {
+            for (int arg : instrs[i].args) {
+                X64Home home = x64_homes[arg];
+                if (home.kind == HOME_REG && last_use[arg] == i && owners[home.reg] == arg) {
+                    owners[home.reg] = -1;
+                }
+            }
+            int value = instrs[i].value;
+            if (value < 0) {
+                continue;
+            }
+            X64Home& home = x64_homes[value];
+            if (x64_is_remat(instrs[i].op)) {
+                home.kind = HOME_REMAT;
+                continue;
+            } else if (uses[value] == 0) {
+                continue;
+            } else if (x64_is_compare(instrs[i].op) && uses[value] == 1 && i + 1 == instrs.size() - 1 &&
+                       instrs[i + 1].op == IR_BRANCH && instrs[i + 1].args[0] == value) {
+                home.kind = HOME_FLAGS;
+                continue;
+            }
+            if (!escapes[value]) {
+                for (X64Reg reg : x64_pool) {
+                    if (owners[reg] < 0) {
+                        owners[reg] = value;
+                        home.kind = HOME_REG;
+                        home.reg = reg;
+                        break;
+                    }
+                }
+            }
+            if (home.kind == HOME_REG) {
+                bool is_saved = false;
+                for (X64Reg saved : x64_saved) {
+                    is_saved = is_saved || saved == home.reg;
+                }
+                if (!is_saved) {
+                    x64_saved.push_back(home.reg);
+                }
+            } else {
+                home.kind = HOME_STACK;
+                home.offset = x64_reserve(8, 8);
+            }
+        }
+    }
+    for (int i = 0; i < x64_saved.size(); i++) {
+        x64_saved_offsets.push_back(x64_reserve(8, 8));
+    }
+    x64_hidden = ir_is_struct(func->return_type) ? 1 : 0;
+    int register_args = func->func->params.size() + x64_hidden;
+    register_args = register_args > 6 ? 6 : register_args;
+    x64_args_offset = x64_reserve(register_args * 8, 8);
+    x64_frame_size = (x64_frame_size + 15) / 16 * 16;
+}
+
+/* Instructions */
+
+IrType x64_type(int value) {
+    return x64_func->values[value];
+}
+
+X64Mem x64_slot(int slot) {
+    return x64_at(RBP, x64_slot_offsets[slot]);
+}
+
+X64Mem x64_global(std::string name) {
+    for (X64Global global : x64_globals) {
+        if (global.name == name) {
+            return x64_rip(global.kind, global.offset);
+        }
+    }
+    return x64_rip(FIX_BSS, 0); // x64_check found every global
+}
+
+bool x64_is_const(int value, int64_t* imm) {
+    IrInstr* def = x64_defs[value];
+    if (def == NULL || (def->op != IR_CONST && def->op != IR_SIZEOF)) {
+        return false;
+    }
+    *imm = def->imm;
+    return true;
+}
+
+void x64_fetch(int value, X64Reg reg) {
+    X64Home home = x64_homes[value];
+    IrInstr* def = x64_defs[value];
+    if (home.kind == HOME_REG) {
+        x64_mov(reg, home.reg);
+    } else if (home.kind == HOME_STACK) {
+        x64_load(reg, x64_at(RBP, home.offset), 8, false);
+    } else if (def->op == IR_CONST || def->op == IR_SIZEOF) {
+        x64_mov_imm(reg, def->imm);
+    } else if (def->op == IR_SLOT) {
+        x64_lea(reg, x64_slot(def->imm));
+    } else if (def->op == IR_GLOBAL) {
+        x64_lea(reg, x64_global(def->name));
+    } else if (def->op == IR_STRING) {
+        x64_lea(reg, x64_rip(FIX_STRING, x64_string_offsets[def->imm]));
+    }
+}
+
+// The register value is in, scratch when it has none of its own
+X64Reg x64_operand(int value, X64Reg scratch) {
+    if (x64_homes[value].kind == HOME_REG) {
+        return x64_homes[value].reg;
+    }
+    x64_fetch(value, scratch);
+    return scratch;
+}
+
+// What address points at, without computing it when it is a slot or a global
+X64Mem x64_memory(int address, X64Reg scratch) {
+    IrInstr* def = x64_defs[address];
+    if (x64_homes[address].kind == HOME_REMAT && def->op == IR_SLOT) {
+        return x64_slot(def->imm);
+    } else if (x64_homes[address].kind == HOME_REMAT && def->op == IR_GLOBAL) {
+        return x64_global(def->name);
+    }
+    return x64_at(x64_operand(address, scratch), 0);
+}
+
+// Where an instruction should leave its result
+X64Reg x64_result_reg(int value) {
+    return x64_homes[value].kind == HOME_REG ? x64_homes[value].reg : RAX;
+}
+
+void x64_define(int value, X64Reg reg) {
+    X64Home home = x64_homes[value];
+    if (home.kind == HOME_REG) {
+        x64_mov(home.reg, reg);
+    } else if (home.kind == HOME_STACK) {
+        x64_store(x64_at(RBP, home.offset), reg, 8);
+    }
+}
+
+void x64_copy_bytes(int64_t size) {
+    x64_mov_imm(RCX, size);
+    x64_opcode({0xF3, 0xA4}); // rep movsb
+}
+
+void x64_epilogue() {
+    for (int i = 0; i < x64_saved.size(); i++) {
+        x64_load(x64_saved[i], x64_at(RBP, x64_saved_offsets[i]), 8, false);
+    }
+    x64_byte(0xC9); // leave
+    x64_byte(0xC3);
+}
+
+X64Cond x64_condition(IrOp op, bool is_unsigned) {
+    switch (op) {
+    case IR_EQ: return CC_E;
+    case IR_NE: return CC_NE;
+    case IR_LT: return is_unsigned ? CC_B : CC_L;
+    case IR_LE: return is_unsigned ? CC_BE : CC_LE;
+    case IR_GT: return is_unsigned ? CC_A : CC_G;
+    default:    return is_unsigned ? CC_AE : CC_GE;
+    }
+}
+
+// Arguments as x64_routine_body describes, a struct by the address of
+// the caller's copy, which the callee copies again into its own slot
+void x64_call_instr(IrInstr& instr) {
+    std::vector<int> args = instr.args;
+    if (instr.dest >= 0) {
+        args.insert(args.begin(), instr.dest);
+    }
+    int on_stack = args.size() > 6 ? args.size() - 6 : 0;
+    int padding = on_stack % 2 == 1 ? 8 : 0; // rsp stays 16 byte aligned
+    if (padding != 0) {
+        x64_alu_imm(ALU_SUB, RSP, padding);
+    }
+    for (int i = args.size() - 1; i >= 6; i--) {
+        x64_fetch(args[i], RAX);
+        x64_push(RAX);
+    }
+    for (int i = 0; i < args.size() && i < 6; i++) {
+        x64_fetch(args[i], x64_arg_regs[i]);
+    }
+    if (instr.op == IR_INTRINSIC) {
+        x64_call(x64_routine(instr.name));
+    } else {
+        for (int i = 0; i < x64_function_names.size(); i++) {
+            if (x64_function_names[i] == instr.name) {
+                x64_call(x64_function_labels[i]);
+            }
+        }
+    }
+    if (on_stack != 0) {
+        x64_alu_imm(ALU_ADD, RSP, on_stack * 8 + padding);
+    }
+    if (instr.value >= 0) {
+        x64_define(instr.value, RAX);
+    }
+}
+
+void x64_instr(IrInstr& instr, int next_block) {
+    int value = instr.value;
+    switch (instr.op) {
+    case IR_CONST:
+    case IR_SLOT:
+    case IR_GLOBAL:
+    case IR_STRING:
+    case IR_SIZEOF:
+        break; // made where they are used
+    case IR_FIELD:
+    {
+        X64Mem mem = x64_memory(instr.args[0], RAX);
+        mem.disp += instr.imm;
+        X64Reg reg = x64_result_reg(value);
+        x64_lea(reg, mem);
+        x64_define(value, reg);
+        break;
+    }
+    case IR_INDEX:
+    {
+        int64_t size = ir_size_of(instr.mem_type);
+        int64_t index;
+        if (x64_is_const(instr.args[1], &index) && x64_fits_i32(index * size)) {
+            X64Mem mem = x64_memory(instr.args[0], RAX);
+            mem.disp += index * size;
+            X64Reg reg = x64_result_reg(value);
+            x64_lea(reg, mem);
+            x64_define(value, reg);
+            break;
+        }
+        X64Reg offset = x64_operand(instr.args[1], RCX);
+        if (size != 1) {
+            x64_imul_imm(RCX, offset, size);
+            offset = RCX;
+        }
+        x64_lea(RAX, x64_memory(instr.args[0], RAX));
+        x64_alu(ALU_ADD, RAX, offset);
+        x64_define(value, RAX);
+        break;
+    }
+    case IR_LOAD:
+    {
+        X64Mem mem = x64_memory(instr.args[0], RCX);
+        X64Reg reg = x64_result_reg(value);
+        bool is_signed = instr.mem_type.ptr_level == 0 && instr.mem_type.kind == IR_INT &&
+                         !ir_is_unsigned(instr.mem_type);
+        x64_load(reg, mem, ir_size_of(instr.mem_type), is_signed);
+        x64_define(value, reg);
+        break;
+    }
+    case IR_STORE:
+    {
+        X64Mem mem = x64_memory(instr.args[0], RCX);
+        x64_store(mem, x64_operand(instr.args[1], RAX), ir_size_of(instr.mem_type));
+        break;
+    }
+    case IR_COPY:
+        x64_fetch(instr.args[0], RDI);
+        x64_fetch(instr.args[1], RSI);
+        x64_copy_bytes(ir_size_of(instr.mem_type));
+        break;
+    case IR_ZERO:
+        x64_fetch(instr.args[0], RDI);
+        x64_mov_imm(RAX, 0);
+        x64_mov_imm(RCX, ir_size_of(instr.mem_type));
+        x64_opcode({0xF3, 0xAA}); // rep stosb
+        break;
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    {
+        IrType lhs_type = x64_type(instr.args[0]);
+        int64_t imm;
+        x64_fetch(instr.args[0], RAX);
+        if (x64_is_const(instr.args[1], &imm) && x64_fits_i32(imm)) {
+            if (instr.op == IR_MUL) {
+                x64_imul_imm(RAX, RAX, imm);
+            } else {
+                x64_alu_imm(instr.op == IR_ADD ? ALU_ADD : ALU_SUB, RAX, imm);
+            }
+        } else {
+            X64Reg rhs = x64_operand(instr.args[1], RCX);
+            if (instr.op == IR_MUL) {
+                x64_imul(RAX, rhs);
+            } else {
+                x64_alu(instr.op == IR_ADD ? ALU_ADD : ALU_SUB, RAX, rhs);
+            }
+        }
+        IrType elem = lhs_type;
+        elem.ptr_level--;
+        if (lhs_type.ptr_level > 0 && ir_size_of(elem) > 1) {
+            // p - q counts elements
+            x64_mov_imm(RCX, ir_size_of(elem));
+            x64_opcode({0x48, 0x99}); // cqo
+            x64_group3(7, RCX);
+        }
+        x64_extend(RAX, instr.type);
+        x64_define(value, RAX);
+        break;
+    }
+    case IR_DIV:
+    case IR_MOD:
+    {
+        x64_fetch(instr.args[0], RAX);
+        X64Reg rhs = x64_operand(instr.args[1], RCX);
+        if (ir_is_unsigned(instr.type)) {
+            x64_mov_imm(RDX, 0);
+            x64_group3(6, rhs);
+        } else {
+            x64_opcode({0x48, 0x99}); // cqo
+            x64_group3(7, rhs);
+        }
+        if (instr.op == IR_MOD) {
+            x64_mov(RAX, RDX);
+        }
+        x64_extend(RAX, instr.type);
+        x64_define(value, RAX);
+        break;
+    }
+    case IR_EQ:
+    case IR_NE:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    {
+        IrType type = x64_type(instr.args[0]);
+        int64_t imm;
+        X64Reg lhs = x64_operand(instr.args[0], RAX);
+        if (x64_is_const(instr.args[1], &imm) && x64_fits_i32(imm)) {
+            x64_alu_imm(ALU_CMP, lhs, imm);
+        } else {
+            x64_alu(ALU_CMP, lhs, x64_operand(instr.args[1], RCX));
+        }
+        X64Cond cc = x64_condition(instr.op, type.ptr_level > 0 || ir_is_unsigned(type));
+        if (x64_homes[value].kind == HOME_FLAGS) {
+            x64_flags_cc = cc;
+        } else {
+            x64_setcc(cc, RAX);
+            x64_define(value, RAX);
+        }
+        break;
+    }
+    case IR_NEG:
+        x64_fetch(instr.args[0], RAX);
+        x64_group3(3, RAX);
+        x64_extend(RAX, instr.type);
+        x64_define(value, RAX);
+        break;
+    case IR_NOT:
+    {
+        X64Reg operand = x64_operand(instr.args[0], RAX);
+        x64_test(operand, operand);
+        x64_setcc(CC_E, RAX);
+        x64_define(value, RAX);
+        break;
+    }
+    case IR_CAST:
+        x64_fetch(instr.args[0], RAX);
+        if (instr.type.kind == IR_BOOL && instr.type.ptr_level == 0) {
+            x64_test(RAX, RAX);
+            x64_setcc(CC_NE, RAX);
+        } else {
+            x64_extend(RAX, instr.type);
+        }
+        x64_define(value, RAX);
+        break;
+    case IR_CALL:
+    case IR_INTRINSIC:
+        x64_call_instr(instr);
+        break;
+    case IR_CHECK:
+    {
+        int ok = x64_new_label();
+        X64Reg index = x64_operand(instr.args[0], RAX);
+        X64Reg length = x64_operand(instr.args[1], RCX);
+        x64_alu(ALU_CMP, index, length);
+        x64_jcc(CC_B, ok);
+        x64_mov(RDI, index);
+        x64_mov(RSI, length);
+        x64_mov_imm(RDX, instr.imm);
+        x64_call(x64_routine("bounds_fail"));
+        x64_bind(ok);
+        break;
+    }
+    case IR_JUMP:
+        if (instr.target != next_block) {
+            x64_jmp(x64_block_labels[instr.target]);
+        }
+        break;
+    case IR_BRANCH:
+    {
+        X64Cond cc = CC_NE;
+        if (x64_homes[instr.args[0]].kind == HOME_FLAGS) {
+            cc = x64_flags_cc;
+        } else {
+            X64Reg cond = x64_operand(instr.args[0], RAX);
+            x64_test(cond, cond);
+        }
+        if (instr.target == next_block) {
+            x64_jcc((X64Cond)(cc ^ 1), x64_block_labels[instr.target_else]);
+            break;
+        }
+        x64_jcc(cc, x64_block_labels[instr.target]);
+        if (instr.target_else != next_block) {
+            x64_jmp(x64_block_labels[instr.target_else]);
+        }
+        break;
+    }
+    case IR_SWITCH:
+    {
+        // a compare per case, a range checks value - lo <= hi - lo unsigned
+        X64Reg value = x64_operand(instr.args[0], RAX);
+        for (IrCase& ir_case : instr.cases) {
+            int label = x64_block_labels[ir_case.target];
+            if (ir_case.lo == ir_case.hi && x64_fits_i32(ir_case.lo)) {
+                x64_alu_imm(ALU_CMP, value, ir_case.lo);
+                x64_jcc(CC_E, label);
+                continue;
+            }
+            x64_mov_imm(RCX, -(uint64_t)ir_case.lo);
+            x64_alu(ALU_ADD, RCX, value);
+            x64_mov_imm(RDX, (uint64_t)ir_case.hi - ir_case.lo);
+            x64_alu(ALU_CMP, RCX, RDX);
+            x64_jcc(ir_case.lo == ir_case.hi ? CC_E : CC_BE, label);
+        }
+        if (instr.target_else != next_block) {
+            x64_jmp(x64_block_labels[instr.target_else]);
+        }
+        break;
+    }
+    case IR_RET:
+        if (instr.args.size() != 0 && x64_hidden) {
+            x64_fetch(instr.args[0], RSI);
+            x64_load(RDI, x64_at(RBP, x64_args_offset), 8, false);
+            x64_copy_bytes(ir_size_of(x64_func->return_type));
+            x64_load(RAX, x64_at(RBP, x64_args_offset), 8, false);
+        } else if (instr.args.size() != 0) {
+            x64_fetch(instr.args[0], RAX);
+        }
+        x64_epilogue();
+        break;
+    }
+}
+
+void x64_function(IrFunction* func, int label) {
+    x64_func = func;
+    x64_allocate(func);
+    x64_bind(label);
+    x64_push(RBP);
+    x64_mov(RBP, RSP);
+    if (x64_frame_size != 0) {
+        x64_alu_imm(ALU_SUB, RSP, x64_frame_size);
+    }
+    for (int i = 0; i < x64_saved.size(); i++) {
+        x64_store(x64_at(RBP, x64_saved_offsets[i]), x64_saved[i], 8);
+    }
+    int register_args = func->func->params.size() + x64_hidden;
+    for (int i = 0; i < register_args && i < 6; i++) {
+        x64_store(x64_at(RBP, x64_args_offset + i * 8), x64_arg_regs[i], 8);
+    }
+    for (int i = 0; i < func->slots.size(); i++) {
+        IrSlot slot = func->slots[i];
+        if (slot.param < 0) {
+            continue;
+        }
+        int arg = slot.param + x64_hidden;
+        X64Mem from = arg < 6 ? x64_at(RBP, x64_args_offset + arg * 8) : x64_at(RBP, 16 + (arg - 6) * 8);
+        if (ir_is_struct(slot.type)) {
+            x64_load(RSI, from, 8, false);
+            x64_lea(RDI, x64_slot(i));
+            x64_copy_bytes(ir_size_of(slot.type));
+        } else {
+            x64_load(RAX, from, 8, false);
+            x64_store(x64_slot(i), RAX, ir_size_of(slot.type));
+        }
+    }
+    x64_block_labels.clear();
+    for (IrBlock* block : func->blocks) {
+        while (x64_block_labels.size() <= block->id) {
+            x64_block_labels.push_back(-1);
+        }
+        x64_block_labels[block->id] = x64_new_label();
+    }
+    for (int b = 0; b < func->blocks.size(); b++) {
+        IrBlock* block = func->blocks[b];
+        int next_block = b + 1 < func->blocks.size() ? func->blocks[b + 1]->id : -1;
+        x64_bind(x64_block_labels[block->id]);
+        for (IrInstr& instr : block->instrs) {
+            x64_instr(instr, next_block);
+        }
+    }
+}
+
+/* Data */
+
+// Globals start zeroed in the bss unless ir_global_init has bytes for them
+void x64_add_global(std::string name, IrType type, std::vector<StatementNode*>& ast) {
+    for (X64Global global : x64_globals) {
+        if (global.name == name) {
+            return;
+        }
+    }
+    std::vector<uint8_t> bytes;
+    if (!ir_global_init(name, type, ast, &bytes)) {
+        x64_fail = "the global " + name + " isn't set to a constant";
+        return;
+    }
+    int64_t align = ir_align_of(type);
+    if (bytes.size() == 0) {
+        x64_bss_size = (x64_bss_size + align - 1) / align * align;
+        x64_globals.push_back({name, FIX_BSS, x64_bss_size});
+        x64_bss_size += ir_size_of(type);
+        return;
+    }
+    int64_t offset = (x64_data.size() + align - 1) / align * align;
+    x64_data.resize(offset, 0);
+    x64_data.insert(x64_data.end(), bytes.begin(), bytes.end());
+    x64_globals.push_back({name, FIX_DATA, offset});
+}
+
+/* Entry */
+
+bool x64_check(std::vector<StatementNode*>& ast) {
+    if (!ir_whole_program(ast, &x64_fail)) {
+        return false;
+    }
+    for (IrFunction* func : ir_functions) {
+        x64_function_names.push_back(func->func->mangled_name);
+        x64_function_labels.push_back(x64_new_label());
+    }
+    for (IrFunction* func : ir_functions) {
+        for (IrBlock* block : func->blocks) {
+            for (IrInstr& instr : block->instrs) {
+                if (instr.op == IR_GLOBAL) {
+                    x64_add_global(instr.name, instr.mem_type, ast);
+                }
+            }
+        }
+    }
+    return x64_fail.size() == 0;
+}
+
+void x64_write_u16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(value);
+    out.push_back(value >> 8);
+}
+
+void x64_write_u32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(value >> (i * 8));
+    }
+}
+
+void x64_write_u64(std::vector<uint8_t>& out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out.push_back(value >> (i * 8));
+    }
+}
+
+void x64_write_phdr(std::vector<uint8_t>& out, uint32_t type, uint32_t flags, uint64_t offset,
+                    uint64_t vaddr, uint64_t filesz, uint64_t memsz, uint64_t align) {
+    x64_write_u32(out, type);
+    x64_write_u32(out, flags);
+    x64_write_u64(out, offset);
+    x64_write_u64(out, vaddr);
+    x64_write_u64(out, vaddr);
+    x64_write_u64(out, filesz);
+    x64_write_u64(out, memsz);
+    x64_write_u64(out, align);
+}
+
+// A static executable with no section headers: the ELF header and three
+// program headers, then the code and the strings mapped read and execute,
+// then the globals on the next page read and write with the bss after
+// them, and a non-executable stack
+void x64_write_elf(std::string path, int entry) {
+    const uint64_t header_size = 64 + 3 * 56;
+    uint64_t text_offset = header_size;
+    uint64_t strings_offset = text_offset + x64_code.size();
+    uint64_t text_end = strings_offset + x64_strings.size();
+    uint64_t data_offset = (text_end + 0xfff) / 0x1000 * 0x1000;
+    uint64_t bss_offset = data_offset + (x64_data.size() + 15) / 16 * 16;
+
+    for (X64Fixup fixup : x64_fixups) {
+        uint64_t target = 0;
+        switch (fixup.kind) {
+        case FIX_LABEL:  target = X64_BASE + text_offset + x64_labels[fixup.index]; break;
+        case FIX_STRING: target = X64_BASE + strings_offset + fixup.index; break;
+        case FIX_DATA:   target = X64_BASE + data_offset + fixup.index; break;
+        case FIX_BSS:    target = X64_BASE + bss_offset + fixup.index; break;
+        }
+        int32_t rel = target - (X64_BASE + text_offset + fixup.at + 4);
+        for (int i = 0; i < 4; i++) {
+            x64_code[fixup.at + i] = rel >> (i * 8);
+        }
+    }
+
+    std::vector<uint8_t> out = {0x7F, 'E', 'L', 'F', 2 /* 64 bit */, 1 /* little endian */, 1, 0};
+    out.resize(16, 0);
+    x64_write_u16(out, 2);    // ET_EXEC
+    x64_write_u16(out, 0x3E); // EM_X86_64
+    x64_write_u32(out, 1);
+    x64_write_u64(out, X64_BASE + text_offset + x64_labels[entry]);
+    x64_write_u64(out, 64);   // program headers
+    x64_write_u64(out, 0);    // no section headers
+    x64_write_u32(out, 0);
+    x64_write_u16(out, 64);
+    x64_write_u16(out, 56);
+    x64_write_u16(out, 3);
+    x64_write_u16(out, 64);
+    x64_write_u16(out, 0);
+    x64_write_u16(out, 0);
+    x64_write_phdr(out, 1 /* PT_LOAD */, 5 /* R X */, 0, X64_BASE, text_end, text_end, 0x1000);
+    x64_write_phdr(out, 1, 6 /* R W */, data_offset, X64_BASE + data_offset, x64_data.size(),
+                   bss_offset - data_offset + x64_bss_size, 0x1000);
+    x64_write_phdr(out, 0x6474e551 /* PT_GNU_STACK */, 6, 0, 0, 0, 0, 16);
+    out.insert(out.end(), x64_code.begin(), x64_code.end());
+    out.insert(out.end(), x64_strings.begin(), x64_strings.end());
+    out.resize(data_offset, 0);
+    out.insert(out.end(), x64_data.begin(), x64_data.end());
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write((const char*)out.data(), out.size());
+    file.close();
+    chmod(path.c_str(), 0755);
+}
+
+bool x64_start(std::vector<StatementNode*> ast, std::string output_file_path) {
+    auto start = std::chrono::steady_clock::now();
+    if (!x64_check(ast)) {
+        log_print("x64: using the C backend, " + x64_fail + "\n");
+        return false;
+    }
+    for (int i = 0; i < ir_strings.size(); i++) {
+        x64_string_offsets.push_back(x64_strings.size());
+        std::string bytes = ir_string_bytes(i);
+        x64_strings.insert(x64_strings.end(), bytes.begin(), bytes.end());
+        x64_strings.push_back(0);
+    }
+
+    // _start: the kernel leaves rsp 16 byte aligned, call main and exit
+    // with what it returns
+    int entry = x64_new_label();
+    x64_bind(entry);
+    for (int i = 0; i < x64_function_names.size(); i++) {
+        if (x64_function_names[i] == "main") {
+            x64_call(x64_function_labels[i]);
+        }
+    }
+    x64_rr(false, {0x89}, RAX, RDI); // mov edi, eax
+    x64_syscall(60);
+
+    for (int i = 0; i < ir_functions.size(); i++) {
+        x64_function(ir_functions[i], x64_function_labels[i]);
+    }
+    // routines can call other routines, alloc calls mmap
+    for (int i = 0; i < x64_routine_names.size(); i++) {
+        x64_bind(x64_routine_labels[i]);
+        x64_routine_body(x64_routine_names[i]);
+    }
+
+    if (output_file_path.size() == 0) {
+        output_file_path = "a.out";
+    }
+    x64_write_elf(output_file_path, entry);
+    auto end = std::chrono::steady_clock::now();
+    log_print("Generated binary \"" + output_file_path + "\" without a C compiler\n");
+    if (global_state->stats) {
+        long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        std::ifstream binary(output_file_path, std::ios::binary | std::ios::ate);
+        error_out() << "x64:     " << ir_functions.size() << " functions, "
+                    << x64_code.size() << " bytes of code\n";
+        escape_report();
+        bounds_report();
+        error_out() << "backend: " << ms << " ms\n";
+        error_out() << "binary:  " << (long)binary.tellg() << " bytes\n";
+        error_out().flush();
+    }
+    return true;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "ast.hpp"
+
+// --native, an x86-64 Linux executable written straight from the IR with
+// no C compiler involved. Returns false, with the reason logged, when the
+// program uses something only the C backend has, and codegen_start takes
+// over as usual
+bool x64_start(std::vector<StatementNode*> ast, std::string output_file_path);
@@ -1,8 +1,11 @@
 
 import os
 import subprocess
+import sys
 
-COMPILE_CMD = ['./atlas', '--include', '.', '--run']
+# NOTE: extra arguments are passed on to the compiler,
+#       e.g. `python test.py --freestanding`
+COMPILE_CMD = ['./atlas', '--include', '.', '--run'] + sys.argv[1:]
 RUN_CMD = ['./test/out']
 
 # NOTE: set to True to output all the tests into txt files for convenience
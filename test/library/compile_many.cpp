@@ -0,0 +1,99 @@
+// Compiles the programs it is given one at a time, then all of them again
+// at once from many threads, and checks every result is the same C. A
+// program with an error in it goes along each time and has to come back
+// as an error, with the process still running. From the repository root:
+//   g++ -std=c++17 -pthread $(ls src/*.cpp | grep -v cli.cpp) \
+//       test/library/compile_many.cpp -o compile_many
+//   ./compile_many test/*.atl test/euler/*.atl
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include "../../src/atlas.hpp"
+
+const int THREADS = 8;
+const int ROUNDS = 3;
+
+struct Input {
+    std::string name;
+    std::string src;
+    State options;
+    AtlasResult expected;
+};
+
+std::vector<Input> inputs;
+std::atomic<int> failures(0);
+std::atomic<int> compiled(0);
+
+bool same(AtlasResult& got, AtlasResult& expected) {
+    return got.ok == expected.ok && got.c == expected.c && got.messages == expected.messages;
+}
+
+// Each thread starts at a different input, so different programs are
+// being compiled at the same moment
+void compile_thread(int id) {
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int n = 0; n < inputs.size(); n++) {
+            Input& input = inputs[(n + id * 7) % inputs.size()];
+            AtlasResult got = atlas_compile(input.options, input.src);
+            compiled++;
+            if (!same(got, input.expected)) {
+                std::cout << "FAILED: " << input.name << " came out different on thread " << id << "\n";
+                failures++;
+            }
+        }
+    }
+}
+
+void add_input(std::string name, std::string src, bool use_ir, bool bounds_check) {
+    Input input;
+    input.name = name + (use_ir ? "" : " --no-ir") + (bounds_check ? " --bounds-check" : "");
+    input.src = src;
+    input.options.include_path = "./";
+    input.options.input_filename = name;
+    input.options.use_ir = use_ir;
+    input.options.bounds_check = bounds_check;
+    inputs.push_back(input);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 1) {
+        std::cout << "usage: compile_many file.atl...\n";
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        std::ifstream file(argv[i]);
+        std::stringstream src;
+        src << file.rdbuf();
+        add_input(argv[i], src.str(), true, false);
+        add_input(argv[i], src.str(), false, false);
+        add_input(argv[i], src.str(), true, true);
+    }
+    add_input("broken.atl", "include \"std.atl\"\n\nmain fn() -> i64 {\n    :: x i64 = \n}\n", true, false);
+
+    for (Input& input : inputs) {
+        input.expected = atlas_compile(input.options, input.src);
+        bool is_broken = input.name == "broken.atl";
+        bool has_error = input.expected.messages.find("[COMPILER ERROR]") != std::string::npos;
+        if (input.expected.ok == is_broken || has_error != is_broken) {
+            std::cout << "FAILED: " << input.name << (is_broken ? " compiled" : " didn't compile") << "\n"
+                      << input.expected.messages;
+            failures++;
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (int id = 0; id < THREADS; id++) {
+        threads.push_back(std::thread(compile_thread, id));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    std::cout << compiled << " compilations on " << THREADS << " threads, " << failures << " failed\n";
+    return failures == 0 ? 0 : 1;
+}